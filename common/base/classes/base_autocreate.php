@@ -0,0 +1,773 @@
+<?php
+/**
+ * @file
+ * Provides a class for requesting accounts from the autocreate_ldap_accounts_in_postgresql service.
+ */
+namespace n_koopa;
+
+require_once('common/base/classes/base_error.php');
+require_once('common/base/classes/base_return.php');
+
+/**
+ * A class for requesting that ldap accounts be created in postgresql.
+ *
+ * This talks to the 'autocreate_ldap_accounts_in_postgresql' service.
+ * The connection is opened with pfsockopen(), so that it stays open between the requests handled by the same PHP process (such as a PHP-FPM worker).
+ * Every packet is sent with the keep flag, so that the service keeps the connection open after each response.
+ *
+ * Any number of names are sent in a single write and their responses are read in a single read, the service responds in the order of the names.
+ * When the service closes the connection before responding to every name, such as after ERROR_CLOSE or ERROR_QUIT, the names not yet provisioned are sent again on a new connection.
+ * A new connection that answers at least one name is not counted as a retry, so that every name is answered even when the service answers one name per connection (such as with 'alap_keepalive 0' or when the kept connections are full).
+ * Only the new connections in a row that answer no names are limited to self::RETRIES.
+ *
+ * Asynchronous requests and ticket polls are not supported here, because a poll closes the connection.
+ */
+class c_base_autocreate extends c_base_return {
+  const PACKET_SIZE_INPUT  = 63;
+  const PACKET_SIZE_OUTPUT = 1;
+
+  const PACKET_HEADER        = 0x80;
+  const PACKET_FLAG_BULK     = 0x01;
+  const PACKET_FLAG_DEADLINE = 0x02;
+  const PACKET_FLAG_KEEP     = 0x20;
+
+  const DEADLINE_MAX = 65535;
+
+  // the status responded by the service for each name, as defined by ERROR_* in the service source code.
+  const STATUS_NONE      = 0;
+  const STATUS_NAME      = 1;
+  const STATUS_LDAP      = 2;
+  const STATUS_USER      = 3;
+  const STATUS_DATABASE  = 4;
+  const STATUS_SQL       = 5;
+  const STATUS_READ      = 6;
+  const STATUS_WRITE     = 7;
+  const STATUS_PACKET    = 8;
+  const STATUS_TIMEOUT   = 9;
+  const STATUS_CLOSE     = 10;
+  const STATUS_QUIT      = 11;
+  const STATUS_PENDING   = 12;
+  const STATUS_TICKET    = 13;
+  const STATUS_DEGRADED  = 14;
+  const STATUS_NOT_READY = 15;
+
+  // the names are sent on a new connection at most this many times in a row without any name being answered.
+  const RETRIES = 1;
+
+  protected $socket;
+  protected $socket_path;
+  protected $socket_port;
+  protected $socket_timeout;
+  protected $socket_error;
+
+  protected $bulk;
+  protected $deadline;
+
+
+  /**
+   * Class constructor.
+   */
+  public function __construct() {
+    parent::__construct();
+
+    $this->socket         = NULL;
+    $this->socket_path    = NULL;
+    $this->socket_port    = NULL;
+    $this->socket_timeout = NULL;
+    $this->socket_error   = NULL;
+
+    $this->bulk     = FALSE;
+    $this->deadline = NULL;
+  }
+
+  /**
+   * Class destructor.
+   *
+   * The connection is intentionally not closed here, so that it is used again by the next request of this PHP process.
+   */
+  public function __destruct() {
+    unset($this->socket);
+    unset($this->socket_path);
+    unset($this->socket_port);
+    unset($this->socket_timeout);
+    unset($this->socket_error);
+
+    unset($this->bulk);
+    unset($this->deadline);
+
+    parent::__destruct();
+  }
+
+  /**
+   * @see: t_base_return_value::p_s_new()
+   */
+  public static function s_new($value) {
+    return self::p_s_new($value, __CLASS__);
+  }
+
+  /**
+   * @see: t_base_return_value::p_s_value()
+   */
+  public static function s_value($return) {
+    return self::p_s_value($return, __CLASS__);
+  }
+
+  /**
+   * @see: t_base_return_value_exact::p_s_value_exact()
+   */
+  public static function s_value_exact($return) {
+    return self::p_s_value_exact($return, __CLASS__, NULL);
+  }
+
+  /**
+   * Assigns the socket path or host name of the service.
+   *
+   * @param string $socket_path
+   *   The socket file, such as: /var/www/sockets/autocreate_ldap_accounts_in_postgresql/example/example_users.socket.
+   *   Or the host name when $socket_port is an integer, such as: example.com.
+   * @param int|null $socket_port
+   *   (optional) The port of the service on the host.
+   *   Set to NULL when $socket_path is a socket file.
+   *
+   * @return c_base_return_status
+   *   TRUE on success, FALSE otherwise.
+   *   FALSE with the error bit set is returned on error.
+   */
+  public function set_socket_path($socket_path, $socket_port = NULL) {
+    if (!is_string($socket_path) || empty($socket_path)) {
+      $error = c_base_error::s_log(NULL, ['arguments' => [':{argument_name}' => 'socket_path', ':{function_name}' => __CLASS__ . '->' . __FUNCTION__]], i_base_error_messages::INVALID_ARGUMENT);
+      return c_base_return_error::s_false($error);
+    }
+
+    if (!is_null($socket_port) && (!is_int($socket_port) || $socket_port < 1 || $socket_port > 65535)) {
+      $error = c_base_error::s_log(NULL, ['arguments' => [':{argument_name}' => 'socket_port', ':{function_name}' => __CLASS__ . '->' . __FUNCTION__]], i_base_error_messages::INVALID_ARGUMENT);
+      return c_base_return_error::s_false($error);
+    }
+
+    $this->socket_path = $socket_path;
+    $this->socket_port = $socket_port;
+    return new c_base_return_true();
+  }
+
+  /**
+   * Assigns the timeout for writing the names and reading the responses.
+   *
+   * @param float|int|null $seconds
+   *   Number of seconds until timeout is reached.
+   *   Set to NULL to use the default_socket_timeout setting.
+   *
+   * @return c_base_return_status
+   *   TRUE on success, FALSE otherwise.
+   *   FALSE with the error bit set is returned on error.
+   *
+   * @see: stream_set_timeout()
+   */
+  public function set_socket_timeout($seconds) {
+    if (!is_null($seconds) && ((!is_int($seconds) && !is_float($seconds)) || $seconds < 0)) {
+      $error = c_base_error::s_log(NULL, ['arguments' => [':{argument_name}' => 'seconds', ':{function_name}' => __CLASS__ . '->' . __FUNCTION__]], i_base_error_messages::INVALID_ARGUMENT);
+      return c_base_return_error::s_false($error);
+    }
+
+    $this->socket_timeout = $seconds;
+
+    if (is_resource($this->socket)) {
+      $this->p_assign_timeout();
+    }
+
+    return new c_base_return_true();
+  }
+
+  /**
+   * Assigns the deadline sent with each name.
+   *
+   * The service drops a name once its deadline has passed, such as when the caller would have given up waiting anyway.
+   *
+   * @param int|null $deadline
+   *   The milliseconds the caller is willing to wait for each name, at most self::DEADLINE_MAX.
+   *   Set to NULL to send no deadline.
+   *
+   * @return c_base_return_status
+   *   TRUE on success, FALSE otherwise.
+   *   FALSE with the error bit set is returned on error.
+   */
+  public function set_deadline($deadline) {
+    if (!is_null($deadline) && (!is_int($deadline) || $deadline < 1 || $deadline > static::DEADLINE_MAX)) {
+      $error = c_base_error::s_log(NULL, ['arguments' => [':{argument_name}' => 'deadline', ':{function_name}' => __CLASS__ . '->' . __FUNCTION__]], i_base_error_messages::INVALID_ARGUMENT);
+      return c_base_return_error::s_false($error);
+    }
+
+    $this->deadline = $deadline;
+    return new c_base_return_true();
+  }
+
+  /**
+   * Returns the socket path or host name.
+   *
+   * @return c_base_return_string|c_base_return_null
+   *   The socket path or host name on success.
+   *   NULL is returned if it is not assigned.
+   */
+  public function get_socket_path() {
+    if (is_null($this->socket_path)) {
+      return new c_base_return_null();
+    }
+
+    return c_base_return_string::s_new($this->socket_path);
+  }
+
+  /**
+   * Returns the port.
+   *
+   * @return c_base_return_int|c_base_return_null
+   *   The port on success.
+   *   NULL is returned if the socket path is a socket file.
+   */
+  public function get_socket_port() {
+    if (is_null($this->socket_port)) {
+      return new c_base_return_null();
+    }
+
+    return c_base_return_int::s_new($this->socket_port);
+  }
+
+  /**
+   * Returns the timeout for writing the names and reading the responses.
+   *
+   * @return c_base_return_float|c_base_return_int|c_base_return_null
+   *   The number of seconds on success.
+   *   NULL is returned if the default_socket_timeout setting is used.
+   */
+  public function get_socket_timeout() {
+    if (is_null($this->socket_timeout)) {
+      return new c_base_return_null();
+    }
+
+    if (is_float($this->socket_timeout)) {
+      return c_base_return_float::s_new($this->socket_timeout);
+    }
+
+    return c_base_return_int::s_new($this->socket_timeout);
+  }
+
+  /**
+   * Returns the deadline.
+   *
+   * @return c_base_return_int|c_base_return_null
+   *   The milliseconds on success.
+   *   NULL is returned if no deadline is sent.
+   */
+  public function get_deadline() {
+    if (is_null($this->deadline)) {
+      return new c_base_return_null();
+    }
+
+    return c_base_return_int::s_new($this->deadline);
+  }
+
+  /**
+   * Returns the last error code of the connection.
+   *
+   * @return c_base_return_int|c_base_return_null
+   *   The error code on success.
+   *   NULL is returned if there is no error.
+   *
+   * @see: pfsockopen()
+   */
+  public function get_error_socket() {
+    if (is_null($this->socket_error)) {
+      return new c_base_return_null();
+    }
+
+    return c_base_return_int::s_new($this->socket_error);
+  }
+
+  /**
+   * Get or Assign the is bulk boolean setting.
+   *
+   * Bulk names (such as from an import script) are processed by the service after the interactive logins.
+   *
+   * @param bool|null $is_bulk
+   *   When a boolean, this is assigned as the current is bulk setting.
+   *   When NULL, the current setting is returned.
+   *
+   * @return c_base_return_bool|c_base_return_status
+   *   When $is_bulk is NULL, is bulk boolean setting on success.
+   *   FALSE with error bit is set on error.
+   */
+  public function is_bulk($is_bulk = NULL) {
+    if (!is_null($is_bulk) && !is_bool($is_bulk)) {
+      $error = c_base_error::s_log(NULL, ['arguments' => [':{argument_name}' => 'is_bulk', ':{function_name}' => __CLASS__ . '->' . __FUNCTION__]], i_base_error_messages::INVALID_ARGUMENT);
+      return c_base_return_error::s_false($error);
+    }
+
+    if (is_null($is_bulk)) {
+      if (!is_bool($this->bulk)) {
+        $this->bulk = FALSE;
+      }
+
+      if ($this->bulk) {
+        return new c_base_return_true();
+      }
+
+      return new c_base_return_false();
+    }
+
+    $this->bulk = $is_bulk;
+    return new c_base_return_true();
+  }
+
+  /**
+   * Returns the connected status.
+   *
+   * This represents whether or not the self::do_connect() function was successfully called.
+   * The service may have closed the connection since, which self::do_provision() checks for.
+   *
+   * @return c_base_return_status
+   *   TRUE when connected, FALSE otherwise.
+   */
+  public function is_connected() {
+    if (is_resource($this->socket)) {
+      return new c_base_return_true();
+    }
+
+    return new c_base_return_false();
+  }
+
+  /**
+   * Opens the connection, or uses the connection already opened by this PHP process.
+   *
+   * This is called by self::do_provision() when needed.
+   *
+   * @return c_base_return_status
+   *   TRUE on success, FALSE on failure.
+   *   FALSE with the error bit set is returned on error.
+   *
+   * @see: c_base_autocreate::set_socket_path()
+   * @see: c_base_autocreate::do_disconnect()
+   */
+  public function do_connect() {
+    if (is_resource($this->socket)) {
+      $error = c_base_error::s_log(NULL, ['arguments' => [':{variable_name}' => 'this->socket', ':{function_name}' => __CLASS__ . '->' . __FUNCTION__]], i_base_error_messages::INVALID_VARIABLE);
+      return c_base_return_error::s_false($error);
+    }
+
+    if (is_null($this->socket_path)) {
+      $error = c_base_error::s_log(NULL, ['arguments' => [':{variable_name}' => 'this->socket_path', ':{function_name}' => __CLASS__ . '->' . __FUNCTION__]], i_base_error_messages::INVALID_VARIABLE);
+      return c_base_return_error::s_false($error);
+    }
+
+    $opened = $this->p_open();
+    if (c_base_return::s_has_error($opened)) {
+      return $opened;
+    }
+    unset($opened);
+
+    // a connection used by an earlier request of this PHP process has nothing to read, unless that request gave up before reading every response or the service closed the connection.
+    // the responses would then no longer match the names, so such a connection is replaced.
+    $read = [$this->socket];
+    $write = NULL;
+    $except = NULL;
+
+    $ready = @stream_select($read, $write, $except, 0);
+    unset($read);
+    unset($write);
+    unset($except);
+
+    if ($ready !== 0) {
+      unset($ready);
+
+      @fclose($this->socket);
+      $this->socket = NULL;
+
+      return $this->p_open();
+    }
+    unset($ready);
+
+    return new c_base_return_true();
+  }
+
+  /**
+   * Closes the connection, so that the next request of this PHP process opens a new one.
+   *
+   * @return c_base_return_status
+   *   TRUE on success, FALSE otherwise.
+   *   FALSE with the error bit set is returned on error.
+   */
+  public function do_disconnect() {
+    if (!is_resource($this->socket)) {
+      $error = c_base_error::s_log(NULL, ['arguments' => [':{variable_name}' => 'this->socket', ':{function_name}' => __CLASS__ . '->' . __FUNCTION__]], i_base_error_messages::INVALID_VARIABLE);
+      return c_base_return_error::s_false($error);
+    }
+
+    @fclose($this->socket);
+
+    $this->socket = NULL;
+    return new c_base_return_true();
+  }
+
+  /**
+   * Requests that the accounts for the given names exist in the database.
+   *
+   * The names are sent in a single write and the responses are read in a single read.
+   * A name with a character other than a letter, a digit, '-', or '_' is not sent and is given self::STATUS_NAME, as the service would respond.
+   *
+   * @param array|string $names
+   *   A name or an array of names.
+   *
+   * @return c_base_return_array|c_base_return_status
+   *   An array of the status (see self::STATUS_*) for each name, keyed by the name.
+   *   A name without a response, such as when the service could not be reached, is not in the array.
+   *   An error is set on the array for every name that is not provisioned, see self::s_get_error().
+   *   FALSE with the error bit set is returned on error.
+   */
+  public function do_provision($names) {
+    if (is_string($names)) {
+      $names = [$names];
+    }
+    else if (!is_array($names) || empty($names)) {
+      $error = c_base_error::s_log(NULL, ['arguments' => [':{argument_name}' => 'names', ':{function_name}' => __CLASS__ . '->' . __FUNCTION__]], i_base_error_messages::INVALID_ARGUMENT);
+      return c_base_return_error::s_false($error);
+    }
+
+    $name_length_max = static::PACKET_SIZE_INPUT - 1;
+    if (!is_null($this->deadline)) {
+      $name_length_max -= 2;
+    }
+
+    foreach ($names as $name) {
+      if (!is_string($name) || strlen($name) == 0 || strlen($name) > $name_length_max || strpos($name, "\0") !== FALSE) {
+        unset($name);
+        unset($name_length_max);
+
+        $error = c_base_error::s_log(NULL, ['arguments' => [':{argument_name}' => 'names', ':{function_name}' => __CLASS__ . '->' . __FUNCTION__]], i_base_error_messages::INVALID_ARGUMENT);
+        return c_base_return_error::s_false($error);
+      }
+    }
+    unset($name);
+    unset($name_length_max);
+
+    $pending = [];
+    $statuses = [];
+    $errors = [];
+
+    // the service only accepts letters, digits, '-', and '_', and closes the connection after any other character, so such a name is answered here without being sent.
+    foreach (array_unique($names) as $name) {
+      if (preg_match('/^[A-Za-z0-9_-]+$/D', $name) !== 1) {
+        $statuses[$name] = static::STATUS_NAME;
+        continue;
+      }
+
+      $pending[] = $name;
+    }
+    unset($name);
+
+    // the connection errors are only returned when a name is still not answered, such as when the service is unreachable.
+    $errors_connection = [];
+
+    // only the attempts that answer no names are counted, so a connection closed after answering some of the names does not use up a retry.
+    $attempt = 0;
+    while ($attempt <= static::RETRIES && !empty($pending)) {
+      if (!is_resource($this->socket)) {
+        $connected = $this->do_connect();
+        if (c_base_return::s_has_error($connected)) {
+          $errors_connection = array_merge($errors_connection, $connected->get_error());
+          unset($connected);
+
+          $attempt++;
+          continue;
+        }
+        unset($connected);
+      }
+
+      $responses = $this->p_transfer($pending);
+      if (c_base_return::s_has_error($responses)) {
+        $errors_connection = array_merge($errors_connection, $responses->get_error());
+        unset($responses);
+
+        $this->do_disconnect();
+
+        $attempt++;
+        continue;
+      }
+
+      $responses = $responses->get_value_exact();
+
+      $retry = [];
+      foreach ($pending as $delta => $name) {
+        if (!array_key_exists($delta, $responses)) {
+          $retry[] = $name;
+          continue;
+        }
+
+        $statuses[$name] = $responses[$delta];
+
+        if ($responses[$delta] === static::STATUS_CLOSE || $responses[$delta] === static::STATUS_QUIT) {
+          $retry[] = $name;
+        }
+      }
+      unset($delta);
+      unset($name);
+
+      // the service closes the connection after ERROR_CLOSE, ERROR_QUIT, or an invalid packet, and the names after it are not answered.
+      if ((!empty($retry) || count($responses) < count($pending)) && is_resource($this->socket)) {
+        $this->do_disconnect();
+      }
+      unset($responses);
+
+      if (count($retry) == count($pending)) {
+        $attempt++;
+      }
+
+      $pending = $retry;
+      unset($retry);
+    }
+    unset($attempt);
+
+    if (!empty($pending)) {
+      $errors = $errors_connection;
+    }
+    unset($errors_connection);
+
+    foreach ($pending as $name) {
+      if (!array_key_exists($name, $statuses)) {
+        $errors[] = c_base_error::s_log(NULL, ['arguments' => [':{operation_name}' => 'fread', ':{socket_error}' => NULL, ':{socket_error_message}' => 'No response for the name \'' . $name . '\'.', ':{function_name}' => __CLASS__ . '->' . __FUNCTION__]], i_base_error_messages::SOCKET_FAILURE);
+      }
+    }
+    unset($name);
+    unset($pending);
+
+    foreach ($statuses as $name => $status) {
+      if ($status !== static::STATUS_NONE) {
+        $errors[] = static::s_get_error($status, $name);
+      }
+    }
+    unset($name);
+    unset($status);
+
+    $return = c_base_return_array::s_new($statuses);
+    unset($statuses);
+
+    if (!empty($errors)) {
+      $return->set_error($errors);
+    }
+    unset($errors);
+
+    return $return;
+  }
+
+  /**
+   * Returns the error for a status responded by the service.
+   *
+   * @param int $status
+   *   The status, see self::STATUS_*.
+   * @param string $name
+   *   The name the status was responded for.
+   *
+   * @return c_base_error|null
+   *   The error on success.
+   *   NULL is returned for self::STATUS_NONE.
+   */
+  public static function s_get_error($status, $name) {
+    $arguments = [':{function_name}' => __CLASS__ . '->' . __FUNCTION__];
+
+    switch ($status) {
+      case static::STATUS_NONE:
+        unset($arguments);
+        return NULL;
+
+      case static::STATUS_NAME:
+        $arguments[':{argument_name}'] = $name;
+        $code = i_base_error_messages::INVALID_ARGUMENT;
+        break;
+
+      case static::STATUS_LDAP:
+        $arguments[':{resource_name}'] = 'ldap';
+        $code = i_base_error_messages::NO_CONNECTION;
+        break;
+
+      case static::STATUS_USER:
+        $code = i_base_error_messages::NOT_FOUND;
+        break;
+
+      case static::STATUS_DATABASE:
+        $arguments[':{database_name}'] = 'autocreate_ldap_accounts_in_postgresql';
+        $code = i_base_error_messages::POSTGRESQL_CONNECTION_FAILURE;
+        break;
+
+      case static::STATUS_SQL:
+        $arguments[':{database_error_message}'] = 'failed to create the account for \'' . $name . '\'';
+        $code = i_base_error_messages::POSTGRESQL_ERROR;
+        break;
+
+      case static::STATUS_READ:
+      case static::STATUS_WRITE:
+        $arguments[':{operation_name}'] = $status === static::STATUS_READ ? 'recv' : 'send';
+        $arguments[':{socket_error}'] = $status;
+        $arguments[':{socket_error_message}'] = 'autocreate_ldap_accounts_in_postgresql';
+        $code = i_base_error_messages::SOCKET_FAILURE;
+        break;
+
+      case static::STATUS_PACKET:
+        $arguments[':{format_name}'] = $name;
+        $arguments[':{expected_format}'] = '';
+        $code = i_base_error_messages::INVALID_FORMAT;
+        break;
+
+      case static::STATUS_TIMEOUT:
+      case static::STATUS_CLOSE:
+      case static::STATUS_QUIT:
+      case static::STATUS_DEGRADED:
+      case static::STATUS_NOT_READY:
+        $arguments[':{operation_name}'] = 'autocreate_ldap_accounts_in_postgresql';
+        $code = i_base_error_messages::ACCESS_DENIED_UNAVAILABLE;
+        break;
+
+      default:
+        $arguments[':{operation_name}'] = 'autocreate_ldap_accounts_in_postgresql';
+        $code = i_base_error_messages::SERVER_ERROR;
+        break;
+    }
+
+    $error = c_base_error::s_log(' Status ' . $status . ' for the name \'' . $name . '\'.', ['arguments' => $arguments], $code);
+    unset($arguments);
+    unset($code);
+
+    return $error;
+  }
+
+  /**
+   * Opens the connection with pfsockopen(), which returns the connection already opened by this PHP process when there is one.
+   *
+   * @return c_base_return_status
+   *   TRUE on success, FALSE on failure.
+   *   FALSE with the error bit set is returned on error.
+   */
+  private function p_open() {
+    $socket_error = 0;
+    $socket_error_message = '';
+
+    if (is_null($this->socket_port)) {
+      $this->socket = @pfsockopen('unix://' . $this->socket_path, -1, $socket_error, $socket_error_message);
+    }
+    else {
+      $this->socket = @pfsockopen($this->socket_path, $this->socket_port, $socket_error, $socket_error_message);
+    }
+
+    if (!is_resource($this->socket)) {
+      $this->socket = NULL;
+      $this->socket_error = $socket_error;
+
+      $error = c_base_error::s_log(NULL, ['arguments' => [':{operation_name}' => 'pfsockopen', ':{socket_error}' => $socket_error, ':{socket_error_message}' => $socket_error_message, ':{function_name}' => __CLASS__ . '->' . __FUNCTION__]], i_base_error_messages::SOCKET_FAILURE);
+      unset($socket_error);
+      unset($socket_error_message);
+
+      return c_base_return_error::s_false($error);
+    }
+    unset($socket_error);
+    unset($socket_error_message);
+
+    $this->p_assign_timeout();
+
+    return new c_base_return_true();
+  }
+
+  /**
+   * Assigns the timeout to the connection.
+   */
+  private function p_assign_timeout() {
+    if (is_null($this->socket_timeout)) {
+      $seconds = (float) ini_get('default_socket_timeout');
+    }
+    else {
+      $seconds = (float) $this->socket_timeout;
+    }
+
+    stream_set_timeout($this->socket, (int) $seconds, (int) (($seconds - floor($seconds)) * 1000000));
+    unset($seconds);
+  }
+
+  /**
+   * Writes the packets for the names and reads their responses.
+   *
+   * @param array $names
+   *   The names, which are already validated.
+   *
+   * @return c_base_return_status|c_base_return_array
+   *   An array of the status for each name, in the order of the names, on success.
+   *   The array is shorter than the names when the service closed the connection.
+   *   When the responses time out, the remaining names are self::STATUS_TIMEOUT and the connection is closed.
+   *   FALSE with the error bit set is returned on error.
+   *
+   * @see: c_base_autocreate::do_connect()
+   */
+  private function p_transfer($names) {
+    $header = chr(static::PACKET_HEADER | static::PACKET_FLAG_KEEP | ($this->bulk ? static::PACKET_FLAG_BULK : 0) | (is_null($this->deadline) ? 0 : static::PACKET_FLAG_DEADLINE));
+    if (!is_null($this->deadline)) {
+      $header .= pack('n', $this->deadline);
+    }
+
+    // with the keep flag, each packet is padded with NULL bytes to self::PACKET_SIZE_INPUT.
+    $packets = '';
+    foreach ($names as $name) {
+      $packets .= str_pad($header . $name, static::PACKET_SIZE_INPUT, "\0");
+    }
+    unset($name);
+    unset($header);
+
+    $packets_length = strlen($packets);
+    for ($written = 0; $written < $packets_length; $written += $result) {
+      $result = @fwrite($this->socket, substr($packets, $written));
+
+      if ($result === FALSE || $result === 0) {
+        unset($result);
+        unset($written);
+        unset($packets);
+        unset($packets_length);
+
+        $error = c_base_error::s_log(NULL, ['arguments' => [':{operation_name}' => 'fwrite', ':{socket_error}' => NULL, ':{socket_error_message}' => 'Failed to write the names.', ':{function_name}' => __CLASS__ . '->' . __FUNCTION__]], i_base_error_messages::SOCKET_FAILURE);
+        return c_base_return_error::s_false($error);
+      }
+    }
+    unset($result);
+    unset($written);
+    unset($packets);
+    unset($packets_length);
+
+    $responses_length = count($names) * static::PACKET_SIZE_OUTPUT;
+    $responses = '';
+    $timed_out = FALSE;
+
+    while (strlen($responses) < $responses_length) {
+      $read = @fread($this->socket, $responses_length - strlen($responses));
+
+      if (is_string($read) && strlen($read) > 0) {
+        $responses .= $read;
+        continue;
+      }
+
+      $meta = stream_get_meta_data($this->socket);
+      $timed_out = !empty($meta['timed_out']);
+      unset($meta);
+
+      // the service closed the connection.
+      break;
+    }
+    unset($read);
+    unset($responses_length);
+
+    $statuses = [];
+    if (strlen($responses) > 0) {
+      $statuses = array_values(unpack('C*', $responses));
+    }
+    unset($responses);
+
+    // the responses may still arrive after the timeout, so this connection can no longer be used.
+    if ($timed_out) {
+      $statuses = array_pad($statuses, count($names), static::STATUS_TIMEOUT);
+      $this->do_disconnect();
+    }
+    unset($timed_out);
+
+    return c_base_return_array::s_new($statuses);
+  }
+}
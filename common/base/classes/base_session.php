@@ -17,10 +17,32 @@ require_once('common/base/classes/base_users.php');
  * The current design does not store session variables, only the session key, username, ip address, and password.
  * This session key can be used to retrieve a password between requests and to access the database.
  * The database can then be used to retrieve any session variables.
+ *
+ * In keep-alive mode (see self::is_keep_alive()), the connection is opened with pfsockopen() and stays open between the requests handled by the same PHP process (such as a PHP-FPM worker).
+ * Each packet is then sent as a length-prefixed frame, encoded as json or in the compact binary encoding of the server (see self::set_encoding()).
+ * When the server does not support frames, this falls back to a json packet on a new connection for each operation.
  */
 class c_base_session extends c_base_return {
   const PACKET_MAX_LENGTH = 8192;
 
+  // the frame is a 1 byte encoding, followed by the length of the packet as a 4 byte big endian integer.
+  const FRAME_HEADER_LENGTH = 5;
+  const FRAME_MAX_LENGTH    = 65536;
+
+  // the encodings are the first byte of each frame.
+  const ENCODING_JSON   = 1;
+  const ENCODING_BINARY = 2;
+
+  // the types of the values in the binary encoding, as defined by binary_encode() in sessionize_accounts-server.php.
+  const BINARY_NULL      = 0;
+  const BINARY_FALSE     = 1;
+  const BINARY_TRUE      = 2;
+  const BINARY_INT       = 3;
+  const BINARY_FLOAT     = 4;
+  const BINARY_STRING    = 5;
+  const BINARY_ARRAY     = 6;
+  const BINARY_DEPTH_MAX = 32;
+
   const SOCKET_PATH_PREFIX = '/programs/sockets/sessionize_accounts/';
   const SOCKET_PATH_SUFFIX = '/sessions.socket';
 
@@ -37,6 +59,10 @@ class c_base_session extends c_base_return {
   protected $socket_path;
   protected $socket_timeout;
   protected $socket_error;
+  protected $socket_persistent;
+
+  protected $keep_alive;
+  protected $encoding;
 
   protected $system_name;
 
@@ -69,8 +95,12 @@ class c_base_session extends c_base_return {
     $this->socket           = NULL;
     $this->socket_directory = NULL;
     $this->socket_path      = NULL;
-    $this->socket_timeout   = NULL;
-    $this->socket_error     = NULL;
+    $this->socket_timeout    = NULL;
+    $this->socket_error      = NULL;
+    $this->socket_persistent = FALSE;
+
+    $this->keep_alive = FALSE;
+    $this->encoding   = static::ENCODING_BINARY;
 
     $this->cookie = NULL;
 
@@ -96,11 +126,13 @@ class c_base_session extends c_base_return {
 
   /**
    * Class destructor.
+   *
+   * A persistent connection is not closed, so that it is used again by the next request of this PHP process.
    */
   public function __destruct() {
     $this->clear_password();
 
-    if (is_resource($this->socket)) {
+    if (is_resource($this->socket) && !$this->socket_persistent) {
       @socket_close($this->socket);
     }
 
@@ -109,6 +141,10 @@ class c_base_session extends c_base_return {
     unset($this->socket_path);
     unset($this->socket_timeout);
     unset($this->socket_error);
+    unset($this->socket_persistent);
+
+    unset($this->keep_alive);
+    unset($this->encoding);
 
     unset($this->cookie);
 
@@ -561,7 +597,10 @@ class c_base_session extends c_base_return {
 
     if ($receive) {
       $this->socket_timeout['receive'] = ['seconds' => $seconds, 'microseconds' => $microseconds];
-      if (is_resource($this->socket)) {
+      if (is_resource($this->socket) && $this->socket_persistent) {
+        stream_set_timeout($this->socket, $seconds, $microseconds);
+      }
+      else if (is_resource($this->socket)) {
         $result = @socket_set_option($this->socket, SOL_SOCKET, SO_RCVTIMEO, $seconds, $microseconds);
         if ($result === FALSE) {
           unset($result);
@@ -575,7 +614,9 @@ class c_base_session extends c_base_return {
     }
     else {
       $this->socket_timeout['send'] = ['seconds' => $seconds, 'microseconds' => $microseconds];
-      if (is_resource($this->socket)) {
+
+      // a persistent connection only has a single timeout for reading and writing, which is the receive timeout.
+      if (is_resource($this->socket) && !$this->socket_persistent) {
         $result = @socket_set_option($this->socket, SOL_SOCKET, SO_SNDTIMEO, $seconds, $microseconds);
         if ($result === FALSE) {
           unset($result);
@@ -591,6 +632,28 @@ class c_base_session extends c_base_return {
     return new c_base_return_true();
   }
 
+  /**
+   * Assigns the encoding of the packets sent in keep-alive mode.
+   *
+   * @param int $encoding
+   *   The encoding, either self::ENCODING_BINARY (the default) or self::ENCODING_JSON.
+   *
+   * @return c_base_return_status
+   *   TRUE on success, FALSE otherwise.
+   *   FALSE with the error bit set is returned on error.
+   *
+   * @see: c_base_session::is_keep_alive()
+   */
+  public function set_encoding($encoding) {
+    if ($encoding !== static::ENCODING_BINARY && $encoding !== static::ENCODING_JSON) {
+      $error = c_base_error::s_log(NULL, ['arguments' => [':{argument_name}' => 'encoding', ':{function_name}' => __CLASS__ . '->' . __FUNCTION__]], i_base_error_messages::INVALID_ARGUMENT);
+      return c_base_return_error::s_false($error);
+    }
+
+    $this->encoding = $encoding;
+    return new c_base_return_true();
+  }
+
   /**
    * Assigns the current user object.
    *
@@ -896,6 +959,16 @@ class c_base_session extends c_base_return {
     return c_base_return_int::s_new($this->socket_error);
   }
 
+  /**
+   * Returns the encoding of the packets sent in keep-alive mode.
+   *
+   * @return c_base_return_int
+   *   The encoding, see self::ENCODING_*.
+   */
+  public function get_encoding() {
+    return c_base_return_int::s_new($this->encoding);
+  }
+
   /**
    * Get the current user object.
    *
@@ -994,6 +1067,42 @@ class c_base_session extends c_base_return {
     return new c_base_return_true();
   }
 
+  /**
+   * Get or Assign the is keep-alive boolean setting.
+   *
+   * In keep-alive mode, the connection stays open between requests of the same PHP process.
+   * This is disabled when the server is found to not support keep-alive connections.
+   *
+   * @param bool|null $is_keep_alive
+   *   When a boolean, this is assigned as the current is keep-alive setting.
+   *   When NULL, the current setting is returned.
+   *
+   * @return c_base_return_bool|c_base_return_status
+   *   When $is_keep_alive is NULL, is keep-alive boolean setting on success.
+   *   FALSE with error bit is set on error.
+   */
+  public function is_keep_alive($is_keep_alive = NULL) {
+    if (!is_null($is_keep_alive) && !is_bool($is_keep_alive)) {
+      $error = c_base_error::s_log(NULL, ['arguments' => [':{argument_name}' => 'is_keep_alive', ':{function_name}' => __CLASS__ . '->' . __FUNCTION__]], i_base_error_messages::INVALID_ARGUMENT);
+      return c_base_return_error::s_false($error);
+    }
+
+    if (is_null($is_keep_alive)) {
+      if (!is_bool($this->keep_alive)) {
+        $this->keep_alive = FALSE;
+      }
+
+      if ($this->keep_alive) {
+        return new c_base_return_true();
+      }
+
+      return new c_base_return_false();
+    }
+
+    $this->keep_alive = $is_keep_alive;
+    return new c_base_return_true();
+  }
+
   /**
    * Returns the connected status.
    *
@@ -1018,6 +1127,8 @@ class c_base_session extends c_base_return {
    * The system name must be defined before this call to ensure a valid socket path exists.
    * The socket should be closed with c_base_session::do_disconnect() when finished.
    *
+   * In keep-alive mode, this uses the connection already opened by this PHP process when there is one.
+   *
    * @return c_base_return_status
    *   TRUE on success, FALSE on failure.
    *
@@ -1035,6 +1146,35 @@ class c_base_session extends c_base_return {
       return c_base_return_error::s_false($error);
     }
 
+    if ($this->keep_alive) {
+      $opened = $this->p_open_persistent();
+      if (c_base_return::s_has_error($opened)) {
+        return $opened;
+      }
+      unset($opened);
+
+      // a connection used by an earlier request of this PHP process has nothing to read, unless that request gave up before reading the response or the server closed the connection.
+      // the response would then not match the next request, so such a connection is replaced.
+      $read = [$this->socket];
+      $write = NULL;
+      $except = NULL;
+
+      $ready = @stream_select($read, $write, $except, 0);
+      unset($read);
+      unset($write);
+      unset($except);
+
+      if ($ready !== 0) {
+        unset($ready);
+
+        $this->do_disconnect(TRUE);
+        return $this->p_open_persistent();
+      }
+      unset($ready);
+
+      return new c_base_return_true();
+    }
+
 
     $this->socket = @socket_create(AF_UNIX, SOCK_STREAM, 0);
     if (!is_resource($this->socket)) {
@@ -1077,19 +1217,30 @@ class c_base_session extends c_base_return {
   /**
    * Close an opened socket.
    *
+   * A persistent connection (see self::is_keep_alive()) is only released, so that the next request of this PHP process uses it again.
+   *
+   * @param bool $close
+   *   (optional) When TRUE, a persistent connection is closed as well.
+   *
    * @return c_base_return_status
    *   TRUE on success, FALSE otherwise.
    *   FALSE with the error bit set is returned on error.
    */
-  public function do_disconnect() {
+  public function do_disconnect($close = FALSE) {
     if (!is_resource($this->socket)) {
       $error = c_base_error::s_log(NULL, ['arguments' => [':{variable_name}' => 'this->socket', ':{function_name}' => __CLASS__ . '->' . __FUNCTION__]], i_base_error_messages::INVALID_VARIABLE);
       return c_base_return_error::s_false($error);
     }
 
-    @socket_close($this->socket);
+    if (!$this->socket_persistent) {
+      @socket_close($this->socket);
+    }
+    else if ($close) {
+      @fclose($this->socket);
+    }
 
     $this->socket = NULL;
+    $this->socket_persistent = FALSE;
     return new c_base_return_true();
   }
 
@@ -1361,6 +1512,10 @@ class c_base_session extends c_base_return {
    * @see: c_base_session::do_connect()
    */
   private function p_transfer($request) {
+    if ($this->socket_persistent) {
+      return $this->p_transfer_frame($request, TRUE);
+    }
+
     $json = json_encode($request);
 
     $written = @socket_write($this->socket, $json);
@@ -1404,4 +1559,343 @@ class c_base_session extends c_base_return {
 
     return c_base_return_array::s_new($response);
   }
+
+  /**
+   * Opens a persistent connection, which is the connection already opened by this PHP process when there is one.
+   *
+   * @return c_base_return_status
+   *   TRUE on success, FALSE on failure.
+   *   FALSE with the error bit set is returned on error.
+   */
+  private function p_open_persistent() {
+    $socket_error = 0;
+    $socket_error_message = '';
+
+    $this->socket = @pfsockopen('unix://' . $this->socket_path, -1, $socket_error, $socket_error_message);
+    if (!is_resource($this->socket)) {
+      $this->socket = NULL;
+      $this->socket_error = $socket_error;
+
+      $error = c_base_error::s_log(NULL, ['arguments' => [':{operation_name}' => 'pfsockopen', ':{socket_error}' => $socket_error, ':{socket_error_message}' => $socket_error_message, ':{function_name}' => __CLASS__ . '->' . __FUNCTION__]], i_base_error_messages::SOCKET_FAILURE);
+      unset($socket_error);
+      unset($socket_error_message);
+
+      return c_base_return_error::s_false($error);
+    }
+    unset($socket_error);
+    unset($socket_error_message);
+
+    $this->socket_persistent = TRUE;
+
+    // assign any pre-defined timeout, a stream only has a single timeout for reading and writing.
+    if (isset($this->socket_timeout['receive']['seconds'])) {
+      stream_set_timeout($this->socket, $this->socket_timeout['receive']['seconds'], $this->socket_timeout['receive']['microseconds']);
+    }
+
+    return new c_base_return_true();
+  }
+
+  /**
+   * Transfer a request frame through a persistent connection.
+   *
+   * @param array $request
+   *   A request array defined as required by the socket.
+   * @param bool $retry
+   *   When TRUE and the connection is known to be closed before any of the response was received (the write failed or the end of the stream was reached), the request is sent once more on a new connection.
+   *   This is the case when the server closed an idle connection.
+   *   The request is never sent again after a timeout, because the server may still be processing it.
+   *
+   * @return c_base_return_status|c_base_return_array
+   *   An array is returned on success.
+   *   FALSE is returned otherwise.
+   *   FALSE with the error bit set is returned on error.
+   *
+   * @see: c_base_session::p_transfer()
+   */
+  private function p_transfer_frame($request, $retry) {
+    if ($this->encoding === static::ENCODING_BINARY) {
+      $packet = static::p_s_binary_encode($request);
+    }
+    else {
+      $packet = json_encode($request);
+    }
+
+    $packet = chr($this->encoding) . pack('N', strlen($packet)) . $packet;
+    $packet_length = strlen($packet);
+
+    for ($written = 0; $written < $packet_length; $written += $result) {
+      $result = @fwrite($this->socket, substr($packet, $written));
+
+      if ($result === FALSE || $result === 0) {
+        break;
+      }
+    }
+    unset($packet);
+
+    $header = '';
+    $closed = TRUE;
+    if ($written >= $packet_length) {
+      $header = $this->p_read_frame(static::FRAME_HEADER_LENGTH);
+      $closed = strlen($header) == 0 && feof($this->socket);
+    }
+    unset($packet_length);
+    unset($written);
+    unset($result);
+
+    $meta = stream_get_meta_data($this->socket);
+    if (!empty($meta['timed_out'])) {
+      $closed = FALSE;
+    }
+    unset($meta);
+
+    if ($closed && $retry) {
+      unset($closed);
+      unset($header);
+
+      $this->do_disconnect(TRUE);
+
+      $connected = $this->do_connect();
+      if (c_base_return::s_has_error($connected)) {
+        return $connected;
+      }
+      unset($connected);
+
+      return $this->p_transfer_frame($request, FALSE);
+    }
+    unset($closed);
+
+    // a server that does not support frames responds with a json error and closes the connection.
+    if (strlen($header) > 0 && $header[0] === '{') {
+      unset($header);
+
+      $this->do_disconnect(TRUE);
+      $this->keep_alive = FALSE;
+
+      $connected = $this->do_connect();
+      if (c_base_return::s_has_error($connected)) {
+        return $connected;
+      }
+      unset($connected);
+
+      return $this->p_transfer($request);
+    }
+
+    if (strlen($header) < static::FRAME_HEADER_LENGTH || ord($header[0]) !== $this->encoding) {
+      unset($header);
+
+      $this->do_disconnect(TRUE);
+
+      $error = c_base_error::s_log(NULL, ['arguments' => [':{operation_name}' => 'fread', ':{socket_error}' => NULL, ':{socket_error_message}' => 'No valid frame received.', ':{function_name}' => __CLASS__ . '->' . __FUNCTION__]], i_base_error_messages::SOCKET_FAILURE);
+      return c_base_return_error::s_false($error);
+    }
+
+    $length = unpack('N', substr($header, 1, 4))[1];
+    unset($header);
+
+    $packet = '';
+    if ($length <= static::FRAME_MAX_LENGTH) {
+      $packet = $this->p_read_frame($length);
+    }
+
+    if (strlen($packet) != $length) {
+      unset($packet);
+      unset($length);
+
+      $this->do_disconnect(TRUE);
+
+      $error = c_base_error::s_log(NULL, ['arguments' => [':{operation_name}' => 'fread', ':{socket_error}' => NULL, ':{socket_error_message}' => 'No valid frame received.', ':{function_name}' => __CLASS__ . '->' . __FUNCTION__]], i_base_error_messages::SOCKET_FAILURE);
+      return c_base_return_error::s_false($error);
+    }
+    unset($length);
+
+    $response = NULL;
+    if ($this->encoding === static::ENCODING_BINARY) {
+      $offset = 0;
+      if (!static::p_s_binary_decode($packet, $offset, $response) || $offset != strlen($packet)) {
+        $response = NULL;
+      }
+      unset($offset);
+    }
+    else {
+      $response = json_decode($packet, TRUE);
+    }
+    unset($packet);
+
+    if (!is_array($response)) {
+      unset($response);
+
+      $operation_name = $this->encoding === static::ENCODING_BINARY ? 'this->p_s_binary_decode' : 'json_decode';
+      $error = c_base_error::s_log(NULL, ['arguments' => [':{operation_name}' => $operation_name, ':{function_name}' => __CLASS__ . '->' . __FUNCTION__]], i_base_error_messages::OPERATION_FAILURE);
+      unset($operation_name);
+
+      return c_base_return_error::s_false($error);
+    }
+
+    return c_base_return_array::s_new($response);
+  }
+
+  /**
+   * Reads the given number of bytes from a persistent connection.
+   *
+   * @param int $length
+   *   The number of bytes to read.
+   *
+   * @return string
+   *   The bytes read, which are fewer than $length when the connection is closed or the read timed out.
+   */
+  private function p_read_frame($length) {
+    $read = '';
+
+    while (strlen($read) < $length) {
+      $part = @fread($this->socket, $length - strlen($read));
+
+      if (!is_string($part) || strlen($part) == 0) {
+        break;
+      }
+
+      $read .= $part;
+    }
+    unset($part);
+
+    return $read;
+  }
+
+  /**
+   * Encodes a value in the binary encoding.
+   *
+   * @param mixed $value
+   *   The value to encode, objects and resources are encoded as NULL.
+   *
+   * @return string
+   *   The encoded value.
+   *
+   * @see: binary_encode() in sessionize_accounts-server.php
+   */
+  private static function p_s_binary_encode($value) {
+    if (is_null($value)) {
+      return chr(static::BINARY_NULL);
+    }
+
+    if (is_bool($value)) {
+      return chr($value ? static::BINARY_TRUE : static::BINARY_FALSE);
+    }
+
+    if (is_int($value)) {
+      return chr(static::BINARY_INT) . pack('J', $value);
+    }
+
+    if (is_float($value)) {
+      return chr(static::BINARY_FLOAT) . pack('E', $value);
+    }
+
+    if (is_string($value)) {
+      return chr(static::BINARY_STRING) . pack('N', strlen($value)) . $value;
+    }
+
+    if (is_array($value)) {
+      $encoded = chr(static::BINARY_ARRAY) . pack('N', count($value));
+      foreach ($value as $key => $item) {
+        $encoded .= static::p_s_binary_encode($key) . static::p_s_binary_encode($item);
+      }
+      unset($key);
+      unset($item);
+
+      return $encoded;
+    }
+
+    return chr(static::BINARY_NULL);
+  }
+
+  /**
+   * Decodes a value in the binary encoding.
+   *
+   * @param string $packet
+   *   The packet.
+   * @param int $offset
+   *   The position in the packet to decode from, which is moved past the decoded value.
+   * @param mixed $value
+   *   The decoded value.
+   * @param int $depth
+   *   (optional) The depth of the arrays this value is in, limited by self::BINARY_DEPTH_MAX.
+   *
+   * @return bool
+   *   TRUE on success, FALSE when the packet is invalid.
+   *
+   * @see: binary_decode() in sessionize_accounts-server.php
+   */
+  private static function p_s_binary_decode($packet, &$offset, &$value, $depth = 0) {
+    $length = strlen($packet);
+    if ($offset >= $length || $depth > static::BINARY_DEPTH_MAX) {
+      return FALSE;
+    }
+
+    $type = ord($packet[$offset]);
+    $offset++;
+
+    if ($type == static::BINARY_NULL) {
+      $value = NULL;
+      return TRUE;
+    }
+
+    if ($type == static::BINARY_FALSE || $type == static::BINARY_TRUE) {
+      $value = $type == static::BINARY_TRUE;
+      return TRUE;
+    }
+
+    if ($type == static::BINARY_INT || $type == static::BINARY_FLOAT) {
+      if ($offset + 8 > $length) {
+        return FALSE;
+      }
+
+      $value = unpack($type == static::BINARY_INT ? 'J' : 'E', substr($packet, $offset, 8))[1];
+      $offset += 8;
+      return TRUE;
+    }
+
+    if ($type != static::BINARY_STRING && $type != static::BINARY_ARRAY) {
+      return FALSE;
+    }
+
+    if ($offset + 4 > $length) {
+      return FALSE;
+    }
+
+    $count = unpack('N', substr($packet, $offset, 4))[1];
+    $offset += 4;
+
+    if ($type == static::BINARY_STRING) {
+      if ($offset + $count > $length) {
+        return FALSE;
+      }
+
+      $value = (string) substr($packet, $offset, $count);
+      $offset += $count;
+      return TRUE;
+    }
+
+    // each key and value is at least 1 byte, which also prevents a large count from looping.
+    if ($count * 2 > $length - $offset) {
+      return FALSE;
+    }
+
+    $value = [];
+    for ($i = 0; $i < $count; $i++) {
+      $key = NULL;
+      $item = NULL;
+
+      if (!static::p_s_binary_decode($packet, $offset, $key, $depth + 1) || (!is_int($key) && !is_string($key))) {
+        return FALSE;
+      }
+
+      if (!static::p_s_binary_decode($packet, $offset, $item, $depth + 1)) {
+        return FALSE;
+      }
+
+      $value[$key] = $item;
+    }
+    unset($key);
+    unset($item);
+
+    return TRUE;
+  }
 }
@@ -77,6 +77,7 @@ class c_standard_index extends c_base_return {
     $this->settings['cookie_secure']    = TRUE;
     $this->settings['session_socket']   = '/programs/sockets/sessionize_accounts/';
     $this->settings['session_system']   = 'standard';
+    $this->settings['session_keep']     = TRUE; // keep the session connection open between requests of the same PHP process.
     $this->settings['session_expire']   = 1200; // 20 minutes
     $this->settings['session_max']      = 7200; // 120 minutes / 2 hours
 
@@ -361,6 +362,7 @@ class c_standard_index extends c_base_return {
     $this->session = new c_base_session();
     $this->session->set_socket_directory($this->settings['session_socket']);
     $this->session->set_system_name($this->settings['session_system']);
+    $this->session->is_keep_alive($this->settings['session_keep']);
 
     // the requester should not have any control over specifying/changing these settings, so overwrite whatever is defined by the request cookie.
     $cookie_login->set_name($this->settings['cookie_name']);
@@ -37,6 +37,8 @@ main() {
   local path_settings="${path_programs}settings/autocreate_ldap_accounts_in_postgresql/"
   local path_systems="${path_settings}systems.settings"
   local path_pids="/var/run/autocreate_ldap_accounts_in_postgresql/"
+  local path_caches="/var/cache/autocreate_ldap_accounts_in_postgresql/"
+  local path_tables="/dev/shm/autocreate_ldap_accounts_in_postgresql/"
   local parameter_system=$2
   local alap_systems=
   local i=
@@ -54,8 +56,20 @@ main() {
     mkdir -p $path_pids
   fi
 
+  if [[ ! -d $path_caches ]] ; then
+    mkdir -p $path_caches
+    chmod 700 $path_caches
+  fi
+
+  if [[ ! -d $path_tables ]] ; then
+    mkdir -p $path_tables
+    chmod 755 $path_tables
+  fi
+
   if [[ $process_owner != "" ]] ; then
     chown $process_owner $path_pids
+    chown $process_owner $path_caches
+    chown $process_owner $path_tables
   fi
 
   alap_systems=$(grep -o '^alap_systems[[:space:]][[:space:]]*.*$' $path_systems | sed -e 's|^alap_systems[[:space:]][[:space:]]*||')
@@ -111,8 +125,17 @@ main() {
     status)
       do_status
       ;;
+    reconcile)
+      do_reconcile
+      ;;
+    statistics)
+      do_statistics
+      ;;
+    trace)
+      do_trace
+      ;;
     *)
-      echo "Usage: autocreate_ldap_accounts_in_postgresql {start|stop|restart|status}"
+      echo "Usage: autocreate_ldap_accounts_in_postgresql {start|stop|restart|status|reconcile|statistics|trace}"
       return 2
   esac
 
@@ -126,6 +149,27 @@ do_start() {
   local alap_connect_user=
   local alap_connect_password=
   local alap_port=
+  local alap_listen=
+  local alap_socket_allow_uid=
+  local alap_socket_allow_gid=
+  local alap_mirror=
+  local alap_cache_ttl=
+  local alap_cache_coherence=
+  local alap_cache_snapshot=
+  local alap_table=
+  local alap_control=
+  local alap_capture=
+  local alap_health_interval=
+  local alap_keepalive=
+  local alap_ldap_servers=
+  local alap_ldap_hedge=
+  local alap_ldap_hedge_percentile=
+  local alap_ldap_spares=
+  local alap_workers=
+  local alap_bulk_listener=
+  local alap_bulk_share=
+  local alap_fair=
+  local alap_fair_weights=
   local alap_system=
   local result=
   local any_success=0
@@ -289,6 +333,134 @@ do_status() {
   return 0
 }
 
+do_statistics() {
+  local alap_name_system=
+  local alap_name_group=
+  local alap_name_database=
+  local alap_port=
+  local alap_system=
+  local pid_file=
+  local pid=
+  local result=
+
+  for alap_system in $alap_systems ; do
+    load_system_settings
+    get_pid
+
+    if [[ $pid == "" ]] ; then
+      continue
+    fi
+
+    # -12 = SIGUSR2, the statistics are written to the system logger.
+    kill -12 $pid
+    result=$?
+
+    if [[ $result -ne 0 ]] ; then
+      echo "Signal to write statistics failed, command: kill -12 $pid."
+    else
+      echo "The statistics for '$alap_system' have been written to the system logger by process $pid."
+    fi
+  done
+
+  return 0
+}
+
+do_trace() {
+  local alap_name_system=
+  local alap_name_group=
+  local alap_name_database=
+  local alap_port=
+  local alap_system=
+  local pid_file=
+  local pid=
+  local result=
+
+  for alap_system in $alap_systems ; do
+    load_system_settings
+    get_pid
+
+    if [[ $pid == "" ]] ; then
+      continue
+    fi
+
+    # -10 = SIGUSR1, the flight recorder is written to the trace file.
+    kill -10 $pid
+    result=$?
+
+    if [[ $result -ne 0 ]] ; then
+      echo "Signal to write the flight recorder failed, command: kill -10 $pid."
+    else
+      echo "The flight recorder for '$alap_system' is being written to ${path_pids}$alap_system.trace by process $pid."
+    fi
+  done
+
+  return 0
+}
+
+do_reconcile() {
+  local alap_name_system=
+  local alap_name_group=
+  local alap_name_database=
+  local alap_connect_user=
+  local alap_connect_password=
+  local alap_port=
+  local alap_listen=
+  local alap_socket_allow_uid=
+  local alap_socket_allow_gid=
+  local alap_mirror=
+  local alap_cache_ttl=
+  local alap_cache_coherence=
+  local alap_cache_snapshot=
+  local alap_table=
+  local alap_control=
+  local alap_capture=
+  local alap_health_interval=
+  local alap_keepalive=
+  local alap_ldap_servers=
+  local alap_ldap_hedge=
+  local alap_ldap_hedge_percentile=
+  local alap_ldap_spares=
+  local alap_workers=
+  local alap_bulk_listener=
+  local alap_bulk_share=
+  local alap_fair=
+  local alap_fair_weights=
+  local alap_reconcile_rate=
+  local alap_reconcile_batch=
+  local alap_system=
+  local result=
+  local any_failure=0
+
+  for alap_system in $alap_systems ; do
+    load_system_settings
+
+    export alap_connect_user="$alap_connect_user"
+    export alap_connect_password="$alap_connect_password"
+    export alap_reconcile_rate="$alap_reconcile_rate"
+    export alap_reconcile_batch="$alap_reconcile_batch"
+    export alap_ldap_servers="$alap_ldap_servers"
+
+    if [[ $process_owner == "" ]] ; then
+      $path_service --reconcile $alap_name_system $alap_name_group $alap_name_database
+      result=$?
+    else
+      su $process_owner -m -c "$path_service --reconcile $alap_name_system $alap_name_group $alap_name_database"
+      result=$?
+    fi
+
+    if [[ $result -ne 0 ]] ; then
+      echo "Failed to reconcile $alap_system, command: $path_service --reconcile $alap_name_system $alap_name_group $alap_name_database."
+      any_failure=1
+    fi
+  done
+
+  if [[ $any_failure -ne 0 ]] ; then
+    exit -1
+  fi
+
+  return 0
+}
+
 load_system_settings() {
   local path_system=$path_settings${alap_system}.settings
   alap_name_system=
@@ -297,6 +469,29 @@ load_system_settings() {
   alap_connect_user=
   alap_connect_password=
   alap_port=
+  alap_listen=
+  alap_socket_allow_uid=
+  alap_socket_allow_gid=
+  alap_mirror=
+  alap_cache_ttl=
+  alap_cache_coherence=
+  alap_cache_snapshot=
+  alap_table=
+  alap_control=
+  alap_capture=
+  alap_health_interval=
+  alap_keepalive=
+  alap_ldap_servers=
+  alap_ldap_hedge=
+  alap_ldap_hedge_percentile=
+  alap_ldap_spares=
+  alap_workers=
+  alap_bulk_listener=
+  alap_bulk_share=
+  alap_fair=
+  alap_fair_weights=
+  alap_reconcile_rate=
+  alap_reconcile_batch=
 
   if [[ $alap_system == "" || ! -f $path_system ]] ; then
     echo "No valid path_systems file defined at: $path_system"
@@ -309,6 +504,29 @@ load_system_settings() {
   alap_connect_user=$(grep -o '^alap_connect_user[[:space:]][[:space:]]*.*$' $path_system | sed -e 's|^alap_connect_user[[:space:]][[:space:]]*||')
   alap_connect_password=$(grep -o '^alap_connect_password[[:space:]][[:space:]]*.*$' $path_system | sed -e 's|^alap_connect_password[[:space:]][[:space:]]*||')
   alap_port=$(grep -o '^alap_port[[:space:]][[:space:]]*.*$' $path_system | sed -e 's|^alap_port[[:space:]][[:space:]]*||')
+  alap_listen=$(grep -o '^alap_listen[[:space:]][[:space:]]*.*$' $path_system | sed -e 's|^alap_listen[[:space:]][[:space:]]*||')
+  alap_socket_allow_uid=$(grep -o '^alap_socket_allow_uid[[:space:]][[:space:]]*.*$' $path_system | sed -e 's|^alap_socket_allow_uid[[:space:]][[:space:]]*||')
+  alap_socket_allow_gid=$(grep -o '^alap_socket_allow_gid[[:space:]][[:space:]]*.*$' $path_system | sed -e 's|^alap_socket_allow_gid[[:space:]][[:space:]]*||')
+  alap_mirror=$(grep -o '^alap_mirror[[:space:]][[:space:]]*.*$' $path_system | sed -e 's|^alap_mirror[[:space:]][[:space:]]*||')
+  alap_cache_ttl=$(grep -o '^alap_cache_ttl[[:space:]][[:space:]]*.*$' $path_system | sed -e 's|^alap_cache_ttl[[:space:]][[:space:]]*||')
+  alap_cache_coherence=$(grep -o '^alap_cache_coherence[[:space:]][[:space:]]*.*$' $path_system | sed -e 's|^alap_cache_coherence[[:space:]][[:space:]]*||')
+  alap_cache_snapshot=$(grep -o '^alap_cache_snapshot[[:space:]][[:space:]]*.*$' $path_system | sed -e 's|^alap_cache_snapshot[[:space:]][[:space:]]*||')
+  alap_table=$(grep -o '^alap_table[[:space:]][[:space:]]*.*$' $path_system | sed -e 's|^alap_table[[:space:]][[:space:]]*||')
+  alap_control=$(grep -o '^alap_control[[:space:]][[:space:]]*.*$' $path_system | sed -e 's|^alap_control[[:space:]][[:space:]]*||')
+  alap_capture=$(grep -o '^alap_capture[[:space:]][[:space:]]*.*$' $path_system | sed -e 's|^alap_capture[[:space:]][[:space:]]*||')
+  alap_health_interval=$(grep -o '^alap_health_interval[[:space:]][[:space:]]*.*$' $path_system | sed -e 's|^alap_health_interval[[:space:]][[:space:]]*||')
+  alap_keepalive=$(grep -o '^alap_keepalive[[:space:]][[:space:]]*.*$' $path_system | sed -e 's|^alap_keepalive[[:space:]][[:space:]]*||')
+  alap_ldap_servers=$(grep -o '^alap_ldap_servers[[:space:]][[:space:]]*.*$' $path_system | sed -e 's|^alap_ldap_servers[[:space:]][[:space:]]*||')
+  alap_ldap_hedge=$(grep -o '^alap_ldap_hedge[[:space:]][[:space:]]*.*$' $path_system | sed -e 's|^alap_ldap_hedge[[:space:]][[:space:]]*||')
+  alap_ldap_hedge_percentile=$(grep -o '^alap_ldap_hedge_percentile[[:space:]][[:space:]]*.*$' $path_system | sed -e 's|^alap_ldap_hedge_percentile[[:space:]][[:space:]]*||')
+  alap_ldap_spares=$(grep -o '^alap_ldap_spares[[:space:]][[:space:]]*.*$' $path_system | sed -e 's|^alap_ldap_spares[[:space:]][[:space:]]*||')
+  alap_workers=$(grep -o '^alap_workers[[:space:]][[:space:]]*.*$' $path_system | sed -e 's|^alap_workers[[:space:]][[:space:]]*||')
+  alap_bulk_listener=$(grep -o '^alap_bulk_listener[[:space:]][[:space:]]*.*$' $path_system | sed -e 's|^alap_bulk_listener[[:space:]][[:space:]]*||')
+  alap_bulk_share=$(grep -o '^alap_bulk_share[[:space:]][[:space:]]*.*$' $path_system | sed -e 's|^alap_bulk_share[[:space:]][[:space:]]*||')
+  alap_fair=$(grep -o '^alap_fair[[:space:]][[:space:]]*.*$' $path_system | sed -e 's|^alap_fair[[:space:]][[:space:]]*||')
+  alap_fair_weights=$(grep -o '^alap_fair_weights[[:space:]][[:space:]]*.*$' $path_system | sed -e 's|^alap_fair_weights[[:space:]][[:space:]]*||')
+  alap_reconcile_rate=$(grep -o '^alap_reconcile_rate[[:space:]][[:space:]]*.*$' $path_system | sed -e 's|^alap_reconcile_rate[[:space:]][[:space:]]*||')
+  alap_reconcile_batch=$(grep -o '^alap_reconcile_batch[[:space:]][[:space:]]*.*$' $path_system | sed -e 's|^alap_reconcile_batch[[:space:]][[:space:]]*||')
 
   if [[ $alap_name_system == "" ]] ; then
     echo "No valid alap_name_system setting defined in file: $path_system"
@@ -330,15 +548,76 @@ load_system_settings() {
     exit -1
   fi
 
-  if [[ $alap_port == "" ]] ; then
+  if [[ $alap_port == "" && $alap_listen != "socket" ]] ; then
     echo "No valid alap_port setting defined in file: $path_system"
     exit -1
   fi
+
+  if [[ $alap_listen != "" && $alap_listen != "network" && $alap_listen != "socket" && $alap_listen != "both" ]] ; then
+    echo "No valid alap_listen setting defined in file: $path_system"
+    exit -1
+  fi
+
+  if [[ $alap_mirror != "" && $alap_mirror != "yes" && $alap_mirror != "no" ]] ; then
+    echo "No valid alap_mirror setting defined in file: $path_system"
+    exit -1
+  fi
+
+  if [[ $alap_table != "" && $alap_table != "yes" && $alap_table != "no" ]] ; then
+    echo "No valid alap_table setting defined in file: $path_system"
+    exit -1
+  fi
+
+  if [[ $alap_control != "" && $alap_control != "yes" && $alap_control != "no" ]] ; then
+    echo "No valid alap_control setting defined in file: $path_system"
+    exit -1
+  fi
+
+  if [[ $alap_capture != "" && $alap_capture != "names" && $alap_capture != "hashes" && $alap_capture != "no" ]] ; then
+    echo "No valid alap_capture setting defined in file: $path_system"
+    exit -1
+  fi
+
+  if [[ $alap_ldap_hedge != "" && $alap_ldap_hedge != "yes" && $alap_ldap_hedge != "no" ]] ; then
+    echo "No valid alap_ldap_hedge setting defined in file: $path_system"
+    exit -1
+  fi
+
+  if [[ $alap_bulk_listener != "" && $alap_bulk_listener != "network" && $alap_bulk_listener != "socket" ]] ; then
+    echo "No valid alap_bulk_listener setting defined in file: $path_system"
+    exit -1
+  fi
+
+  if [[ $alap_fair != "" && $alap_fair != "yes" && $alap_fair != "no" ]] ; then
+    echo "No valid alap_fair setting defined in file: $path_system"
+    exit -1
+  fi
 }
 
 start_command() {
   export alap_connect_user="$alap_connect_user"
   export alap_connect_password="$alap_connect_password"
+  export alap_listen="$alap_listen"
+  export alap_socket_allow_uid="$alap_socket_allow_uid"
+  export alap_socket_allow_gid="$alap_socket_allow_gid"
+  export alap_mirror="$alap_mirror"
+  export alap_cache_ttl="$alap_cache_ttl"
+  export alap_cache_coherence="$alap_cache_coherence"
+  export alap_cache_snapshot="$alap_cache_snapshot"
+  export alap_table="$alap_table"
+  export alap_control="$alap_control"
+  export alap_capture="$alap_capture"
+  export alap_health_interval="$alap_health_interval"
+  export alap_keepalive="$alap_keepalive"
+  export alap_ldap_servers="$alap_ldap_servers"
+  export alap_ldap_hedge="$alap_ldap_hedge"
+  export alap_ldap_hedge_percentile="$alap_ldap_hedge_percentile"
+  export alap_ldap_spares="$alap_ldap_spares"
+  export alap_workers="$alap_workers"
+  export alap_bulk_listener="$alap_bulk_listener"
+  export alap_bulk_share="$alap_bulk_share"
+  export alap_fair="$alap_fair"
+  export alap_fair_weights="$alap_fair_weights"
 
   if [[ $process_owner == "" ]] ; then
     $path_service $alap_name_system $alap_name_group $alap_name_database $alap_port
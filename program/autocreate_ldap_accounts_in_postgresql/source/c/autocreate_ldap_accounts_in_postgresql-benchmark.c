@@ -0,0 +1,381 @@
+/**
+ * Microbenchmarks for the CPU work done by autocreate_ldap_accounts_in_postgresql for each request.
+ *
+ * This includes the service source without its main(), so that the same functions are measured as are run.
+ * - Only work that does not reach ldap, postgresql, or the system logger is measured.
+ * - Each benchmark reports the nanoseconds per operation and the heap allocations per operation (see USE_ALLOCATION_COUNTERS).
+ * - The idle connections kept open between requests are then measured for their resident memory, and for the time to answer a ping while they are kept.
+ *
+ * The program expects the following optional parameters: [iterations] [connections].
+ * - Each connection is a socket pair, so the file descriptor limit must be more than twice the connections (such as via ulimit -n).
+ *
+ * Compiled with:
+ *   gcc -O2 -lpq -lldap -lssl -lpthread autocreate_ldap_accounts_in_postgresql-benchmark.c -o autocreate_ldap_accounts_in_postgresql-benchmark
+ *
+ * Copyright Kevin Day, lgpl v2.1 or later.
+ */
+#define MAIN_DISABLED 1
+
+// the allocations per operation are always counted by the benchmarks.
+#define USE_ALLOCATION_COUNTERS  1
+
+#include "autocreate_ldap_accounts_in_postgresql.c"
+
+#define BENCHMARK_ITERATIONS  1000000
+#define BENCHMARK_WARMUP      10000
+
+#define BENCHMARK_NAME        "john_smith-42"
+#define BENCHMARK_GROUP       "example_users"
+
+#define BENCHMARK_CONNECTIONS  100000
+#define BENCHMARK_PINGS        1000 // the kept connections a ping is sent on, spread across all of them.
+#define BENCHMARK_SWEEPS       10
+
+typedef int (*benchmark_function)(void *argument);
+
+typedef struct {
+  char packet[PACKET_SIZE_INPUT];
+  char user_name[PACKET_SIZE_INPUT + 1];
+  char query[PSQL_QUERY_LENGTH];
+  char ldap_name[LDAP_SEARCH_DN_LENGTH + PACKET_SIZE_INPUT + 1];
+  char psql_grant[PSQL_GRANT_LENGTH + PARAMETER_LENGTH_MAX + 3];
+  char log[LOG_LENGTH];
+} benchmark_data;
+
+// the results are summed here so that the compiler cannot drop the work being measured.
+static volatile long benchmark_sink = 0;
+
+/**
+ * Runs a benchmark and prints its cost per operation.
+ *
+ * @param const char *name
+ *   The name of the benchmark.
+ * @param benchmark_function function
+ *   The operation to measure.
+ * @param void *argument
+ *   The argument passed to the operation.
+ * @param long iterations
+ *   The number of times the operation is measured.
+ */
+void benchmark_run(const char *name, benchmark_function function, void *argument, long iterations) {
+  struct timespec started;
+  struct timespec finished;
+  unsigned long allocations = 0;
+  long i = 0;
+  long sum = 0;
+  double elapsed = 0;
+
+  for (; i < BENCHMARK_WARMUP; i++) {
+    sum += function(argument);
+  } // for
+
+  allocations = allocation_count();
+  clock_gettime(CLOCK_MONOTONIC, &started);
+
+  for (i = 0; i < iterations; i++) {
+    sum += function(argument);
+  } // for
+
+  clock_gettime(CLOCK_MONOTONIC, &finished);
+  allocations = allocation_count() - allocations;
+
+  benchmark_sink += sum;
+
+  elapsed = ((finished.tv_sec - started.tv_sec) * 1000000000.0) + (finished.tv_nsec - started.tv_nsec);
+
+  printf("%-24s %10.1f ns/op %8.2f allocs/op\n", name, elapsed / iterations, ((double) allocations) / iterations);
+}
+
+/**
+ * Validates a packet holding a bulk request, as the listeners do for each packet received.
+ *
+ * @see packet_parse()
+ */
+int benchmark_packet_parse(void *argument) {
+  benchmark_data *data = (benchmark_data *) argument;
+  int processed = 0;
+  int user_name_length = 0;
+  int flags = 0;
+  int budget = 0;
+  uint32_t ticket = 0;
+
+  return packet_parse(data->packet, PACKET_SIZE_INPUT, data->user_name, &processed, &user_name_length, &flags, &budget, &ticket) + user_name_length;
+}
+
+/**
+ * Normalizes the name, as is done before the cache is searched.
+ *
+ * @see name_normalize()
+ */
+int benchmark_name_normalize(void *argument) {
+  benchmark_data *data = (benchmark_data *) argument;
+
+  return name_normalize(BENCHMARK_NAME, sizeof(BENCHMARK_NAME) - 1, data->user_name);
+}
+
+/**
+ * Builds the ldap name searched for.
+ *
+ * @see ldap_name_build()
+ */
+int benchmark_ldap_name(void *argument) {
+  benchmark_data *data = (benchmark_data *) argument;
+
+  return ldap_name_build(data->ldap_name, BENCHMARK_NAME);
+}
+
+/**
+ * Builds the three statements made when a role is created.
+ *
+ * @see grant_role_query()
+ */
+int benchmark_grant_role_query(void *argument) {
+  benchmark_data *data = (benchmark_data *) argument;
+  int length = 0;
+
+  length += grant_role_query(data->query, PSQL_SELECT, BENCHMARK_NAME);
+  length += grant_role_query(data->query, PSQL_CREATE, BENCHMARK_NAME);
+  length += grant_role_query(data->query, data->psql_grant, BENCHMARK_NAME);
+
+  return length;
+}
+
+/**
+ * Calls log_format() with a variable number of arguments, as log_write() does.
+ */
+int benchmark_log_format_arguments(char *buffer, size_t size, const char *message, ...) {
+  va_list arguments;
+  int length = 0;
+
+  va_start(arguments, message);
+  length = log_format(buffer, size, message, arguments);
+  va_end(arguments);
+
+  return length;
+}
+
+/**
+ * Formats one of the longer log messages written for a failed request.
+ *
+ * @see log_format()
+ */
+int benchmark_log_format(void *argument) {
+  benchmark_data *data = (benchmark_data *) argument;
+
+  return benchmark_log_format_arguments(data->log, LOG_LENGTH, "ERROR: failed to search for '%s' on the ldap server '%s' with the ldap name '%s' with the ldap error (%d): %s\n", BENCHMARK_NAME, "ldaps://ldap.example.com:1636", data->ldap_name, LDAP_TIMEOUT, "Timed out");
+}
+
+/**
+ * Returns the resident memory of this process.
+ *
+ * @return long
+ *   The resident bytes, or 0 when /proc/self/statm cannot be read.
+ */
+long benchmark_resident() {
+  FILE *file = fopen("/proc/self/statm", "r");
+  long size = 0;
+  long resident = 0;
+
+  if (file == NULL) {
+    return 0;
+  }
+
+  if (fscanf(file, "%ld %ld", &size, &resident) != 2) {
+    resident = 0;
+  }
+
+  fclose(file);
+
+  return resident * sysconf(_SC_PAGESIZE);
+}
+
+/**
+ * Keeps idle connections, as the workers do after answering a request with PACKET_FLAG_KEEP, and reports their cost.
+ *
+ * The client end of each socket pair stays in this process, so the memory of the sockets in the kernel is not included in the resident memory.
+ * While every connection is kept, a ping is sent on some of them and answered by the keepalive thread.
+ *
+ * @param long connections
+ *   The connections to keep, which is reduced to fit the file descriptor limit.
+ *
+ * @return int
+ *   1 on success and -1 on error.
+ */
+int benchmark_keepalive(long connections) {
+  shared_data *shared = calloc(1, sizeof(shared_data));
+  struct rlimit descriptors;
+  struct timespec started;
+  struct timespec finished;
+  trace_data trace;
+  int *clients = NULL;
+  long kept = 0;
+  long resident = 0;
+  long pings = 0;
+  long i = 0;
+  double released = 0;
+  double swept = 0;
+  double pinged = 0;
+
+  if (shared == NULL) {
+    printf("ERROR: failed to allocate memory for the shared data.\n");
+    return -1;
+  }
+
+  shared->keepalive.limit = connections;
+  shared->keepalive.worker.shared = shared;
+  shared->listeners[LISTENER_SOCKET].type = LISTENER_SOCKET;
+  shared->listeners[LISTENER_SOCKET].shared = shared;
+
+  // the limit is only checked against KEEPALIVE_DESCRIPTORS_MAX here, the descriptors are checked below.
+  if (keepalive_initialize(&shared->keepalive) < 0) {
+    printf("ERROR: failed to initialize the kept connections.\n");
+    free(shared);
+    return -1;
+  }
+
+  getrlimit(RLIMIT_NOFILE, &descriptors);
+
+  if (descriptors.rlim_cur != RLIM_INFINITY && connections > ((long) descriptors.rlim_cur - 64) / 2) {
+    connections = ((long) descriptors.rlim_cur - 64) / 2;
+    printf("NOTICE: only %ld connections are kept, because of the file descriptor limit of %lu.\n", connections, (unsigned long) descriptors.rlim_cur);
+  }
+
+  clients = calloc(connections, sizeof(int));
+
+  if (clients == NULL) {
+    printf("ERROR: failed to allocate memory for the clients.\n");
+    free(shared);
+    return -1;
+  }
+
+  memset(&trace, 0, sizeof(trace_data));
+  trace.listener = LISTENER_SOCKET;
+
+  // the clients are touched first, so that only the memory of the service is measured.
+  memset(clients, 0, sizeof(int) * connections);
+  resident = benchmark_resident();
+
+  for (; kept < connections; kept++) {
+    int pair[2];
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) < 0) {
+      printf("ERROR: failed to create socket pair %ld, error: %i.\n", kept, errno);
+      break;
+    }
+
+    clients[kept] = pair[0];
+
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    keepalive_release(shared, pair[1], &trace, 1);
+    clock_gettime(CLOCK_MONOTONIC, &finished);
+
+    released += ((finished.tv_sec - started.tv_sec) * 1000000000.0) + (finished.tv_nsec - started.tv_nsec);
+  } // for
+
+  resident = benchmark_resident() - resident;
+
+  if (kept == 0) {
+    free(clients);
+    free(shared);
+    return -1;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &started);
+
+  for (i = 0; i < BENCHMARK_SWEEPS; i++) {
+    keepalive_sweep(&shared->keepalive, started.tv_sec);
+  } // for
+
+  clock_gettime(CLOCK_MONOTONIC, &finished);
+  swept = ((finished.tv_sec - started.tv_sec) * 1000000000.0) + (finished.tv_nsec - started.tv_nsec);
+
+  if (pthread_create(&shared->keepalive.thread, NULL, handler_keepalive, shared) != 0) {
+    printf("ERROR: failed to create the keepalive thread.\n");
+    free(clients);
+    free(shared);
+    return -1;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &started);
+
+  for (i = 0; i < kept; i += kept > BENCHMARK_PINGS ? kept / BENCHMARK_PINGS : 1) {
+    char packet[PACKET_SIZE_INPUT];
+    char response[PACKET_SIZE_OUTPUT + HEALTH_LENGTH];
+
+    memset(packet, 0, PACKET_SIZE_INPUT);
+    packet[0] = PACKET_HEADER | PACKET_FLAG_PING | PACKET_FLAG_KEEP;
+
+    if (send(clients[i], packet, PACKET_SIZE_INPUT, FLAGS_SEND) != PACKET_SIZE_INPUT || recv(clients[i], response, PACKET_SIZE_OUTPUT + HEALTH_LENGTH, MSG_WAITALL) != PACKET_SIZE_OUTPUT + HEALTH_LENGTH) {
+      printf("ERROR: the ping on kept connection %ld was not answered.\n", i);
+      break;
+    }
+
+    pings++;
+  } // for
+
+  clock_gettime(CLOCK_MONOTONIC, &finished);
+  pinged = ((finished.tv_sec - started.tv_sec) * 1000000000.0) + (finished.tv_nsec - started.tv_nsec);
+
+  printf("%-24s %10ld kept %8.1f bytes/connection %10.1f ns/keep %10.1f us/sweep %8.1f us/ping\n", "keepalive_idle", kept, ((double) resident) / kept, released / kept, swept / BENCHMARK_SWEEPS / 1000, pings > 0 ? pinged / pings / 1000 : 0.0);
+
+  // the process exits after this, which closes the connections and stops the keepalive thread.
+  free(clients);
+
+  return 1;
+}
+
+/**
+ * Main Function
+ *
+ * @param int argc
+ *   Total of command line arguments.
+ * @param char *argv[]
+ *   Array of command line argument strings.
+ *
+ * @return int
+ *   The return status of the program.
+ */
+int main(int argc, char *argv[]) {
+  benchmark_data data;
+  long iterations = BENCHMARK_ITERATIONS;
+  long connections = BENCHMARK_CONNECTIONS;
+
+  if (argc > 1) {
+    iterations = strtol(argv[1], NULL, 10);
+
+    if (iterations < 1) {
+      printf("ERROR: the iterations must be a number greater than 0.\n");
+      return 1;
+    }
+  }
+
+  if (argc > 2) {
+    connections = strtol(argv[2], NULL, 10);
+
+    if (connections < 1 || connections > KEEPALIVE_DESCRIPTORS_MAX) {
+      printf("ERROR: the connections must be a number from 1 to %u.\n", KEEPALIVE_DESCRIPTORS_MAX);
+      return 1;
+    }
+  }
+
+  memset(&data, 0, sizeof(benchmark_data));
+
+  // a bulk request, padded with NULL bytes as the client does.
+  data.packet[0] = PACKET_HEADER | PACKET_FLAG_BULK;
+  memcpy(data.packet + 1, BENCHMARK_NAME, sizeof(BENCHMARK_NAME) - 1);
+
+  snprintf(data.psql_grant, sizeof(data.psql_grant), PSQL_GRANT, BENCHMARK_GROUP, "%s");
+  ldap_name_build(data.ldap_name, BENCHMARK_NAME);
+
+  benchmark_run("packet_parse", benchmark_packet_parse, &data, iterations);
+  benchmark_run("name_normalize", benchmark_name_normalize, &data, iterations);
+  benchmark_run("ldap_name_build", benchmark_ldap_name, &data, iterations);
+  benchmark_run("grant_role_query", benchmark_grant_role_query, &data, iterations);
+  benchmark_run("log_format", benchmark_log_format, &data, iterations);
+
+  if (benchmark_keepalive(connections) < 0) {
+    return 1;
+  }
+
+  return 0;
+}
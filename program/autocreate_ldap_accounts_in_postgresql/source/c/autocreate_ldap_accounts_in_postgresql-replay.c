@@ -0,0 +1,671 @@
+/**
+ * Replays the requests captured by autocreate_ldap_accounts_in_postgresql (see ENVIRONMENT_CAPTURE) against a test service.
+ *
+ * This includes the service source with MAIN_DISABLED, so that the capture file and the packets are read and written as the service does.
+ * - Each request is sent at the time it arrived, relative to the first request, divided by the speed (0 sends every request as fast as possible).
+ * - The latency is measured from when the request was due, so a service that falls behind is not hidden by the replay waiting on it.
+ * - Names rejected with ERROR_NAME are sent with an invalid character after the captured characters, so that they are rejected again.
+ * - Hashed names are sent as 'h' followed by the hash in hex, so the same name is repeated as often as it was captured.
+ * - Connections that were closed without a response and ticket polls (which have no name) are not replayed.
+ * - Asynchronous requests are replayed as regular requests.
+ *
+ * The latency, throughput, and results of the replay are reported next to those of the capture.
+ * When a results file is given, the replay is written there in the capture format, so that the replays of two builds may be compared with --compare.
+ *
+ * The program expects the following parameters: [capture file] [target] [speed] [results file].
+ * - The [target] is either an address and port (such as 127.0.0.1:5433) or the path of a socket.
+ * - The [speed] is optional and defaults to 1 (real time), such as 10 to replay a 10 minute capture in 1 minute.
+ * - The [results file] is optional.
+ *
+ * Or: --compare [capture or results file] [capture or results file].
+ *
+ * Compiled with:
+ *   gcc -O2 -lpq -lldap -lssl -lpthread autocreate_ldap_accounts_in_postgresql-replay.c -o autocreate_ldap_accounts_in_postgresql-replay
+ *
+ * Copyright Kevin Day, lgpl v2.1 or later.
+ */
+#define MAIN_DISABLED 1
+
+#include "autocreate_ldap_accounts_in_postgresql.c"
+
+#define REPLAY_COMPARE      "--compare"
+#define REPLAY_CONNECTIONS  256    // the requests that may be waiting on the service at the same time.
+#define REPLAY_TIMEOUT      10     // (seconds) a request that is not answered within this is counted as ERROR_TIMEOUT.
+#define REPLAY_LATE         1000   // (microseconds) a request sent later than this after it was due is counted as late.
+#define REPLAY_INVALID      '!'    // appended to the names that were rejected with ERROR_NAME.
+#define REPLAY_STATUS_MAX   256
+
+// a captured request and the result of replaying it.
+typedef struct {
+  capture_record record;
+  char name[PACKET_SIZE_INPUT + 1];
+  int hashed;
+
+  uint32_t latency; // (microseconds) from when the request was due until the response.
+  uint8_t status;   // the response, TRACE_STATUS_NONE when there was none.
+  int late;
+} replay_request;
+
+typedef struct {
+  replay_request *requests;
+  size_t total;
+  int mode;
+} replay_capture;
+
+typedef struct {
+  replay_capture *capture;
+  struct sockaddr_storage address;
+  socklen_t address_length;
+  double speed;
+
+  struct timespec started; // CLOCK_MONOTONIC.
+  int64_t first;           // (microseconds) the arrival of the first request.
+  size_t next;             // the next request to send, taken using __atomic_fetch_add().
+  pthread_t threads[REPLAY_CONNECTIONS];
+} replay_data;
+
+// the summary of a capture or a replay.
+typedef struct {
+  size_t total;
+  size_t late;
+  int64_t first; // (microseconds) the earliest arrival.
+  double seconds;
+  uint32_t percentiles[4]; // 50, 90, 99, and 100 (the maximum).
+  size_t statuses[REPLAY_STATUS_MAX];
+} replay_summary;
+
+/**
+ * Loads a capture file, as written by the service or by a replay.
+ *
+ * @param const char *path
+ *   The path of the capture file.
+ * @param replay_capture *capture
+ *   The loaded capture, the requests are allocated and must be freed.
+ *
+ * @return int
+ *   1 on success and -1 on error.
+ */
+int replay_load(const char *path, replay_capture *capture) {
+  FILE *file = fopen(path, "r");
+  capture_header header;
+  capture_record record;
+  size_t allocated = 0;
+
+  memset(capture, 0, sizeof(replay_capture));
+
+  if (file == NULL) {
+    printf("ERROR: failed to open the capture '%s', error: %i.\n", path, errno);
+    return -1;
+  }
+
+  if (fread(&header, sizeof(capture_header), 1, file) != 1 || memcmp(header.magic, CAPTURE_MAGIC, sizeof(header.magic)) != 0 || header.version != CAPTURE_VERSION) {
+    printf("ERROR: the file '%s' is not a capture of this version.\n", path);
+    fclose(file);
+    return -1;
+  }
+
+  capture->mode = header.mode;
+
+  while (fread(&record, sizeof(capture_record), 1, file) == 1) {
+    replay_request *request = NULL;
+
+    if (capture->total == allocated) {
+      replay_request *requests = NULL;
+
+      allocated = allocated == 0 ? 65536 : allocated * 2;
+      requests = realloc(capture->requests, sizeof(replay_request) * allocated);
+
+      if (requests == NULL) {
+        printf("ERROR: failed to allocate memory for %lu requests.\n", (unsigned long) allocated);
+        fclose(file);
+        return -1;
+      }
+
+      capture->requests = requests;
+    }
+
+    request = &capture->requests[capture->total];
+    memset(request, 0, sizeof(replay_request));
+    memcpy(&request->record, &record, sizeof(capture_record));
+
+    if (record.name_length > PACKET_SIZE_INPUT || (record.name_length > 0 && fread(request->name, record.name_length, 1, file) != 1)) {
+      printf("WARNING: the capture '%s' ends with an incomplete request, which is ignored.\n", path);
+      break;
+    }
+
+    request->hashed = capture->mode == CAPTURE_HASHES && record.name_length == CAPTURE_HASH_LENGTH;
+
+    if (request->hashed) {
+      uint32_t hash = 0;
+
+      memcpy(&hash, request->name, CAPTURE_HASH_LENGTH);
+      snprintf(request->name, PACKET_SIZE_INPUT + 1, "h%08x", hash);
+    }
+    else {
+      request->name[record.name_length] = 0;
+    }
+
+    // until replayed, the result is the one captured.
+    request->latency = record.latency;
+    request->status = record.status;
+
+    capture->total++;
+  } // while
+
+  fclose(file);
+
+  return 1;
+}
+
+/**
+ * Gets whether a captured request is replayed.
+ *
+ * @param const replay_request *request
+ *   The captured request.
+ *
+ * @return int
+ *   1 when the request is replayed and 0 when it is not.
+ */
+int replay_wanted(const replay_request *request) {
+  if (request->record.status == TRACE_STATUS_NONE) {
+    return 0;
+  }
+
+  return request->name[0] != 0 || request->record.status == (uint8_t) ERROR_NAME[0];
+}
+
+/**
+ * Sends a single request and waits for the response.
+ *
+ * @param replay_data *replay
+ *   The replay settings.
+ * @param replay_request *request
+ *   The request to send, the status is updated.
+ */
+void replay_send(replay_data *replay, replay_request *request) {
+  char packet[PACKET_SIZE_INPUT];
+  char response[PACKET_SIZE_OUTPUT + PACKET_TICKET_LENGTH];
+  struct timeval timeout;
+  int length = strnlen(request->name, PACKET_SIZE_INPUT - 2);
+  int socket_id = socket(replay->address.ss_family, SOCK_STREAM, 0);
+  ssize_t received = 0;
+  int offset = 0;
+
+  request->status = (uint8_t) ERROR_CLOSE[0];
+
+  if (socket_id < 0) {
+    return;
+  }
+
+  memset(&timeout, 0, sizeof(struct timeval));
+  timeout.tv_sec = REPLAY_TIMEOUT;
+  setsockopt(socket_id, SOL_SOCKET, SO_RCVTIMEO, (char *) &timeout, sizeof(timeout));
+  setsockopt(socket_id, SOL_SOCKET, SO_SNDTIMEO, (char *) &timeout, sizeof(timeout));
+
+  if (connect(socket_id, (struct sockaddr *) &replay->address, replay->address_length) < 0) {
+    close(socket_id);
+    return;
+  }
+
+  memset(packet, 0, PACKET_SIZE_INPUT);
+
+  if (request->record.priority == PRIORITY_BULK) {
+    packet[0] = PACKET_HEADER | PACKET_FLAG_BULK;
+    offset = 1;
+  }
+
+  memcpy(packet + offset, request->name, length);
+
+  if (request->record.status == (uint8_t) ERROR_NAME[0]) {
+    packet[offset + length] = REPLAY_INVALID;
+  }
+
+  if (send(socket_id, packet, PACKET_SIZE_INPUT, FLAGS_SEND) != PACKET_SIZE_INPUT) {
+    close(socket_id);
+    return;
+  }
+
+  received = recv(socket_id, response, sizeof(response), FLAGS_RECEIVE);
+
+  if (received > 0) {
+    request->status = (uint8_t) response[0];
+  }
+  else if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+    request->status = (uint8_t) ERROR_TIMEOUT[0];
+  }
+
+  close(socket_id);
+}
+
+/**
+ * Sends the captured requests, each at the time it is due.
+ *
+ * This is called by pthread_create(), REPLAY_CONNECTIONS times.
+ *
+ * @param void *argument
+ *   The replay_data.
+ *
+ * @return void *
+ *   NULL is always returned.
+ */
+void *handler_replay(void *argument) {
+  replay_data *replay = (replay_data *) argument;
+
+  for (;;) {
+    size_t index = __atomic_fetch_add(&replay->next, 1, __ATOMIC_RELAXED);
+    replay_request *request = NULL;
+    struct timespec due;
+    struct timespec now;
+    int64_t offset = 0;
+
+    if (index >= replay->capture->total) {
+      break;
+    }
+
+    request = &replay->capture->requests[index];
+
+    if (!replay_wanted(request)) {
+      continue;
+    }
+
+    due = replay->started;
+
+    if (replay->speed > 0) {
+      offset = (int64_t) ((request->record.accepted - replay->first) / replay->speed);
+      due.tv_sec += offset / 1000000;
+      due.tv_nsec += (offset % 1000000) * 1000;
+
+      if (due.tv_nsec >= 1000000000) {
+        due.tv_sec++;
+        due.tv_nsec -= 1000000000;
+      }
+
+      while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL) == EINTR) {
+      } // while
+    }
+    else {
+      clock_gettime(CLOCK_MONOTONIC, &due);
+      offset = ((due.tv_sec - replay->started.tv_sec) * 1000000) + ((due.tv_nsec - replay->started.tv_nsec) / 1000);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    request->late = ((now.tv_sec - due.tv_sec) * 1000000) + ((now.tv_nsec - due.tv_nsec) / 1000) > REPLAY_LATE;
+
+    replay_send(replay, request);
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    request->latency = ((now.tv_sec - due.tv_sec) * 1000000) + ((now.tv_nsec - due.tv_nsec) / 1000);
+
+    // the replay is written in the capture format, using the times it was sent at.
+    request->record.accepted = replay->first + offset;
+  } // for
+
+  return NULL;
+}
+
+/**
+ * Compares two latencies for qsort().
+ *
+ * @param const void *a
+ *   The first latency.
+ * @param const void *b
+ *   The second latency.
+ *
+ * @return int
+ *   Less than, equal to, or greater than 0 as the first is less than, equal to, or greater than the second.
+ */
+int replay_compare_latency(const void *a, const void *b) {
+  const uint32_t first = *((const uint32_t *) a);
+  const uint32_t second = *((const uint32_t *) b);
+
+  return first < second ? -1 : (first > second ? 1 : 0);
+}
+
+/**
+ * Compares two requests by their arrival for qsort().
+ *
+ * @param const void *a
+ *   The first request.
+ * @param const void *b
+ *   The second request.
+ *
+ * @return int
+ *   Less than, equal to, or greater than 0 as the first arrived before, with, or after the second.
+ */
+int replay_compare_accepted(const void *a, const void *b) {
+  const int64_t first = ((const replay_request *) a)->record.accepted;
+  const int64_t second = ((const replay_request *) b)->record.accepted;
+
+  return first < second ? -1 : (first > second ? 1 : 0);
+}
+
+/**
+ * Summarizes the replayed requests of a capture.
+ *
+ * @param const replay_capture *capture
+ *   The capture.
+ * @param replay_summary *summary
+ *   The summary, this value will be updated.
+ *
+ * @return int
+ *   1 on success and -1 on error.
+ */
+int replay_summarize(const replay_capture *capture, replay_summary *summary) {
+  uint32_t *latencies = NULL;
+  int64_t first = 0;
+  int64_t last = 0;
+  size_t i = 0;
+
+  memset(summary, 0, sizeof(replay_summary));
+
+  latencies = malloc(sizeof(uint32_t) * (capture->total + 1));
+
+  if (latencies == NULL) {
+    printf("ERROR: failed to allocate memory for %lu latencies.\n", (unsigned long) capture->total);
+    return -1;
+  }
+
+  for (; i < capture->total; i++) {
+    const replay_request *request = &capture->requests[i];
+
+    if (!replay_wanted(request)) {
+      continue;
+    }
+
+    if (summary->total == 0 || request->record.accepted < first) {
+      first = request->record.accepted;
+    }
+
+    if (request->record.accepted + request->latency > last) {
+      last = request->record.accepted + request->latency;
+    }
+
+    latencies[summary->total] = request->latency;
+    summary->statuses[request->status]++;
+    summary->late += request->late;
+    summary->total++;
+  } // for
+
+  if (summary->total > 0) {
+    qsort(latencies, summary->total, sizeof(uint32_t), replay_compare_latency);
+
+    summary->percentiles[0] = latencies[(summary->total - 1) * 50 / 100];
+    summary->percentiles[1] = latencies[(summary->total - 1) * 90 / 100];
+    summary->percentiles[2] = latencies[(summary->total - 1) * 99 / 100];
+    summary->percentiles[3] = latencies[summary->total - 1];
+    summary->first = first;
+    summary->seconds = (last - first) / 1000000.0;
+  }
+
+  free(latencies);
+
+  return 1;
+}
+
+/**
+ * Prints two summaries next to each other, with the difference of the second from the first.
+ *
+ * @param const char *name_first
+ *   The name of the first summary.
+ * @param const replay_summary *first
+ *   The first summary.
+ * @param const char *name_second
+ *   The name of the second summary.
+ * @param const replay_summary *second
+ *   The second summary.
+ */
+void replay_report(const char *name_first, const replay_summary *first, const char *name_second, const replay_summary *second) {
+  const char *names[4] = { "p50", "p90", "p99", "max" };
+  double rates[2] = { 0, 0 };
+  int i = 0;
+
+  if (first->seconds > 0) {
+    rates[0] = first->total / first->seconds;
+  }
+
+  if (second->seconds > 0) {
+    rates[1] = second->total / second->seconds;
+  }
+
+  printf("%-24s %16s %16s %12s\n", "", name_first, name_second, "difference");
+  printf("%-24s %16lu %16lu %+12ld\n", "requests", (unsigned long) first->total, (unsigned long) second->total, (long) second->total - (long) first->total);
+  printf("%-24s %16.3f %16.3f %+12.3f\n", "seconds", first->seconds, second->seconds, second->seconds - first->seconds);
+  printf("%-24s %16.1f %16.1f %+11.1f%%\n", "requests per second", rates[0], rates[1], rates[0] > 0 ? ((rates[1] - rates[0]) * 100 / rates[0]) : 0);
+
+  for (; i < 4; i++) {
+    char label[32];
+
+    snprintf(label, sizeof(label), "%s (microseconds)", names[i]);
+    printf("%-24s %16u %16u %+11.1f%%\n", label, first->percentiles[i], second->percentiles[i], first->percentiles[i] > 0 ? ((((double) second->percentiles[i]) - first->percentiles[i]) * 100 / first->percentiles[i]) : 0);
+  } // for
+
+  printf("%-24s %16lu %16lu\n", "sent late", (unsigned long) first->late, (unsigned long) second->late);
+
+  for (i = 0; i < REPLAY_STATUS_MAX; i++) {
+    char label[32];
+
+    if (first->statuses[i] == 0 && second->statuses[i] == 0) {
+      continue;
+    }
+
+    snprintf(label, sizeof(label), "status 0x%02x", i);
+    printf("%-24s %16lu %16lu %+12ld\n", label, (unsigned long) first->statuses[i], (unsigned long) second->statuses[i], (long) second->statuses[i] - (long) first->statuses[i]);
+  } // for
+}
+
+/**
+ * Writes the replayed requests to a results file, in the capture format.
+ *
+ * @param const char *path
+ *   The path of the results file.
+ * @param const replay_capture *capture
+ *   The replayed capture.
+ *
+ * @return int
+ *   1 on success and -1 on error.
+ */
+int replay_write(const char *path, const replay_capture *capture) {
+  FILE *file = fopen(path, "w");
+  capture_header header;
+  size_t i = 0;
+
+  if (file == NULL) {
+    printf("ERROR: failed to create the results '%s', error: %i.\n", path, errno);
+    return -1;
+  }
+
+  memset(&header, 0, sizeof(capture_header));
+  memcpy(header.magic, CAPTURE_MAGIC, sizeof(header.magic));
+  header.version = CAPTURE_VERSION;
+  header.mode = CAPTURE_NAMES;
+
+  fwrite(&header, sizeof(capture_header), 1, file);
+
+  for (; i < capture->total; i++) {
+    const replay_request *request = &capture->requests[i];
+    capture_record record;
+
+    if (!replay_wanted(request)) {
+      continue;
+    }
+
+    memcpy(&record, &request->record, sizeof(capture_record));
+    record.latency = request->latency;
+    record.status = request->status;
+    record.name_length = strnlen(request->name, PACKET_SIZE_INPUT);
+
+    fwrite(&record, sizeof(capture_record), 1, file);
+    fwrite(request->name, record.name_length, 1, file);
+  } // for
+
+  if (fclose(file) != 0) {
+    printf("ERROR: failed to write the results '%s', error: %i.\n", path, errno);
+    return -1;
+  }
+
+  return 1;
+}
+
+/**
+ * Resolves the target of the replay.
+ *
+ * @param const char *target
+ *   Either an address and port (such as 127.0.0.1:5433) or the path of a socket.
+ * @param replay_data *replay
+ *   The replay, the address is updated.
+ *
+ * @return int
+ *   1 on success and -1 on error.
+ */
+int replay_target(const char *target, replay_data *replay) {
+  if (target[0] == '/') {
+    struct sockaddr_un *address = (struct sockaddr_un *) &replay->address;
+
+    if (strlen(target) >= sizeof(address->sun_path)) {
+      printf("ERROR: the socket path '%s' is too long.\n", target);
+      return -1;
+    }
+
+    address->sun_family = AF_UNIX;
+    strcpy(address->sun_path, target);
+    replay->address_length = sizeof(struct sockaddr_un);
+  }
+  else {
+    struct sockaddr_in *address = (struct sockaddr_in *) &replay->address;
+    char host[INET_ADDRSTRLEN];
+    const char *separator = strrchr(target, ':');
+    long port = 0;
+
+    if (separator == NULL || separator - target >= INET_ADDRSTRLEN) {
+      printf("ERROR: the target '%s' must be an address and port, such as 127.0.0.1:5433, or the path of a socket.\n", target);
+      return -1;
+    }
+
+    memcpy(host, target, separator - target);
+    host[separator - target] = 0;
+    port = strtol(separator + 1, NULL, 10);
+
+    if (port < 1 || port > 65535 || inet_pton(AF_INET, host, &address->sin_addr) != 1) {
+      printf("ERROR: the target '%s' must be an address and port, such as 127.0.0.1:5433, or the path of a socket.\n", target);
+      return -1;
+    }
+
+    address->sin_family = AF_INET;
+    address->sin_port = htons(port);
+    replay->address_length = sizeof(struct sockaddr_in);
+  }
+
+  return 1;
+}
+
+/**
+ * Main Function
+ *
+ * @param int argc
+ *   Total of command line arguments.
+ * @param char *argv[]
+ *   Array of command line argument strings.
+ *
+ * @return int
+ *   The return status of the program.
+ */
+int main(int argc, char *argv[]) {
+  replay_capture capture;
+  replay_summary summaries[2];
+  replay_data *replay = NULL;
+  int i = 0;
+
+  if (argc == 4 && strcmp(argv[1], REPLAY_COMPARE) == 0) {
+    replay_capture second;
+
+    if (replay_load(argv[2], &capture) < 0 || replay_load(argv[3], &second) < 0 || replay_summarize(&capture, &summaries[0]) < 0 || replay_summarize(&second, &summaries[1]) < 0) {
+      return 1;
+    }
+
+    replay_report("first", &summaries[0], "second", &summaries[1]);
+
+    free(capture.requests);
+    free(second.requests);
+
+    return 0;
+  }
+
+  if (argc < 3 || argc > 5) {
+    printf("Usage: %s [capture file] [target] [speed] [results file]\n", argv[0]);
+    printf("   or: %s %s [capture or results file] [capture or results file]\n", argv[0], REPLAY_COMPARE);
+    printf("\n");
+    printf("  [ target ]        An address and port (such as 127.0.0.1:5433) or the path of a socket.\n");
+    printf("  [ speed ]         How many times faster than captured to send the requests, 0 for as fast as possible (default: 1).\n");
+    printf("  [ results file ]  Write the replay in the capture format, to compare with the replay of another build.\n");
+    return 1;
+  }
+
+  replay = calloc(1, sizeof(replay_data));
+
+  if (replay == NULL) {
+    printf("ERROR: failed to allocate memory for the replay.\n");
+    return 1;
+  }
+
+  replay->speed = 1;
+
+  if (argc > 3) {
+    char *end = NULL;
+
+    replay->speed = strtod(argv[3], &end);
+
+    if (*end != 0 || replay->speed < 0) {
+      printf("ERROR: the speed '%s' must be a number, 0 or greater.\n", argv[3]);
+      free(replay);
+      return 1;
+    }
+  }
+
+  if (replay_target(argv[2], replay) < 0 || replay_load(argv[1], &capture) < 0 || replay_summarize(&capture, &summaries[0]) < 0) {
+    free(replay);
+    return 1;
+  }
+
+  if (summaries[0].total == 0) {
+    printf("ERROR: the capture '%s' has no requests to replay.\n", argv[1]);
+    free(capture.requests);
+    free(replay);
+    return 1;
+  }
+
+  // the service captures a request when it finishes, so the requests are sorted into the order they arrived before they are sent.
+  qsort(capture.requests, capture.total, sizeof(replay_request), replay_compare_accepted);
+
+  replay->capture = &capture;
+  replay->first = summaries[0].first;
+
+  signal(SIGPIPE, SIG_IGN);
+  clock_gettime(CLOCK_MONOTONIC, &replay->started);
+
+  for (i = 0; i < REPLAY_CONNECTIONS; i++) {
+    int created = pthread_create(&replay->threads[i], NULL, handler_replay, replay);
+
+    if (created != 0) {
+      printf("ERROR: failed to create the replay thread, error: %i.\n", created);
+      break;
+    }
+  } // for
+
+  while (--i >= 0) {
+    pthread_join(replay->threads[i], NULL);
+  } // while
+
+  replay_summarize(&capture, &summaries[1]);
+  replay_report("captured", &summaries[0], "replayed", &summaries[1]);
+
+  if (argc > 4 && replay_write(argv[4], &capture) < 0) {
+    free(capture.requests);
+    free(replay);
+    return 1;
+  }
+
+  free(capture.requests);
+  free(replay);
+
+  return 0;
+}
@@ -2,11 +2,16 @@
  * Helper program for auto-creating ldap accounts.
  *
  * This was written originally using sockets, but it makes more sense to run this on the database server (for security reasons).
- * - The original socket code is left alone, but is not used.
  * - The socket code is designed to run on the same system as the PHP client making the requests.
  * - The network code allows for the PHP client to connect to this via an ip address and port number.
+ * - Either one or both may be listened on at the same time, as selected by the ENVIRONMENT_LISTEN environment variable.
+ * - Socket clients may be restricted to a given uid and/or gid using the SO_PEERCRED credentials of the connection.
+ *
+ * When ENVIRONMENT_MIRROR is enabled, the ldap names are kept in a local mirror that is updated by an ldap persistent search.
+ * - Requests are then answered from the mirror instead of querying ldap, falling back to ldap while the mirror is not synced.
  *
  * The program expects the following parameters: [user_name] [group_name] [database_name] [listen_port].
+ * - The [listen_port] is optional when only the socket is listened on.
  *
  * The system will listen on the socket waiting on a valid username to create.
  * This only accept usernames with alphanumeric, '-', or '_' in their name.
@@ -15,11 +20,32 @@
  *
  * A packet size of PACKET_SIZE_INPUT is defined to ensure that the string is operated on only after all data is received.
  * - A NULL byte before the PACKET_SIZE_INPUT is reached will also terminate the packet.
+ * - An optional first byte with PACKET_HEADER set holds the PACKET_FLAG_* flags, such as marking the request as bulk provisioning.
+ * - With PACKET_FLAG_DEADLINE, the next two bytes are the time budget of the client, and work is dropped with ERROR_TIMEOUT once it has passed.
+ * - With PACKET_FLAG_ASYNC, the request is answered as soon as it is queued with a ticket, which is later polled using PACKET_FLAG_TICKET.
+ * - With PACKET_FLAG_PING, no name is sent and the health of the service is answered at once from the state kept by the background probes.
+ * - With PACKET_FLAG_KEEP, the connection is kept open after the response for the next request, instead of being closed.
+ *
+ * When ENVIRONMENT_TABLE is enabled, the names known to be provisioned are published to a shared memory table at PATH_TABLE.
+ * - Clients on the same host may look a name up in the table themselves and only send a request when it is not found.
+ *
+ * The listeners only accept and read the packets, the names are then processed by a pool of worker threads.
+ * - Interactive requests are always dispatched first, with a minimum share for bulk requests so that they are not starved.
+ * - The connections kept open by the clients wait in epoll for their next request, which is read by a single keepalive thread.
+ * - Each kept connection only takes a small slot in a slab (see keepalive_connection), so that a very large number of idle connections may be kept.
+ *
+ * When ENVIRONMENT_CONTROL is enabled, an admin may change the workers, ldap spares, and cache at runtime via a unix socket at PATH_CONTROL.
+ * - Only root and the user the service runs as are accepted, using the SO_PEERCRED credentials of the connection.
+ *
+ * When ENVIRONMENT_CAPTURE is enabled, the arrival, name (or a hash of it), and result of every request is written to a binary log at PATH_CAPTURE.
+ * - The capture may be replayed against a test service using autocreate_ldap_accounts_in_postgresql-replay.c.
  *
  * @todo: review this functionality "http://www.postgresql.org/docs/current/static/libpq-notice-processing.html".
  *
  * Compiled with:
- *   gcc  -lpq -lldap autocreate_ldap_accounts_in_postgresql.c -o autocreate_ldap_accounts_in_postgresql
+ *   gcc  -lpq -lldap -lssl -lpthread autocreate_ldap_accounts_in_postgresql.c -o autocreate_ldap_accounts_in_postgresql
+ *
+ * The microbenchmarks of the request hot paths are compiled from autocreate_ldap_accounts_in_postgresql-benchmark.c, which includes this file with MAIN_DISABLED.
  *
  * Role created with:
  *   create role create_ldap_users createrole;
@@ -39,11 +65,13 @@
 #include <errno.h>
 #include <string.h>
 #include <signal.h>
-#include <sched.h>
+#include <pthread.h>
 #include <netdb.h>
 #include <limits.h>
 #include <syslog.h>
 #include <time.h>
+#include <stdint.h>
+#include <fcntl.h>
 
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -52,19 +80,56 @@
 #include <sys/signalfd.h>
 #include <sys/syscall.h>
 #include <sys/wait.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <poll.h>
 
 #include <netinet/in.h>
+#include <arpa/inet.h>
 
 #include <ldap.h>
 #include <libpq-fe.h>
+#include <openssl/ssl.h>
 
-// select either socket or network method.
-//#define USE_SOCKET     1
-#define USE_NETWORK    1
 //#define DEBUG_ENABLED  1
 
+// use io_uring for accept(), recv(), and send() when the running kernel supports it (falling back to blocking calls when it does not).
+//#define USE_IO_URING   1
+
+#ifdef USE_IO_URING
+  #include <linux/io_uring.h>
+  #include <sys/eventfd.h>
+#endif // USE_IO_URING
+
+// count the heap allocations made by each thread, reported with the statistics (see SIGNAL_STATISTICS), this replaces malloc(), calloc(), and realloc() for the whole process.
+//#define USE_ALLOCATION_COUNTERS  1
+
+// add USDT probes at each stage of a request for bpftrace and perf, this requires sys/sdt.h (such as from systemtap-sdt-dev).
+//#define USE_USDT_PROBES  1
+
+// each probe is a single nop instruction when no tracer is attached, and nothing at all when USE_USDT_PROBES is not defined.
+#ifdef USE_USDT_PROBES
+  #include <sys/sdt.h>
+
+  #define MACRO_PROBE_1(name, a)           DTRACE_PROBE1(alap, name, a)
+  #define MACRO_PROBE_2(name, a, b)        DTRACE_PROBE2(alap, name, a, b)
+  #define MACRO_PROBE_3(name, a, b, c)     DTRACE_PROBE3(alap, name, a, b, c)
+#else
+  #define MACRO_PROBE_1(name, a)
+  #define MACRO_PROBE_2(name, a, b)
+  #define MACRO_PROBE_3(name, a, b, c)
+#endif // USE_USDT_PROBES
+
 #define LOG_ID    "autocreate_ldap_accounts_in_postgresql: "
+#define LOG_LENGTH 2048 // longer messages are truncated.
 #define PATH_PID  "/var/run/autocreate_ldap_accounts_in_postgresql/%s.pid"
+#define PATH_CACHE "/var/cache/autocreate_ldap_accounts_in_postgresql/%s.cache"
+#define PATH_TRACE "/var/run/autocreate_ldap_accounts_in_postgresql/%s.trace"
+#define PATH_TABLE "/dev/shm/autocreate_ldap_accounts_in_postgresql/%s.table"
+#define PATH_CONTROL "/var/run/autocreate_ldap_accounts_in_postgresql/%s.control"
+#define PATH_CAPTURE "/var/cache/autocreate_ldap_accounts_in_postgresql/%s.capture"
 
 // by granting a postgresql user the same access as a specified role, one can easily manage access by only setting permissions on the role.
 // for consistency purposes, I suggest individual users have something like 'fcs_user' while the role/group should be something like 'fcs_users'.
@@ -76,28 +141,221 @@
 #define PSQL_CREATE_LENGTH      32
 #define PSQL_GRANT              "grant %s to %s;"
 #define PSQL_GRANT_LENGTH       11
+#define PSQL_SELECT_ROLES       "select rolname from pg_roles;"
+#define PSQL_SELECT_MEMBERS     "select r.rolname from pg_auth_members m inner join pg_roles r on r.oid = m.member inner join pg_roles g on g.oid = m.roleid where g.rolname = '%s';"
 //#define PSQL_CONNECTION         "host=127.0.0.1 port=5433 dbname=%s connect_timeout=2 sslmode=require user= password="
 #define PSQL_CONNECTION         "port=5433 dbname=%s connect_timeout=2 sslmode=disable user=%s password=%s"
 #define PSQL_CONNECTION_LENGTH  73
 
+#define PSQL_QUERY_LENGTH  (PSQL_SELECT_LENGTH + PSQL_GRANT_LENGTH + PARAMETER_LENGTH_MAX + PACKET_SIZE_INPUT + 1) // large enough for any of the request queries.
+
 #define PARAMETER_LENGTH_MAX 96
 
-#define LDAP_SERVER            "ldaps://ldap.example.com:1636"
-#define LDAP_SEARCH_DN         "uid=%s,ou=users,ou=People"
+#define LDAP_SERVER            "ldaps://ldap.example.com:1636" // the default when ENVIRONMENT_LDAP_SERVERS is not set.
+#define LDAP_SEARCH_BASE       "ou=users,ou=People"
+#define LDAP_SEARCH_DN         "uid=%s," LDAP_SEARCH_BASE
 #define LDAP_SEARCH_DN_LENGTH  47
+#define LDAP_SEARCH_FILTER     "(uid=*)"
+#define LDAP_SEARCH_ATTRIBUTE  "uid"
+
+#define LDAP_PAGE_SIZE     500
+#define LDAP_PAGE_TIMEOUT  30 // (seconds) for each page.
 
-#define LDAP_RETRY_BIND_RETRY      4
-#define LDAP_RETRY_BIND_TIMEOUT    200000 // (microseconds) 0.2 second timeout.
 #define LDAP_RETRY_SEARCH_RETRY    4
 #define LDAP_RETRY_SEARCH_TIMEOUT  200000 // (microseconds) 0.2 second timeout.
+#define LDAP_RETRY_BACKOFF         5000   // (microseconds) the wait before the first retry, doubled for each retry (see backoff_jitter()).
+
+#define LDAP_POOL_SERVERS_MAX     8
+#define LDAP_POOL_LIST_LENGTH     1024  // the maximum length of the ENVIRONMENT_LDAP_SERVERS list.
+#define LDAP_POOL_SAMPLES         64    // the recent latencies kept for each server, used for the hedge delay percentile.
+#define LDAP_POOL_EXPLORE         32    // every this many selections, the next server is chosen in turn so that every latency stays current.
+
+#define LDAP_POOL_HEDGE_ENABLED        "yes"
+#define LDAP_POOL_HEDGE_PERCENTILE     95
+#define LDAP_POOL_HEDGE_DELAY_DEFAULT  50000 // (microseconds) used until a server has LDAP_POOL_SAMPLES latencies.
+#define LDAP_POOL_HEDGE_DELAY_MINIMUM  1000  // (microseconds) never hedge sooner than this.
+
+#define LDAP_POOL_SPARES       2         // the spare connections kept bound ahead of time for each server.
+#define LDAP_POOL_SPARES_MAX   16
+#define LDAP_POOL_SPARE_AGE    60        // (seconds) a spare older than this is replaced, so that it is not closed by the idle timeout of the server.
+#define LDAP_POOL_TLS_PACKAGE  "OpenSSL" // tls session resumption requires libldap to be built with this tls package.
+
+#define BREAKER_CLOSED       0
+#define BREAKER_OPEN         1
+#define BREAKER_FAILURES     3     // consecutive failures that open the circuit.
+#define BREAKER_BACKOFF      1000  // (milliseconds) the wait before the first probe, doubled for each failed probe (see backoff_jitter()).
+#define BREAKER_BACKOFF_MAX  60000 // (milliseconds)
+#define BREAKER_PROBE_POLL   100000 // (microseconds) how often the breaker thread checks for circuits due to be probed.
 
 #define PACKET_SIZE_INPUT   63
 #define PACKET_SIZE_OUTPUT  1
 
+#define PACKET_HEADER         0x80 // an optional first byte, which cannot be part of a name, holding the PACKET_FLAG_* flags.
+#define PACKET_FLAG_BULK      0x01 // the request is bulk (background) provisioning instead of an interactive login.
+#define PACKET_FLAG_DEADLINE  0x02 // the header is followed by the time budget of the client, in milliseconds after the connection, as a 16-bit big endian integer.
+
+#define PACKET_FLAG_ASYNC     0x04 // respond as soon as the request is queued, with ERROR_NONE followed by a ticket for polling the result.
+#define PACKET_FLAG_TICKET    0x08 // the header is followed by a ticket (after any time budget), respond with the result of that asynchronous request.
+#define PACKET_FLAG_PING      0x10 // no name follows, respond at once with the health of the service followed by HEALTH_LENGTH bytes of HEALTH_FLAG_* flags.
+#define PACKET_FLAG_KEEP      0x20 // keep the connection open after the response for the next request, the packet is then always PACKET_SIZE_INPUT bytes (padded with NULL bytes).
+
+#define PACKET_DEADLINE_LENGTH  2
+#define PACKET_TICKET_LENGTH    4 // a 32-bit big endian integer, 0 is never a valid ticket.
+
+#define DEADLINE_DISPATCH  0 // the deadline passed while the request waited for a worker.
+#define DEADLINE_LDAP      1 // the deadline passed before or between the ldap searches.
+#define DEADLINE_DATABASE  2 // the deadline passed before the database was changed.
+#define DEADLINE_TOTAL     3
+
+#define PRIORITY_INTERACTIVE  0
+#define PRIORITY_BULK         1
+#define PRIORITY_TOTAL        2
+
+#define SCHEDULER_WORKERS        4   // the default number of worker threads that process requests.
+#define SCHEDULER_WORKERS_MAX    64
+#define SCHEDULER_REQUESTS       256 // the requests waiting for or being processed by a worker, beyond this new requests are closed with ERROR_CLOSE.
+#define SCHEDULER_BULK_SHARE     10  // (percent) the default minimum share of the dispatches given to waiting bulk requests.
+#define SCHEDULER_BULK_RESERVED  1   // the workers that bulk requests may not occupy, so that an interactive request does not wait behind bulk requests.
+
+#define SCHEDULER_FAIR_DISABLED   "no"
+#define SCHEDULER_FLOWS           64   // must be a power of 2, the clients are hashed into this many flows in each class (clients sharing a flow share its turns).
+#define SCHEDULER_WEIGHTS_MAX     32   // the clients that may be given a weight in ENVIRONMENT_FAIR_WEIGHTS.
+#define SCHEDULER_WEIGHTS_LENGTH  1024 // the maximum length of the ENVIRONMENT_FAIR_WEIGHTS list.
+#define SCHEDULER_WEIGHT_MAX      100
+
+#define LIMITER_INITIAL        4     // the requests that may change the database at the same time, before any latency is known.
+#define LIMITER_MINIMUM        1
+#define LIMITER_MAXIMUM        SCHEDULER_WORKERS_MAX
+#define LIMITER_BACKOFF        75    // (percent) the limit is reduced to this on an error or contention.
+#define LIMITER_TOLERANCE      2     // a latency above this multiple of the baseline is contention.
+#define LIMITER_WINDOW         64    // the successful requests after which the baseline is replaced by the lowest latency among them.
+#define LIMITER_LATENCY_FLOOR  2000  // (microseconds) a latency below this is never contention, so that the jitter of a fast database is ignored.
+
+#define TICKET_SLOTS    1024 // must be a power of 2, the results of this many of the most recent asynchronous requests may be polled.
+#define TICKET_WAITERS  64   // the polls that may wait for a result at the same time, further polls are answered with ERROR_PENDING at once.
+
+#define NAME_SET_SLOTS_MINIMUM   1024
+#define NAME_SET_STRING_AVERAGE  12 // expected average bytes per name, including the length prefix.
+#define NAME_SET_LENGTH_MAX      PACKET_SIZE_INPUT
+
+#define MIRROR_ENABLED          "yes"
+#define MIRROR_NAMES_EXPECTED   65536
+#define MIRROR_CHANGE_TYPES     15    // add, delete, modify, and modDN.
+#define MIRROR_WAIT_TIMEOUT     60    // (seconds) maximum wait for a change before checking MIRROR_RELOAD_INTERVAL.
+#define MIRROR_RELOAD_INTERVAL  3600  // (seconds) the mirror is fully reloaded this often to correct any drift.
+#define MIRROR_RETRY_DELAY      5     // (seconds) wait before reconnecting after a failure.
+
+// these are defined by openldap, but are provided here in case the ldap.h in use does not.
+#ifndef LDAP_CONTROL_PERSIST_REQUEST
+  #define LDAP_CONTROL_PERSIST_REQUEST              "2.16.840.1.113730.3.4.3"
+  #define LDAP_CONTROL_PERSIST_ENTRY_CHANGE_NOTICE  "2.16.840.1.113730.3.4.7"
+  #define LDAP_CONTROL_PERSIST_ENTRY_CHANGE_ADD     0x1
+  #define LDAP_CONTROL_PERSIST_ENTRY_CHANGE_DELETE  0x2
+  #define LDAP_CONTROL_PERSIST_ENTRY_CHANGE_MODIFY  0x4
+  #define LDAP_CONTROL_PERSIST_ENTRY_CHANGE_RENAME  0x8
+#endif // LDAP_CONTROL_PERSIST_REQUEST
+
+#define CACHE_SLOTS      16384 // must be a power of 2, at most half of the slots are used.
+#define CACHE_TTL        600   // (seconds) default time a name is cached, 0 to disable the cache.
+#define CACHE_COHERENCE  30    // (seconds) default time between group membership snapshots, 0 to disable.
+
+#define CACHE_SNAPSHOT            300        // (seconds) default time between writing the cache snapshot, 0 to disable.
+#define CACHE_SNAPSHOT_MAGIC      "alapsnap" // exactly 8 characters, the NULL terminator is not written.
+#define CACHE_SNAPSHOT_VERSION    1          // increment whenever cache_entry or cache_snapshot_header changes.
+#define CACHE_SNAPSHOT_TEMPORARY  ".%i.new"  // the thread id is included because both the cache thread and the parent may write.
+#define CACHE_SNAPSHOT_MODE       0600
+
+#define TABLE_ENABLED  "yes"
+#define TABLE_MAGIC    "alaptabl" // exactly 8 characters, the NULL terminator is not written.
+#define TABLE_VERSION  1          // increment whenever table_entry or table_header changes.
+#define TABLE_MODE     0644       // the clients must be able to read the table.
+
+#define CONTROL_ENABLED        "yes"
+#define CONTROL_MODE           0600
+#define CONTROL_LINE_LENGTH    4096   // the longest command, such as a prewarm with many names.
+#define CONTROL_REPLY_LENGTH   1024
+#define CONTROL_TIMEOUT        30     // (seconds) an admin connection that sends nothing for this long is closed.
+#define CONTROL_PREWARM_WAIT   10000  // (microseconds) the wait before queueing a prewarm name again while the queues are too full.
+#define CONTROL_PREWARM_SHARE  2      // a prewarm name is only queued while more than 1/CONTROL_PREWARM_SHARE of the requests are unused, leaving the rest for the clients.
+
+#define HEALTH_INTERVAL  5 // (seconds) default time between the background probes of the ldap servers and the database, 0 to disable.
+#define HEALTH_LENGTH    1 // the bytes of HEALTH_FLAG_* flags that follow the status of a ping response.
+
+#define HEALTH_FLAG_LDAP_SOME  0x01 // some of the ldap servers are failing, the others are used.
+#define HEALTH_FLAG_LDAP       0x02 // every ldap server is failing.
+#define HEALTH_FLAG_DATABASE   0x04 // the database is failing.
+#define HEALTH_FLAG_PAUSED     0x08 // accepting new connections is paused by the control socket.
+#define HEALTH_FLAG_FULL       0x10 // every request is in use, so new requests are rejected with ERROR_CLOSE.
+#define HEALTH_FLAG_UNPROBED   0x20 // the backends have not been probed yet since the service started.
+
+#define KEEPALIVE_CONNECTIONS      131072  // default most connections kept open between requests, 0 to disable.
+#define KEEPALIVE_DESCRIPTORS_MAX  1048576 // the slab is indexed by the socket id, so it is sized to the file descriptor limit, up to this.
+#define KEEPALIVE_PARTIALS         1024    // the packets that may be partially received on the kept connections at the same time.
+#define KEEPALIVE_EVENTS           256     // the epoll events handled for each wait.
+#define KEEPALIVE_IDLE             300     // (seconds) a kept connection without a request for this long is closed.
+#define KEEPALIVE_PARTIAL_TIMEOUT  1       // (seconds) a kept connection that does not finish sending a packet within this is closed.
+#define KEEPALIVE_SWEEP            1       // (seconds) how often the kept connections are checked for the timeouts.
+
+#define KEEPALIVE_STATE_NONE  0 // the socket id is not a kept connection.
+#define KEEPALIVE_STATE_IDLE  1 // waiting in epoll for the next request, owned by the keepalive thread.
+#define KEEPALIVE_STATE_BUSY  2 // a request is being answered, owned by the thread that responds (see keepalive_release()).
+
+#define CAPTURE_NONE         0
+#define CAPTURE_NAMES        1
+#define CAPTURE_HASHES       2
+#define CAPTURE_NAMES_VALUE  "names"
+#define CAPTURE_HASHES_VALUE "hashes"
+#define CAPTURE_MAGIC        "alapcapt" // exactly 8 characters, the NULL terminator is not written.
+#define CAPTURE_VERSION      1          // increment whenever capture_header or capture_record changes.
+#define CAPTURE_MODE         0600
+#define CAPTURE_PREVIOUS     ".previous" // the capture of the previous run is kept once, under this suffix.
+#define CAPTURE_BUFFER       65536      // the records are written to the file once this is full, or after CAPTURE_FLUSH.
+#define CAPTURE_FLUSH        1          // (seconds)
+#define CAPTURE_SIZE_MAX     1073741824 // stop capturing once the file reaches this size.
+#define CAPTURE_HASH_LENGTH  4
+
+#define CACHE_LDAP    0 // the name exists in ldap.
+#define CACHE_MEMBER  1 // the role exists and is a member of the group.
+#define CACHE_TOTAL   2
+
+#define TRACE_SLOTS  512 // the most recent requests kept by the flight recorder of each listener.
+
+#define TRACE_ACCEPT        0
+#define TRACE_PARSE         1
+#define TRACE_DISPATCH      2
+#define TRACE_LDAP_BIND     3
+#define TRACE_LDAP_SEARCH   4
+#define TRACE_SQL_CONNECT   5
+#define TRACE_SQL_SELECT    6
+#define TRACE_SQL_CREATE    7
+#define TRACE_SQL_GRANT     8
+#define TRACE_SEND          9
+#define TRACE_TOTAL         10
+
+#define TRACE_FLAG_MIRROR        0x1 // ldap existence was answered by the mirror.
+#define TRACE_FLAG_CACHE_LDAP    0x2 // ldap existence was answered by the cache.
+#define TRACE_FLAG_CACHE_MEMBER  0x4 // group membership was answered by the cache.
+
+#define TRACE_STATUS_NONE  0xff // no response was sent, such as when the client closed the connection.
+
+#define RECONCILE_PARAMETER        "--reconcile"
+#define RECONCILE_NAMES_EXPECTED   65536
+#define RECONCILE_RATE             200   // names provisioned per second, 0 for no limit.
+#define RECONCILE_BATCH            100   // names provisioned per transaction.
+#define RECONCILE_BATCH_MAX        10000
+
+#define PACKET_PARSE_INVALID  -1
+#define PACKET_PARSE_MORE     0
+#define PACKET_PARSE_DONE     1
+
+#define PACKET_PARSE_PADDING  0x100 // set in the flags by packet_parse() once the name of a PACKET_FLAG_KEEP packet has ended, this is never part of a header.
+
 // if stack size is too small, then on some systems (generally glibc based ones) will segfault/illegal-instruction under certain circumstances.
-// in this case it the circumstance happens with clone(), ldap_initialize(), and glibc.
+// in this case it the circumstance happens with ldap_initialize() and glibc.
+// the thread stack also holds glibc's static thread-local storage, which includes that of the ldap and tls libraries.
 //#define STACK_SIZE 8192
-#define STACK_SIZE 65536
+//#define STACK_SIZE 65536
+#define STACK_SIZE 131072
 
 #define PROTOCOL_NULL    0
 #define PROTOCOL_SOCKET  SOL_SOCKET
@@ -107,27 +365,74 @@
 #define SOCKET_TYPE     SOCK_STREAM
 #define SOCKET_BACKLOG  15
 
-#ifdef USE_NETWORK
-  #define SOCKET_FAMILY    AF_INET // 'family' is also called 'domain' in this case.
-  #define SOCKET_PROTOCOL  PROTOCOL_TCP
-  #define SOCKET_TIMEOUT   160000 // 0.16 seconds.
-#elif defined USE_SOCKET
-  #define SOCKET_FAMILY       AF_UNIX // 'family' is also called 'domain' in this case.
-  #define SOCKET_PATH         "/var/www/sockets/autocreate_ldap_accounts_in_postgresql/%s/%s.socket"
-  #define SOCKET_PATH_LENGTH  64
-  #define SOCKET_PROTOCOL     PROTOCOL_NULL
-  #define SOCKET_PORT         0
-  #define SOCKET_TIMEOUT      10000 // (microseconds) 0.01 seconds.
-#endif // USE_SOCKET
+// both the network and the socket listeners may be used at the same time, selected at runtime via ENVIRONMENT_LISTEN.
+#define LISTENER_NETWORK  0
+#define LISTENER_SOCKET   1
+#define LISTENER_TOTAL    2
+#define LISTENER_CONTROL  LISTENER_TOTAL // only used in the trace, for the requests queued by the control socket.
+
+#define LISTEN_NETWORK  "network"
+#define LISTEN_SOCKET   "socket"
+#define LISTEN_BOTH     "both"
+
+#define SOCKET_FAMILY_NETWORK    AF_INET // 'family' is also called 'domain' in this case.
+#define SOCKET_PROTOCOL_NETWORK  PROTOCOL_TCP
+#define SOCKET_TIMEOUT_NETWORK   160000 // 0.16 seconds.
+
+#define SOCKET_FAMILY_SOCKET       AF_UNIX // 'family' is also called 'domain' in this case.
+#define SOCKET_PATH                "/var/www/sockets/autocreate_ldap_accounts_in_postgresql/%s/%s.socket"
+#define SOCKET_PATH_LENGTH         64
+#define SOCKET_PROTOCOL_SOCKET     PROTOCOL_NULL
+#define SOCKET_TIMEOUT_SOCKET      10000 // (microseconds) 0.01 seconds.
+
+#ifdef USE_IO_URING
+  #define IO_URING_ENTRIES  64
+  #define IO_URING_SLOTS    16 // the number of client connections that may be reading at the same time.
+
+  #define IO_URING_OPERATION_ACCEPT   1
+  #define IO_URING_OPERATION_READ     2
+  #define IO_URING_OPERATION_TIMEOUT  3
+  #define IO_URING_OPERATION_SEND     4
+  #define IO_URING_OPERATION_CLOSE    5
+  #define IO_URING_OPERATION_WAKE     6 // the control thread paused or resumed accepting.
+  #define IO_URING_OPERATION_CANCEL   7
+
+  // the user data is: 8-bit operation, 24-bit slot, and 32-bit socket id.
+  #define IO_URING_USER_DATA(operation, slot, socket_id) ((((__u64) (operation)) << 56) | (((__u64) (slot) & 0xffffff) << 32) | ((__u64) (unsigned) (socket_id)))
+  #define IO_URING_USER_DATA_OPERATION(user_data)          ((int) ((user_data) >> 56))
+  #define IO_URING_USER_DATA_SLOT(user_data)               ((int) (((user_data) >> 32) & 0xffffff))
+#endif // USE_IO_URING
 
 #define FLAGS_RECEIVE  0
 #define FLAGS_SEND     MSG_NOSIGNAL
-#define FLAGS_CLONE    CLONE_FILES | CLONE_FS | CLONE_IO | CLONE_VM | CLONE_SIGHAND | CLONE_THREAD
 
 
 // environment variables used.
 #define ENVIRONMENT_CONNECT_USER      "alap_connect_user"
 #define ENVIRONMENT_CONNECT_PASSWORD  "alap_connect_password"
+#define ENVIRONMENT_LISTEN            "alap_listen"            // one of LISTEN_NETWORK, LISTEN_SOCKET, or LISTEN_BOTH, defaults to LISTEN_NETWORK.
+#define ENVIRONMENT_SOCKET_ALLOW_UID  "alap_socket_allow_uid"  // (optional) only accept socket clients whose SO_PEERCRED uid matches.
+#define ENVIRONMENT_SOCKET_ALLOW_GID  "alap_socket_allow_gid"  // (optional) only accept socket clients whose SO_PEERCRED gid matches.
+#define ENVIRONMENT_MIRROR            "alap_mirror"            // (optional) set to MIRROR_ENABLED to answer ldap existence checks from a live local mirror.
+#define ENVIRONMENT_CACHE_TTL         "alap_cache_ttl"         // (optional) the seconds a name is cached, 0 to disable the cache.
+#define ENVIRONMENT_CACHE_COHERENCE   "alap_cache_coherence"   // (optional) the seconds between group membership snapshots, 0 to disable.
+#define ENVIRONMENT_CACHE_SNAPSHOT    "alap_cache_snapshot"    // (optional) the seconds between writing the cache to PATH_CACHE, 0 to disable.
+#define ENVIRONMENT_TABLE             "alap_table"             // (optional) set to TABLE_ENABLED to publish the provisioned names to PATH_TABLE for the clients.
+#define ENVIRONMENT_CONTROL           "alap_control"           // (optional) set to CONTROL_ENABLED to accept admin commands on PATH_CONTROL.
+#define ENVIRONMENT_CAPTURE           "alap_capture"           // (optional) CAPTURE_NAMES_VALUE or CAPTURE_HASHES_VALUE to write every request to PATH_CAPTURE.
+#define ENVIRONMENT_HEALTH_INTERVAL   "alap_health_interval"   // (optional) the seconds between the background probes of the backends, 0 to disable.
+#define ENVIRONMENT_KEEPALIVE         "alap_keepalive"         // (optional) the most connections kept open between requests (see PACKET_FLAG_KEEP), 0 to disable.
+#define ENVIRONMENT_LDAP_SERVERS      "alap_ldap_servers"      // (optional) space separated ldap server uris, defaults to LDAP_SERVER.
+#define ENVIRONMENT_LDAP_HEDGE        "alap_ldap_hedge"        // (optional) set to LDAP_POOL_HEDGE_ENABLED to send a slow search to a second server.
+#define ENVIRONMENT_LDAP_PERCENTILE   "alap_ldap_hedge_percentile" // (optional) the latency percentile of a server after which a search is hedged.
+#define ENVIRONMENT_LDAP_SPARES       "alap_ldap_spares"       // (optional) the spare connections kept bound ahead of time for each ldap server.
+#define ENVIRONMENT_WORKERS           "alap_workers"           // (optional) the worker threads that process requests.
+#define ENVIRONMENT_BULK_LISTENER     "alap_bulk_listener"     // (optional) LISTEN_NETWORK or LISTEN_SOCKET, requests accepted on that listener are bulk.
+#define ENVIRONMENT_BULK_SHARE        "alap_bulk_share"        // (optional) the minimum percent of the dispatches given to waiting bulk requests.
+#define ENVIRONMENT_FAIR              "alap_fair"              // (optional) set to SCHEDULER_FAIR_DISABLED to not take turns between the network client addresses within each class.
+#define ENVIRONMENT_FAIR_WEIGHTS      "alap_fair_weights"      // (optional) space separated address=weight pairs, the requests dispatched per turn for that client.
+#define ENVIRONMENT_RECONCILE_RATE    "alap_reconcile_rate"    // (optional) the RECONCILE_PARAMETER names provisioned per second.
+#define ENVIRONMENT_RECONCILE_BATCH   "alap_reconcile_batch"   // (optional) the RECONCILE_PARAMETER names provisioned per transaction.
 
 #define ENVIRONMENT_MAX_CONNECT_USER      128 // maximum characters to be supported for the connect name.
 #define ENVIRONMENT_MAX_CONNECT_PASSWORD  512 // maximum characters to be supported for the connect password.
@@ -143,124 +448,681 @@
 #define ERROR_READ      "\x06" // error occured while reading input from the user (such as via recv()).
 #define ERROR_WRITE     "\x07" // error occured while writing input from the user (such as via send()).
 #define ERROR_PACKET    "\x08" // the received packet is invalid, such as wrong length.
-#define ERROR_TIMEOUT   "\x09" // connection timed out when reading or writing.
+#define ERROR_TIMEOUT   "\x09" // connection timed out when reading or writing, or the deadline of the request passed.
 #define ERROR_CLOSE     "\x0a" // the connection is being forced closed.
 #define ERROR_QUIT      "\x0b" // the connection is closing because the service is quitting.
+#define ERROR_PENDING   "\x0c" // the asynchronous request of the ticket is still being processed.
+#define ERROR_TICKET    "\x0d" // the ticket is unknown, such as when it is too old or was issued for another name.
+#define ERROR_DEGRADED  "\x0e" // (ping) the service is live and ready, but ldap or the database is failing (see HEALTH_FLAG_*).
+#define ERROR_NOT_READY "\x0f" // (ping) the service is live, but not ready for requests (see HEALTH_FLAG_*).
 
 #define PROBLEM_COUNT_MAX_SIGNAL_SIZE  10
 
-#ifdef USE_NETWORK
-  #define MACRO_EXIT_STANDARD_1(shared, stack, exit_code) \
-    if (shared.socket_id_client > 0) { \
-      send(shared.socket_id_client, ERROR_QUIT, PACKET_SIZE_OUTPUT, FLAGS_SEND); \
-      shutdown(shared.socket_id_client, SHUT_RDWR); \
-    } \
-    \
-    if (shared.socket_id_target > 0) { \
-      shutdown(shared.socket_id_target, SHUT_RDWR); \
-    } \
-    \
-    if (shared.socket_bound > 0) { \
-      shared.socket_bound = 0; \
-    } \
-    \
-    if (stack != NULL) { \
-      free(stack); \
-      stack = NULL; \
-    } \
-    \
-    if (shared.pid_path != NULL) { \
-      unlink(shared.pid_path); \
-      free(shared.pid_path); \
-      shared.pid_path = NULL; \
-    } \
-    \
-    memset(&shared, 0, sizeof(shared_data)); \
-    \
-    return exit_code;
-
-  typedef struct {
-    char parameter_system[PARAMETER_LENGTH_MAX];
-    char parameter_group[PARAMETER_LENGTH_MAX];
-    char parameter_database[PARAMETER_LENGTH_MAX];
-    char parameter_connect_name[ENVIRONMENT_MAX_CONNECT_USER];
-    char parameter_connect_password[ENVIRONMENT_MAX_CONNECT_PASSWORD];
-
-    int socket_id_target;
-    int socket_id_client;
-    int socket_bound;
-
-    int parameter_port;
-
-    pid_t pid_parent;
-    pid_t pid_child;
-    char *pid_path;
-  } shared_data;
-#elif defined USE_SOCKET
-  #define MACRO_EXIT_STANDARD_1(shared, stack, exit_code) \
-    if (shared.socket_id_client > 0) { \
-      send(shared.socket_id_client, ERROR_QUIT, PACKET_SIZE_OUTPUT, FLAGS_SEND); \
-      shutdown(shared.socket_id_client, SHUT_RDWR); \
-    } \
-    \
-    if (shared.socket_id_target > 0) { \
-      shutdown(shared.socket_id_target, SHUT_RDWR); \
-    } \
-    \
-    if (shared.socket_bound > 0) { \
-      shared.socket_bound = 0; \
+#define SIGNAL_STATISTICS  SIGUSR2 // write the statistics counters to the system logger.
+#define SIGNAL_TRACE       SIGUSR1 // write the flight recorder to PATH_TRACE.
+
+#define MACRO_EXIT_STANDARD_1(shared, exit_code) \
+  { \
+    int listener_index = 0; \
+    for (; listener_index < LISTENER_TOTAL; listener_index++) { \
+      if (shared.listeners[listener_index].socket_id_client > 0) { \
+        send(shared.listeners[listener_index].socket_id_client, ERROR_QUIT, PACKET_SIZE_OUTPUT, FLAGS_SEND); \
+        shutdown(shared.listeners[listener_index].socket_id_client, SHUT_RDWR); \
+      } \
+      \
+      if (shared.listeners[listener_index].socket_id_target > 0) { \
+        shutdown(shared.listeners[listener_index].socket_id_target, SHUT_RDWR); \
+      } \
+      \
+      if (shared.listeners[listener_index].socket_bound > 0) { \
+        shared.listeners[listener_index].socket_bound = 0; \
+      } \
     } \
-    \
-    if (stack != NULL) { \
-      free(stack); \
-      stack = NULL; \
-    } \
-    \
-    if (shared.socket_path != NULL) { \
+  } \
+  \
+  if (shared.socket_path != NULL) { \
+    if (shared.listeners[LISTENER_SOCKET].socket_id_target > 0) { \
       unlink(shared.socket_path); \
     } \
     \
-    if (shared.pid_path != NULL) { \
-      unlink(shared.pid_path); \
-      free(shared.pid_path); \
-      shared.pid_path = NULL; \
+    free(shared.socket_path); \
+    shared.socket_path = NULL; \
+  } \
+  \
+  capture_close(&shared.capture); \
+  \
+  if (shared.control.path != NULL) { \
+    if (shared.control.socket_id_target > 0) { \
+      close(shared.control.socket_id_target); \
+      unlink(shared.control.path); \
+      shared.control.socket_id_target = 0; \
     } \
     \
-    memset(&shared, 0, sizeof(shared_data)); \
-    \
-    return exit_code;
+    free(shared.control.path); \
+    shared.control.path = NULL; \
+  } \
+  \
+  if (shared.pid_path != NULL) { \
+    unlink(shared.pid_path); \
+    free(shared.pid_path); \
+    shared.pid_path = NULL; \
+  } \
+  \
+  memset(&shared, 0, sizeof(shared_data)); \
+  \
+  return exit_code;
+
+// forward declaration for listener_data, which is embedded in shared_data.
+typedef struct shared_data_struct shared_data;
+
+// a single request recorded by the flight recorder, the stages are microseconds after the connection was accepted.
+typedef struct {
+  uint64_t sequence; // 0 while the entry is being written, must be first (see trace_finish()).
+
+  struct timespec accepted; // CLOCK_REALTIME.
+  struct timespec started;  // CLOCK_MONOTONIC.
+
+  uint32_t stages[TRACE_TOTAL];
+  uint16_t reached; // bit mask of the completed stages.
+
+  uint32_t address; // network byte order.
+  uint16_t port;
+
+  uint8_t listener;
+  uint8_t priority;
+  uint8_t flags;
+  uint8_t status;
+  uint8_t retries;
+
+  char name[PACKET_SIZE_INPUT + 1];
+} trace_data;
+
+// the buffers and counters of a single worker thread, only that thread uses these so no lock is needed.
+typedef struct {
+  shared_data *shared;
+
+  char query[PSQL_QUERY_LENGTH];
+  char ldap_name[LDAP_SEARCH_DN_LENGTH + PACKET_SIZE_INPUT + 1];
+
+  unsigned long total_requests;
+  unsigned long total_requests_allocating; // requests that made at least one heap allocation.
+  unsigned long total_allocations;
+
+  trace_data *trace; // the request currently being processed, may be NULL.
+  struct timespec deadline; // CLOCK_MONOTONIC, of the request currently being processed, 0 for no deadline.
+  unsigned long total_expired[DEADLINE_TOTAL];
+
+  trace_data trace_current;
+  trace_data traces[TRACE_SLOTS]; // the flight recorder ring, read by the parent in trace_dump().
+  unsigned long trace_total;
+} worker_data;
+
+typedef struct {
+  int type;
+  int enabled;
+  int priority; // the priority class of the requests accepted, unless the request has PACKET_FLAG_BULK.
+
+  int socket_id_target;
+  int socket_id_client;
+  int socket_bound;
+
+  pthread_t thread;
+  pid_t pid_child;
+
+  int wake_id; // (io_uring) an eventfd written by the control thread when accepting is paused or resumed, 0 when not used.
+
+  worker_data worker;
 
+  shared_data *shared;
+} listener_data;
+
+typedef struct {
+  uint32_t *slots;
+  size_t slots_total;
+  size_t used;
+
+  char *strings;
+  size_t strings_used;
+  size_t strings_size;
+} name_set;
+
+// the circuit breaker of a single backend, such as an ldap server or the database.
+typedef struct {
+  const char *name;
+  pthread_mutex_t lock;
+
+  int state;
+  int failures; // consecutive failures.
+  int opened;   // consecutive times opened, including failed probes, for the backoff.
+  struct timespec probe_at; // CLOCK_MONOTONIC.
+
+  unsigned long total_opened;
+  unsigned long total_rejected;
+  unsigned long total_probes;
+} breaker_data;
+
+// a single ldap server of the ldap pool, the pool lock must be held when accessing (except for the breaker and the tls session, which have their own locks).
+typedef struct {
+  const char *uri;
+  breaker_data breaker;
+
+  // bound connections ready for use, oldest first, see ldap_pool_prewarm().
+  LDAP *spares[LDAP_POOL_SPARES_MAX];
+  time_t spares_created[LDAP_POOL_SPARES_MAX];
+  int spares_total;
+
+  // the tls session of the most recent handshake, offered to the server by the next handshake, see ldap_pool_tls_connect().
+  pthread_mutex_t tls_lock;
+  SSL_SESSION *tls_session;
+
+  uint32_t latency_average; // (microseconds) exponentially weighted, 0 until the first search.
+  uint32_t latencies[LDAP_POOL_SAMPLES];
+  unsigned long latencies_total;
+  uint32_t hedge_delay; // (microseconds) the hedge percentile of latencies.
+
+  unsigned long total_searches;
+  unsigned long total_failures;
+  unsigned long total_hedged;
+  unsigned long total_hedge_wins;
+  unsigned long total_spares_used;
+  unsigned long total_handshakes; // the tls lock must be held when accessing.
+  unsigned long total_resumed;    // the tls lock must be held when accessing.
+} ldap_pool_server;
+
+// the ldap servers searched for names, chosen by latency and health.
+typedef struct {
+  char list[LDAP_POOL_LIST_LENGTH]; // the uris, each is NULL terminated once the pool is initialized.
+  int hedge;
+  long hedge_percentile;
+  long spares;
+  int tls_resume;
+
+  pthread_mutex_t lock;
+  int total;
+  unsigned long selections;
+  ldap_pool_server servers[LDAP_POOL_SERVERS_MAX];
+} ldap_pool_data;
+
+// the live local copy of the ldap names, the lock must be held when accessing synced or names.
+typedef struct {
+  int enabled;
+  int synced;
+
+  pthread_mutex_t lock;
+  name_set names;
+
+  pthread_t thread;
+  pid_t pid_child;
+
+  unsigned long total_loaded;
+  unsigned long total_added;
+  unsigned long total_removed;
+  unsigned long total_reloads;
+} mirror_data;
+
+typedef struct {
+  time_t expires[CACHE_TOTAL]; // 0 when not cached for the kind.
+  uint8_t length;              // 0 for an empty slot.
+  char name[PACKET_SIZE_INPUT + 1];
+} cache_entry;
+
+// the cache snapshot file is this header followed by CACHE_SLOTS cache_entry structures.
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t entry_size;
+  uint32_t slots;
+  uint32_t used;
+  time_t written;
+  char group[PARAMETER_LENGTH_MAX];
+  char database[PARAMETER_LENGTH_MAX];
+} cache_snapshot_header;
+
+// the published table file is this header followed by CACHE_SLOTS table_entry structures, in the native byte order.
+// the entries mirror the cache slot for slot, so a name is found at the cache hash (name_set_hash() of the normalized name) followed by a linear probe up to an empty entry.
+// the sequence is odd while the table is being changed, a reader must retry when the sequence is odd or has changed by the end of the lookup.
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t entry_size;
+  uint32_t slots;
+  uint32_t sequence;
+  int64_t published;
+  char system[PARAMETER_LENGTH_MAX];
+  char group[PARAMETER_LENGTH_MAX];
+  char database[PARAMETER_LENGTH_MAX];
+} table_header;
+
+typedef struct {
+  int64_t expires;   // the unix time the name is known to be provisioned until, 0 when it is not.
+  uint32_t length;   // 0 for an empty slot.
+  uint32_t reserved;
+  char name[PACKET_SIZE_INPUT + 1];
+} table_entry;
+
+// the cache of recently provisioned names, the lock must be held when accessing the entries.
+typedef struct {
+  long ttl;
+  long coherence;
+  long snapshot;
+
+  pthread_mutex_t lock;
+  cache_entry *entries;
+  size_t used;
+
+  // when the entries are mapped from the snapshot file, these are the mapping.
+  char *snapshot_map;
+  size_t snapshot_length;
+  char *snapshot_path;
+
+  // when publish is enabled, every change to the entries is also made to the table shared with the clients.
+  int publish;
+  table_header *table;
+  size_t table_length;
+
+  pthread_t thread;
+  pid_t pid_child;
+
+  unsigned long total_hits;
+  unsigned long total_misses;
+  unsigned long total_refreshed;
+  unsigned long total_evicted;
+  unsigned long total_full;
+  unsigned long total_snapshots;
+} cache_data;
+
+// a parsed request waiting for or being processed by a worker.
+typedef struct {
+  int socket_id_client;
+  int priority;
+  struct timespec queued;   // CLOCK_MONOTONIC.
+  struct timespec deadline; // CLOCK_MONOTONIC, 0 for no deadline.
+  uint32_t ticket;          // for asynchronous requests, which have already been answered (the socket_id_client is then -1), 0 otherwise.
+  int keep;                 // PACKET_FLAG_KEEP, the client connection is kept open after the response (see keepalive_release()).
+  int next;                 // the next request in the same flow, -1 for the last (see scheduler_data).
+  char name[PACKET_SIZE_INPUT + 1];
+  trace_data trace;
+} request_data;
+
+// the result of an asynchronous request, in the slot given by the ticket modulo TICKET_SLOTS.
+typedef struct {
+  uint32_t ticket; // 0 for an unused slot.
+  char *status;    // one of the ERROR_* strings, NULL while the request is pending.
+  char name[PACKET_SIZE_INPUT + 1];
+} ticket_entry;
+
+// a poll waiting for the result of a ticket.
+typedef struct {
+  int socket_id_client;
+  uint32_t ticket;
+  struct timespec deadline; // CLOCK_MONOTONIC.
+} ticket_waiter;
+
+// the tickets of the asynchronous requests, the lock must be held when accessing the entries and waiters.
+typedef struct {
+  pthread_mutex_t lock;
+  pthread_cond_t changed; // CLOCK_MONOTONIC, signalled when a result is recorded or a poll starts waiting.
+  pthread_t thread;
+
+  uint32_t issued; // the most recently issued ticket.
+  ticket_entry entries[TICKET_SLOTS];
+  ticket_waiter waiters[TICKET_WAITERS];
+  int waiters_total;
+
+  unsigned long total_issued;
+  unsigned long total_full;
+  unsigned long total_polls;
+  unsigned long total_waited;
+  unsigned long total_pending;
+  unsigned long total_unknown;
+} ticket_data;
+
+// the queue of each priority class and the worker threads that process them, the lock must be held when accessing the requests and queues.
+typedef struct {
+  long workers;
+  long bulk_share;
+
+  pthread_mutex_t lock;
+  pthread_cond_t ready;
+
+  request_data requests[SCHEDULER_REQUESTS];
+  int unused[SCHEDULER_REQUESTS]; // the indexes of the requests not in use.
+  int unused_total;
+
+  // each class is a weighted round robin of flows, and each flow is a list of request indexes in the order they were queued.
+  // without fair, every request is in flow 0, which is then the order the requests were queued.
+  int fair;
+  int flow_head[PRIORITY_TOTAL][SCHEDULER_FLOWS]; // -1 for an empty flow.
+  int flow_tail[PRIORITY_TOTAL][SCHEDULER_FLOWS];
+  int flow_credit[PRIORITY_TOTAL][SCHEDULER_FLOWS]; // the requests the flow may still be dispatched in its current turn.
+  int flows_waiting[PRIORITY_TOTAL][SCHEDULER_FLOWS]; // a ring of the flows that are not empty, in turn order.
+  int flows_head[PRIORITY_TOTAL];
+  int flows_total[PRIORITY_TOTAL];
+  int queue_total[PRIORITY_TOTAL];
+
+  // the weights of the clients, see scheduler_weights_initialize().
+  char weights_list[SCHEDULER_WEIGHTS_LENGTH];
+  uint32_t weight_addresses[SCHEDULER_WEIGHTS_MAX]; // network byte order.
+  int weight_values[SCHEDULER_WEIGHTS_MAX];
+  int weights_total;
+
+  int active[PRIORITY_TOTAL]; // requests being processed by a worker.
+  int bulk_limit;             // the most bulk requests processed at the same time.
+  int bulk_streak;            // interactive requests dispatched in a row while bulk requests waited.
+  int bulk_streak_limit;
+
+  // allocated for SCHEDULER_WORKERS_MAX, so that the workers may be resized at runtime (see scheduler_resize()).
+  worker_data *worker_list;
+  pthread_t *threads;
+  int running[SCHEDULER_WORKERS_MAX]; // cleared by a worker thread as it exits after the workers were reduced.
+  int started[SCHEDULER_WORKERS_MAX]; // only used by scheduler_resize().
+  long workers_created;               // the most workers ever running, the statistics and trace include the workers that have exited.
+
+  unsigned long total_dispatched[PRIORITY_TOTAL];
+  unsigned long total_rejected[PRIORITY_TOTAL];
+  unsigned long total_wait[PRIORITY_TOTAL]; // (microseconds)
+  unsigned long wait_longest[PRIORITY_TOTAL];
+} scheduler_data;
+
+// the adaptive limit on the requests changing the database at the same time (create role and grant take locks on the shared catalogs).
+// the lock must be held when accessing these.
+typedef struct {
+  pthread_mutex_t lock;
+  pthread_cond_t released; // CLOCK_MONOTONIC, signalled when a request stops changing the database.
+
+  int limit;
+  int in_flight;
+  int waiting;
+  int increase_credit; // the fast requests in a row since the limit last changed.
+
+  uint32_t baseline;       // (microseconds) the latency without contention, 0 until the first window is complete.
+  uint32_t window_minimum; // (microseconds)
+  uint32_t window_samples;
+  struct timespec decreased; // CLOCK_MONOTONIC.
+
+  unsigned long total_acquired;
+  unsigned long total_waited;
+  unsigned long total_expired;
+  unsigned long total_increased;
+  unsigned long total_decreased;
+} limiter_data;
+
+// the admin control socket, the lock must be held when changing paused.
+typedef struct {
+  int enabled;
+  int socket_id_target;
+  char *path;
+
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t resumed;
+  int paused; // the listeners do not accept new connections while set.
+
+  unsigned long total_commands;
+  unsigned long total_rejected;
+} control_data;
+
+// the health of the backends from the background probes, see health_probe().
+// the listeners read this without a lock, each value is only written by the breaker thread.
+typedef struct {
+  long interval;
+  time_t probed_at; // 0 until the backends are first probed.
+
+  int ldap_failed[LDAP_POOL_SERVERS_MAX]; // the last probe of the server failed.
+  int database_failed;
+
+  unsigned long total_probes;
+  unsigned long total_pings;
+} health_data;
+
+// the capture file is this header followed by capture_record structures, in the native byte order.
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t mode;    // CAPTURE_NAMES or CAPTURE_HASHES.
+  int64_t started; // (microseconds) CLOCK_REALTIME.
+} capture_header;
+
+// each record is followed by name_length bytes of the name, or the CAPTURE_HASH_LENGTH bytes of name_set_hash() when hashed.
+// a name rejected with ERROR_NAME holds the valid characters received before the invalid one.
+typedef struct {
+  int64_t accepted;    // (microseconds) CLOCK_REALTIME.
+  uint32_t latency;    // (microseconds) after accepted that the response was sent, 0 when none was sent.
+  uint8_t status;      // the response sent, TRACE_STATUS_NONE when none was sent.
+  uint8_t priority;
+  uint8_t listener;
+  uint8_t name_length;
+} capture_record;
+
+// the capture of every request, the lock must be held when accessing the active buffer and the counters.
+// a full buffer is swapped for the other and written while only the flush_lock is held, so that requests are not delayed by the disk.
+// the flush_lock must be taken before the lock, and while holding the lock it may only be taken with pthread_mutex_trylock().
+typedef struct {
+  int mode; // one of CAPTURE_NONE, CAPTURE_NAMES, or CAPTURE_HASHES.
+  int file; // only changed while both locks are held.
+
+  pthread_mutex_t lock;
+  pthread_mutex_t flush_lock;
+  char buffers[2][CAPTURE_BUFFER];
+  int active;
+  size_t used;
+  unsigned long records; // in the active buffer.
+  size_t written;
+  time_t flushed;
+
+  unsigned long total_captured; // written to the capture file.
+  unsigned long total_dropped;  // once CAPTURE_SIZE_MAX is reached, after a write failed, or while both buffers are full.
+} capture_data;
+
+// a connection kept open between requests, in the slab of keepalive_data at the index of its socket id.
+// this is kept small, since there may be a hundred thousand or more of these, the rest of a request is only held while it is received or processed.
+typedef struct {
+  uint8_t state;       // one of KEEPALIVE_STATE_*, changed atomically.
+  uint8_t listener;    // the listener that accepted the connection, LISTENER_NETWORK or LISTENER_SOCKET.
+  uint16_t port;
+  uint32_t address;    // network byte order.
+  uint32_t idle_since; // (seconds) CLOCK_MONOTONIC, when the connection became idle or received the first segment of a packet.
+  int32_t partial;     // the index of the packet being partially received, -1 for none.
+} keepalive_connection;
+
+// a packet received in more than one segment on a kept connection, which is parsed as each segment arrives.
+typedef struct {
+  char user_name[PACKET_SIZE_INPUT + 1];
+  int processed;
+  int user_name_length;
+  int flags;
+  int budget;
+  uint32_t ticket;
+  trace_data trace;
+} keepalive_partial;
+
+// the connections kept open between requests, waiting in epoll for the keepalive thread.
+typedef struct {
+  long limit; // the most connections kept at the same time, 0 when disabled.
+
+  int epoll_id;
+  pthread_t thread;
+
+  // both are mapped without reserving memory, so only the pages of the slots in use become resident.
+  keepalive_connection *connections; // indexed by the socket id.
+  size_t connections_total;
+  keepalive_partial *partials;
+  int partials_unused[KEEPALIVE_PARTIALS]; // only used by the keepalive thread.
+  int partials_unused_total;
+
+  long kept;   // the connections kept now, including those being answered.
+  int highest; // the highest socket id ever kept, the timeouts are only checked up to this.
+
+  worker_data worker; // the flight recorder of the requests on the kept connections that failed before being queued.
+
+  unsigned long total_kept;
+  unsigned long total_full; // connections closed instead of kept because the limit was reached.
+  unsigned long total_requests;
+  unsigned long total_partial;
+  unsigned long total_partial_full; // connections closed because every partial was in use.
+  unsigned long total_idle;
+  unsigned long total_timeout;
+} keepalive_data;
+
+struct shared_data_struct {
+  char parameter_system[PARAMETER_LENGTH_MAX];
+  char parameter_group[PARAMETER_LENGTH_MAX];
+  char parameter_database[PARAMETER_LENGTH_MAX];
+  char parameter_connect_name[ENVIRONMENT_MAX_CONNECT_USER];
+  char parameter_connect_password[ENVIRONMENT_MAX_CONNECT_PASSWORD];
+
+  int parameter_port;
+
+  // when not -1, socket clients must have a matching SO_PEERCRED uid and/or gid.
+  long parameter_socket_allow_uid;
+  long parameter_socket_allow_gid;
+
+  // when non-zero, pre-provision all ldap names and exit instead of running as a service.
+  int parameter_reconcile;
+  long parameter_reconcile_rate;
+  long parameter_reconcile_batch;
+
+  // built once from the parameters, see populate_templates().
+  char psql_connection[PSQL_CONNECTION_LENGTH + PARAMETER_LENGTH_MAX + ENVIRONMENT_MAX_CONNECT_USER + ENVIRONMENT_MAX_CONNECT_PASSWORD + 1];
+  char psql_grant[PSQL_GRANT_LENGTH + PARAMETER_LENGTH_MAX + 3]; // the "%s" for the user name remains.
+
+  listener_data listeners[LISTENER_TOTAL];
+  ldap_pool_data ldap_pool;
+  breaker_data breaker_database;
+  limiter_data limiter_database;
+  pthread_t breaker_thread;
+  mirror_data mirror;
+  cache_data cache;
+  scheduler_data scheduler;
+  ticket_data tickets;
+  control_data control;
+  capture_data capture;
+  health_data health;
+  keepalive_data keepalive;
+
+  char *socket_path;
+
+  pid_t pid_parent;
+  char *pid_path;
+};
+
+#ifdef USE_IO_URING
   typedef struct {
-    char parameter_system[PARAMETER_LENGTH_MAX];
-    char parameter_group[PARAMETER_LENGTH_MAX];
-    char parameter_database[PARAMETER_LENGTH_MAX];
-    char parameter_connect_name[ENVIRONMENT_MAX_CONNECT_USER];
-    char parameter_connect_password[ENVIRONMENT_MAX_CONNECT_PASSWORD];
-
-    int socket_id_target;
-    int socket_id_client;
-    int socket_bound;
-
-    char *socket_path;
-
-    pid_t pid_parent;
-    pid_t pid_child;
-    char pid_path[PATH_MAX];
-  } shared_data;
-#endif // USE_SOCKET
-
-#define MACRO_EXIT_STANDARD_2(pid_child, shared, stack, exit_code) \
-  if (pid_child > 0) { \
-    kill(pid_child, SIGQUIT); \
-    pid_child = 0; \
+    int ring_id;
+
+    char *ring;
+    size_t ring_length;
+
+    struct io_uring_sqe *sqes;
+    size_t sqes_length;
+
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned sq_entries;
+
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    unsigned pending;
+    int multishot;
+    int accepting; // an accept is armed, this is cleared while the control socket has paused accepting.
+
+    // per-slot client connection state, the buffers are registered with IORING_REGISTER_BUFFERS.
+    char buffers[IO_URING_SLOTS][PACKET_SIZE_INPUT];
+    int slot_client[IO_URING_SLOTS];
+    int slot_processed[IO_URING_SLOTS];
+    int slot_name_length[IO_URING_SLOTS];
+    char slot_name[IO_URING_SLOTS][PACKET_SIZE_INPUT + 1];
+    int slot_flags[IO_URING_SLOTS];
+    int slot_budget[IO_URING_SLOTS];
+    uint32_t slot_ticket[IO_URING_SLOTS];
+    struct __kernel_timespec slot_timeout[IO_URING_SLOTS];
+    trace_data slot_trace[IO_URING_SLOTS];
+  } uring_data;
+#endif // USE_IO_URING
+
+typedef struct {
+  name_set roles;
+  name_set members;
+
+  char *query;
+  size_t query_size;
+
+  char *batch_names;
+  char *batch_create;
+  int batch_used;
+  int batch_size;
+
+  long rate;
+
+  unsigned long total_scanned;
+  unsigned long total_invalid;
+  unsigned long total_provisioned;
+  unsigned long total_created;
+  unsigned long total_granted;
+  unsigned long total_failed;
+
+  struct timespec started;
+} reconcile_data;
+
+typedef struct {
+  PGconn *connection;
+  reconcile_data *reconcile;
+  const char *group_name;
+} reconcile_page_data;
+
+// called by ldap_page_names() for each name and with a NULL name at the end of each page.
+typedef int (*ldap_page_callback)(void *argument, const char *name, int name_length);
+
+// the threads are all part of this process and so are terminated when the process exits.
+// the cache snapshot is written first so that the next start is warm, and the published table is emptied.
+#define MACRO_EXIT_STANDARD_2(shared, exit_code) \
+  if (shared.cache.entries != NULL && shared.cache.snapshot_path != NULL) { \
+    cache_snapshot_write(&shared.cache, shared.parameter_group, shared.parameter_database); \
+  } \
+  \
+  if (shared.cache.snapshot_path != NULL) { \
+    free(shared.cache.snapshot_path); \
+    shared.cache.snapshot_path = NULL; \
   } \
   \
-  MACRO_EXIT_STANDARD_1(shared, stack, exit_code)
+  table_close(&shared.cache); \
+  \
+  MACRO_EXIT_STANDARD_1(shared, exit_code)
 
 
+/**
+ * Formats a log message.
+ *
+ * This is separate from log_write() so that the formatting may be measured on its own.
+ *
+ * @param char *buffer
+ *   The formatted message, truncated to fit.
+ * @param size_t size
+ *   The size of the buffer.
+ * @param const char *message
+ *   The message format string.
+ * @param va_list arguments
+ *   The arguments of the message format string.
+ *
+ * @return int
+ *   The length of the formatted message, before any truncation.
+ *
+ * @see vsnprintf()
+ */
+int log_format(char *buffer, size_t size, const char *message, va_list arguments) {
+  return vsnprintf(buffer, size, message, arguments);
+}
+
 /**
  * Immediately writes to system logger.
  *
+ * The message is formatted once, even when it is also printed for debugging.
+ *
  * @param const unsigned level
  *   The log messages level.
  *   LOG_ERR is the most common choice here.
@@ -269,728 +1131,7411 @@
  * @param const char *message
  *   The complete message string to write to the logger.
  *
- * @see vsyslog()
- * @see printf()
+ * @see log_format()
+ * @see syslog()
  */
 void log_write(const int level, const char *message, ...) {
+  char buffer[LOG_LENGTH];
   va_list arguments;
 
+  va_start(arguments, message);
+  log_format(buffer, LOG_LENGTH, message, arguments);
+  va_end(arguments);
+
   #ifdef DEBUG_ENABLED
-    va_start(arguments, message);
-    vprintf(message, arguments);
+    fputs(buffer, stdout);
     fflush(stdout);
-    va_end(arguments);
   #endif // DEBUG_ENABLED
 
-  va_start(arguments, message);
-
   openlog(LOG_ID, LOG_PID | LOG_CONS, LOG_DAEMON);
-  vsyslog(level | LOG_DAEMON, message, arguments);
+  syslog(level | LOG_DAEMON, "%s", buffer);
   closelog();
+}
 
-  va_end(arguments);
+#ifdef USE_ALLOCATION_COUNTERS
+  // these are the glibc allocator entry points that the replacements below forward to.
+  extern void *__libc_malloc(size_t size);
+  extern void *__libc_calloc(size_t count, size_t size);
+  extern void *__libc_realloc(void *pointer, size_t size);
+
+  static __thread unsigned long allocation_total = 0;
+
+  /**
+   * Replaces malloc() for the entire process (including libldap and libpq) to count the allocations made by each thread.
+   *
+   * @see malloc()
+   */
+  void *malloc(size_t size) {
+    allocation_total++;
+    return __libc_malloc(size);
+  }
+
+  /**
+   * Replaces calloc() for the entire process to count the allocations made by each thread.
+   *
+   * @see calloc()
+   */
+  void *calloc(size_t count, size_t size) {
+    allocation_total++;
+    return __libc_calloc(count, size);
+  }
+
+  /**
+   * Replaces realloc() for the entire process to count the allocations made by each thread.
+   *
+   * @see realloc()
+   */
+  void *realloc(void *pointer, size_t size) {
+    allocation_total++;
+    return __libc_realloc(pointer, size);
+  }
+#endif // USE_ALLOCATION_COUNTERS
+
+/**
+ * Gets the number of heap allocations made by the calling thread so far.
+ *
+ * @return unsigned long
+ *   The allocations made by the calling thread, always 0 when USE_ALLOCATION_COUNTERS is not defined.
+ */
+unsigned long allocation_count() {
+  #ifdef USE_ALLOCATION_COUNTERS
+    return allocation_total;
+  #else
+    return 0;
+  #endif // USE_ALLOCATION_COUNTERS
 }
 
 /**
- * Grants the user access to the specified group in the postgresql database.
+ * Calculates the FNV-1a hash of a name.
  *
- * @param char *user_name
- *   Name of the user/role to grant access to..
- * @param char *user_password
- *   Password for the database user.
- * @param char *group_name
- *   Name of the group.
- * @param char *database_name
- *   Name of the database.
-  * @param char *connect_name
- *   Name of the role used to connect to the database.
- * @param char *connect_password
- *   Password for the role used to connect to the database.
+ * @param const char *name
+ *   The name to hash.
+ * @param int length
+ *   The length of the name.
+ *
+ * @return uint32_t
+ *   The hash.
+ */
+uint32_t name_set_hash(const char *name, int length) {
+  uint32_t hash = 2166136261u;
+  int i = 0;
+
+  for (; i < length; i++) {
+    hash ^= (unsigned char) name[i];
+    hash *= 16777619u;
+  }
+
+  return hash;
+}
+
+/**
+ * Writes a swapped capture buffer to the capture file.
+ *
+ * The flush lock must be held and the lock must not be, so that requests are captured into the other buffer while this writes.
+ * Once CAPTURE_SIZE_MAX is reached or a write fails, the capture file is closed and the records are dropped instead.
+ *
+ * @param capture_data *capture
+ *   The capture to flush.
+ * @param const char *buffer
+ *   The buffer to write.
+ * @param size_t length
+ *   The bytes of the buffer to write.
+ * @param unsigned long records
+ *   The records in the buffer.
  *
  * @return int
  *   1 on success and -1 on error.
  */
-int grant_role_in_database(const char *user_name, const char *group_name, const char *database_name, const char *connect_name, const char *connect_password) {
-  PGconn *connection = NULL;
-  char *connection_information = NULL;
+int capture_flush(capture_data *capture, const char *buffer, size_t length, unsigned long records) {
+  size_t flushed = 0;
+  int result = 1;
 
-  {
-    int connection_information_length = PSQL_CONNECTION_LENGTH + 1;
+  while (flushed < length) {
+    ssize_t wrote = write(capture->file, buffer + flushed, length - flushed);
 
-    connection_information_length += strnlen(database_name, PARAMETER_LENGTH_MAX);
-    connection_information_length += strnlen(connect_name, PARAMETER_LENGTH_MAX);
-    connection_information_length += strnlen(connect_password, PARAMETER_LENGTH_MAX);
-    connection_information = malloc(sizeof(char) * connection_information_length);
+    if (wrote < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
 
-    if (connection_information == NULL) {
-      log_write(LOG_ERR, "ERROR: failed to allocate memory when building the postgresql connection information string while processing user '%s', group '%s', and database '%s'.\n", user_name, group_name, database_name);
-      return -1;
+      log_write(LOG_ERR, "ERROR: failed to write the capture, the capture is stopped, error: %i.\n", errno);
+      result = -1;
+      break;
     }
 
-    memset(connection_information, 0, sizeof(char) * connection_information_length);
-    snprintf(connection_information, connection_information_length, PSQL_CONNECTION, database_name, connect_name, connect_password);
-  }
+    flushed += wrote;
+  } // while
 
-  connection = PQconnectdb(connection_information);
+  pthread_mutex_lock(&capture->lock);
 
-  if (connection == NULL) {
-    log_write(LOG_ERR, "ERROR: failed to establish the postgresql connection while processing user '%s', group '%s', and database '%s', reason: NULL returned.\n", user_name, group_name, database_name);
-    return -1;
+  if (result > 0) {
+    capture->written += length;
+    capture->total_captured += records;
+
+    if (capture->written >= CAPTURE_SIZE_MAX) {
+      log_write(LOG_NOTICE, "NOTICE: the capture reached %u bytes, the capture is stopped.\n", CAPTURE_SIZE_MAX);
+    }
   }
-  else if (PQstatus(connection) != CONNECTION_OK) {
-    log_write(LOG_ERR, "ERROR: failed to establish the postgresql connection while processing user '%s', group '%s', and database '%s', reason (%u): %s.\n", user_name, group_name, database_name, PQstatus(connection), PQerrorMessage(connection));
-    PQfinish(connection);
-    free(connection_information);
-    connection_information = NULL;
-    return -1;
+  else {
+    capture->total_dropped += records;
   }
 
-  // check to see if role exists and has
-  short role_exists = 0;
-  {
-    char *query = NULL;
-    int query_length = PSQL_SELECT_LENGTH + 1;
+  if (result < 0 || capture->written >= CAPTURE_SIZE_MAX) {
+    // the records waiting in the active buffer are never written.
+    capture->total_dropped += capture->records;
+    capture->used = 0;
+    capture->records = 0;
 
-    query_length += strnlen(user_name, PARAMETER_LENGTH_MAX);
-    query = malloc(sizeof(char) * query_length);
+    close(capture->file);
+    capture->file = -1;
+  }
 
-    if (query == NULL) {
-      log_write(LOG_ERR, "ERROR: failed to allocate memory when building the postgresql select query string while processing user '%s', group '%s', and database '%s'.\n", user_name, group_name, database_name);
+  pthread_mutex_unlock(&capture->lock);
 
-      PQfinish(connection);
-      free(connection_information);
-      connection_information = NULL;
-      return -1;
-    }
+  return result;
+}
 
-    memset(query, 0, sizeof(char) * query_length);
-    snprintf(query, query_length, PSQL_SELECT, user_name);
+/**
+ * Swaps the active capture buffer for the other one, so that the active buffer can be written without holding the lock.
+ *
+ * The lock must be held.
+ * The other buffer is only free once its own flush is finished, which is when the flush lock can be taken.
+ *
+ * @param capture_data *capture
+ *   The capture to swap the buffers of.
+ * @param const char **buffer
+ *   The buffer to pass to capture_flush(), this value will be updated.
+ * @param size_t *length
+ *   The bytes of the buffer, this value will be updated.
+ * @param unsigned long *records
+ *   The records in the buffer, this value will be updated.
+ *
+ * @return int
+ *   1 when swapped, with the flush lock held until capture_flush() is done, and 0 when a flush is already in progress.
+ */
+int capture_swap(capture_data *capture, const char **buffer, size_t *length, unsigned long *records) {
+  if (pthread_mutex_trylock(&capture->flush_lock) != 0) {
+    return 0;
+  }
 
-    {
-      PGresult *result = NULL;
+  *buffer = capture->buffers[capture->active];
+  *length = capture->used;
+  *records = capture->records;
 
-      result = PQexec(connection, query);
+  capture->active ^= 1;
+  capture->used = 0;
+  capture->records = 0;
+  capture->flushed = time(NULL);
 
-      int status = PQresultStatus(result);
+  return 1;
+}
 
-      if (status == PGRES_EMPTY_QUERY) {
-        //role_exists = 0;
-      }
-      else if (status == PGRES_COMMAND_OK || status == PGRES_TUPLES_OK) {
-        if (PQnfields(result) > 0 && PQntuples(result) > 0) {
-          role_exists = 1;
-        }
-      }
-      else {
-        PQclear(result);
-        PQfinish(connection);
+/**
+ * Creates the capture file, keeping the capture of the previous run under CAPTURE_PREVIOUS.
+ *
+ * @param capture_data *capture
+ *   The capture, with the mode already populated.
+ * @param const char *path
+ *   The path of the capture file.
+ *
+ * @return int
+ *   1 on success and -1 on error.
+ */
+int capture_initialize(capture_data *capture, const char *path) {
+  char path_previous[PATH_MAX];
+  capture_header header;
+  struct timespec now;
+  int result = 0;
 
-        free(query);
-        free(connection_information);
+  pthread_mutex_init(&capture->lock, NULL);
+  pthread_mutex_init(&capture->flush_lock, NULL);
 
-        result = NULL;
-        query = NULL;
-        connection_information = NULL;
+  if (snprintf(path_previous, PATH_MAX, "%s" CAPTURE_PREVIOUS, path) >= PATH_MAX) {
+    log_write(LOG_ERR, "ERROR: the capture path '%s' is too long.\n", path);
+    return -1;
+  }
 
-        return -1;
-      }
+  if (rename(path, path_previous) < 0 && errno != ENOENT) {
+    log_write(LOG_ERR, "ERROR: failed to keep the previous capture '%s', error: %i.\n", path, errno);
+    return -1;
+  }
 
-      PQclear(result);
-      result = NULL;
-    }
+  capture->file = open(path, O_WRONLY | O_CREAT | O_TRUNC, CAPTURE_MODE);
 
-    free(query);
-    query = NULL;
+  if (capture->file < 0) {
+    log_write(LOG_ERR, "ERROR: failed to create the capture '%s', error: %i.\n", path, errno);
+    return -1;
   }
 
-  // Create the specified role.
-  if (role_exists == 0) {
-    char *query = NULL;
-    int query_length = PSQL_CREATE_LENGTH + 1;
+  clock_gettime(CLOCK_REALTIME, &now);
 
-    query_length += strnlen(user_name, PARAMETER_LENGTH_MAX);
-    query = malloc(sizeof(char) * query_length);
+  memset(&header, 0, sizeof(capture_header));
+  memcpy(header.magic, CAPTURE_MAGIC, sizeof(header.magic));
+  header.version = CAPTURE_VERSION;
+  header.mode = capture->mode;
+  header.started = (((int64_t) now.tv_sec) * 1000000) + (now.tv_nsec / 1000);
 
-    if (query == NULL) {
-      log_write(LOG_ERR, "ERROR: failed to allocate memory when building the postgresql creates query string while processing user '%s', group '%s', and database '%s'.\n", user_name, group_name, database_name);
+  capture->active = 0;
+  capture->used = 0;
+  capture->records = 0;
+  capture->flushed = time(NULL);
 
-      PQfinish(connection);
-      free(connection_information);
-      connection_information = NULL;
-      return -1;
+  pthread_mutex_lock(&capture->flush_lock);
+  result = capture_flush(capture, (const char *) &header, sizeof(capture_header), 0);
+  pthread_mutex_unlock(&capture->flush_lock);
+
+  return result;
+}
+
+/**
+ * Adds a finished request to the capture.
+ *
+ * The record is dropped when both buffers are full, rather than having the request wait for the disk.
+ *
+ * @param capture_data *capture
+ *   The capture to add to.
+ * @param const trace_data *trace
+ *   The trace of the finished request.
+ */
+void capture_write(capture_data *capture, const trace_data *trace) {
+  capture_record record;
+  const char *name = trace->name;
+  const char *flush = NULL;
+  size_t flush_length = 0;
+  unsigned long flush_records = 0;
+  uint32_t hash = 0;
+  int name_length = strnlen(trace->name, PACKET_SIZE_INPUT);
+
+  // the record is built here and copied in, because the records are not aligned within the buffer.
+  memset(&record, 0, sizeof(capture_record));
+  record.accepted = (((int64_t) trace->accepted.tv_sec) * 1000000) + (trace->accepted.tv_nsec / 1000);
+  record.latency = (trace->reached & (1 << TRACE_SEND)) ? trace->stages[TRACE_SEND] : 0;
+  record.status = trace->status;
+  record.priority = trace->priority;
+  record.listener = trace->listener;
+  record.name_length = name_length;
+
+  if (capture->mode == CAPTURE_HASHES && name_length > 0) {
+    hash = name_set_hash(trace->name, name_length);
+    name = (const char *) &hash;
+    record.name_length = CAPTURE_HASH_LENGTH;
+  }
+
+  pthread_mutex_lock(&capture->lock);
+
+  if (capture->file < 0) {
+    capture->total_dropped++;
+    pthread_mutex_unlock(&capture->lock);
+    return;
+  }
+
+  if (capture->used + sizeof(capture_record) + record.name_length > CAPTURE_BUFFER) {
+    if (capture_swap(capture, &flush, &flush_length, &flush_records) == 0) {
+      // the other buffer is still being written.
+      capture->total_dropped++;
+      pthread_mutex_unlock(&capture->lock);
+      return;
     }
+  }
 
-    memset(query, 0, sizeof(char) * query_length);
-    snprintf(query, query_length, PSQL_CREATE, user_name);
+  memcpy(capture->buffers[capture->active] + capture->used, &record, sizeof(capture_record));
+  memcpy(capture->buffers[capture->active] + capture->used + sizeof(capture_record), name, record.name_length);
 
-    {
-      PGresult *result = NULL;
+  capture->used += sizeof(capture_record) + record.name_length;
+  capture->records++;
 
-      result = PQexec(connection, query);
+  if (flush == NULL && time(NULL) - capture->flushed >= CAPTURE_FLUSH) {
+    capture_swap(capture, &flush, &flush_length, &flush_records);
+  }
 
-      int status = PQresultStatus(result);
+  pthread_mutex_unlock(&capture->lock);
 
-      if (status != PGRES_EMPTY_QUERY && status != PGRES_COMMAND_OK && status != PGRES_TUPLES_OK) {
-        log_write(LOG_ERR, "ERROR: failed to process sql query '%s', reason (%u): %s.\n", query, status, PQerrorMessage(connection));
+  if (flush != NULL) {
+    capture_flush(capture, flush, flush_length, flush_records);
+    pthread_mutex_unlock(&capture->flush_lock);
+  }
+}
 
-        PQclear(result);
-        PQfinish(connection);
+/**
+ * Writes the buffered capture records once CAPTURE_FLUSH has passed since the last flush.
+ *
+ * This is called by the breaker thread, so that the records are written even when no later request finishes to flush them.
+ *
+ * @param capture_data *capture
+ *   The capture to flush.
+ */
+void capture_tick(capture_data *capture) {
+  const char *flush = NULL;
+  size_t flush_length = 0;
+  unsigned long flush_records = 0;
 
-        free(query);
-        free(connection_information);
+  if (capture->mode == CAPTURE_NONE) {
+    return;
+  }
 
-        result = NULL;
-        query = NULL;
-        connection_information = NULL;
+  pthread_mutex_lock(&capture->lock);
 
-        return -1;
-      }
+  // a flush already in progress is left to finish, the records are then written on a later tick.
+  if (capture->file >= 0 && capture->used > 0 && time(NULL) - capture->flushed >= CAPTURE_FLUSH) {
+    capture_swap(capture, &flush, &flush_length, &flush_records);
+  }
 
-      PQclear(result);
-      result = NULL;
-    }
+  pthread_mutex_unlock(&capture->lock);
+
+  if (flush != NULL) {
+    capture_flush(capture, flush, flush_length, flush_records);
+    pthread_mutex_unlock(&capture->flush_lock);
+  }
+}
+
+/**
+ * Writes any buffered capture records and closes the capture file.
+ *
+ * @param capture_data *capture
+ *   The capture to close.
+ */
+void capture_close(capture_data *capture) {
+  const char *flush = NULL;
+  size_t flush_length = 0;
+  unsigned long flush_records = 0;
 
-    free(query);
-    query = NULL;
+  if (capture->mode == CAPTURE_NONE) {
+    return;
   }
 
-  // grant the user access to the specified role.
-  {
-    char *query = NULL;
-    int query_length = PSQL_GRANT_LENGTH + 1;
+  // waits for any flush in progress, the flush lock is then already held so the buffers are swapped directly.
+  pthread_mutex_lock(&capture->flush_lock);
+  pthread_mutex_lock(&capture->lock);
 
-    query_length += strnlen(group_name, PARAMETER_LENGTH_MAX);
-    query_length += strnlen(user_name, PARAMETER_LENGTH_MAX);
-    query = malloc(sizeof(char) * query_length);
+  if (capture->file >= 0 && capture->used > 0) {
+    flush = capture->buffers[capture->active];
+    flush_length = capture->used;
+    flush_records = capture->records;
 
-    if (query == NULL) {
-      log_write(LOG_ERR, "ERROR: failed to allocate memory when building the postgresql grant query string while processing user '%s', group '%s', and database '%s'.\n", user_name, group_name, database_name);
+    capture->active ^= 1;
+    capture->used = 0;
+    capture->records = 0;
+  }
 
-      PQfinish(connection);
-      free(connection_information);
-      connection_information = NULL;
-      return -1;
-    }
+  pthread_mutex_unlock(&capture->lock);
 
-    memset(query, 0, sizeof(char) * query_length);
-    snprintf(query, query_length, PSQL_GRANT, group_name, user_name);
+  if (flush != NULL) {
+    capture_flush(capture, flush, flush_length, flush_records);
+  }
 
-    {
-      PGresult *result = NULL;
+  pthread_mutex_lock(&capture->lock);
 
-      result = PQexec(connection, query);
+  if (capture->file >= 0) {
+    close(capture->file);
+    capture->file = -1;
+  }
 
-      int status = PQresultStatus(result);
+  pthread_mutex_unlock(&capture->lock);
+  pthread_mutex_unlock(&capture->flush_lock);
+}
 
-      if (status != PGRES_EMPTY_QUERY && status != PGRES_COMMAND_OK && status != PGRES_TUPLES_OK) {
-        log_write(LOG_ERR, "ERROR: failed to process sql query '%s', reason (%u): %s.\n", query, status, PQerrorMessage(connection));
+/**
+ * Starts the trace of a newly accepted connection.
+ *
+ * @param trace_data *trace
+ *   The trace to start.
+ * @param listener_data *listener
+ *   The listener that accepted the connection.
+ * @param int socket_id_client
+ *   The accepted client connection.
+ * @param const struct sockaddr *address
+ *   The client address returned by accept() or NULL to look it up with getpeername().
+ */
+void trace_begin(trace_data *trace, listener_data *listener, int socket_id_client, const struct sockaddr *address) {
+  memset(trace, 0, sizeof(trace_data));
 
-        PQclear(result);
-        PQfinish(connection);
+  clock_gettime(CLOCK_REALTIME, &trace->accepted);
+  clock_gettime(CLOCK_MONOTONIC, &trace->started);
 
-        free(query);
-        free(connection_information);
+  trace->listener = listener->type;
+  trace->priority = listener->priority;
+  trace->reached = 1 << TRACE_ACCEPT;
+  trace->status = TRACE_STATUS_NONE;
 
-        result = NULL;
-        query = NULL;
-        connection_information = NULL;
+  if (listener->type == LISTENER_NETWORK) {
+    struct sockaddr_in peer;
 
-        return -1;
-      }
+    if (address == NULL) {
+      socklen_t length = sizeof(struct sockaddr_in);
 
-      PQclear(result);
-      result = NULL;
+      memset(&peer, 0, sizeof(struct sockaddr_in));
+      getpeername(socket_id_client, (struct sockaddr *) &peer, &length);
+      address = (struct sockaddr *) &peer;
     }
 
-    free(query);
-    query = NULL;
+    if (address->sa_family == AF_INET) {
+      trace->address = ((const struct sockaddr_in *) address)->sin_addr.s_addr;
+      trace->port = ntohs(((const struct sockaddr_in *) address)->sin_port);
+    }
   }
+}
 
-  if (connection_information != NULL) {
-    PQfinish(connection);
-    free(connection_information);
+/**
+ * Records the time that a stage of the request was completed.
+ *
+ * @param trace_data *trace
+ *   The trace to record into, may be NULL.
+ * @param int stage
+ *   One of the TRACE_* stages.
+ */
+void trace_stage(trace_data *trace, int stage) {
+  struct timespec now;
+
+  if (trace == NULL) {
+    return;
   }
 
-  return 1;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  trace->stages[stage] = (now.tv_sec - trace->started.tv_sec) * 1000000 + (now.tv_nsec - trace->started.tv_nsec) / 1000;
+  trace->reached |= 1 << stage;
 }
 
 /**
- * Queries the name in the ldap server to see if it exists.
+ * Finishes a trace and copies it into the worker's flight recorder ring, replacing the oldest trace.
  *
- * @param const char *user_name
- *   The user name to query in the ldap database.
+ * The sequence is 0 while the entry is being written, so that trace_dump() can skip an entry that changes while it is being read.
  *
- * @return bool
- *   1 on found, 0 on not found, and -1 on error.
+ * @param worker_data *worker
+ *   The worker that owns the ring.
+ * @param trace_data *trace
+ *   The trace to finish.
+ * @param const char *status
+ *   The response sent to the client or NULL when no response is sent.
  */
-int does_name_exist_in_ldap(const char *user_name) {
-  int user_name_length = 0;
-  int ldap_name_length = 0;
-  int ldap_status = 0;
-  LDAP *ldap_settings = NULL;
-  char *ldap_name = NULL;
-
-  user_name_length = strnlen(user_name, PACKET_SIZE_INPUT);
-  ldap_name_length = user_name_length + LDAP_SEARCH_DN_LENGTH;
+void trace_finish(worker_data *worker, trace_data *trace, const char *status) {
+  trace_data *entry = &worker->traces[worker->trace_total % TRACE_SLOTS];
 
-  ldap_name = malloc(sizeof(char) * (ldap_name_length + 1));
-  if (ldap_name == NULL) {
-    log_write(LOG_ERR, "ERROR: failed to allocate memory when building the ldap user name for the user: '%s'.\n", user_name);
-    return -1;
+  if (status != NULL) {
+    trace->status = (unsigned char) status[0];
+    trace_stage(trace, TRACE_SEND);
   }
 
-  memset(ldap_name, 0, sizeof(char) * (ldap_name_length + 1));
-  sprintf(ldap_name, LDAP_SEARCH_DN, user_name);
+  __atomic_store_n(&entry->sequence, 0, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
 
+  memcpy(((char *) entry) + sizeof(uint64_t), ((char *) trace) + sizeof(uint64_t), sizeof(trace_data) - sizeof(uint64_t));
 
-  ldap_status = ldap_initialize(&ldap_settings, LDAP_SERVER);
-
-  if (ldap_status != LDAP_SUCCESS) {
-    log_write(LOG_ERR, "ERROR: failed to initialize ldap settings for the ldap server '%s' with the ldap name '%s' with the ldap error (%d): %s.\n", LDAP_SERVER, ldap_name, ldap_status, ldap_err2string(ldap_status));
+  worker->trace_total++;
+  __atomic_store_n(&entry->sequence, worker->trace_total, __ATOMIC_RELEASE);
 
-    if (ldap_name != NULL) {
-      free(ldap_name);
-    }
-    return -1;
+  if (worker->shared != NULL && worker->shared->capture.mode != CAPTURE_NONE) {
+    capture_write(&worker->shared->capture, trace);
   }
+}
 
+/**
+ * Writes the flight recorder ring of a single worker to the trace file, oldest first.
+ *
+ * @param FILE *file
+ *   The trace file.
+ * @param worker_data *worker
+ *   The worker that owns the ring.
+ */
+void trace_dump_worker(FILE *file, worker_data *worker) {
+  const char *stage_names[TRACE_TOTAL] = { "accept", "parse", "dispatch", "ldap_bind", "ldap_search", "sql_connect", "sql_select", "sql_create", "sql_grant", "send" };
+  unsigned long total = __atomic_load_n(&worker->trace_total, __ATOMIC_ACQUIRE);
+  unsigned long index = total > TRACE_SLOTS ? total - TRACE_SLOTS : 0;
+
+  for (; index < total; index++) {
+    trace_data *entry = &worker->traces[index % TRACE_SLOTS];
+    trace_data trace;
+    uint64_t sequence = __atomic_load_n(&entry->sequence, __ATOMIC_ACQUIRE);
+    struct tm accepted;
+    char accepted_string[32];
+    char client[INET_ADDRSTRLEN];
+    int stage = 0;
+
+    if (sequence == 0) {
+      continue;
+    }
 
-  // a bind is ldap's way of saying 'login' or 'authenticate', do no use string to search with bind.
-  {
-    int tries = 0;
-    for (; tries < LDAP_RETRY_BIND_RETRY; tries++) {
-      ldap_status = ldap_simple_bind_s(ldap_settings, "", "");
+    memcpy(&trace, entry, sizeof(trace_data));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
 
-      if (ldap_status == LDAP_SUCCESS) {
-        break;
-      }
-      else if (ldap_status == LDAP_SERVER_DOWN) {
-        if (tries + 1 < LDAP_RETRY_BIND_RETRY) {
-          continue;
-        }
-      }
-      else if (ldap_status == LDAP_TIMEOUT) {
-        if (tries + 1 < LDAP_RETRY_BIND_RETRY) {
-          continue;
-        }
-      }
+    // the entry was replaced while being copied.
+    if (__atomic_load_n(&entry->sequence, __ATOMIC_RELAXED) != sequence) {
+      continue;
+    }
 
-      log_write(LOG_ERR, "ERROR: failed to connect and bind to the ldap server '%s' with the ldap name '%s' with the ldap error (%d): %s\n", LDAP_SERVER, ldap_name, ldap_status, ldap_err2string(ldap_status));
+    localtime_r(&trace.accepted.tv_sec, &accepted);
+    strftime(accepted_string, sizeof(accepted_string), "%Y-%m-%d %H:%M:%S", &accepted);
 
-      if (ldap_name != NULL) {
-        free(ldap_name);
-      }
-      return -1;
+    if (trace.listener == LISTENER_NETWORK) {
+      inet_ntop(AF_INET, &trace.address, client, INET_ADDRSTRLEN);
+      fprintf(file, "%s.%06ld %s %s:%u", accepted_string, trace.accepted.tv_nsec / 1000, LISTEN_NETWORK, client, trace.port);
     }
+    else if (trace.listener == LISTENER_SOCKET) {
+      fprintf(file, "%s.%06ld %s -", accepted_string, trace.accepted.tv_nsec / 1000, LISTEN_SOCKET);
+    }
+    else {
+      fprintf(file, "%s.%06ld control -", accepted_string, trace.accepted.tv_nsec / 1000);
+    }
+
+    trace.name[PACKET_SIZE_INPUT] = 0;
+
+    fprintf(file, " %s", trace.priority == PRIORITY_BULK ? "bulk" : "interactive");
+
+    if (trace.status == TRACE_STATUS_NONE) {
+      fprintf(file, " '%s' none", trace.name);
+    }
+    else {
+      fprintf(file, " '%s' %u", trace.name, trace.status);
+    }
+
+    if (trace.flags == 0) {
+      fprintf(file, " -");
+    }
+    else {
+      fprintf(file, " %s%s%s", (trace.flags & TRACE_FLAG_MIRROR) ? "mirror" : "", (trace.flags & TRACE_FLAG_CACHE_LDAP) ? ((trace.flags & TRACE_FLAG_MIRROR) ? ",cache_ldap" : "cache_ldap") : "", (trace.flags & TRACE_FLAG_CACHE_MEMBER) ? ((trace.flags & (TRACE_FLAG_MIRROR | TRACE_FLAG_CACHE_LDAP)) ? ",cache_member" : "cache_member") : "");
+    }
+    fprintf(file, " %u", trace.retries);
+
+    for (stage = TRACE_ACCEPT + 1; stage < TRACE_TOTAL; stage++) {
+      if (trace.reached & (1 << stage)) {
+        fprintf(file, " %s=%u", stage_names[stage], trace.stages[stage]);
+      }
+    } // for
+
+    fprintf(file, "\n");
+  } // for
+}
+
+/**
+ * Writes the flight recorder rings of every listener and every worker to the trace file.
+ *
+ * Each line is a single request, with the time of each completed stage in microseconds after the connection was accepted.
+ * The requests processed by a worker are in the ring of that worker, and those that failed before being queued (such as an invalid name) are in the ring of the listener.
+ * The later requests on a kept connection that failed before being queued are in the ring of the keepalive thread.
+ *
+ * @param shared_data *shared
+ *   The data shared between the parent and all threads.
+ *
+ * @return int
+ *   1 on success and -1 on error.
+ */
+int trace_dump(shared_data *shared) {
+  char path[PATH_MAX];
+  FILE *file = NULL;
+  int listener_index = 0;
+  int worker_index = 0;
+
+  if (snprintf(path, PATH_MAX, PATH_TRACE, shared->parameter_system) >= PATH_MAX) {
+    log_write(LOG_ERR, "ERROR: the trace path for the system name '%s' is too long.\n", shared->parameter_system);
+    return -1;
+  }
+
+  file = fopen(path, "w");
+
+  if (file == NULL) {
+    log_write(LOG_ERR, "ERROR: failed to create the trace file '%s', error: %i.\n", path, errno);
+    return -1;
+  }
+
+  fprintf(file, "# accepted, listener, client, priority, name, status, answered from, ldap retries, stages (microseconds after accepted).\n");
+
+  for (; listener_index < LISTENER_TOTAL; listener_index++) {
+    if (shared->listeners[listener_index].enabled) {
+      trace_dump_worker(file, &shared->listeners[listener_index].worker);
+    }
+  } // for
+
+  if (shared->keepalive.connections != NULL) {
+    trace_dump_worker(file, &shared->keepalive.worker);
+  }
+
+  if (shared->scheduler.worker_list != NULL) {
+    const long workers = __atomic_load_n(&shared->scheduler.workers_created, __ATOMIC_ACQUIRE);
+
+    for (; worker_index < workers; worker_index++) {
+      trace_dump_worker(file, &shared->scheduler.worker_list[worker_index]);
+    } // for
+  }
+
+  fclose(file);
+
+  log_write(LOG_INFO, "INFO: the flight recorder was written to '%s'.\n", path);
+
+  return 1;
+}
+
+/**
+ * Checks whether the deadline of a request has passed.
+ *
+ * @param const struct timespec *deadline
+ *   The CLOCK_MONOTONIC deadline, 0 for no deadline.
+ *
+ * @return int
+ *   1 when the deadline has passed and 0 otherwise.
+ */
+int deadline_expired(const struct timespec *deadline) {
+  struct timespec now;
+
+  if (deadline->tv_sec == 0 && deadline->tv_nsec == 0) {
+    return 0;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return now.tv_sec > deadline->tv_sec || (now.tv_sec == deadline->tv_sec && now.tv_nsec >= deadline->tv_nsec);
+}
+
+/**
+ * Sets a deadline from a time budget.
+ *
+ * @param struct timespec *deadline
+ *   The deadline to set, 0 when there is no budget.
+ * @param const struct timespec *started
+ *   The CLOCK_MONOTONIC time the budget is counted from.
+ * @param int budget
+ *   The time budget in milliseconds, 0 for no deadline.
+ */
+void deadline_set(struct timespec *deadline, const struct timespec *started, int budget) {
+  memset(deadline, 0, sizeof(struct timespec));
+
+  if (budget <= 0) {
+    return;
+  }
+
+  deadline->tv_sec = started->tv_sec + budget / 1000;
+  deadline->tv_nsec = started->tv_nsec + (budget % 1000) * 1000000;
+
+  if (deadline->tv_nsec >= 1000000000) {
+    deadline->tv_sec++;
+    deadline->tv_nsec -= 1000000000;
+  }
+}
+
+/**
+ * Gets a randomized exponential backoff.
+ *
+ * The backoff doubles for each attempt, up to the maximum, and is then randomized between half of that and all of that so that many clients do not retry in step.
+ *
+ * @param unsigned long base
+ *   The backoff of the first attempt.
+ * @param int attempt
+ *   The attempt, starting at 0.
+ * @param unsigned long maximum
+ *   The largest backoff before randomizing.
+ *
+ * @return unsigned long
+ *   The backoff, in the same units as base.
+ */
+unsigned long backoff_jitter(unsigned long base, int attempt, unsigned long maximum) {
+  static __thread unsigned int seed = 0;
+  unsigned long backoff = base;
+
+  if (seed == 0) {
+    seed = (unsigned int) syscall(SYS_gettid) ^ (unsigned int) time(NULL);
+  }
+
+  for (; attempt > 0 && backoff < maximum; attempt--) {
+    backoff *= 2;
+  } // for
+
+  if (backoff > maximum) {
+    backoff = maximum;
+  }
+
+  return backoff / 2 + rand_r(&seed) % (backoff / 2 + 1);
+}
+
+/**
+ * Initializes a circuit breaker in the closed state.
+ *
+ * @param breaker_data *breaker
+ *   The breaker to initialize.
+ * @param const char *name
+ *   The name of the backend, used in the log messages.
+ */
+void breaker_initialize(breaker_data *breaker, const char *name) {
+  memset(breaker, 0, sizeof(breaker_data));
+
+  breaker->name = name;
+  breaker->state = BREAKER_CLOSED;
+
+  pthread_mutex_init(&breaker->lock, NULL);
+}
+
+/**
+ * Checks whether the backend may be used.
+ *
+ * While the circuit is open, requests fail fast and only the breaker thread probes the backend, see handler_breaker().
+ *
+ * @param breaker_data *breaker
+ *   The breaker of the backend.
+ *
+ * @return int
+ *   1 when the circuit is closed and 0 when it is open.
+ */
+int breaker_allow(breaker_data *breaker) {
+  int allowed = 1;
+
+  pthread_mutex_lock(&breaker->lock);
+
+  if (breaker->state == BREAKER_OPEN) {
+    breaker->total_rejected++;
+    allowed = 0;
+  }
+
+  pthread_mutex_unlock(&breaker->lock);
+
+  return allowed;
+}
+
+/**
+ * Records the outcome of using a backend.
+ *
+ * BREAKER_FAILURES consecutive failures open the circuit.
+ * A failed probe keeps the circuit open and doubles the wait before the next probe, up to BREAKER_BACKOFF_MAX.
+ * A success closes the circuit.
+ *
+ * @param breaker_data *breaker
+ *   The breaker of the backend.
+ * @param int success
+ *   1 when the backend answered and 0 when it failed.
+ */
+void breaker_record(breaker_data *breaker, int success) {
+  pthread_mutex_lock(&breaker->lock);
+
+  if (success) {
+    if (breaker->state == BREAKER_OPEN) {
+      log_write(LOG_INFO, "INFO: the circuit for '%s' is closed again after %u failed probes.\n", breaker->name, breaker->opened - 1);
+    }
+
+    // the state is also read without the lock by the health checks, see health_check().
+    __atomic_store_n(&breaker->state, BREAKER_CLOSED, __ATOMIC_RELAXED);
+    breaker->failures = 0;
+    breaker->opened = 0;
+  }
+  else {
+    breaker->failures++;
+
+    if (breaker->state == BREAKER_OPEN || breaker->failures >= BREAKER_FAILURES) {
+      unsigned long backoff = backoff_jitter(BREAKER_BACKOFF, breaker->opened, BREAKER_BACKOFF_MAX);
+
+      if (breaker->state == BREAKER_CLOSED) {
+        breaker->total_opened++;
+        log_write(LOG_ERR, "ERROR: the circuit for '%s' is open after %u failures in a row, requests fail fast until a probe succeeds.\n", breaker->name, breaker->failures);
+      }
+
+      __atomic_store_n(&breaker->state, BREAKER_OPEN, __ATOMIC_RELAXED);
+      breaker->opened++;
+
+      clock_gettime(CLOCK_MONOTONIC, &breaker->probe_at);
+      breaker->probe_at.tv_sec += backoff / 1000;
+      breaker->probe_at.tv_nsec += (backoff % 1000) * 1000000;
+
+      if (breaker->probe_at.tv_nsec >= 1000000000) {
+        breaker->probe_at.tv_sec++;
+        breaker->probe_at.tv_nsec -= 1000000000;
+      }
+    }
+  }
+
+  pthread_mutex_unlock(&breaker->lock);
+}
+
+/**
+ * Checks whether an open circuit is due to be probed.
+ *
+ * @param breaker_data *breaker
+ *   The breaker of the backend.
+ *
+ * @return int
+ *   1 when the circuit is open and the backoff has passed, 0 otherwise.
+ */
+int breaker_probe_due(breaker_data *breaker) {
+  struct timespec now;
+  int due = 0;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  pthread_mutex_lock(&breaker->lock);
+
+  if (breaker->state == BREAKER_OPEN && (now.tv_sec > breaker->probe_at.tv_sec || (now.tv_sec == breaker->probe_at.tv_sec && now.tv_nsec >= breaker->probe_at.tv_nsec))) {
+    breaker->total_probes++;
+    due = 1;
+  }
+
+  pthread_mutex_unlock(&breaker->lock);
+
+  return due;
+}
+
+/**
+ * Initializes a name set.
+ *
+ * The name set is a compact string index: the names are packed into a single arena (prefixed by their length) and an open-addressing table holds 32-bit offsets into that arena.
+ * This keeps the per-name overhead to a few bytes, allowing for hundreds of thousands of names.
+ *
+ * @param name_set *set
+ *   The name set to initialize.
+ * @param size_t total
+ *   The expected number of names, used to size the initial allocation.
+ *
+ * @return int
+ *   1 on success and -1 on error.
+ */
+int name_set_initialize(name_set *set, size_t total) {
+  memset(set, 0, sizeof(name_set));
+
+  set->slots_total = NAME_SET_SLOTS_MINIMUM;
+  while (set->slots_total < total * 2) {
+    set->slots_total *= 2;
+  }
+
+  set->slots = calloc(set->slots_total, sizeof(uint32_t));
+  if (set->slots == NULL) {
+    memset(set, 0, sizeof(name_set));
+    return -1;
+  }
+
+  set->strings_size = total * NAME_SET_STRING_AVERAGE;
+  if (set->strings_size < NAME_SET_STRING_AVERAGE * NAME_SET_SLOTS_MINIMUM) {
+    set->strings_size = NAME_SET_STRING_AVERAGE * NAME_SET_SLOTS_MINIMUM;
+  }
+
+  set->strings = malloc(set->strings_size);
+  if (set->strings == NULL) {
+    free(set->slots);
+    memset(set, 0, sizeof(name_set));
+    return -1;
+  }
+
+  // offset 0 is reserved so that 0 can represent an empty slot.
+  set->strings[0] = 0;
+  set->strings_used = 1;
+
+  return 1;
+}
+
+/**
+ * Releases the memory used by a name set.
+ *
+ * @param name_set *set
+ *   The name set to release.
+ */
+void name_set_destroy(name_set *set) {
+  if (set->slots != NULL) {
+    free(set->slots);
+  }
+
+  if (set->strings != NULL) {
+    free(set->strings);
+  }
+
+  memset(set, 0, sizeof(name_set));
+}
+
+/**
+ * Finds the slot of a name in the name set.
+ *
+ * @param const name_set *set
+ *   The name set to search.
+ * @param const char *name
+ *   The name to find.
+ * @param int length
+ *   The length of the name.
+ *
+ * @return size_t
+ *   The slot containing the name or the empty slot where the name would be inserted.
+ */
+size_t name_set_slot(const name_set *set, const char *name, int length) {
+  size_t mask = set->slots_total - 1;
+  size_t slot = name_set_hash(name, length) & mask;
+
+  while (set->slots[slot] != 0) {
+    const char *stored = set->strings + set->slots[slot];
+
+    if ((unsigned char) stored[0] == length && memcmp(stored + 1, name, length) == 0) {
+      break;
+    }
+
+    slot = (slot + 1) & mask;
+  } // while
+
+  return slot;
+}
+
+/**
+ * Checks if a name exists in the name set.
+ *
+ * @param const name_set *set
+ *   The name set to search.
+ * @param const char *name
+ *   The name to find.
+ * @param int length
+ *   The length of the name.
+ *
+ * @return int
+ *   1 when found and 0 when not found.
+ */
+int name_set_find(const name_set *set, const char *name, int length) {
+  if (set->slots == NULL || length <= 0 || length > NAME_SET_LENGTH_MAX) {
+    return 0;
+  }
+
+  return set->slots[name_set_slot(set, name, length)] != 0;
+}
+
+/**
+ * Doubles the size of the name set table, re-inserting all names.
+ *
+ * @param name_set *set
+ *   The name set to grow.
+ *
+ * @return int
+ *   1 on success and -1 on error.
+ */
+int name_set_grow(name_set *set) {
+  uint32_t *slots_old = set->slots;
+  size_t slots_total_old = set->slots_total;
+  size_t i = 0;
+
+  set->slots = calloc(slots_total_old * 2, sizeof(uint32_t));
+  if (set->slots == NULL) {
+    set->slots = slots_old;
+    return -1;
+  }
+
+  set->slots_total = slots_total_old * 2;
+
+  for (; i < slots_total_old; i++) {
+    if (slots_old[i] == 0) {
+      continue;
+    }
+
+    const char *stored = set->strings + slots_old[i];
+    set->slots[name_set_slot(set, stored + 1, (unsigned char) stored[0])] = slots_old[i];
+  } // for
+
+  free(slots_old);
+
+  return 1;
+}
+
+/**
+ * Inserts a name into the name set.
+ *
+ * @param name_set *set
+ *   The name set to insert into.
+ * @param const char *name
+ *   The name to insert.
+ * @param int length
+ *   The length of the name, at most NAME_SET_LENGTH_MAX.
+ *
+ * @return int
+ *   1 when inserted, 0 when the name already exists, and -1 on error.
+ */
+int name_set_insert(name_set *set, const char *name, int length) {
+  size_t slot = 0;
+
+  if (set->slots == NULL || length <= 0 || length > NAME_SET_LENGTH_MAX) {
+    return -1;
+  }
+
+  // keep the table at most half full so that the probe sequences stay short.
+  if ((set->used + 1) * 2 > set->slots_total) {
+    if (name_set_grow(set) < 0) {
+      return -1;
+    }
+  }
+
+  slot = name_set_slot(set, name, length);
+
+  if (set->slots[slot] != 0) {
+    return 0;
+  }
+
+  if (set->strings_used + length + 1 > set->strings_size) {
+    size_t strings_size = set->strings_size * 2;
+    char *strings = NULL;
+
+    if (strings_size > UINT32_MAX) {
+      return -1;
+    }
+
+    strings = realloc(set->strings, strings_size);
+    if (strings == NULL) {
+      return -1;
+    }
+
+    set->strings = strings;
+    set->strings_size = strings_size;
+  }
+
+  set->strings[set->strings_used] = (char) length;
+  memcpy(set->strings + set->strings_used + 1, name, length);
+
+  set->slots[slot] = (uint32_t) set->strings_used;
+  set->strings_used += length + 1;
+  set->used++;
+
+  return 1;
+}
+
+/**
+ * Removes a name from the name set.
+ *
+ * The following entries of the probe sequence are shifted back so that no tombstones are needed.
+ * The space used by the name in the arena is not reclaimed until the name set is rebuilt.
+ *
+ * @param name_set *set
+ *   The name set to remove from.
+ * @param const char *name
+ *   The name to remove.
+ * @param int length
+ *   The length of the name.
+ *
+ * @return int
+ *   1 when removed and 0 when the name does not exist.
+ */
+int name_set_remove(name_set *set, const char *name, int length) {
+  size_t mask = 0;
+  size_t slot = 0;
+  size_t next = 0;
+
+  if (set->slots == NULL || length <= 0 || length > NAME_SET_LENGTH_MAX) {
+    return 0;
+  }
+
+  mask = set->slots_total - 1;
+  slot = name_set_slot(set, name, length);
+
+  if (set->slots[slot] == 0) {
+    return 0;
+  }
+
+  set->slots[slot] = 0;
+  set->used--;
+
+  for (next = (slot + 1) & mask; set->slots[next] != 0; next = (next + 1) & mask) {
+    const char *stored = set->strings + set->slots[next];
+    size_t home = name_set_hash(stored + 1, (unsigned char) stored[0]) & mask;
+
+    // only move the entry when the emptied slot lies between its home slot and its current slot.
+    if ((next > slot && (home <= slot || home > next)) || (next < slot && (home <= slot && home > next))) {
+      set->slots[slot] = set->slots[next];
+      set->slots[next] = 0;
+      slot = next;
+    }
+  } // for
+
+  return 1;
+}
+
+/**
+ * Normalizes a name for comparison against role names, validating it at the same time.
+ *
+ * Postgresql folds unquoted role names to lower case and ldap uids are generally case insensitive, so the name is converted to lower case.
+ *
+ * @param const char *name
+ *   The name to normalize (not required to be NULL terminated).
+ * @param int name_length
+ *   The length of the name.
+ * @param char *normalized
+ *   The normalized and NULL terminated name, must be at least PACKET_SIZE_INPUT + 1 in size.
+ *
+ * @return int
+ *   1 when the name is valid and 0 when it is not.
+ */
+int name_normalize(const char *name, int name_length, char *normalized) {
+  int i = 0;
+
+  if (name_length <= 0 || name_length > PACKET_SIZE_INPUT) {
+    return 0;
+  }
+
+  for (; i < name_length; i++) {
+    if (name[i] >= 'A' && name[i] <= 'Z') {
+      normalized[i] = name[i] - 'A' + 'a';
+    }
+    else if ((name[i] >= 'a' && name[i] <= 'z') || (name[i] >= '0' && name[i] <= '9') || name[i] == '-' || name[i] == '_') {
+      normalized[i] = name[i];
+    }
+    else {
+      return 0;
+    }
+  } // for
+
+  normalized[name_length] = 0;
+
+  return 1;
+}
+
+/**
+ * Loads the first column of every row returned by a query into a name set.
+ *
+ * @param PGconn *connection
+ *   The database connection.
+ * @param const char *query
+ *   The query to execute.
+ * @param name_set *set
+ *   The name set to load into.
+ *
+ * @return int
+ *   1 on success and -1 on error.
+ */
+int database_load_names(PGconn *connection, const char *query, name_set *set) {
+  PGresult *result = NULL;
+  int status = 0;
+  int rows = 0;
+  int i = 0;
+
+  result = PQexec(connection, query);
+  status = PQresultStatus(result);
+
+  if (status != PGRES_TUPLES_OK) {
+    log_write(LOG_ERR, "ERROR: failed to process sql query '%s', reason (%u): %s.\n", query, status, PQerrorMessage(connection));
+    PQclear(result);
+    return -1;
+  }
+
+  rows = PQntuples(result);
+
+  for (; i < rows; i++) {
+    const char *name = PQgetvalue(result, i, 0);
+    int name_length = PQgetlength(result, i, 0);
+
+    // names too long to have been created by this program are not relevant.
+    if (name_length > NAME_SET_LENGTH_MAX) {
+      continue;
+    }
+
+    if (name_set_insert(set, name, name_length) < 0) {
+      log_write(LOG_ERR, "ERROR: failed to allocate memory when loading the results of the sql query '%s'.\n", query);
+      PQclear(result);
+      return -1;
+    }
+  } // for
+
+  PQclear(result);
+
+  return 1;
+}
+/**
+ * Executes a single query, logging any errors.
+ *
+ * @param PGconn *connection
+ *   The database connection.
+ * @param const char *query
+ *   The query to execute.
+ *
+ * @return int
+ *   1 on success and -1 on error.
+ */
+int database_execute(PGconn *connection, const char *query) {
+  PGresult *result = NULL;
+  int status = 0;
+
+  MACRO_PROBE_1(sql_start, query);
+
+  result = PQexec(connection, query);
+  status = PQresultStatus(result);
+
+  MACRO_PROBE_2(sql_finish, query, status);
+
+  if (status != PGRES_EMPTY_QUERY && status != PGRES_COMMAND_OK && status != PGRES_TUPLES_OK) {
+    log_write(LOG_ERR, "ERROR: failed to process sql query '%s', reason (%u): %s.\n", query, status, PQerrorMessage(connection));
+    PQclear(result);
+    return -1;
+  }
+
+  PQclear(result);
+
+  return 1;
+}
+
+/**
+ * Initializes the database limiter.
+ *
+ * @param limiter_data *limiter
+ *   The limiter to initialize.
+ *
+ * @return int
+ *   1 on success and -1 on error.
+ */
+int limiter_initialize(limiter_data *limiter) {
+  pthread_condattr_t attributes;
+
+  // the waiting requests have CLOCK_MONOTONIC deadlines.
+  if (pthread_condattr_init(&attributes) != 0 || pthread_condattr_setclock(&attributes, CLOCK_MONOTONIC) != 0 || pthread_cond_init(&limiter->released, &attributes) != 0) {
+    log_write(LOG_ERR, "ERROR: failed to initialize the database limiter condition.\n");
+    return -1;
+  }
+
+  pthread_condattr_destroy(&attributes);
+  pthread_mutex_init(&limiter->lock, NULL);
+
+  limiter->limit = LIMITER_INITIAL;
+  limiter->window_minimum = UINT32_MAX;
+
+  return 1;
+}
+
+/**
+ * Waits until fewer than the limit of requests are changing the database, and then counts this request as one of them.
+ *
+ * @param limiter_data *limiter
+ *   The database limiter.
+ * @param const struct timespec *deadline
+ *   The CLOCK_MONOTONIC deadline of the request, 0 for no deadline.
+ *
+ * @return int
+ *   1 on success and -1 when the deadline passed while waiting.
+ */
+int limiter_acquire(limiter_data *limiter, const struct timespec *deadline) {
+  const int has_deadline = deadline->tv_sec != 0 || deadline->tv_nsec != 0;
+
+  pthread_mutex_lock(&limiter->lock);
+
+  if (limiter->in_flight >= limiter->limit) {
+    limiter->total_waited++;
+    limiter->waiting++;
+
+    while (limiter->in_flight >= limiter->limit) {
+      if (!has_deadline) {
+        pthread_cond_wait(&limiter->released, &limiter->lock);
+      }
+      else if (pthread_cond_timedwait(&limiter->released, &limiter->lock, deadline) == ETIMEDOUT) {
+        limiter->waiting--;
+        limiter->total_expired++;
+        pthread_mutex_unlock(&limiter->lock);
+        return -1;
+      }
+    } // while
+
+    limiter->waiting--;
+  }
+
+  limiter->in_flight++;
+  limiter->total_acquired++;
+
+  pthread_mutex_unlock(&limiter->lock);
+
+  return 1;
+}
+
+/**
+ * Counts a request as no longer changing the database, and adjusts the limit using its latency and result.
+ *
+ * The limit is increased by one after each limit of requests in a row that were fast while the limit was in use (additive increase).
+ * An error or a latency above LIMITER_TOLERANCE times the baseline reduces the limit to LIMITER_BACKOFF percent (multiplicative decrease).
+ * Only requests started after the last decrease may decrease it again, so that the requests already slowed by the same contention count once.
+ *
+ * @param limiter_data *limiter
+ *   The database limiter.
+ * @param const struct timespec *started
+ *   The CLOCK_MONOTONIC time the request acquired the limiter.
+ * @param int result
+ *   1 on success, -3 when the request stopped at its deadline (which is not a sample), and any other value on error.
+ */
+void limiter_release(limiter_data *limiter, const struct timespec *started, int result) {
+  struct timespec now;
+  uint32_t latency = 0;
+  int contended = 0;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  latency = (now.tv_sec - started->tv_sec) * 1000000 + (now.tv_nsec - started->tv_nsec) / 1000;
+
+  pthread_mutex_lock(&limiter->lock);
+
+  if (result != -3) {
+    if (result > 0) {
+      if (latency < limiter->window_minimum) {
+        limiter->window_minimum = latency;
+      }
+
+      // the baseline is the lowest latency of the previous window, so that it follows the database without being pulled up by a single slow request.
+      if (++limiter->window_samples >= LIMITER_WINDOW) {
+        limiter->baseline = limiter->window_minimum;
+        limiter->window_minimum = UINT32_MAX;
+        limiter->window_samples = 0;
+      }
+
+      contended = limiter->baseline > 0 && latency > LIMITER_LATENCY_FLOOR && latency > limiter->baseline * LIMITER_TOLERANCE;
+    }
+    else {
+      contended = 1;
+    }
+
+    if (contended) {
+      const int before = started->tv_sec < limiter->decreased.tv_sec || (started->tv_sec == limiter->decreased.tv_sec && started->tv_nsec < limiter->decreased.tv_nsec);
+
+      if (!before) {
+        limiter->limit = limiter->limit * LIMITER_BACKOFF / 100;
+
+        if (limiter->limit < LIMITER_MINIMUM) {
+          limiter->limit = LIMITER_MINIMUM;
+        }
+
+        limiter->increase_credit = 0;
+        limiter->decreased = now;
+        limiter->total_decreased++;
+      }
+    }
+    // only a limit that is in use is increased, otherwise an idle service would grow it without bound.
+    else if (limiter->in_flight >= limiter->limit || limiter->waiting > 0) {
+      if (++limiter->increase_credit >= limiter->limit && limiter->limit < LIMITER_MAXIMUM) {
+        limiter->limit++;
+        limiter->increase_credit = 0;
+        limiter->total_increased++;
+      }
+    }
+  }
+
+  limiter->in_flight--;
+
+  pthread_cond_broadcast(&limiter->released);
+  pthread_mutex_unlock(&limiter->lock);
+}
+
+/**
+ * Builds one of the statements made by grant_role_statements() for a given user name.
+ *
+ * @param char *query
+ *   The built query, must be at least PSQL_QUERY_LENGTH in size.
+ * @param const char *statement
+ *   The statement, such as PSQL_SELECT, PSQL_CREATE, or the prepared grant (see populate_templates()).
+ * @param const char *user_name
+ *   Name of the user/role.
+ *
+ * @return int
+ *   The length of the query, before any truncation.
+ */
+int grant_role_query(char *query, const char *statement, const char *user_name) {
+  return snprintf(query, PSQL_QUERY_LENGTH, statement, user_name);
+}
+
+/**
+ * Connects to the database, creates the role when it does not exist, and grants it the group.
+ *
+ * The connection information and the grant statement are built once at startup, see populate_templates().
+ * The queries are built in the worker buffers, so no memory is allocated here (libpq does allocate).
+ *
+ * @param shared_data *shared
+ *   The data shared between the parent and all threads.
+ * @param worker_data *worker
+ *   The buffers of the calling worker.
+ * @param const char *user_name
+ *   Name of the user/role to grant access to.
+ *
+ * @return int
+ *   1 on success, -1 on sql error, -2 when the database could not be connected to, and -3 when the deadline passed before the role was created.
+ *
+ * @see grant_role_in_database()
+ */
+int grant_role_statements(shared_data *shared, worker_data *worker, const char *user_name) {
+  PGconn *connection = NULL;
+  short role_exists = 0;
+
+  MACRO_PROBE_1(sql_connect_start, user_name);
+
+  connection = PQconnectdb(shared->psql_connection);
+
+  MACRO_PROBE_2(sql_connect_finish, user_name, connection == NULL ? CONNECTION_BAD : PQstatus(connection));
+
+  if (connection == NULL) {
+    log_write(LOG_ERR, "ERROR: failed to establish the postgresql connection while processing user '%s', group '%s', and database '%s', reason: NULL returned.\n", user_name, shared->parameter_group, shared->parameter_database);
+    breaker_record(&shared->breaker_database, 0);
+    return -2;
+  }
+  else if (PQstatus(connection) != CONNECTION_OK) {
+    log_write(LOG_ERR, "ERROR: failed to establish the postgresql connection while processing user '%s', group '%s', and database '%s', reason (%u): %s.\n", user_name, shared->parameter_group, shared->parameter_database, PQstatus(connection), PQerrorMessage(connection));
+    PQfinish(connection);
+    breaker_record(&shared->breaker_database, 0);
+    return -2;
+  }
+
+  breaker_record(&shared->breaker_database, 1);
+  trace_stage(worker->trace, TRACE_SQL_CONNECT);
+
+  // check to see if role exists.
+  {
+    PGresult *result = NULL;
+    int status = 0;
+
+    grant_role_query(worker->query, PSQL_SELECT, user_name);
+
+    MACRO_PROBE_1(sql_start, worker->query);
+
+    result = PQexec(connection, worker->query);
+    status = PQresultStatus(result);
+
+    MACRO_PROBE_2(sql_finish, worker->query, status);
+
+    if (status == PGRES_EMPTY_QUERY) {
+      //role_exists = 0;
+    }
+    else if (status == PGRES_COMMAND_OK || status == PGRES_TUPLES_OK) {
+      if (PQnfields(result) > 0 && PQntuples(result) > 0) {
+        role_exists = 1;
+      }
+    }
+    else {
+      PQclear(result);
+      PQfinish(connection);
+      return -1;
+    }
+
+    PQclear(result);
+    result = NULL;
+
+    trace_stage(worker->trace, TRACE_SQL_SELECT);
+  }
+
+  // once the role is created, the grant is always made so that the role is not left without the group.
+  if (deadline_expired(&worker->deadline)) {
+    PQfinish(connection);
+    return -3;
+  }
+
+  // Create the specified role.
+  if (role_exists == 0) {
+    grant_role_query(worker->query, PSQL_CREATE, user_name);
+
+    if (database_execute(connection, worker->query) < 0) {
+      PQfinish(connection);
+      return -1;
+    }
+
+    trace_stage(worker->trace, TRACE_SQL_CREATE);
+  }
+
+  // grant the user access to the specified role, the group name is already in the statement.
+  grant_role_query(worker->query, shared->psql_grant, user_name);
+
+  if (database_execute(connection, worker->query) < 0) {
+    PQfinish(connection);
+    return -1;
+  }
+
+  trace_stage(worker->trace, TRACE_SQL_GRANT);
+
+  PQfinish(connection);
+
+  return 1;
+}
+
+/**
+ * Grants the user access to the specified group in the postgresql database.
+ *
+ * While the database circuit is open, this fails immediately without connecting.
+ * Only the limit of the database limiter may change the database at the same time, the others wait (see limiter_release()).
+ * When the deadline of the request passes while waiting, before the connection, or before the role is created, the database is not changed.
+ *
+ * @param shared_data *shared
+ *   The data shared between the parent and all threads.
+ * @param worker_data *worker
+ *   The buffers of the calling worker.
+ * @param const char *user_name
+ *   Name of the user/role to grant access to.
+ *
+ * @return int
+ *   1 on success, -1 on sql error, -2 when the database could not be connected to (or the circuit is open), and -3 when the deadline passed.
+ */
+int grant_role_in_database(shared_data *shared, worker_data *worker, const char *user_name) {
+  struct timespec started;
+  int result = 0;
+
+  if (deadline_expired(&worker->deadline)) {
+    return -3;
+  }
+
+  if (!breaker_allow(&shared->breaker_database)) {
+    return -2;
+  }
+
+  if (limiter_acquire(&shared->limiter_database, &worker->deadline) < 0) {
+    return -3;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &started);
+
+  result = grant_role_statements(shared, worker, user_name);
+
+  limiter_release(&shared->limiter_database, &started, result);
+
+  return result;
+}
+
+/**
+ * Splits the ldap server list into the servers of the ldap pool.
+ *
+ * @param ldap_pool_data *pool
+ *   The pool with the list and hedge parameters already populated.
+ *
+ * @return int
+ *   1 on success and -1 on error.
+ */
+int ldap_pool_initialize(ldap_pool_data *pool) {
+  char *position = pool->list;
+
+  pool->total = 0;
+  pool->selections = 0;
+  memset(pool->servers, 0, sizeof(ldap_pool_server) * LDAP_POOL_SERVERS_MAX);
+
+  if (pool->list[0] == 0) {
+    snprintf(pool->list, LDAP_POOL_LIST_LENGTH, "%s", LDAP_SERVER);
+  }
+
+  while (*position != 0) {
+    while (*position == ' ' || *position == ',') {
+      *position = 0;
+      position++;
+    } // while
+
+    if (*position == 0) {
+      break;
+    }
+
+    if (pool->total == LDAP_POOL_SERVERS_MAX) {
+      log_write(LOG_ERR, "ERROR: only %u ldap servers are supported in '%s'.\n", LDAP_POOL_SERVERS_MAX, ENVIRONMENT_LDAP_SERVERS);
+      return -1;
+    }
+
+    pool->servers[pool->total].uri = position;
+    breaker_initialize(&pool->servers[pool->total].breaker, position);
+    pthread_mutex_init(&pool->servers[pool->total].tls_lock, NULL);
+    pool->total++;
+
+    while (*position != 0 && *position != ' ' && *position != ',') {
+      position++;
+    } // while
+  } // while
+
+  if (pool->total == 0) {
+    log_write(LOG_ERR, "ERROR: no ldap servers are defined in '%s'.\n", ENVIRONMENT_LDAP_SERVERS);
+    return -1;
+  }
+
+  if (pool->spares > LDAP_POOL_SPARES_MAX) {
+    log_write(LOG_ERR, "ERROR: only %u spare connections for each ldap server are supported in '%s'.\n", LDAP_POOL_SPARES_MAX, ENVIRONMENT_LDAP_SPARES);
+    return -1;
+  }
+
+  // the saved sessions are OpenSSL sessions, so resumption is only possible when libldap uses OpenSSL.
+  {
+    char *package = NULL;
+
+    ldap_get_option(NULL, LDAP_OPT_X_TLS_PACKAGE, &package);
+
+    pool->tls_resume = package != NULL && strcmp(package, LDAP_POOL_TLS_PACKAGE) == 0;
+
+    if (!pool->tls_resume) {
+      log_write(LOG_INFO, "INFO: ldap tls session resumption is disabled because libldap uses the tls package '%s' instead of '%s'.\n", package == NULL ? "(none)" : package, LDAP_POOL_TLS_PACKAGE);
+    }
+
+    if (package != NULL) {
+      ldap_memfree(package);
+    }
+  }
+
+  pthread_mutex_init(&pool->lock, NULL);
+
+  return 1;
+}
+
+/**
+ * Chooses the ldap server with the lowest average latency whose circuit is closed.
+ *
+ * Every LDAP_POOL_EXPLORE selections, the next server is chosen in turn instead, so that the slower servers are still measured.
+ * The circuit states are read without the breaker locks, and the open servers only count a rejection when no server is chosen.
+ *
+ * @param ldap_pool_data *pool
+ *   The ldap pool to choose from.
+ * @param int exclude
+ *   A server index to not choose, such as the server already searched, or -1 to allow any server.
+ *
+ * @return int
+ *   The index of the chosen server or -1 when there is no server to choose, such as when every circuit is open.
+ */
+int ldap_pool_select(ldap_pool_data *pool, int exclude) {
+  int chosen = -1;
+  int index = 0;
+
+  pthread_mutex_lock(&pool->lock);
+
+  pool->selections++;
+
+  if (pool->selections % LDAP_POOL_EXPLORE == 0) {
+    int offset = 0;
+
+    for (; offset < pool->total; offset++) {
+      index = (pool->selections / LDAP_POOL_EXPLORE + offset) % pool->total;
+
+      if (index != exclude && __atomic_load_n(&pool->servers[index].breaker.state, __ATOMIC_RELAXED) != BREAKER_OPEN) {
+        chosen = index;
+        break;
+      }
+    } // for
+  }
+
+  if (chosen < 0) {
+    for (index = 0; index < pool->total; index++) {
+      if (index == exclude || __atomic_load_n(&pool->servers[index].breaker.state, __ATOMIC_RELAXED) == BREAKER_OPEN) {
+        continue;
+      }
+
+      if (chosen < 0 || pool->servers[index].latency_average < pool->servers[chosen].latency_average) {
+        chosen = index;
+      }
+    } // for
+  }
+
+  // the rejection is counted once for each open server, only when no server could be chosen.
+  // the total_rejected of the ldap servers is only changed here, while the pool lock is held.
+  if (chosen < 0) {
+    for (index = 0; index < pool->total; index++) {
+      if (index != exclude && __atomic_load_n(&pool->servers[index].breaker.state, __ATOMIC_RELAXED) == BREAKER_OPEN) {
+        pool->servers[index].breaker.total_rejected++;
+      }
+    } // for
+  }
+
+  pthread_mutex_unlock(&pool->lock);
+
+  return chosen;
+}
+
+/**
+ * Compares two latencies for qsort().
+ */
+int ldap_pool_compare(const void *a, const void *b) {
+  const uint32_t first = *(const uint32_t *) a;
+  const uint32_t second = *(const uint32_t *) b;
+
+  return first < second ? -1 : first > second;
+}
+
+/**
+ * Records the outcome of using an ldap server.
+ *
+ * The outcome is also recorded in the circuit breaker of the server.
+ *
+ * @param ldap_pool_data *pool
+ *   The ldap pool the server belongs to.
+ * @param int index
+ *   The index of the server.
+ * @param uint32_t latency
+ *   The latency in microseconds to add to the average and the percentile, or 0 to not record a latency.
+ * @param int success
+ *   1 when the server answered and 0 when it failed or timed out.
+ */
+void ldap_pool_record(ldap_pool_data *pool, int index, uint32_t latency, int success) {
+  ldap_pool_server *server = &pool->servers[index];
+
+  pthread_mutex_lock(&pool->lock);
+
+  server->total_searches++;
+
+  if (latency > 0) {
+    if (server->latency_average == 0) {
+      server->latency_average = latency;
+    }
+    else {
+      server->latency_average = server->latency_average - server->latency_average / 8 + latency / 8;
+    }
+
+    server->latencies[server->latencies_total % LDAP_POOL_SAMPLES] = latency;
+    server->latencies_total++;
+
+    // the percentile is recalculated after every quarter of the samples are replaced.
+    if (server->latencies_total >= LDAP_POOL_SAMPLES && server->latencies_total % (LDAP_POOL_SAMPLES / 4) == 0) {
+      uint32_t sorted[LDAP_POOL_SAMPLES];
+
+      memcpy(sorted, server->latencies, sizeof(uint32_t) * LDAP_POOL_SAMPLES);
+      qsort(sorted, LDAP_POOL_SAMPLES, sizeof(uint32_t), ldap_pool_compare);
+
+      server->hedge_delay = sorted[(LDAP_POOL_SAMPLES - 1) * pool->hedge_percentile / 100];
+    }
+  }
+
+  if (!success) {
+    server->total_failures++;
+  }
+
+  pthread_mutex_unlock(&pool->lock);
+
+  breaker_record(&server->breaker, success);
+}
+
+/**
+ * Gets the time after which a search on the given server is hedged.
+ *
+ * @param ldap_pool_data *pool
+ *   The ldap pool the server belongs to.
+ * @param int index
+ *   The index of the server.
+ *
+ * @return uint32_t
+ *   The delay in microseconds.
+ */
+uint32_t ldap_pool_hedge_delay(ldap_pool_data *pool, int index) {
+  uint32_t delay = 0;
+
+  pthread_mutex_lock(&pool->lock);
+  delay = pool->servers[index].hedge_delay;
+  pthread_mutex_unlock(&pool->lock);
+
+  if (delay == 0) {
+    return LDAP_POOL_HEDGE_DELAY_DEFAULT;
+  }
+
+  if (delay < LDAP_POOL_HEDGE_DELAY_MINIMUM) {
+    return LDAP_POOL_HEDGE_DELAY_MINIMUM;
+  }
+
+  return delay;
+}
+
+/**
+ * Offers the saved tls session of an ldap server for resumption, this is called by libldap before each tls handshake.
+ *
+ * @param LDAP *ldap_settings
+ *   The connection being established.
+ * @param void *ssl
+ *   The OpenSSL SSL of the connection.
+ * @param void *context
+ *   The OpenSSL SSL_CTX of the connection.
+ * @param void *argument
+ *   The ldap_pool_server being connected to.
+ *
+ * @return int
+ *   0, a session that cannot be resumed only costs a full handshake.
+ *
+ * @see: LDAP_OPT_X_TLS_CONNECT_CB
+ */
+int ldap_pool_tls_connect(LDAP *ldap_settings, void *ssl, void *context, void *argument) {
+  ldap_pool_server *server = (ldap_pool_server *) argument;
+
+  (void) ldap_settings;
+  (void) context;
+
+  pthread_mutex_lock(&server->tls_lock);
+
+  if (server->tls_session != NULL) {
+    SSL_set_session((SSL *) ssl, server->tls_session);
+  }
+
+  pthread_mutex_unlock(&server->tls_lock);
+
+  return 0;
+}
+
+/**
+ * Prepares a new connection to an ldap server to resume the saved tls session of that server.
+ *
+ * @param ldap_pool_data *pool
+ *   The ldap pool the server belongs to.
+ * @param int index
+ *   The index of the server.
+ * @param LDAP *ldap_settings
+ *   The initialized connection, before the bind.
+ */
+void ldap_pool_tls_prepare(ldap_pool_data *pool, int index, LDAP *ldap_settings) {
+  if (!pool->tls_resume) {
+    return;
+  }
+
+  ldap_set_option(ldap_settings, LDAP_OPT_X_TLS_CONNECT_CB, (void *) ldap_pool_tls_connect);
+  ldap_set_option(ldap_settings, LDAP_OPT_X_TLS_CONNECT_ARG, (void *) &pool->servers[index]);
+}
+
+/**
+ * Saves the tls session of a bound connection for the next handshake with that server to resume.
+ *
+ * This is done after the bind, because a tls 1.3 server sends the session ticket after the handshake.
+ *
+ * @param ldap_pool_data *pool
+ *   The ldap pool the server belongs to.
+ * @param int index
+ *   The index of the server.
+ * @param LDAP *ldap_settings
+ *   The bound connection, a connection without tls is ignored.
+ */
+void ldap_pool_tls_save(ldap_pool_data *pool, int index, LDAP *ldap_settings) {
+  ldap_pool_server *server = &pool->servers[index];
+  SSL *ssl = NULL;
+  SSL_SESSION *session = NULL;
+  SSL_SESSION *replaced = NULL;
+  int resumed = 0;
+
+  if (!pool->tls_resume) {
+    return;
+  }
+
+  if (ldap_get_option(ldap_settings, LDAP_OPT_X_TLS_SSL_CTX, &ssl) != LDAP_OPT_SUCCESS || ssl == NULL) {
+    return;
+  }
+
+  resumed = SSL_session_reused(ssl);
+  session = SSL_get1_session(ssl);
+
+  if (session != NULL && !SSL_SESSION_is_resumable(session)) {
+    SSL_SESSION_free(session);
+    session = NULL;
+  }
+
+  pthread_mutex_lock(&server->tls_lock);
+
+  if (session != NULL) {
+    replaced = server->tls_session;
+    server->tls_session = session;
+  }
+
+  server->total_handshakes++;
+
+  if (resumed) {
+    server->total_resumed++;
+  }
+
+  pthread_mutex_unlock(&server->tls_lock);
+
+  if (replaced != NULL) {
+    SSL_SESSION_free(replaced);
+  }
+}
+
+/**
+ * Connects and binds a new connection to an ldap server of the ldap pool.
+ *
+ * The bind is not retried here, a failure is recorded by the caller and the retry (if any) is made after a backoff.
+ *
+ * @param ldap_pool_data *pool
+ *   The ldap pool the server belongs to.
+ * @param int index
+ *   The index of the server.
+ *
+ * @return LDAP *
+ *   The bound ldap connection or NULL on error.
+ */
+LDAP *ldap_pool_handshake(ldap_pool_data *pool, int index) {
+  const char *uri = pool->servers[index].uri;
+  LDAP *ldap_settings = NULL;
+  int ldap_status = 0;
+
+  ldap_status = ldap_initialize(&ldap_settings, uri);
+
+  if (ldap_status != LDAP_SUCCESS) {
+    log_write(LOG_ERR, "ERROR: failed to initialize ldap settings for the ldap server '%s' with the ldap error (%d): %s.\n", uri, ldap_status, ldap_err2string(ldap_status));
+    return NULL;
+  }
+
+  ldap_pool_tls_prepare(pool, index, ldap_settings);
+
+  // a bind is ldap's way of saying 'login' or 'authenticate', do no use string to search with bind.
+  ldap_status = ldap_simple_bind_s(ldap_settings, "", "");
+
+  if (ldap_status == LDAP_SUCCESS) {
+    ldap_pool_tls_save(pool, index, ldap_settings);
+    return ldap_settings;
+  }
+
+  log_write(LOG_ERR, "ERROR: failed to connect and bind to the ldap server '%s' with the ldap error (%d): %s\n", uri, ldap_status, ldap_err2string(ldap_status));
+
+  ldap_unbind(ldap_settings);
+
+  return NULL;
+}
+
+/**
+ * Gets a bound connection to an ldap server of the ldap pool.
+ *
+ * A spare connection is used when there is one, otherwise a new connection is made, see ldap_pool_handshake().
+ *
+ * @param ldap_pool_data *pool
+ *   The ldap pool the server belongs to.
+ * @param int index
+ *   The index of the server.
+ * @param trace_data *trace
+ *   The trace of the current request, may be NULL.
+ *
+ * @return LDAP *
+ *   The bound ldap connection or NULL on error.
+ */
+LDAP *ldap_pool_connect(ldap_pool_data *pool, int index, trace_data *trace) {
+  ldap_pool_server *server = &pool->servers[index];
+  LDAP *ldap_settings = NULL;
+
+  while (1) {
+    struct pollfd descriptor;
+
+    pthread_mutex_lock(&pool->lock);
+
+    if (server->spares_total == 0) {
+      pthread_mutex_unlock(&pool->lock);
+      break;
+    }
+
+    ldap_settings = server->spares[0];
+    server->spares_total--;
+    memmove(server->spares, server->spares + 1, sizeof(LDAP *) * server->spares_total);
+    memmove(server->spares_created, server->spares_created + 1, sizeof(time_t) * server->spares_total);
+
+    pthread_mutex_unlock(&pool->lock);
+
+    descriptor.fd = -1;
+    descriptor.events = POLLIN;
+    descriptor.revents = 0;
+    ldap_get_option(ldap_settings, LDAP_OPT_DESC, &descriptor.fd);
+
+    // an idle spare has nothing to read, unless the server closed it (or sent a notice of disconnection).
+    if (descriptor.fd >= 0 && poll(&descriptor, 1, 0) == 0) {
+      pthread_mutex_lock(&pool->lock);
+      server->total_spares_used++;
+      pthread_mutex_unlock(&pool->lock);
+
+      trace_stage(trace, TRACE_LDAP_BIND);
+      return ldap_settings;
+    }
+
+    ldap_unbind(ldap_settings);
+  } // while
+
+  ldap_settings = ldap_pool_handshake(pool, index);
+
+  if (ldap_settings != NULL) {
+    trace_stage(trace, TRACE_LDAP_BIND);
+  }
+
+  return ldap_settings;
+}
+
+/**
+ * Keeps the spare connections of each ldap server bound and ready, so that a burst of requests (such as after a network failure) does not wait on handshakes.
+ *
+ * Spares older than LDAP_POOL_SPARE_AGE are replaced and the spares of a server whose circuit is open are closed.
+ * When the spares wanted was reduced, the oldest spares beyond it are closed.
+ * A failed handshake is recorded in the circuit breaker of the server.
+ *
+ * @param ldap_pool_data *pool
+ *   The ldap pool to prewarm.
+ */
+void ldap_pool_prewarm(ldap_pool_data *pool) {
+  const time_t now = time(NULL);
+  int index = 0;
+
+  for (; index < pool->total; index++) {
+    ldap_pool_server *server = &pool->servers[index];
+    LDAP *closing[LDAP_POOL_SPARES_MAX];
+    int closing_total = 0;
+    int missing = 0;
+    int open = 0;
+    int spare = 0;
+
+    pthread_mutex_lock(&server->breaker.lock);
+    open = server->breaker.state == BREAKER_OPEN;
+    pthread_mutex_unlock(&server->breaker.lock);
+
+    pthread_mutex_lock(&pool->lock);
+
+    // the oldest spares are first, those beyond the spares wanted are closed as well (see handler_control()).
+    while (closing_total < server->spares_total && (open || now - server->spares_created[closing_total] >= LDAP_POOL_SPARE_AGE || server->spares_total - closing_total > pool->spares)) {
+      closing[closing_total] = server->spares[closing_total];
+      closing_total++;
+    } // while
+
+    if (closing_total > 0) {
+      server->spares_total -= closing_total;
+      memmove(server->spares, server->spares + closing_total, sizeof(LDAP *) * server->spares_total);
+      memmove(server->spares_created, server->spares_created + closing_total, sizeof(time_t) * server->spares_total);
+    }
+
+    if (!open) {
+      missing = pool->spares - server->spares_total;
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+
+    for (; spare < closing_total; spare++) {
+      ldap_unbind(closing[spare]);
+    } // for
+
+    for (; missing > 0; missing--) {
+      LDAP *ldap_settings = ldap_pool_handshake(pool, index);
+
+      if (ldap_settings == NULL) {
+        breaker_record(&server->breaker, 0);
+        break;
+      }
+
+      pthread_mutex_lock(&pool->lock);
+
+      if (server->spares_total < pool->spares) {
+        server->spares[server->spares_total] = ldap_settings;
+        server->spares_created[server->spares_total] = now;
+        server->spares_total++;
+        ldap_settings = NULL;
+      }
+
+      pthread_mutex_unlock(&pool->lock);
+
+      if (ldap_settings != NULL) {
+        ldap_unbind(ldap_settings);
+      }
+    } // for
+  } // for
+}
+
+/**
+ * Waits for the first of one or two outstanding ldap searches to answer.
+ *
+ * A search whose connection fails is removed by setting its connection to NULL (after unbinding it).
+ *
+ * @param LDAP **ldap_settings
+ *   The connections of the searches, a NULL connection is ignored.
+ * @param int *message_ids
+ *   The message ids of the searches.
+ * @param int total
+ *   The number of searches.
+ * @param long timeout
+ *   The maximum microseconds to wait.
+ * @param LDAPMessage **ldap_message
+ *   The answer is stored here, it must be freed with ldap_msgfree().
+ *
+ * @return int
+ *   The index of the search that answered, -1 on timeout, and -2 when every search has failed.
+ */
+int ldap_pool_wait(LDAP **ldap_settings, int *message_ids, int total, long timeout, LDAPMessage **ldap_message) {
+  struct timespec started;
+  struct timespec now;
+  struct pollfd descriptors[2];
+  struct timespec remaining;
+  long elapsed = 0;
+  int index = 0;
+  int active = 0;
+
+  clock_gettime(CLOCK_MONOTONIC, &started);
+
+  while (1) {
+    active = 0;
+
+    // check without waiting first, because libldap may have already read the answer into its own buffer.
+    for (index = 0; index < total; index++) {
+      struct timeval zero;
+      int ldap_status = 0;
+
+      if (ldap_settings[index] == NULL) {
+        continue;
+      }
+
+      memset(&zero, 0, sizeof(struct timeval));
+      *ldap_message = NULL;
+
+      ldap_status = ldap_result(ldap_settings[index], message_ids[index], LDAP_MSG_ALL, &zero, ldap_message);
+
+      if (ldap_status > 0) {
+        return index;
+      }
+
+      if (ldap_status < 0) {
+        ldap_unbind(ldap_settings[index]);
+        ldap_settings[index] = NULL;
+        continue;
+      }
+
+      descriptors[active].fd = -1;
+      descriptors[active].events = POLLIN;
+      descriptors[active].revents = 0;
+      ldap_get_option(ldap_settings[index], LDAP_OPT_DESC, &descriptors[active].fd);
+      active++;
+    } // for
+
+    if (active == 0) {
+      return -2;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    elapsed = (now.tv_sec - started.tv_sec) * 1000000 + (now.tv_nsec - started.tv_nsec) / 1000;
+
+    if (elapsed >= timeout) {
+      return -1;
+    }
+
+    remaining.tv_sec = (timeout - elapsed) / 1000000;
+    remaining.tv_nsec = ((timeout - elapsed) % 1000000) * 1000;
+
+    if (ppoll(descriptors, active, &remaining, NULL) < 0 && errno != EINTR) {
+      return -2;
+    }
+  } // while
+}
+
+/**
+ * Builds the ldap name (dn) searched for a given user name.
+ *
+ * @param char *ldap_name
+ *   The built ldap name, must be at least LDAP_SEARCH_DN_LENGTH + PACKET_SIZE_INPUT + 1 in size.
+ * @param const char *user_name
+ *   The user name.
+ *
+ * @return int
+ *   The length of the ldap name.
+ */
+int ldap_name_build(char *ldap_name, const char *user_name) {
+  int ldap_name_length = strnlen(user_name, PACKET_SIZE_INPUT) + LDAP_SEARCH_DN_LENGTH;
+
+  snprintf(ldap_name, ldap_name_length + 1, LDAP_SEARCH_DN, user_name);
+
+  return ldap_name_length;
+}
+
+/**
+ * Queries the name in the ldap server to see if it exists.
+ *
+ * The fastest server of the ldap pool whose circuit is closed is searched, and when every circuit is open this fails immediately.
+ * When hedging is enabled and the server has not answered within its hedge delay, the same search is sent to a second server and the first answer is used.
+ * A server that fails or times out is recorded against that server and the search is retried on the next server chosen, after a randomized exponential backoff.
+ * No search is started once the deadline of the request has passed.
+ *
+ * @param ldap_pool_data *pool
+ *   The ldap servers to search.
+ * @param worker_data *worker
+ *   The buffers of the calling worker, the ldap name is built here.
+ * @param const char *user_name
+ *   The user name to query in the ldap database.
+ *
+ * @return bool
+ *   1 on found, 0 on not found, and -1 on error.
+ */
+int does_name_exist_in_ldap(ldap_pool_data *pool, worker_data *worker, const char *user_name) {
+  char *ldap_name = worker->ldap_name;
+  int tries = 0;
+  int failed = -1;
+  int result = -1;
+
+  ldap_name_build(ldap_name, user_name);
+
+  for (; tries < LDAP_RETRY_SEARCH_RETRY; tries++) {
+    LDAP *ldap_settings[2] = { NULL, NULL };
+    int servers[2] = { -1, -1 };
+    int message_ids[2] = { -1, -1 };
+    struct timespec started[2];
+    struct timespec now;
+    struct timeval ldap_timeout;
+    LDAPMessage *ldap_message = NULL;
+    int ldap_status = 0;
+    int answered = -1;
+    int index = 0;
+    long waited = 0;
+
+    if (tries > 0) {
+      usleep(backoff_jitter(LDAP_RETRY_BACKOFF, tries - 1, LDAP_RETRY_SEARCH_TIMEOUT));
+    }
+
+    if (deadline_expired(&worker->deadline)) {
+      break;
+    }
+
+    if (worker->trace != NULL) {
+      worker->trace->retries = tries;
+    }
+
+    memset(&ldap_timeout, 0, sizeof(struct timeval));
+    ldap_timeout.tv_sec = 0;
+    ldap_timeout.tv_usec = LDAP_RETRY_SEARCH_TIMEOUT;
+
+    // avoid the server that just failed, when there is another.
+    servers[0] = ldap_pool_select(pool, pool->total > 1 ? failed : -1);
+
+    if (servers[0] < 0) {
+      break;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &started[0]);
+
+    ldap_settings[0] = ldap_pool_connect(pool, servers[0], worker->trace);
+
+    if (ldap_settings[0] == NULL) {
+      ldap_pool_record(pool, servers[0], 0, 0);
+      failed = servers[0];
+      continue;
+    }
+
+    ldap_status = ldap_search_ext(ldap_settings[0], ldap_name, LDAP_SCOPE_BASE, NULL, NULL, 0, NULL, NULL, &ldap_timeout, 1, &message_ids[0]);
+
+    if (ldap_status != LDAP_SUCCESS) {
+      log_write(LOG_ERR, "ERROR: failed to search for '%s' on the ldap server '%s' with the ldap name '%s' with the ldap error (%d): %s\n", user_name, pool->servers[servers[0]].uri, ldap_name, ldap_status, ldap_err2string(ldap_status));
+      ldap_unbind(ldap_settings[0]);
+      ldap_pool_record(pool, servers[0], 0, 0);
+      failed = servers[0];
+      continue;
+    }
+
+    if (pool->hedge && pool->total > 1) {
+      long delay = ldap_pool_hedge_delay(pool, servers[0]);
+
+      if (delay < LDAP_RETRY_SEARCH_TIMEOUT) {
+        answered = ldap_pool_wait(ldap_settings, message_ids, 1, delay, &ldap_message);
+        waited = delay;
+
+        if (answered == -1) {
+          servers[1] = ldap_pool_select(pool, servers[0]);
+
+          if (servers[1] >= 0) {
+            clock_gettime(CLOCK_MONOTONIC, &started[1]);
+
+            // the trace is not passed, so that the bind stage and retries remain those of the first server.
+            ldap_settings[1] = ldap_pool_connect(pool, servers[1], NULL);
+
+            if (ldap_settings[1] == NULL) {
+              ldap_pool_record(pool, servers[1], 0, 0);
+            }
+            else if (ldap_search_ext(ldap_settings[1], ldap_name, LDAP_SCOPE_BASE, NULL, NULL, 0, NULL, NULL, &ldap_timeout, 1, &message_ids[1]) != LDAP_SUCCESS) {
+              ldap_unbind(ldap_settings[1]);
+              ldap_settings[1] = NULL;
+              ldap_pool_record(pool, servers[1], 0, 0);
+            }
+            else {
+              pthread_mutex_lock(&pool->lock);
+              pool->servers[servers[0]].total_hedged++;
+              pthread_mutex_unlock(&pool->lock);
+            }
+          }
+        }
+      }
+    }
+
+    if (answered == -1) {
+      answered = ldap_pool_wait(ldap_settings, message_ids, 2, LDAP_RETRY_SEARCH_TIMEOUT - waited, &ldap_message);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    for (index = 0; index < 2; index++) {
+      long latency = 0;
+
+      if (servers[index] < 0) {
+        continue;
+      }
+
+      latency = (now.tv_sec - started[index].tv_sec) * 1000000 + (now.tv_nsec - started[index].tv_nsec) / 1000;
+
+      if (index == answered) {
+        ldap_pool_record(pool, servers[index], latency, 1);
+
+        if (index == 1) {
+          pthread_mutex_lock(&pool->lock);
+          pool->servers[servers[1]].total_hedge_wins++;
+          pthread_mutex_unlock(&pool->lock);
+        }
+      }
+      else if (ldap_settings[index] == NULL || answered < 0) {
+        // failed or timed out, the full wait is recorded as the latency so that a slow server is less likely to be chosen.
+        ldap_pool_record(pool, servers[index], ldap_settings[index] == NULL ? 0 : latency, 0);
+      }
+      else if (index == 0) {
+        // the first server lost to the hedged search, so the time waited is at least its latency.
+        ldap_pool_record(pool, servers[index], latency, 1);
+      }
+
+      if (ldap_settings[index] != NULL && index != answered) {
+        ldap_abandon_ext(ldap_settings[index], message_ids[index], NULL, NULL);
+      }
+    } // for
+
+    if (answered < 0) {
+      log_write(LOG_ERR, "ERROR: failed to find '%s' on the ldap server '%s' with the ldap name '%s', the search %s.\n", user_name, pool->servers[servers[0]].uri, ldap_name, answered == -1 ? "timed out" : "failed");
+
+      for (index = 0; index < 2; index++) {
+        if (ldap_settings[index] != NULL) {
+          ldap_unbind(ldap_settings[index]);
+        }
+      } // for
+
+      failed = servers[0];
+      continue;
+    }
+
+    if (ldap_parse_result(ldap_settings[answered], ldap_message, &ldap_status, NULL, NULL, NULL, NULL, 0) != LDAP_SUCCESS) {
+      ldap_get_option(ldap_settings[answered], LDAP_OPT_RESULT_CODE, &ldap_status);
+    }
+
+    if (ldap_status == LDAP_SUCCESS) {
+      trace_stage(worker->trace, TRACE_LDAP_SEARCH);
+      result = ldap_count_entries(ldap_settings[answered], ldap_message) > 0;
+    }
+    else {
+      log_write(LOG_ERR, "ERROR: failed to find '%s' on the ldap server '%s' with the ldap name '%s' with the ldap error (%d): %s\n", user_name, pool->servers[servers[answered]].uri, ldap_name, ldap_status, ldap_err2string(ldap_status));
+    }
+
+    ldap_msgfree(ldap_message);
+
+    for (index = 0; index < 2; index++) {
+      if (ldap_settings[index] != NULL) {
+        ldap_unbind(ldap_settings[index]);
+      }
+    } // for
+
+    break;
+  } // for
+
+  return result;
+}
+
+/**
+ * Binds and begins listening on the socket for the given listener.
+ *
+ * @param listener_data *listener
+ *   The listener to bind and listen on.
+ *
+ * @return int
+ *   1 on success and -1 on error.
+ */
+int listener_bind(listener_data *listener) {
+  shared_data *shared = listener->shared;
+
+  if (listener->type == LISTENER_NETWORK) {
+    // bind the socket to port.
+    struct addrinfo *port_information = NULL;
+    struct addrinfo port_setup;
+
+    memset(&port_setup, 0, sizeof(struct addrinfo));
+
+    port_setup.ai_family = INADDR_ANY;
+    port_setup.ai_socktype = SOCKET_TYPE;
+    port_setup.ai_flags = AI_PASSIVE;
+
+    {
+      char string_port[16];
+      memset(&string_port, 0, sizeof(char) * 16);
+
+      sprintf(string_port, "%u", shared->parameter_port);
+
+      int addressed = getaddrinfo(NULL, string_port, &port_setup, &port_information);
+      if (addressed != 0) {
+        log_write(LOG_ERR, "ERROR: failed to process the port '%u' using protocol '%u', 'socket id = '%i': error %i (%u).\n", shared->parameter_port, SOCKET_PROTOCOL_NETWORK, listener->pid_child, addressed, errno);
+
+        freeaddrinfo(port_information);
+        port_information = NULL;
+
+        // send SIGCHLD signal to parent process.
+        if (shared->pid_parent > 0) {
+          kill(shared->pid_parent, SIGCHLD);
+        }
+        return -1;
+      }
+    }
+
+    if (listener->socket_bound == 0) {
+      // the service closes the client connections, so allow binding while old connections are still in TIME_WAIT (such as on restart).
+      {
+        int reuse = 1;
+        setsockopt(listener->socket_id_target, PROTOCOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(int));
+      }
+
+      listener->socket_bound = bind(listener->socket_id_target, port_information->ai_addr, port_information->ai_addrlen);
+      if (listener->socket_bound < 0) {
+        log_write(LOG_ERR, "ERROR: failed to bind the port '%u' using protocol '%u', 'socket id = '%i': error %i (%u).\n", shared->parameter_port, SOCKET_PROTOCOL_NETWORK, listener->pid_child, listener->socket_bound, errno);
+        listener->socket_bound = 0;
+
+        freeaddrinfo(port_information);
+        port_information = NULL;
+
+        // send SIGQUIT signal to parent process.
+        if (shared->pid_parent > 0) {
+          kill(shared->pid_parent, SIGQUIT);
+        }
+        return -1;
+      }
+
+      listener->socket_bound = 1;
+    }
+
+    freeaddrinfo(port_information);
+    port_information = NULL;
+  }
+  else {
+    // bind the socket to the shared.socket_path so that the local clients can connect.
+    struct sockaddr_un socket_address;
+
+    memset(&socket_address, 0, sizeof(struct sockaddr_un));
+    socket_address.sun_family = SOCKET_FAMILY_SOCKET;
+    strncpy(socket_address.sun_path, shared->socket_path, sizeof(socket_address.sun_path) - 1);
+
+    if (listener->socket_bound == 0) {
+      int bound = bind(listener->socket_id_target, (struct sockaddr *) &socket_address, sizeof(struct sockaddr_un));
+      if (bound < 0) {
+        log_write(LOG_ERR, "ERROR: failed to bind the socket '%s' using protocol '%u', 'socket id = '%i'\n", shared->socket_path, SOCKET_PROTOCOL_SOCKET, listener->socket_id_target);
+
+        // send SIGQUIT signal to parent process.
+        if (shared->pid_parent > 0) {
+          kill(shared->pid_parent, SIGQUIT);
+        }
+        return -1;
+      }
+
+      listener->socket_bound = 1;
+    }
+  }
+
+  {
+    int listening = listen(listener->socket_id_target, SOCKET_BACKLOG);
+
+    if (listening < 0) {
+      if (listener->type == LISTENER_NETWORK) {
+        log_write(LOG_ERR, "ERROR: failed to listen to the port '%u' using protocol '%u', 'socket id = '%i', error %i (%u).\n", shared->parameter_port, SOCKET_PROTOCOL_NETWORK, listener->pid_child, listening, errno);
+      }
+      else {
+        log_write(LOG_ERR, "ERROR: failed to listen to the socket '%s' using protocol '%u', 'socket id = '%i', error %i (%u).\n", shared->socket_path, SOCKET_PROTOCOL_SOCKET, listener->pid_child, listening, errno);
+      }
+
+      // send SIGQUIT signal to parent process.
+      if (shared->pid_parent > 0) {
+        kill(shared->pid_parent, SIGQUIT);
+      }
+      return -1;
+    }
+  }
+
+  // linger connection for at most 2 seconds to help properly close connections.
+  // accepted connections inherit this from the listening socket, so it only needs to be set once.
+  {
+    struct linger linger_value = {1, 2};
+    setsockopt(listener->socket_id_target, PROTOCOL_SOCKET, SO_LINGER, &linger_value, sizeof(struct linger));
+  }
+
+  return 1;
+}
+
+/**
+ * Authorizes a local socket client using the SO_PEERCRED credentials of the connection.
+ *
+ * The credentials are provided by the kernel once per connection, so there is no per-request overhead.
+ *
+ * @param listener_data *listener
+ *   The listener the client connected to.
+ * @param int socket_id_client
+ *   The accepted client connection.
+ *
+ * @return int
+ *   1 when authorized, 0 when not authorized, and -1 on error.
+ */
+int listener_authorize_client(listener_data *listener, int socket_id_client) {
+  shared_data *shared = listener->shared;
+
+  if (listener->type != LISTENER_SOCKET) {
+    return 1;
+  }
+
+  if (shared->parameter_socket_allow_uid < 0 && shared->parameter_socket_allow_gid < 0) {
+    return 1;
+  }
+
+  struct ucred credentials;
+  socklen_t credentials_length = sizeof(struct ucred);
+
+  memset(&credentials, 0, sizeof(struct ucred));
+
+  if (getsockopt(socket_id_client, PROTOCOL_SOCKET, SO_PEERCRED, &credentials, &credentials_length) < 0) {
+    log_write(LOG_ERR, "ERROR: failed to load the peer credentials on the socket '%s': error (%u).\n", shared->socket_path, errno);
+    return -1;
+  }
+
+  if (shared->parameter_socket_allow_uid >= 0 && credentials.uid != (uid_t) shared->parameter_socket_allow_uid) {
+    log_write(LOG_WARNING, "WARNING: rejected socket client pid = %u, uid = %u, gid = %u on the socket '%s', the uid is not allowed.\n", credentials.pid, credentials.uid, credentials.gid, shared->socket_path);
+    return 0;
+  }
+
+  if (shared->parameter_socket_allow_gid >= 0 && credentials.gid != (gid_t) shared->parameter_socket_allow_gid) {
+    log_write(LOG_WARNING, "WARNING: rejected socket client pid = %u, uid = %u, gid = %u on the socket '%s', the gid is not allowed.\n", credentials.pid, credentials.uid, credentials.gid, shared->socket_path);
+    return 0;
+  }
+
+  return 1;
+}
+
+/**
+ * Pages through every name under LDAP_SEARCH_BASE using the ldap paged results control.
+ *
+ * @param LDAP *ldap_settings
+ *   The bound ldap connection.
+ * @param ldap_page_callback callback
+ *   Called for every name found.
+ *   Called with a NULL name at the end of every page.
+ *   The callback returns -1 to stop paging.
+ * @param void *argument
+ *   Passed to the callback.
+ *
+ * @return int
+ *   1 on success and -1 on error.
+ */
+int ldap_page_names(LDAP *ldap_settings, ldap_page_callback callback, void *argument) {
+  struct berval cookie;
+  struct timeval ldap_timeout;
+  char *attributes[] = { LDAP_SEARCH_ATTRIBUTE, NULL };
+  int ldap_status = 0;
+  int result = 1;
+
+  memset(&cookie, 0, sizeof(struct berval));
+  memset(&ldap_timeout, 0, sizeof(struct timeval));
+  ldap_timeout.tv_sec = LDAP_PAGE_TIMEOUT;
+
+  do {
+    LDAPControl *page_control = NULL;
+    LDAPControl *server_controls[2] = { NULL, NULL };
+    LDAPControl **response_controls = NULL;
+    LDAPMessage *ldap_message = NULL;
+    LDAPMessage *ldap_entry = NULL;
+    int ldap_result_code = 0;
+
+    ldap_status = ldap_create_page_control(ldap_settings, LDAP_PAGE_SIZE, &cookie, 1, &page_control);
+
+    if (cookie.bv_val != NULL) {
+      ber_memfree(cookie.bv_val);
+      memset(&cookie, 0, sizeof(struct berval));
+    }
+
+    if (ldap_status != LDAP_SUCCESS) {
+      log_write(LOG_ERR, "ERROR: failed to create the ldap paged results control with the ldap error (%d): %s\n", ldap_status, ldap_err2string(ldap_status));
+      result = -1;
+      break;
+    }
+
+    server_controls[0] = page_control;
+
+    ldap_status = ldap_search_ext_s(ldap_settings, LDAP_SEARCH_BASE, LDAP_SCOPE_ONELEVEL, LDAP_SEARCH_FILTER, attributes, 0, server_controls, NULL, &ldap_timeout, LDAP_NO_LIMIT, &ldap_message);
+    ldap_control_free(page_control);
+
+    if (ldap_status != LDAP_SUCCESS) {
+      log_write(LOG_ERR, "ERROR: failed to search '%s' on the ldap server with the ldap error (%d): %s\n", LDAP_SEARCH_BASE, ldap_status, ldap_err2string(ldap_status));
+
+      // From manpage: "Note that res parameter of ldap_search_ext_s() and ldap_search_s() should be freed with ldap_msgfree() regardless of return value of these functions"
+      ldap_msgfree(ldap_message);
+      result = -1;
+      break;
+    }
+
+    for (ldap_entry = ldap_first_entry(ldap_settings, ldap_message); ldap_entry != NULL && result > 0; ldap_entry = ldap_next_entry(ldap_settings, ldap_entry)) {
+      struct berval **values = ldap_get_values_len(ldap_settings, ldap_entry, LDAP_SEARCH_ATTRIBUTE);
+      int i = 0;
+
+      if (values == NULL) {
+        continue;
+      }
+
+      for (; values[i] != NULL && result > 0; i++) {
+        result = callback(argument, values[i]->bv_val, values[i]->bv_len);
+      } // for
+
+      ldap_value_free_len(values);
+    } // for
+
+    if (result > 0) {
+      ldap_status = ldap_parse_result(ldap_settings, ldap_message, &ldap_result_code, NULL, NULL, NULL, &response_controls, 0);
+
+      if (ldap_status == LDAP_SUCCESS && response_controls != NULL) {
+        LDAPControl *page_response = ldap_control_find(LDAP_CONTROL_PAGEDRESULTS, response_controls, NULL);
+
+        if (page_response != NULL) {
+          int estimate = 0;
+          ldap_parse_pageresponse_control(ldap_settings, page_response, &estimate, &cookie);
+        }
+      }
+
+      if (response_controls != NULL) {
+        ldap_controls_free(response_controls);
+      }
+    }
+
+    ldap_msgfree(ldap_message);
+
+    if (result > 0) {
+      result = callback(argument, NULL, 0);
+    }
+  } while (result > 0 && cookie.bv_val != NULL && cookie.bv_len > 0);
+
+  if (cookie.bv_val != NULL) {
+    ber_memfree(cookie.bv_val);
+  }
+
+  return result;
+}
+
+
+
+/**
+ * Reports the reconcile progress to the logger and to standard output.
+ *
+ * @param reconcile_data *reconcile
+ *   The reconcile state.
+ * @param const char *stage
+ *   A short description of the current stage, such as "progress" or "complete".
+ */
+void reconcile_report(reconcile_data *reconcile, const char *stage) {
+  struct timespec now;
+  double elapsed = 0;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  elapsed = (now.tv_sec - reconcile->started.tv_sec) + (now.tv_nsec - reconcile->started.tv_nsec) / 1000000000.0;
+
+  log_write(LOG_INFO, "INFO: reconcile %s: %lu scanned, %lu invalid, %lu already provisioned, %lu created, %lu granted, %lu failed, %.1f seconds.\n", stage, reconcile->total_scanned, reconcile->total_invalid, reconcile->total_provisioned, reconcile->total_created, reconcile->total_granted, reconcile->total_failed, elapsed);
+
+  printf("reconcile %s: %lu scanned, %lu invalid, %lu already provisioned, %lu created, %lu granted, %lu failed, %.1f seconds.\n", stage, reconcile->total_scanned, reconcile->total_invalid, reconcile->total_provisioned, reconcile->total_created, reconcile->total_granted, reconcile->total_failed, elapsed);
+  fflush(stdout);
+}
+
+/**
+ * Sleeps as needed so that the names provisioned so far do not exceed the rate limit.
+ *
+ * @param reconcile_data *reconcile
+ *   The reconcile state.
+ */
+void reconcile_throttle(reconcile_data *reconcile) {
+  struct timespec now;
+  double elapsed = 0;
+  double expected = 0;
+
+  if (reconcile->rate <= 0) {
+    return;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  elapsed = (now.tv_sec - reconcile->started.tv_sec) + (now.tv_nsec - reconcile->started.tv_nsec) / 1000000000.0;
+  expected = (double) (reconcile->total_created + reconcile->total_granted) / reconcile->rate;
+
+  if (expected > elapsed) {
+    struct timespec delay;
+    double difference = expected - elapsed;
+
+    delay.tv_sec = (time_t) difference;
+    delay.tv_nsec = (long) ((difference - delay.tv_sec) * 1000000000.0);
+
+    while (nanosleep(&delay, &delay) < 0 && errno == EINTR) {
+      // continue sleeping for the remaining time.
+    }
+  }
+}
+
+/**
+ * Creates and grants all names in the current batch.
+ *
+ * The batch is performed in a single transaction.
+ * Should the transaction fail, such as when a role has been created by the running service in the meantime, each name in the batch is retried individually.
+ *
+ * @param PGconn *connection
+ *   The database connection.
+ * @param reconcile_data *reconcile
+ *   The reconcile state.
+ * @param const char *group_name
+ *   Name of the group to grant.
+ *
+ * @return int
+ *   1 on success and -1 on error.
+ */
+int reconcile_flush(PGconn *connection, reconcile_data *reconcile, const char *group_name) {
+  char *query = reconcile->query;
+  size_t query_used = 0;
+  int i = 0;
+
+  if (reconcile->batch_used == 0) {
+    return 1;
+  }
+
+  query_used = snprintf(query, reconcile->query_size, "begin;");
+
+  for (; i < reconcile->batch_used; i++) {
+    const char *user_name = reconcile->batch_names + i * (PACKET_SIZE_INPUT + 1);
+
+    if (reconcile->batch_create[i]) {
+      query_used += snprintf(query + query_used, reconcile->query_size - query_used, PSQL_CREATE, user_name);
+    }
+
+    query_used += snprintf(query + query_used, reconcile->query_size - query_used, PSQL_GRANT, group_name, user_name);
+  } // for
+
+  snprintf(query + query_used, reconcile->query_size - query_used, "commit;");
+
+  if (database_execute(connection, query) > 0) {
+    for (i = 0; i < reconcile->batch_used; i++) {
+      if (reconcile->batch_create[i]) {
+        reconcile->total_created++;
+      }
+      else {
+        reconcile->total_granted++;
+      }
+    } // for
+  }
+  else {
+    // the failed transaction must be ended before individual statements can be executed.
+    database_execute(connection, "rollback;");
+
+    log_write(LOG_WARNING, "WARNING: the reconcile batch of %i names failed, retrying each name individually.\n", reconcile->batch_used);
+
+    for (i = 0; i < reconcile->batch_used; i++) {
+      const char *user_name = reconcile->batch_names + i * (PACKET_SIZE_INPUT + 1);
+
+      if (reconcile->batch_create[i]) {
+        snprintf(query, reconcile->query_size, PSQL_CREATE, user_name);
+
+        if (database_execute(connection, query) < 0) {
+          reconcile->total_failed++;
+          continue;
+        }
+      }
+
+      snprintf(query, reconcile->query_size, PSQL_GRANT, group_name, user_name);
+
+      if (database_execute(connection, query) < 0) {
+        reconcile->total_failed++;
+        continue;
+      }
+
+      if (reconcile->batch_create[i]) {
+        reconcile->total_created++;
+      }
+      else {
+        reconcile->total_granted++;
+      }
+    } // for
+
+    if (PQstatus(connection) != CONNECTION_OK) {
+      log_write(LOG_ERR, "ERROR: lost the postgresql connection while reconciling, reason (%u): %s.\n", PQstatus(connection), PQerrorMessage(connection));
+      reconcile->batch_used = 0;
+      return -1;
+    }
+  }
+
+  reconcile->batch_used = 0;
+
+  reconcile_throttle(reconcile);
+
+  return 1;
+}
+
+/**
+ * Compares a single ldap name against the database, adding it to the batch when it needs to be created or granted.
+ *
+ * @param PGconn *connection
+ *   The database connection.
+ * @param reconcile_data *reconcile
+ *   The reconcile state.
+ * @param const char *group_name
+ *   Name of the group to grant.
+ * @param const char *name
+ *   The name, as returned by ldap (not NULL terminated).
+ * @param int name_length
+ *   The length of the name.
+ *
+ * @return int
+ *   1 on success and -1 on error.
+ */
+int reconcile_name(PGconn *connection, reconcile_data *reconcile, const char *group_name, const char *name, int name_length) {
+  char user_name[PACKET_SIZE_INPUT + 1];
+
+  reconcile->total_scanned++;
+
+  if (!name_normalize(name, name_length, user_name)) {
+    reconcile->total_invalid++;
+    return 1;
+  }
+
+  if (name_set_find(&reconcile->members, user_name, name_length)) {
+    reconcile->total_provisioned++;
+    return 1;
+  }
+
+  memcpy(reconcile->batch_names + reconcile->batch_used * (PACKET_SIZE_INPUT + 1), user_name, name_length + 1);
+  reconcile->batch_create[reconcile->batch_used] = !name_set_find(&reconcile->roles, user_name, name_length);
+  reconcile->batch_used++;
+
+  // prevent duplicate names in ldap from being provisioned twice.
+  if (name_set_insert(&reconcile->members, user_name, name_length) < 0) {
+    log_write(LOG_ERR, "ERROR: failed to allocate memory when reconciling the name '%s'.\n", user_name);
+    return -1;
+  }
+
+  if (reconcile->batch_used >= reconcile->batch_size) {
+    return reconcile_flush(connection, reconcile, group_name);
+  }
+
+  return 1;
+}
+
+/**
+ * The ldap_page_names() callback for reconcile_run().
+ *
+ * @param void *argument
+ *   The reconcile_page_data.
+ * @param const char *name
+ *   The name (not NULL terminated) or NULL at the end of a page.
+ * @param int name_length
+ *   The length of the name.
+ *
+ * @return int
+ *   1 on success and -1 on error.
+ */
+int reconcile_page_name(void *argument, const char *name, int name_length) {
+  reconcile_page_data *page = (reconcile_page_data *) argument;
+
+  if (name == NULL) {
+    reconcile_report(page->reconcile, "progress");
+    return 1;
+  }
+
+  return reconcile_name(page->connection, page->reconcile, page->group_name, name, name_length);
+}
+
+/**
+ * Pre-provisions every ldap name, creating and granting the roles that are missing from the database.
+ *
+ * This pages through every entry under LDAP_SEARCH_BASE, see ldap_page_names().
+ * The names are compared against pg_roles and pg_auth_members for the group and only the missing ones are created and granted.
+ * The work is performed in batched transactions, limited to a rate of names per second.
+ *
+ * @param shared_data *shared
+ *   The populated parameters.
+ *
+ * @return int
+ *   1 on success and -1 on error.
+ */
+int reconcile_run(shared_data *shared) {
+  reconcile_data reconcile;
+  reconcile_page_data reconcile_callback;
+  PGconn *connection = NULL;
+  LDAP *ldap_settings = NULL;
+  int server = -1;
+  int result = 1;
+
+  memset(&reconcile, 0, sizeof(reconcile_data));
+  clock_gettime(CLOCK_MONOTONIC, &reconcile.started);
+
+  reconcile.rate = shared->parameter_reconcile_rate;
+  reconcile.batch_size = shared->parameter_reconcile_batch;
+
+  // each name results in at most a create and a grant statement.
+  reconcile.query_size = 16 + reconcile.batch_size * (PSQL_CREATE_LENGTH + PSQL_GRANT_LENGTH + PARAMETER_LENGTH_MAX + (PACKET_SIZE_INPUT * 2));
+  reconcile.query = malloc(reconcile.query_size);
+  reconcile.batch_names = malloc(reconcile.batch_size * (PACKET_SIZE_INPUT + 1));
+  reconcile.batch_create = malloc(reconcile.batch_size * sizeof(char));
+
+  if (reconcile.query == NULL || reconcile.batch_names == NULL || reconcile.batch_create == NULL || name_set_initialize(&reconcile.roles, RECONCILE_NAMES_EXPECTED) < 0 || name_set_initialize(&reconcile.members, RECONCILE_NAMES_EXPECTED) < 0) {
+    log_write(LOG_ERR, "ERROR: failed to allocate memory for the reconcile.\n");
+    result = -1;
+  }
+
+  if (result > 0) {
+    connection = PQconnectdb(shared->psql_connection);
+
+    if (connection == NULL || PQstatus(connection) != CONNECTION_OK) {
+      log_write(LOG_ERR, "ERROR: failed to establish the postgresql connection while reconciling group '%s' and database '%s', reason: %s.\n", shared->parameter_group, shared->parameter_database, connection == NULL ? "NULL returned" : PQerrorMessage(connection));
+      result = -1;
+    }
+  }
+
+  if (result > 0) {
+    result = database_load_names(connection, PSQL_SELECT_ROLES, &reconcile.roles);
+  }
+
+  if (result > 0) {
+    snprintf(reconcile.query, reconcile.query_size, PSQL_SELECT_MEMBERS, shared->parameter_group);
+    result = database_load_names(connection, reconcile.query, &reconcile.members);
+  }
+
+  if (result > 0) {
+    log_write(LOG_INFO, "INFO: reconcile loaded %lu roles and %lu members of the group '%s' in the database '%s'.\n", reconcile.roles.used, reconcile.members.used, shared->parameter_group, shared->parameter_database);
+
+    server = ldap_pool_select(&shared->ldap_pool, -1);
+
+    if (server < 0) {
+      log_write(LOG_ERR, "ERROR: failed to reconcile group '%s' and database '%s', reason: no ldap server is available.\n", shared->parameter_group, shared->parameter_database);
+      result = -1;
+    }
+  }
+
+  if (result > 0) {
+    ldap_settings = ldap_pool_connect(&shared->ldap_pool, server, NULL);
+
+    if (ldap_settings == NULL) {
+      result = -1;
+    }
+  }
+
+  if (result > 0) {
+    reconcile_callback.connection = connection;
+    reconcile_callback.reconcile = &reconcile;
+    reconcile_callback.group_name = shared->parameter_group;
+
+    result = ldap_page_names(ldap_settings, reconcile_page_name, &reconcile_callback);
+  }
+
+  if (result > 0) {
+    result = reconcile_flush(connection, &reconcile, shared->parameter_group);
+  }
+
+  reconcile_report(&reconcile, result > 0 ? "complete" : "failed");
+
+  if (ldap_settings != NULL) {
+    ldap_unbind(ldap_settings);
+  }
+
+  if (connection != NULL) {
+    PQfinish(connection);
+  }
+
+  name_set_destroy(&reconcile.roles);
+  name_set_destroy(&reconcile.members);
+
+  if (reconcile.query != NULL) {
+    free(reconcile.query);
+  }
+
+  if (reconcile.batch_names != NULL) {
+    free(reconcile.batch_names);
+  }
+
+  if (reconcile.batch_create != NULL) {
+    free(reconcile.batch_create);
+  }
+
+  return result;
+}
+
+/**
+ * Applies a single change to the mirror.
+ *
+ * @param mirror_data *mirror
+ *   The mirror to change.
+ * @param const char *name
+ *   The name, as returned by ldap (not NULL terminated).
+ * @param int name_length
+ *   The length of the name.
+ * @param int add
+ *   1 to add the name and 0 to remove the name.
+ *
+ * @return int
+ *   1 on success and -1 on error.
+ */
+int mirror_change(mirror_data *mirror, const char *name, int name_length, int add) {
+  char normalized[PACKET_SIZE_INPUT + 1];
+  int result = 1;
+
+  // invalid names can never be requested, so they are not mirrored.
+  if (!name_normalize(name, name_length, normalized)) {
+    return 1;
+  }
+
+  pthread_mutex_lock(&mirror->lock);
+
+  if (add) {
+    result = name_set_insert(&mirror->names, normalized, name_length);
+
+    if (result > 0) {
+      mirror->total_added++;
+    }
+  }
+  else if (name_set_remove(&mirror->names, normalized, name_length)) {
+    mirror->total_removed++;
+  }
+
+  pthread_mutex_unlock(&mirror->lock);
+
+  if (result < 0) {
+    log_write(LOG_ERR, "ERROR: failed to allocate memory when adding the name '%s' to the mirror.\n", normalized);
+    return -1;
+  }
+
+  return 1;
+}
+
+/**
+ * The ldap_page_names() callback for loading the mirror.
+ *
+ * @param void *argument
+ *   The name_set being loaded.
+ * @param const char *name
+ *   The name (not NULL terminated) or NULL at the end of a page.
+ * @param int name_length
+ *   The length of the name.
+ *
+ * @return int
+ *   1 on success and -1 on error.
+ */
+int mirror_page_name(void *argument, const char *name, int name_length) {
+  char normalized[PACKET_SIZE_INPUT + 1];
+
+  if (name == NULL || !name_normalize(name, name_length, normalized)) {
+    return 1;
+  }
+
+  if (name_set_insert((name_set *) argument, normalized, name_length) < 0) {
+    log_write(LOG_ERR, "ERROR: failed to allocate memory when loading the name '%s' into the mirror.\n", normalized);
+    return -1;
+  }
+
+  return 1;
+}
+
+/**
+ * Applies a persistent search entry to the mirror.
+ *
+ * The entry change notification control provides the change type and, for a modDN, the previous DN.
+ * Entries without the control are treated as an add.
+ * A uid value removed by a modify cannot be detected from the entry, which is corrected by the next full reload.
+ *
+ * @param mirror_data *mirror
+ *   The mirror to change.
+ * @param LDAP *ldap_settings
+ *   The ldap connection.
+ * @param LDAPMessage *ldap_entry
+ *   The search entry.
+ *
+ * @return int
+ *   1 on success and -1 on error.
+ */
+int mirror_apply_entry(mirror_data *mirror, LDAP *ldap_settings, LDAPMessage *ldap_entry) {
+  LDAPControl **entry_controls = NULL;
+  struct berval **values = NULL;
+  ber_int_t change_type = LDAP_CONTROL_PERSIST_ENTRY_CHANGE_ADD;
+  int result = 1;
+
+  if (ldap_get_entry_controls(ldap_settings, ldap_entry, &entry_controls) == LDAP_SUCCESS && entry_controls != NULL) {
+    LDAPControl *change_control = ldap_control_find(LDAP_CONTROL_PERSIST_ENTRY_CHANGE_NOTICE, entry_controls, NULL);
+
+    if (change_control != NULL) {
+      BerElement *ber = ber_init(&change_control->ldctl_value);
+
+      if (ber != NULL) {
+        ber_len_t length = 0;
+
+        if (ber_scanf(ber, "{e", &change_type) == LBER_ERROR) {
+          change_type = LDAP_CONTROL_PERSIST_ENTRY_CHANGE_ADD;
+        }
+        else if (change_type == LDAP_CONTROL_PERSIST_ENTRY_CHANGE_RENAME && ber_peek_tag(ber, &length) == LBER_OCTETSTRING) {
+          struct berval previous;
+
+          memset(&previous, 0, sizeof(struct berval));
+
+          // the previous DN is expected to be in the form 'uid=name,' LDAP_SEARCH_BASE.
+          if (ber_scanf(ber, "m", &previous) != LBER_ERROR && previous.bv_len > 4 && strncasecmp(previous.bv_val, "uid=", 4) == 0) {
+            ber_len_t end = 4;
+
+            while (end < previous.bv_len && previous.bv_val[end] != ',') {
+              end++;
+            } // while
+
+            result = mirror_change(mirror, previous.bv_val + 4, end - 4, 0);
+          }
+        }
+
+        ber_free(ber, 1);
+      }
+    }
+
+    ldap_controls_free(entry_controls);
+  }
+
+  if (result < 0) {
+    return -1;
+  }
+
+  values = ldap_get_values_len(ldap_settings, ldap_entry, LDAP_SEARCH_ATTRIBUTE);
+
+  if (values != NULL) {
+    int i = 0;
+
+    for (; values[i] != NULL && result > 0; i++) {
+      result = mirror_change(mirror, values[i]->bv_val, values[i]->bv_len, change_type != LDAP_CONTROL_PERSIST_ENTRY_CHANGE_DELETE);
+    } // for
+
+    ldap_value_free_len(values);
+  }
+
+  return result;
+}
+
+/**
+ * Loads the mirror and then keeps it up to date until a failure or until MIRROR_RELOAD_INTERVAL is reached.
+ *
+ * The persistent search (changes only) is started before the full load so that no change made during the load is missed.
+ * The changes queued during the load are applied after the loaded names replace the mirror.
+ * The fastest healthy server of the ldap pool is used, and a failure is recorded against that server so that the next attempt may choose another.
+ *
+ * @param mirror_data *mirror
+ *   The mirror to load.
+ * @param ldap_pool_data *pool
+ *   The ldap servers to choose from.
+ *
+ * @return int
+ *   1 when the reload interval is reached and -1 on error.
+ */
+int mirror_synchronize(mirror_data *mirror, ldap_pool_data *pool) {
+  const int server = ldap_pool_select(pool, -1);
+  const char *uri = NULL;
+  LDAP *ldap_settings = NULL;
+  LDAPControl *persist_control = NULL;
+  name_set loading;
+  struct timespec loaded;
+  int ldap_status = 0;
+  int ldap_version = LDAP_VERSION3;
+  int message_id = -1;
+  int result = 1;
+
+  memset(&loading, 0, sizeof(name_set));
+  memset(&loaded, 0, sizeof(struct timespec));
+
+  // every circuit is open, the breaker thread probes the servers until one is closed.
+  if (server < 0) {
+    return -1;
+  }
+
+  uri = pool->servers[server].uri;
+
+  ldap_status = ldap_initialize(&ldap_settings, uri);
+
+  if (ldap_status != LDAP_SUCCESS) {
+    log_write(LOG_ERR, "ERROR: failed to initialize ldap settings for the ldap server '%s' with the ldap error (%d): %s.\n", uri, ldap_status, ldap_err2string(ldap_status));
+    ldap_pool_record(pool, server, 0, 0);
+    return -1;
+  }
+
+  // the persistent search control requires ldap version 3.
+  ldap_set_option(ldap_settings, LDAP_OPT_PROTOCOL_VERSION, &ldap_version);
+  ldap_pool_tls_prepare(pool, server, ldap_settings);
+
+  ldap_status = ldap_simple_bind_s(ldap_settings, "", "");
+
+  if (ldap_status == LDAP_SUCCESS) {
+    ldap_pool_tls_save(pool, server, ldap_settings);
+  }
+  else {
+    log_write(LOG_ERR, "ERROR: failed to connect and bind to the ldap server '%s' for the mirror with the ldap error (%d): %s\n", uri, ldap_status, ldap_err2string(ldap_status));
+    result = -1;
+  }
+
+  // PersistentSearch ::= SEQUENCE { changeTypes INTEGER, changesOnly BOOLEAN, returnECs BOOLEAN }.
+  if (result > 0) {
+    BerElement *ber = ber_alloc_t(LBER_USE_DER);
+    struct berval value;
+
+    memset(&value, 0, sizeof(struct berval));
+
+    if (ber == NULL || ber_printf(ber, "{ibb}", (ber_int_t) MIRROR_CHANGE_TYPES, (ber_int_t) 1, (ber_int_t) 1) == -1 || ber_flatten2(ber, &value, 0) == -1 || ldap_control_create(LDAP_CONTROL_PERSIST_REQUEST, 1, &value, 1, &persist_control) != LDAP_SUCCESS) {
+      log_write(LOG_ERR, "ERROR: failed to create the ldap persistent search control.\n");
+      result = -1;
+    }
+
+    if (ber != NULL) {
+      ber_free(ber, 1);
+    }
+  }
+
+  if (result > 0) {
+    LDAPControl *server_controls[2] = { persist_control, NULL };
+    char *attributes[] = { LDAP_SEARCH_ATTRIBUTE, NULL };
+
+    ldap_status = ldap_search_ext(ldap_settings, LDAP_SEARCH_BASE, LDAP_SCOPE_ONELEVEL, LDAP_SEARCH_FILTER, attributes, 0, server_controls, NULL, NULL, LDAP_NO_LIMIT, &message_id);
+
+    if (ldap_status != LDAP_SUCCESS) {
+      log_write(LOG_ERR, "ERROR: failed to start the persistent search of '%s' on the ldap server '%s' with the ldap error (%d): %s\n", LDAP_SEARCH_BASE, uri, ldap_status, ldap_err2string(ldap_status));
+      message_id = -1;
+      result = -1;
+    }
+  }
+
+  if (result > 0) {
+    if (name_set_initialize(&loading, MIRROR_NAMES_EXPECTED) < 0) {
+      log_write(LOG_ERR, "ERROR: failed to allocate memory for the mirror.\n");
+      result = -1;
+    }
+  }
+
+  if (result > 0) {
+    result = ldap_page_names(ldap_settings, mirror_page_name, &loading);
+  }
+
+  // swap in the loaded names, the previous names are then freed outside of the lock.
+  if (result > 0) {
+    name_set previous;
+
+    pthread_mutex_lock(&mirror->lock);
+    previous = mirror->names;
+    mirror->names = loading;
+    mirror->synced = 1;
+    mirror->total_loaded = loading.used;
+    mirror->total_reloads++;
+    pthread_mutex_unlock(&mirror->lock);
+
+    loading = previous;
+    name_set_destroy(&loading);
+
+    clock_gettime(CLOCK_MONOTONIC, &loaded);
+    log_write(LOG_INFO, "INFO: the mirror loaded %lu names from the ldap server '%s'.\n", mirror->total_loaded, uri);
+  }
+
+  while (result > 0) {
+    LDAPMessage *ldap_message = NULL;
+    struct timeval ldap_timeout;
+    struct timespec now;
+
+    memset(&ldap_timeout, 0, sizeof(struct timeval));
+    ldap_timeout.tv_sec = MIRROR_WAIT_TIMEOUT;
+
+    ldap_status = ldap_result(ldap_settings, message_id, LDAP_MSG_ONE, &ldap_timeout, &ldap_message);
+
+    if (ldap_status < 0) {
+      ldap_get_option(ldap_settings, LDAP_OPT_RESULT_CODE, &ldap_status);
+      log_write(LOG_ERR, "ERROR: the persistent search on the ldap server '%s' failed with the ldap error (%d): %s\n", uri, ldap_status, ldap_err2string(ldap_status));
+      result = -1;
+      break;
+    }
+
+    if (ldap_status == LDAP_RES_SEARCH_ENTRY) {
+      result = mirror_apply_entry(mirror, ldap_settings, ldap_message);
+    }
+    else if (ldap_status == LDAP_RES_SEARCH_RESULT) {
+      log_write(LOG_ERR, "ERROR: the persistent search on the ldap server '%s' was ended by the server.\n", uri);
+      result = -1;
+    }
+
+    if (ldap_message != NULL) {
+      ldap_msgfree(ldap_message);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    if (result > 0 && now.tv_sec - loaded.tv_sec >= MIRROR_RELOAD_INTERVAL) {
+      break;
+    }
+  } // while
+
+  if (message_id >= 0) {
+    ldap_abandon_ext(ldap_settings, message_id, NULL, NULL);
+  }
+
+  if (persist_control != NULL) {
+    ldap_control_free(persist_control);
+  }
+
+  if (result < 0) {
+    ldap_pool_record(pool, server, 0, 0);
+  }
+
+  ldap_unbind(ldap_settings);
+  name_set_destroy(&loading);
+
+  return result;
+}
+
+/**
+ * The mirror thread, keeping the mirror synchronized with ldap.
+ *
+ * While the mirror is not synced, name lookups fall back to querying ldap directly.
+ *
+ * @param void *argument
+ *   The shared_data.
+ *
+ * @return void *
+ *   NULL, this thread does not return until the process exits.
+ *
+ * @see: pthread_create()
+ */
+void *handler_mirror(void *argument) {
+  mirror_data *mirror = &((shared_data *) argument)->mirror;
+  ldap_pool_data *pool = &((shared_data *) argument)->ldap_pool;
+
+  mirror->pid_child = syscall(SYS_gettid);
+
+  while (1) {
+    if (mirror_synchronize(mirror, pool) < 0) {
+      pthread_mutex_lock(&mirror->lock);
+      mirror->synced = 0;
+      pthread_mutex_unlock(&mirror->lock);
+
+      sleep(MIRROR_RETRY_DELAY);
+    }
+  } // while
+
+  return NULL;
+}
+
+/**
+ * Finds a name in the mirror.
+ *
+ * @param mirror_data *mirror
+ *   The mirror to search.
+ * @param const char *user_name
+ *   The validated user name.
+ *
+ * @return int
+ *   1 when found, 0 when not found, and -1 when the mirror is not enabled or not synced.
+ */
+int mirror_find(mirror_data *mirror, const char *user_name) {
+  char normalized[PACKET_SIZE_INPUT + 1];
+  int user_name_length = 0;
+  int result = -1;
+
+  if (!mirror->enabled) {
+    return -1;
+  }
+
+  user_name_length = strnlen(user_name, PACKET_SIZE_INPUT);
+
+  if (!name_normalize(user_name, user_name_length, normalized)) {
+    return 0;
+  }
+
+  pthread_mutex_lock(&mirror->lock);
+
+  if (mirror->synced) {
+    result = name_set_find(&mirror->names, normalized, user_name_length);
+  }
+
+  pthread_mutex_unlock(&mirror->lock);
+
+  return result;
+}
+
+/**
+ * Maps a cache snapshot file written by cache_snapshot_write() for use as the cache entries.
+ *
+ * The file is mapped privately, so the entries are copied on write and the file itself is never changed.
+ * The whole snapshot is ignored when any entry is malformed or expires later than the ttl allows, and the used count is recounted from the entries.
+ * Otherwise the entries are used as is, expired entries are ignored by cache_find() and are removed when the cache is full.
+ *
+ * @param cache_data *cache
+ *   The cache to load into, the snapshot_path must already be populated.
+ * @param const char *group_name
+ *   The group the snapshot must have been written for.
+ * @param const char *database_name
+ *   The database the snapshot must have been written for.
+ *
+ * @return int
+ *   1 when the snapshot is mapped, 0 when there is no usable snapshot.
+ */
+int cache_snapshot_load(cache_data *cache, const char *group_name, const char *database_name) {
+  struct stat file_stat;
+  cache_snapshot_header *header = NULL;
+  cache_entry *entries = NULL;
+  size_t length = sizeof(cache_snapshot_header) + CACHE_SLOTS * sizeof(cache_entry);
+  size_t slot = 0;
+  size_t used = 0;
+  time_t now = 0;
+  char *map = NULL;
+  int file = 0;
+  int kind = 0;
+
+  file = open(cache->snapshot_path, O_RDONLY);
+
+  if (file < 0) {
+    if (errno != ENOENT) {
+      log_write(LOG_ERR, "ERROR: failed to open the cache snapshot '%s', error: %i.\n", cache->snapshot_path, errno);
+    }
+
+    return 0;
+  }
+
+  if (fstat(file, &file_stat) < 0 || file_stat.st_size != (off_t) length) {
+    log_write(LOG_INFO, "INFO: ignoring the cache snapshot '%s' because it has the wrong size.\n", cache->snapshot_path);
+    close(file);
+    return 0;
+  }
+
+  map = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE, file, 0);
+  close(file);
+
+  if (map == MAP_FAILED) {
+    log_write(LOG_ERR, "ERROR: failed to map the cache snapshot '%s', error: %i.\n", cache->snapshot_path, errno);
+    return 0;
+  }
+
+  header = (cache_snapshot_header *) map;
+
+  if (memcmp(header->magic, CACHE_SNAPSHOT_MAGIC, sizeof(header->magic)) != 0 || header->version != CACHE_SNAPSHOT_VERSION || header->entry_size != sizeof(cache_entry) || header->slots != CACHE_SLOTS || header->used > CACHE_SLOTS / 2 || strncmp(header->group, group_name, PARAMETER_LENGTH_MAX) != 0 || strncmp(header->database, database_name, PARAMETER_LENGTH_MAX) != 0) {
+    log_write(LOG_INFO, "INFO: ignoring the cache snapshot '%s' because it was written by a different version or for a different group or database.\n", cache->snapshot_path);
+    munmap(map, length);
+    return 0;
+  }
+
+  // the entries are probed until an empty slot while the lock is held, so every entry is checked before the snapshot is trusted.
+  entries = (cache_entry *) (map + sizeof(cache_snapshot_header));
+  now = time(NULL);
+
+  for (slot = 0; slot < CACHE_SLOTS; slot++) {
+    if (entries[slot].length == 0) {
+      continue;
+    }
+
+    if (entries[slot].length > PACKET_SIZE_INPUT || entries[slot].name[entries[slot].length] != 0) {
+      break;
+    }
+
+    for (kind = 0; kind < CACHE_TOTAL; kind++) {
+      if (entries[slot].expires[kind] > now + cache->ttl) {
+        break;
+      }
+    } // for
+
+    if (kind < CACHE_TOTAL) {
+      break;
+    }
+
+    used++;
+  } // for
+
+  if (slot < CACHE_SLOTS || used > CACHE_SLOTS / 2) {
+    log_write(LOG_INFO, "INFO: ignoring the cache snapshot '%s' because it has an invalid entry or too few empty slots.\n", cache->snapshot_path);
+    munmap(map, length);
+    return 0;
+  }
+
+  cache->entries = entries;
+  cache->used = used;
+  cache->snapshot_map = map;
+  cache->snapshot_length = length;
+
+  log_write(LOG_INFO, "INFO: the cache started warm with %lu names from the snapshot '%s'.\n", used, cache->snapshot_path);
+
+  return 1;
+}
+
+/**
+ * Writes the cache entries to the snapshot file.
+ *
+ * The entries are copied while the lock is held and then written to a temporary file that replaces the snapshot file.
+ * The file is the header followed by the cache entries exactly as they are in memory, so that it can be mapped without parsing.
+ *
+ * @param cache_data *cache
+ *   The cache to write.
+ * @param const char *group_name
+ *   The group the cache is for.
+ * @param const char *database_name
+ *   The database the cache is for.
+ *
+ * @return int
+ *   1 on success and -1 on error.
+ */
+int cache_snapshot_write(cache_data *cache, const char *group_name, const char *database_name) {
+  cache_snapshot_header *header = NULL;
+  size_t length = sizeof(cache_snapshot_header) + CACHE_SLOTS * sizeof(cache_entry);
+  size_t written = 0;
+  char path_temporary[PATH_MAX];
+  char *buffer = NULL;
+  int file = 0;
+
+  if (snprintf(path_temporary, PATH_MAX, "%s" CACHE_SNAPSHOT_TEMPORARY, cache->snapshot_path, (int) syscall(SYS_gettid)) >= PATH_MAX) {
+    log_write(LOG_ERR, "ERROR: the cache snapshot path '%s' is too long.\n", cache->snapshot_path);
+    return -1;
+  }
+
+  buffer = calloc(1, length);
+
+  if (buffer == NULL) {
+    log_write(LOG_ERR, "ERROR: failed to allocate memory for the cache snapshot.\n");
+    return -1;
+  }
+
+  header = (cache_snapshot_header *) buffer;
+  memcpy(header->magic, CACHE_SNAPSHOT_MAGIC, sizeof(header->magic));
+  header->version = CACHE_SNAPSHOT_VERSION;
+  header->entry_size = sizeof(cache_entry);
+  header->slots = CACHE_SLOTS;
+  header->written = time(NULL);
+  strncpy(header->group, group_name, PARAMETER_LENGTH_MAX - 1);
+  strncpy(header->database, database_name, PARAMETER_LENGTH_MAX - 1);
+
+  pthread_mutex_lock(&cache->lock);
+  header->used = cache->used;
+  memcpy(buffer + sizeof(cache_snapshot_header), cache->entries, CACHE_SLOTS * sizeof(cache_entry));
+  pthread_mutex_unlock(&cache->lock);
+
+  file = open(path_temporary, O_WRONLY | O_CREAT | O_TRUNC, CACHE_SNAPSHOT_MODE);
+
+  if (file < 0) {
+    log_write(LOG_ERR, "ERROR: failed to create the cache snapshot '%s', error: %i.\n", path_temporary, errno);
+    free(buffer);
+    return -1;
+  }
+
+  while (written < length) {
+    ssize_t result = write(file, buffer + written, length - written);
+
+    if (result < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+
+      break;
+    }
+
+    written += result;
+  } // while
+
+  free(buffer);
+
+  if (written < length || fsync(file) < 0) {
+    log_write(LOG_ERR, "ERROR: failed to write the cache snapshot '%s', error: %i.\n", path_temporary, errno);
+    close(file);
+    unlink(path_temporary);
+    return -1;
+  }
+
+  close(file);
+
+  if (rename(path_temporary, cache->snapshot_path) < 0) {
+    log_write(LOG_ERR, "ERROR: failed to replace the cache snapshot '%s', error: %i.\n", cache->snapshot_path, errno);
+    unlink(path_temporary);
+    return -1;
+  }
+
+  return 1;
+}
+
+/**
+ * Allocates the cache, starting warm from the snapshot file when one is usable.
+ *
+ * @param cache_data *cache
+ *   The cache to initialize, the ttl, coherence, snapshot, and snapshot_path must already be populated.
+ * @param const char *group_name
+ *   The group the cache is for.
+ * @param const char *database_name
+ *   The database the cache is for.
+ *
+ * @return int
+ *   1 on success and -1 on error.
+ */
+int cache_initialize(cache_data *cache, const char *group_name, const char *database_name) {
+  if (cache->snapshot > 0 && cache_snapshot_load(cache, group_name, database_name) > 0) {
+    return 1;
+  }
+
+  cache->entries = calloc(CACHE_SLOTS, sizeof(cache_entry));
+
+  if (cache->entries == NULL) {
+    return -1;
+  }
+
+  cache->used = 0;
+
+  return 1;
+}
+
+/**
+ * Starts a change to the published table.
+ *
+ * The cache lock must be held, the readers retry while the sequence is odd.
+ *
+ * @param cache_data *cache
+ *   The cache that owns the table.
+ */
+void table_begin(cache_data *cache) {
+  if (cache->table == NULL) {
+    return;
+  }
+
+  __atomic_store_n(&cache->table->sequence, cache->table->sequence | 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+/**
+ * Finishes a change to the published table, see table_begin().
+ *
+ * @param cache_data *cache
+ *   The cache that owns the table.
+ */
+void table_end(cache_data *cache) {
+  if (cache->table == NULL) {
+    return;
+  }
+
+  __atomic_store_n(&cache->table->sequence, (cache->table->sequence | 1) + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Copies a cache slot to the same slot of the published table.
+ *
+ * The cache lock must be held and the change must be between table_begin() and table_end().
+ *
+ * @param cache_data *cache
+ *   The cache that owns the table.
+ * @param size_t slot
+ *   The slot that changed.
+ */
+void table_publish(cache_data *cache, size_t slot) {
+  table_entry *entry = NULL;
+
+  if (cache->table == NULL) {
+    return;
+  }
+
+  entry = ((table_entry *) (((char *) cache->table) + sizeof(table_header))) + slot;
+
+  entry->expires = cache->entries[slot].expires[CACHE_MEMBER];
+  entry->length = cache->entries[slot].length;
+  memcpy(entry->name, cache->entries[slot].name, PACKET_SIZE_INPUT + 1);
+
+  // an expiry further away than the ttl was cached with a longer ttl, such as by an older snapshot (see cache_find()).
+  if (entry->expires > time(NULL) + cache->ttl) {
+    entry->expires = 0;
+  }
+}
+
+/**
+ * Maps the table file shared with the clients and publishes the current cache entries to it.
+ *
+ * The file is reused when it already exists, so that clients holding it open see the new entries.
+ *
+ * @param cache_data *cache
+ *   The cache to publish, which must already be initialized.
+ * @param const char *path
+ *   The path of the table file.
+ * @param const char *system_name
+ *   The system the table is for.
+ * @param const char *group_name
+ *   The group the table is for.
+ * @param const char *database_name
+ *   The database the table is for.
+ *
+ * @return int
+ *   1 on success and -1 on error.
+ */
+int table_initialize(cache_data *cache, const char *path, const char *system_name, const char *group_name, const char *database_name) {
+  table_header *header = NULL;
+  size_t length = sizeof(table_header) + CACHE_SLOTS * sizeof(table_entry);
+  size_t slot = 0;
+  char *map = NULL;
+  int file = 0;
+
+  file = open(path, O_RDWR | O_CREAT, TABLE_MODE);
+
+  if (file < 0) {
+    log_write(LOG_ERR, "ERROR: failed to open the table '%s', error: %i.\n", path, errno);
+    return -1;
+  }
+
+  // the mode is applied even when the file already exists or the umask is more restrictive.
+  if (fchmod(file, TABLE_MODE) < 0 || ftruncate(file, length) < 0) {
+    log_write(LOG_ERR, "ERROR: failed to prepare the table '%s', error: %i.\n", path, errno);
+    close(file);
+    return -1;
+  }
+
+  map = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+  close(file);
+
+  if (map == MAP_FAILED) {
+    log_write(LOG_ERR, "ERROR: failed to map the table '%s', error: %i.\n", path, errno);
+    return -1;
+  }
+
+  header = (table_header *) map;
+
+  pthread_mutex_lock(&cache->lock);
+
+  cache->table = header;
+  cache->table_length = length;
+
+  table_begin(cache);
+
+  memcpy(header->magic, TABLE_MAGIC, sizeof(header->magic));
+  header->version = TABLE_VERSION;
+  header->entry_size = sizeof(table_entry);
+  header->slots = CACHE_SLOTS;
+  header->published = time(NULL);
+
+  memset(header->system, 0, PARAMETER_LENGTH_MAX);
+  memset(header->group, 0, PARAMETER_LENGTH_MAX);
+  memset(header->database, 0, PARAMETER_LENGTH_MAX);
+  strncpy(header->system, system_name, PARAMETER_LENGTH_MAX - 1);
+  strncpy(header->group, group_name, PARAMETER_LENGTH_MAX - 1);
+  strncpy(header->database, database_name, PARAMETER_LENGTH_MAX - 1);
+
+  for (; slot < CACHE_SLOTS; slot++) {
+    table_publish(cache, slot);
+  } // for
+
+  table_end(cache);
+
+  pthread_mutex_unlock(&cache->lock);
+
+  return 1;
+}
+
+/**
+ * Empties and unmaps the published table.
+ *
+ * The file is emptied instead of removed so that the clients holding it open stop finding names once nothing keeps the table current.
+ *
+ * @param cache_data *cache
+ *   The cache that owns the table.
+ */
+void table_close(cache_data *cache) {
+  if (cache->table == NULL) {
+    return;
+  }
+
+  pthread_mutex_lock(&cache->lock);
+
+  table_begin(cache);
+  memset(((char *) cache->table) + sizeof(table_header), 0, CACHE_SLOTS * sizeof(table_entry));
+  table_end(cache);
+
+  munmap(cache->table, cache->table_length);
+  cache->table = NULL;
+
+  pthread_mutex_unlock(&cache->lock);
+}
+
+/**
+ * Finds the slot for a name in the cache.
+ *
+ * @param const cache_data *cache
+ *   The cache to search.
+ * @param const char *name
+ *   The normalized name.
+ * @param int length
+ *   The length of the name.
+ *
+ * @return size_t
+ *   The slot containing the name or the empty slot where the name would be inserted.
+ */
+size_t cache_slot(const cache_data *cache, const char *name, int length) {
+  size_t slot = name_set_hash(name, length) & (CACHE_SLOTS - 1);
+
+  while (cache->entries[slot].length != 0) {
+    if (cache->entries[slot].length == length && memcmp(cache->entries[slot].name, name, length) == 0) {
+      break;
+    }
+
+    slot = (slot + 1) & (CACHE_SLOTS - 1);
+  } // while
+
+  return slot;
+}
+
+/**
+ * Removes the entry at the given slot, shifting the following entries of the probe sequence back.
+ *
+ * @param cache_data *cache
+ *   The cache to remove from.
+ * @param size_t slot
+ *   The occupied slot to remove.
+ */
+void cache_remove_slot(cache_data *cache, size_t slot) {
+  size_t next = (slot + 1) & (CACHE_SLOTS - 1);
+
+  memset(&cache->entries[slot], 0, sizeof(cache_entry));
+  cache->used--;
+  table_publish(cache, slot);
+
+  for (; cache->entries[next].length != 0; next = (next + 1) & (CACHE_SLOTS - 1)) {
+    size_t home = name_set_hash(cache->entries[next].name, cache->entries[next].length) & (CACHE_SLOTS - 1);
+
+    // only move the entry when the emptied slot lies between its home slot and its current slot.
+    if ((next > slot && (home <= slot || home > next)) || (next < slot && (home <= slot && home > next))) {
+      cache->entries[slot] = cache->entries[next];
+      memset(&cache->entries[next], 0, sizeof(cache_entry));
+      table_publish(cache, slot);
+      table_publish(cache, next);
+      slot = next;
+    }
+  } // for
+}
+
+/**
+ * Checks whether the entry at the given slot has expired for every cache kind.
+ *
+ * @param const cache_entry *entry
+ *   The occupied entry.
+ * @param time_t now
+ *   The current time.
+ *
+ * @return int
+ *   1 when expired and 0 otherwise.
+ */
+int cache_entry_expired(const cache_entry *entry, time_t now) {
+  int kind = 0;
+
+  for (; kind < CACHE_TOTAL; kind++) {
+    if (entry->expires[kind] > now) {
+      return 0;
+    }
+  } // for
+
+  return 1;
+}
+
+/**
+ * Removes every expired entry from the cache.
+ *
+ * The cache lock must be held.
+ *
+ * @param cache_data *cache
+ *   The cache to purge.
+ * @param time_t now
+ *   The current time.
+ */
+void cache_purge(cache_data *cache, time_t now) {
+  size_t slot = 0;
+
+  // a removal may shift a later entry into this slot, so the slot is checked again after a removal.
+  while (slot < CACHE_SLOTS) {
+    if (cache->entries[slot].length != 0 && cache_entry_expired(&cache->entries[slot], now)) {
+      cache_remove_slot(cache, slot);
+      continue;
+    }
+
+    slot++;
+  } // while
+}
+
+/**
+ * Checks whether a name is cached and not expired for the given cache kind.
+ *
+ * @param cache_data *cache
+ *   The cache to search.
+ * @param const char *name
+ *   The normalized name.
+ * @param int length
+ *   The length of the name.
+ * @param int kind
+ *   One of CACHE_LDAP or CACHE_MEMBER.
+ *
+ * @return int
+ *   1 when cached and 0 when not cached, expired, or the cache is disabled.
+ */
+int cache_find(cache_data *cache, const char *name, int length, int kind) {
+  time_t now = 0;
+  size_t slot = 0;
+  int result = 0;
+
+  if (cache->entries == NULL) {
+    return 0;
+  }
+
+  now = time(NULL);
+
+  pthread_mutex_lock(&cache->lock);
+
+  slot = cache_slot(cache, name, length);
+
+  // an expiry further away than the ttl was cached with a longer ttl, such as by an older snapshot.
+  if (cache->entries[slot].length != 0 && cache->entries[slot].expires[kind] > now && cache->entries[slot].expires[kind] <= now + cache->ttl) {
+    cache->total_hits++;
+    result = 1;
+  }
+  else {
+    cache->total_misses++;
+  }
+
+  pthread_mutex_unlock(&cache->lock);
+
+  if (result) {
+    MACRO_PROBE_3(cache_hit, name, length, kind);
+  }
+  else {
+    MACRO_PROBE_3(cache_miss, name, length, kind);
+  }
+
+  return result;
+}
+
+/**
+ * Caches a name for the given cache kind, expiring after the cache ttl.
+ *
+ * When the cache is full, the expired entries are purged and if it is still full then the name is not cached.
+ * The changed entries are also published to the table, when there is one.
+ *
+ * @param cache_data *cache
+ *   The cache to add to.
+ * @param const char *name
+ *   The normalized name.
+ * @param int length
+ *   The length of the name.
+ * @param int kind
+ *   One of CACHE_LDAP or CACHE_MEMBER.
+ */
+void cache_set(cache_data *cache, const char *name, int length, int kind) {
+  time_t now = 0;
+  size_t slot = 0;
+
+  if (cache->entries == NULL || length <= 0 || length > PACKET_SIZE_INPUT) {
+    return;
+  }
+
+  now = time(NULL);
+
+  pthread_mutex_lock(&cache->lock);
+  table_begin(cache);
+
+  slot = cache_slot(cache, name, length);
+
+  if (cache->entries[slot].length == 0) {
+    // at most half of the slots are used to keep the probe sequences short.
+    if (cache->used >= CACHE_SLOTS / 2) {
+      cache_purge(cache, now);
+
+      if (cache->used >= CACHE_SLOTS / 2) {
+        cache->total_full++;
+        table_end(cache);
+        pthread_mutex_unlock(&cache->lock);
+        return;
+      }
+
+      slot = cache_slot(cache, name, length);
+    }
+
+    memcpy(cache->entries[slot].name, name, length);
+    cache->entries[slot].length = length;
+    cache->used++;
+  }
+
+  cache->entries[slot].expires[kind] = now + cache->ttl;
+  table_publish(cache, slot);
+
+  table_end(cache);
+  pthread_mutex_unlock(&cache->lock);
+}
+
+/**
+ * Compares the cached group memberships against a snapshot of the group members.
+ *
+ * Cached members that are still in the group are refreshed and those no longer in the group are evicted.
+ * Names in the snapshot that are not cached are ignored.
+ *
+ * @param cache_data *cache
+ *   The cache to update.
+ * @param const name_set *members
+ *   The snapshot of the group members.
+ */
+void cache_cohere(cache_data *cache, const name_set *members) {
+  time_t now = time(NULL);
+  size_t slot = 0;
+
+  pthread_mutex_lock(&cache->lock);
+  table_begin(cache);
+
+  // a removal may shift a later entry into this slot, so the slot is checked again after a removal.
+  while (slot < CACHE_SLOTS) {
+    cache_entry *entry = &cache->entries[slot];
+
+    if (entry->length != 0 && entry->expires[CACHE_MEMBER] != 0) {
+      if (name_set_find(members, entry->name, entry->length)) {
+        entry->expires[CACHE_MEMBER] = now + cache->ttl;
+        cache->total_refreshed++;
+      }
+      else {
+        entry->expires[CACHE_MEMBER] = 0;
+        cache->total_evicted++;
+
+        if (cache_entry_expired(entry, now)) {
+          cache_remove_slot(cache, slot);
+          continue;
+        }
+      }
+
+      table_publish(cache, slot);
+    }
+
+    slot++;
+  } // while
+
+  cache->total_snapshots++;
+
+  table_end(cache);
+  pthread_mutex_unlock(&cache->lock);
+}
+
+/**
+ * Removes every entry from the cache, such as when the cache is known to be wrong.
+ *
+ * @param cache_data *cache
+ *   The cache to empty.
+ *
+ * @return size_t
+ *   The entries removed.
+ */
+size_t cache_flush(cache_data *cache) {
+  size_t removed = 0;
+  size_t slot = 0;
+
+  pthread_mutex_lock(&cache->lock);
+  table_begin(cache);
+
+  removed = cache->used;
+
+  for (; slot < CACHE_SLOTS; slot++) {
+    if (cache->entries[slot].length != 0) {
+      memset(&cache->entries[slot], 0, sizeof(cache_entry));
+      table_publish(cache, slot);
+    }
+  } // for
+
+  cache->used = 0;
+
+  table_end(cache);
+  pthread_mutex_unlock(&cache->lock);
+
+  return removed;
+}
+
+/**
+ * Removes a single name from the cache, so that the next request for it goes to ldap and the database.
+ *
+ * @param cache_data *cache
+ *   The cache to remove from.
+ * @param const char *name
+ *   The normalized name.
+ * @param int length
+ *   The length of the name.
+ *
+ * @return int
+ *   1 when the name was removed and 0 when it was not cached.
+ */
+int cache_invalidate(cache_data *cache, const char *name, int length) {
+  size_t slot = 0;
+  int result = 0;
+
+  pthread_mutex_lock(&cache->lock);
+
+  slot = cache_slot(cache, name, length);
+
+  if (cache->entries[slot].length != 0) {
+    table_begin(cache);
+    cache_remove_slot(cache, slot);
+    table_end(cache);
+    result = 1;
+  }
+
+  pthread_mutex_unlock(&cache->lock);
+
+  return result;
+}
+
+/**
+ * The cache thread, periodically comparing the cache against the group membership in the database and writing the cache snapshot.
+ *
+ * The database connection is kept open between snapshots and is re-established after a failure.
+ *
+ * @param void *argument
+ *   The shared_data.
+ *
+ * @return void *
+ *   NULL, this thread does not return until the process exits.
+ *
+ * @see: pthread_create()
+ */
+void *handler_cache(void *argument) {
+  shared_data *shared = (shared_data *) argument;
+  cache_data *cache = &shared->cache;
+  PGconn *connection = NULL;
+  time_t next_coherence = 0;
+  time_t next_snapshot = 0;
+  char query[sizeof(PSQL_SELECT_MEMBERS) + PARAMETER_LENGTH_MAX];
+
+  cache->pid_child = syscall(SYS_gettid);
+
+  // the first coherence is performed immediately to correct any cache entries loaded from the snapshot.
+  next_coherence = time(NULL);
+  next_snapshot = next_coherence + cache->snapshot;
+
+  while (1) {
+    name_set members;
+    time_t now = 0;
+
+    sleep(1);
+
+    now = time(NULL);
+
+    if (cache->snapshot > 0 && now >= next_snapshot) {
+      cache_snapshot_write(cache, shared->parameter_group, shared->parameter_database);
+      next_snapshot = now + cache->snapshot;
+    }
+
+    if (cache->coherence == 0 || now < next_coherence) {
+      continue;
+    }
+
+    next_coherence = now + cache->coherence;
+
+    if (connection == NULL) {
+      connection = PQconnectdb(shared->psql_connection);
+
+      if (connection == NULL || PQstatus(connection) != CONNECTION_OK) {
+        log_write(LOG_ERR, "ERROR: failed to establish the postgresql connection for the cache coherence of group '%s' and database '%s', reason: %s.\n", shared->parameter_group, shared->parameter_database, connection == NULL ? "NULL returned" : PQerrorMessage(connection));
+
+        if (connection != NULL) {
+          PQfinish(connection);
+          connection = NULL;
+        }
+
+        continue;
+      }
+    }
+
+    if (name_set_initialize(&members, CACHE_SLOTS / 2) < 0) {
+      log_write(LOG_ERR, "ERROR: failed to allocate memory for the cache coherence snapshot.\n");
+      continue;
+    }
+
+    snprintf(query, sizeof(query), PSQL_SELECT_MEMBERS, shared->parameter_group);
+
+    if (database_load_names(connection, query, &members) < 0) {
+      PQfinish(connection);
+      connection = NULL;
+    }
+    else {
+      cache_cohere(cache, &members);
+    }
+
+    name_set_destroy(&members);
+  } // while
+
+  return NULL;
+}
+
+/**
+ * Maps the slab of the kept connections and creates the epoll instance they wait in.
+ *
+ * The slab is indexed by the socket id, so the soft file descriptor limit is raised to the hard limit and the slab is sized to it (up to KEEPALIVE_DESCRIPTORS_MAX).
+ * The slab and the partials are mapped with MAP_NORESERVE, so that their memory is only used once a slot is.
+ *
+ * @param keepalive_data *keepalive
+ *   The keepalive data, with the limit already populated.
+ *
+ * @return int
+ *   1 on success and -1 on error.
+ */
+int keepalive_initialize(keepalive_data *keepalive) {
+  struct rlimit descriptors;
+  int index = 0;
+
+  if (keepalive->limit > KEEPALIVE_DESCRIPTORS_MAX) {
+    log_write(LOG_ERR, "ERROR: only %u connections may be kept in '%s'.\n", KEEPALIVE_DESCRIPTORS_MAX, ENVIRONMENT_KEEPALIVE);
+    return -1;
+  }
+
+  memset(&descriptors, 0, sizeof(struct rlimit));
+
+  if (getrlimit(RLIMIT_NOFILE, &descriptors) < 0) {
+    log_write(LOG_ERR, "ERROR: failed to get the file descriptor limit, error: %i.\n", errno);
+    return -1;
+  }
+
+  if (descriptors.rlim_cur < descriptors.rlim_max) {
+    descriptors.rlim_cur = descriptors.rlim_max;
+
+    if (setrlimit(RLIMIT_NOFILE, &descriptors) < 0) {
+      log_write(LOG_NOTICE, "NOTICE: failed to raise the file descriptor limit to %lu, error: %i.\n", (unsigned long) descriptors.rlim_max, errno);
+      getrlimit(RLIMIT_NOFILE, &descriptors);
+    }
+  }
+
+  if (descriptors.rlim_cur == RLIM_INFINITY || descriptors.rlim_cur > KEEPALIVE_DESCRIPTORS_MAX) {
+    keepalive->connections_total = KEEPALIVE_DESCRIPTORS_MAX;
+  }
+  else {
+    keepalive->connections_total = descriptors.rlim_cur;
+  }
+
+  if ((size_t) keepalive->limit > keepalive->connections_total) {
+    log_write(LOG_NOTICE, "NOTICE: the file descriptor limit of %lu is below the %ld connections that may be kept, raise the limit (such as LimitNOFILE) to keep them all.\n", (unsigned long) keepalive->connections_total, keepalive->limit);
+  }
+
+  keepalive->connections = mmap(NULL, sizeof(keepalive_connection) * keepalive->connections_total, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+  if (keepalive->connections == MAP_FAILED) {
+    log_write(LOG_ERR, "ERROR: failed to map the slab of %lu kept connections, error: %i.\n", (unsigned long) keepalive->connections_total, errno);
+    keepalive->connections = NULL;
+    return -1;
+  }
+
+  keepalive->partials = mmap(NULL, sizeof(keepalive_partial) * KEEPALIVE_PARTIALS, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+  if (keepalive->partials == MAP_FAILED) {
+    log_write(LOG_ERR, "ERROR: failed to map the partial packets of the kept connections, error: %i.\n", errno);
+    keepalive->partials = NULL;
+    return -1;
+  }
+
+  keepalive->epoll_id = epoll_create1(EPOLL_CLOEXEC);
+
+  if (keepalive->epoll_id < 0) {
+    log_write(LOG_ERR, "ERROR: failed to create the epoll instance of the kept connections, error: %i.\n", errno);
+    keepalive->epoll_id = 0;
+    return -1;
+  }
+
+  // the partials are taken from the end, so the lowest is used first.
+  for (; index < KEEPALIVE_PARTIALS; index++) {
+    keepalive->partials_unused[index] = KEEPALIVE_PARTIALS - 1 - index;
+  } // for
+
+  keepalive->partials_unused_total = KEEPALIVE_PARTIALS;
+
+  return 1;
+}
+
+/**
+ * Stops keeping a connection, before it is closed or given to a thread that closes it.
+ *
+ * @param keepalive_data *keepalive
+ *   The keepalive data.
+ * @param int socket_id_client
+ *   The client connection, which need not be kept.
+ */
+void keepalive_detach(keepalive_data *keepalive, int socket_id_client) {
+  keepalive_connection *connection = NULL;
+
+  if (keepalive->connections == NULL || socket_id_client < 0 || (size_t) socket_id_client >= keepalive->connections_total) {
+    return;
+  }
+
+  connection = &keepalive->connections[socket_id_client];
+
+  if (__atomic_load_n(&connection->state, __ATOMIC_ACQUIRE) != KEEPALIVE_STATE_NONE) {
+    __atomic_store_n(&connection->state, KEEPALIVE_STATE_NONE, __ATOMIC_RELEASE);
+    __atomic_sub_fetch(&keepalive->kept, 1, __ATOMIC_RELAXED);
+  }
+}
+
+/**
+ * Arms a kept connection in epoll, so that the keepalive thread receives its next packet segment.
+ *
+ * Each connection is disarmed after its event (EPOLLONESHOT), so that it is not read while a request is being answered.
+ * A closed connection is removed from epoll by the kernel, so it is added again when its socket id is reused.
+ *
+ * @param keepalive_data *keepalive
+ *   The keepalive data.
+ * @param int socket_id_client
+ *   The kept client connection.
+ *
+ * @return int
+ *   1 on success and -1 on error.
+ */
+int keepalive_arm(keepalive_data *keepalive, int socket_id_client) {
+  struct epoll_event event;
+
+  memset(&event, 0, sizeof(struct epoll_event));
+  event.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+  event.data.fd = socket_id_client;
+
+  if (epoll_ctl(keepalive->epoll_id, EPOLL_CTL_MOD, socket_id_client, &event) < 0) {
+    if (errno != ENOENT || epoll_ctl(keepalive->epoll_id, EPOLL_CTL_ADD, socket_id_client, &event) < 0) {
+      log_write(LOG_ERR, "ERROR: failed to wait for the next request of the kept connection %i, error: %i.\n", socket_id_client, errno);
+      return -1;
+    }
+  }
+
+  return 1;
+}
+
+/**
+ * Keeps the client connection open for its next request, or closes it, once the response has been sent.
+ *
+ * The connection is kept when the request had PACKET_FLAG_KEEP and fewer than the limit are already kept.
+ * This is called by the thread that responded, the keepalive thread then owns a kept connection.
+ *
+ * @param shared_data *shared
+ *   The data shared between the parent and all threads.
+ * @param int socket_id_client
+ *   The client connection.
+ * @param const trace_data *trace
+ *   The trace of the request, holding the listener and the address of the client.
+ * @param int keep
+ *   Non-zero when the request had PACKET_FLAG_KEEP.
+ */
+void keepalive_release(shared_data *shared, int socket_id_client, const trace_data *trace, int keep) {
+  keepalive_data *keepalive = &shared->keepalive;
+  keepalive_connection *connection = NULL;
+  struct timespec now;
+
+  if (keep && keepalive->connections != NULL && socket_id_client >= 0 && (size_t) socket_id_client < keepalive->connections_total) {
+    connection = &keepalive->connections[socket_id_client];
+
+    // a connection accepted by a listener is kept for the first time.
+    if (__atomic_load_n(&connection->state, __ATOMIC_ACQUIRE) == KEEPALIVE_STATE_NONE) {
+      if (__atomic_add_fetch(&keepalive->kept, 1, __ATOMIC_RELAXED) > keepalive->limit) {
+        __atomic_sub_fetch(&keepalive->kept, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&keepalive->total_full, 1, __ATOMIC_RELAXED);
+        connection = NULL;
+      }
+      else {
+        int highest = __atomic_load_n(&keepalive->highest, __ATOMIC_RELAXED);
+
+        connection->listener = trace->listener;
+        connection->address = trace->address;
+        connection->port = trace->port;
+        connection->partial = -1;
+
+        while (socket_id_client > highest && !__atomic_compare_exchange_n(&keepalive->highest, &highest, socket_id_client, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        } // while
+
+        __atomic_add_fetch(&keepalive->total_kept, 1, __ATOMIC_RELAXED);
+      }
+    }
+  }
+
+  if (connection != NULL) {
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    connection->idle_since = now.tv_sec;
+
+    // the keepalive thread owns the connection from here.
+    __atomic_store_n(&connection->state, KEEPALIVE_STATE_IDLE, __ATOMIC_RELEASE);
+
+    if (keepalive_arm(keepalive, socket_id_client) > 0) {
+      return;
+    }
+  }
+
+  keepalive_detach(keepalive, socket_id_client);
+  shutdown(socket_id_client, SHUT_RDWR);
+  close(socket_id_client);
+}
+
+/**
+ * Probes each ldap server and the database, when HEALTH_INTERVAL has passed since the last probes.
+ *
+ * This is called by the breaker thread, so a probe never delays a request.
+ * A backend whose circuit is open is not probed here, the breaker probes it instead (see breaker_probe_due()).
+ * The ldap servers are bound to as for a search, while the database is only pinged without logging in, see PQping().
+ *
+ * @param shared_data *shared
+ *   The data shared between the parent and all threads.
+ */
+void health_probe(shared_data *shared) {
+  health_data *health = &shared->health;
+  ldap_pool_data *pool = &shared->ldap_pool;
+  time_t now = time(NULL);
+  int index = 0;
+
+  if (health->interval <= 0 || now - health->probed_at < health->interval) {
+    return;
+  }
+
+  for (; index < pool->total; index++) {
+    LDAP *ldap_settings = NULL;
+
+    if (__atomic_load_n(&pool->servers[index].breaker.state, __ATOMIC_RELAXED) == BREAKER_OPEN) {
+      continue;
+    }
+
+    ldap_settings = ldap_pool_handshake(pool, index);
+
+    __atomic_store_n(&health->ldap_failed[index], ldap_settings == NULL, __ATOMIC_RELAXED);
+    breaker_record(&pool->servers[index].breaker, ldap_settings != NULL);
+
+    if (ldap_settings != NULL) {
+      ldap_unbind(ldap_settings);
+    }
+  } // for
+
+  if (__atomic_load_n(&shared->breaker_database.state, __ATOMIC_RELAXED) != BREAKER_OPEN) {
+    const int failed = PQping(shared->psql_connection) != PQPING_OK;
+
+    __atomic_store_n(&health->database_failed, failed, __ATOMIC_RELAXED);
+
+    // a ping does not log in, so only a failure is recorded against the database.
+    if (failed) {
+      breaker_record(&shared->breaker_database, 0);
+    }
+  }
+
+  health->total_probes++;
+  __atomic_store_n(&health->probed_at, now, __ATOMIC_RELEASE);
+}
+
+/**
+ * Gets the health of the service, from the background probes and the circuit breakers.
+ *
+ * No lock is held and no backend is contacted, so this may be called for every ping.
+ *
+ * @param shared_data *shared
+ *   The data shared between the parent and all threads.
+ * @param int *flags
+ *   The HEALTH_FLAG_* flags, this value will be updated.
+ *
+ * @return char *
+ *   ERROR_NONE when ready, ERROR_DEGRADED when ready but a backend is failing, and ERROR_NOT_READY when not ready.
+ */
+char *health_check(shared_data *shared, int *flags) {
+  health_data *health = &shared->health;
+  ldap_pool_data *pool = &shared->ldap_pool;
+  int ldap_failing = 0;
+  int index = 0;
+
+  *flags = 0;
+
+  for (; index < pool->total; index++) {
+    if (__atomic_load_n(&pool->servers[index].breaker.state, __ATOMIC_RELAXED) == BREAKER_OPEN || __atomic_load_n(&health->ldap_failed[index], __ATOMIC_RELAXED)) {
+      ldap_failing++;
+    }
+  } // for
+
+  if (ldap_failing > 0) {
+    *flags |= ldap_failing < pool->total ? HEALTH_FLAG_LDAP_SOME : HEALTH_FLAG_LDAP;
+  }
+
+  if (__atomic_load_n(&shared->breaker_database.state, __ATOMIC_RELAXED) == BREAKER_OPEN || __atomic_load_n(&health->database_failed, __ATOMIC_RELAXED)) {
+    *flags |= HEALTH_FLAG_DATABASE;
+  }
+
+  if (__atomic_load_n(&shared->control.paused, __ATOMIC_ACQUIRE)) {
+    *flags |= HEALTH_FLAG_PAUSED;
+  }
+
+  if (__atomic_load_n(&shared->scheduler.unused_total, __ATOMIC_RELAXED) == 0) {
+    *flags |= HEALTH_FLAG_FULL;
+  }
+
+  if (health->interval > 0 && __atomic_load_n(&health->probed_at, __ATOMIC_ACQUIRE) == 0) {
+    *flags |= HEALTH_FLAG_UNPROBED;
+  }
+
+  if (*flags & (HEALTH_FLAG_PAUSED | HEALTH_FLAG_FULL | HEALTH_FLAG_UNPROBED)) {
+    return ERROR_NOT_READY;
+  }
+
+  if (*flags & (HEALTH_FLAG_LDAP | HEALTH_FLAG_DATABASE)) {
+    return ERROR_DEGRADED;
+  }
+
+  return ERROR_NONE;
+}
+
+/**
+ * Responds to a ping with the health of the service and closes the client connection.
+ *
+ * @param shared_data *shared
+ *   The data shared between the parent and all threads.
+ * @param int socket_id_client
+ *   The client connection, which is then kept or closed (see keepalive_release()).
+ * @param const trace_data *trace
+ *   The trace of the ping.
+ * @param int keep
+ *   Non-zero when the ping had PACKET_FLAG_KEEP.
+ *
+ * @return char *
+ *   The status sent, see health_check().
+ */
+char *health_respond(shared_data *shared, int socket_id_client, const trace_data *trace, int keep) {
+  char response[PACKET_SIZE_OUTPUT + HEALTH_LENGTH];
+  int flags = 0;
+  char *status = health_check(shared, &flags);
+
+  __atomic_add_fetch(&shared->health.total_pings, 1, __ATOMIC_RELAXED);
+
+  response[0] = status[0];
+  response[1] = flags;
+
+  send(socket_id_client, response, PACKET_SIZE_OUTPUT + HEALTH_LENGTH, FLAGS_SEND);
+  keepalive_release(shared, socket_id_client, trace, keep);
+
+  return status;
+}
+
+/**
+ * The breaker thread, probing each backend whose circuit is open once its backoff has passed.
+ *
+ * An ldap server is probed with a bind and the database is probed with a connection.
+ * A successful probe closes the circuit and a failed probe doubles the backoff, see breaker_record().
+ * This thread also keeps the spare ldap connections ready, see ldap_pool_prewarm(), and flushes the capture while no requests finish, see capture_tick().
+ *
+ * @param void *argument
+ *   The shared_data.
+ *
+ * @return void *
+ *   NULL, this thread does not return until the process exits.
+ *
+ * @see: pthread_create()
+ */
+void *handler_breaker(void *argument) {
+  shared_data *shared = (shared_data *) argument;
+  ldap_pool_data *pool = &shared->ldap_pool;
+
+  while (1) {
+    int index = 0;
+
+    usleep(BREAKER_PROBE_POLL);
+
+    for (; index < pool->total; index++) {
+      if (breaker_probe_due(&pool->servers[index].breaker)) {
+        LDAP *ldap_settings = ldap_pool_handshake(pool, index);
+
+        breaker_record(&pool->servers[index].breaker, ldap_settings != NULL);
+
+        if (ldap_settings != NULL) {
+          ldap_unbind(ldap_settings);
+        }
+      }
+    } // for
+
+    if (breaker_probe_due(&shared->breaker_database)) {
+      PGconn *connection = PQconnectdb(shared->psql_connection);
+
+      breaker_record(&shared->breaker_database, connection != NULL && PQstatus(connection) == CONNECTION_OK);
+
+      if (connection != NULL) {
+        PQfinish(connection);
+      }
+    }
+
+    health_probe(shared);
+    ldap_pool_prewarm(pool);
+    capture_tick(&shared->capture);
+  } // while
+
+  return NULL;
+}
+
+/**
+ * Validates a received packet segment and appends it to the user name.
+ *
+ * Only alphanumeric, '-', and '_' are allowed in the user name (utf8 should be fine for all codes that match the ASCII table).
+ * A NULL byte terminates the packet, as does reaching PACKET_SIZE_INPUT.
+ * The first byte may instead be a header with PACKET_HEADER set, holding the PACKET_FLAG_* flags (the header counts towards PACKET_SIZE_INPUT).
+ * With PACKET_FLAG_DEADLINE, the header is followed by PACKET_DEADLINE_LENGTH bytes of time budget, which may contain NULL bytes.
+ * With PACKET_FLAG_TICKET, the header (and any time budget) is followed by PACKET_TICKET_LENGTH bytes of ticket, which may also contain NULL bytes.
+ * With PACKET_FLAG_KEEP, the NULL byte only ends the name and the packet is complete once PACKET_SIZE_INPUT bytes are processed, so that the next packet on the connection starts after it.
+ * The caller must not receive more than PACKET_SIZE_INPUT less the processed bytes at a time, so that no part of the next packet is received.
+ *
+ * @param const char *buffer
+ *   The received packet segment.
+ * @param const int buffer_length
+ *   The length of the received packet segment.
+ * @param char *user_name
+ *   The user name being built, must be at least PACKET_SIZE_INPUT + 1 in size.
+ * @param int *processed
+ *   The total number of packet bytes processed so far, this value will be updated.
+ * @param int *user_name_length
+ *   The length of the user name built so far, this value will be updated.
+ * @param int *flags
+ *   The PACKET_FLAG_* flags of the packet header, this value will be updated (must be 0 before the first segment).
+ * @param int *budget
+ *   The time budget in milliseconds from PACKET_FLAG_DEADLINE, this value will be updated (must be 0 before the first segment).
+ * @param uint32_t *ticket
+ *   The ticket from PACKET_FLAG_TICKET, this value will be updated (must be 0 before the first segment).
+ *
+ * @return int
+ *   PACKET_PARSE_DONE when the packet is complete, PACKET_PARSE_MORE when more data is expected, and PACKET_PARSE_INVALID on an invalid user name.
+ */
+int packet_parse(const char *buffer, const int buffer_length, char *user_name, int *processed, int *user_name_length, int *flags, int *budget, uint32_t *ticket) {
+  int i = 0;
+
+  for (; i < buffer_length && *processed < PACKET_SIZE_INPUT; i++) {
+    // the budget and then the ticket follow the header and may be split across segments.
+    if ((*flags & PACKET_FLAG_DEADLINE) && *processed <= PACKET_DEADLINE_LENGTH) {
+      *budget = (*budget << 8) | ((unsigned char) buffer[i]);
+      (*processed)++;
+      continue;
+    }
+
+    if ((*flags & PACKET_FLAG_TICKET) && *processed <= ((*flags & PACKET_FLAG_DEADLINE) ? PACKET_DEADLINE_LENGTH : 0) + PACKET_TICKET_LENGTH) {
+      *ticket = (*ticket << 8) | ((unsigned char) buffer[i]);
+      (*processed)++;
+      continue;
+    }
+
+    // the rest of a PACKET_FLAG_KEEP packet after the name is padding.
+    if (*flags & PACKET_PARSE_PADDING) {
+      (*processed)++;
+      continue;
+    }
+
+    // if a NULL char is reached, then the packet is finished.
+    if (buffer[i] == 0) {
+      if (*flags & PACKET_FLAG_KEEP) {
+        *flags |= PACKET_PARSE_PADDING;
+        (*processed)++;
+        continue;
+      }
+
+      *processed = PACKET_SIZE_INPUT;
+      break;
+    }
+
+    if (*processed == 0 && (((unsigned char) buffer[i]) & PACKET_HEADER)) {
+      *flags = ((unsigned char) buffer[i]) & ~PACKET_HEADER;
+      (*processed)++;
+      continue;
+    }
+
+    if ((buffer[i] < 'a' || buffer[i] > 'z') && (buffer[i] < 'A' || buffer[i] > 'Z') && (buffer[i] < '0' || buffer[i] > '9')) {
+      if (buffer[i] != '-' && buffer[i] != '_') {
+        return PACKET_PARSE_INVALID;
+      }
+    }
+
+    user_name[*user_name_length] = buffer[i];
+    (*user_name_length)++;
+    (*processed)++;
+  } // for
+
+  if (*processed < PACKET_SIZE_INPUT) {
+    return PACKET_PARSE_MORE;
+  }
+
+  // require the user name to be populated in some manner at this point, a ping has no name.
+  if (*user_name_length == 0 && !(*flags & PACKET_FLAG_PING)) {
+    return PACKET_PARSE_INVALID;
+  }
+
+  user_name[*user_name_length] = 0;
+
+  return PACKET_PARSE_DONE;
+}
+
+/**
+ * Processes a validated user name, querying ldap (or the mirror) and then granting the role in the database.
+ *
+ * Names that recently existed in ldap or were recently granted are answered from the cache.
+ * Once the deadline of the request (see worker->deadline) has passed, no further ldap or database work is started and ERROR_TIMEOUT is returned.
+ * The heap allocations made while processing are added to the worker counters.
+ *
+ * @param shared_data *shared
+ *   The data shared between the parent and all threads.
+ * @param worker_data *worker
+ *   The buffers and counters of the calling worker.
+ * @param const char *user_name
+ *   The validated user name.
+ *
+ * @return char *
+ *   The status to respond to the client with, such as ERROR_NONE.
+ */
+char *request_process_name(shared_data *shared, worker_data *worker, const char *user_name) {
+  char normalized[PACKET_SIZE_INPUT + 1];
+  int user_name_length = strnlen(user_name, PACKET_SIZE_INPUT);
+  int ldap_name_exists = 0;
+  unsigned long allocations = allocation_count();
+  char *status = ERROR_NONE;
+
+  // the user name is already validated, this only converts to lower case for the cache.
+  name_normalize(user_name, user_name_length, normalized);
+
+  // the mirror answers without an ldap round trip when it is enabled and synced.
+  ldap_name_exists = mirror_find(&shared->mirror, user_name);
+
+  if (ldap_name_exists >= 0 && worker->trace != NULL) {
+    worker->trace->flags |= TRACE_FLAG_MIRROR;
+  }
+
+  if (ldap_name_exists < 0 && cache_find(&shared->cache, normalized, user_name_length, CACHE_LDAP)) {
+    ldap_name_exists = 1;
+
+    if (worker->trace != NULL) {
+      worker->trace->flags |= TRACE_FLAG_CACHE_LDAP;
+    }
+  }
+
+  if (ldap_name_exists < 0) {
+    MACRO_PROBE_1(ldap_search_start, user_name);
+    ldap_name_exists = does_name_exist_in_ldap(&shared->ldap_pool, worker, user_name);
+    MACRO_PROBE_2(ldap_search_finish, user_name, ldap_name_exists);
+
+    if (ldap_name_exists > 0) {
+      cache_set(&shared->cache, normalized, user_name_length, CACHE_LDAP);
+    }
+  }
+
+  if (ldap_name_exists < 0) {
+    if (deadline_expired(&worker->deadline)) {
+      worker->total_expired[DEADLINE_LDAP]++;
+      status = ERROR_TIMEOUT;
+    }
+    else {
+      status = ERROR_LDAP;
+    }
+  }
+  else if (ldap_name_exists == 0) {
+    status = ERROR_NAME;
+  }
+  else if (cache_find(&shared->cache, normalized, user_name_length, CACHE_MEMBER)) {
+    if (worker->trace != NULL) {
+      worker->trace->flags |= TRACE_FLAG_CACHE_MEMBER;
+    }
+  }
+  else {
+    int granted = grant_role_in_database(shared, worker, user_name);
+
+    if (granted == -3) {
+      worker->total_expired[DEADLINE_DATABASE]++;
+      status = ERROR_TIMEOUT;
+    }
+    else if (granted == -2) {
+      status = ERROR_DATABASE;
+    }
+    else if (granted < 0) {
+      status = ERROR_SQL;
+    }
+    else {
+      cache_set(&shared->cache, normalized, user_name_length, CACHE_MEMBER);
+    }
+  }
+
+  allocations = allocation_count() - allocations;
+
+  worker->total_requests++;
+
+  if (allocations > 0) {
+    worker->total_requests_allocating++;
+    worker->total_allocations += allocations;
+  }
+
+  return status;
+}
+
+/**
+ * Initializes the tickets, the ticket thread is created separately.
+ *
+ * @param ticket_data *tickets
+ *   The tickets to initialize.
+ *
+ * @return int
+ *   1 on success and -1 on error.
+ */
+int ticket_initialize(ticket_data *tickets) {
+  pthread_condattr_t attributes;
+
+  // the waiting polls have CLOCK_MONOTONIC deadlines, as do the requests.
+  if (pthread_condattr_init(&attributes) != 0 || pthread_condattr_setclock(&attributes, CLOCK_MONOTONIC) != 0 || pthread_cond_init(&tickets->changed, &attributes) != 0) {
+    log_write(LOG_ERR, "ERROR: failed to initialize the ticket condition.\n");
+    return -1;
+  }
+
+  pthread_condattr_destroy(&attributes);
+  pthread_mutex_init(&tickets->lock, NULL);
+
+  return 1;
+}
+
+/**
+ * Issues a ticket for an asynchronous request.
+ *
+ * @param ticket_data *tickets
+ *   The tickets to issue from.
+ * @param const char *user_name
+ *   The validated user name, a poll for the ticket must have the same name.
+ *
+ * @return uint32_t
+ *   The ticket or 0 when the slot of the next ticket is still pending (too many asynchronous requests are being processed).
+ */
+uint32_t ticket_issue(ticket_data *tickets, const char *user_name) {
+  ticket_entry *entry = NULL;
+  uint32_t ticket = 0;
+
+  pthread_mutex_lock(&tickets->lock);
+
+  ticket = tickets->issued + 1;
+
+  if (ticket == 0) {
+    ticket = 1;
+  }
+
+  entry = &tickets->entries[ticket & (TICKET_SLOTS - 1)];
+
+  if (entry->ticket != 0 && entry->status == NULL) {
+    tickets->total_full++;
+    pthread_mutex_unlock(&tickets->lock);
+    return 0;
+  }
+
+  tickets->issued = ticket;
+  tickets->total_issued++;
+
+  entry->ticket = ticket;
+  entry->status = NULL;
+  memset(entry->name, 0, PACKET_SIZE_INPUT + 1);
+  strncpy(entry->name, user_name, PACKET_SIZE_INPUT);
+
+  pthread_mutex_unlock(&tickets->lock);
+
+  return ticket;
+}
+
+/**
+ * Records the result of an asynchronous request, waking the ticket thread for any polls waiting on it.
+ *
+ * @param ticket_data *tickets
+ *   The tickets the ticket was issued from.
+ * @param uint32_t ticket
+ *   The ticket.
+ * @param char *status
+ *   The result, one of the ERROR_* strings such as ERROR_NONE.
+ */
+void ticket_finish(ticket_data *tickets, uint32_t ticket, char *status) {
+  ticket_entry *entry = &tickets->entries[ticket & (TICKET_SLOTS - 1)];
+
+  pthread_mutex_lock(&tickets->lock);
+
+  if (entry->ticket == ticket) {
+    entry->status = status;
+
+    if (tickets->waiters_total > 0) {
+      pthread_cond_signal(&tickets->changed);
+    }
+  }
+
+  pthread_mutex_unlock(&tickets->lock);
+}
+
+/**
+ * Polls the result of an asynchronous request.
+ *
+ * When the result is still pending and the poll has a time budget, the ticket thread waits for the result and responds to the client.
+ *
+ * @param ticket_data *tickets
+ *   The tickets the ticket was issued from.
+ * @param int socket_id_client
+ *   The client connection.
+ * @param const char *user_name
+ *   The validated user name, which must be the name the ticket was issued for.
+ * @param uint32_t ticket
+ *   The ticket.
+ * @param int budget
+ *   The time budget in milliseconds to wait for the result, 0 to not wait.
+ * @param const struct timespec *started
+ *   The CLOCK_MONOTONIC time the connection was accepted, the budget is counted from.
+ *
+ * @return char *
+ *   The status to respond to the client with, or NULL when the ticket thread now owns the client connection.
+ */
+char *ticket_poll(ticket_data *tickets, int socket_id_client, const char *user_name, uint32_t ticket, int budget, const struct timespec *started) {
+  ticket_entry *entry = &tickets->entries[ticket & (TICKET_SLOTS - 1)];
+  char *status = ERROR_PENDING;
+
+  pthread_mutex_lock(&tickets->lock);
+
+  tickets->total_polls++;
+
+  if (ticket == 0 || entry->ticket != ticket || strncmp(entry->name, user_name, PACKET_SIZE_INPUT) != 0) {
+    tickets->total_unknown++;
+    status = ERROR_TICKET;
+  }
+  else if (entry->status != NULL) {
+    status = entry->status;
+  }
+  else if (budget > 0 && tickets->waiters_total < TICKET_WAITERS) {
+    ticket_waiter *waiter = &tickets->waiters[tickets->waiters_total];
+
+    waiter->socket_id_client = socket_id_client;
+    waiter->ticket = ticket;
+    deadline_set(&waiter->deadline, started, budget);
+
+    tickets->waiters_total++;
+    tickets->total_waited++;
+    status = NULL;
+
+    pthread_cond_signal(&tickets->changed);
+  }
+  else {
+    tickets->total_pending++;
+  }
+
+  pthread_mutex_unlock(&tickets->lock);
+
+  return status;
+}
+
+/**
+ * The ticket thread, responding to the polls that wait for a result once the result is recorded or the wait has timed out.
+ *
+ * A poll whose wait times out is answered with ERROR_PENDING.
+ *
+ * @param void *argument
+ *   The shared_data.
+ *
+ * @return void *
+ *   NULL, this thread does not return until the process exits.
+ *
+ * @see: pthread_create()
+ */
+void *handler_ticket(void *argument) {
+  shared_data *shared = (shared_data *) argument;
+  ticket_data *tickets = &shared->tickets;
+
+  pthread_mutex_lock(&tickets->lock);
+
+  while (1) {
+    struct timespec earliest;
+    int waiter_index = 0;
+
+    memset(&earliest, 0, sizeof(struct timespec));
+
+    while (waiter_index < tickets->waiters_total) {
+      ticket_waiter *waiter = &tickets->waiters[waiter_index];
+      ticket_entry *entry = &tickets->entries[waiter->ticket & (TICKET_SLOTS - 1)];
+      char *status = NULL;
+
+      if (entry->ticket != waiter->ticket) {
+        tickets->total_unknown++;
+        status = ERROR_TICKET;
+      }
+      else if (entry->status != NULL) {
+        status = entry->status;
+      }
+      else if (deadline_expired(&waiter->deadline)) {
+        tickets->total_pending++;
+        status = ERROR_PENDING;
+      }
+      else {
+        if ((earliest.tv_sec == 0 && earliest.tv_nsec == 0) || waiter->deadline.tv_sec < earliest.tv_sec || (waiter->deadline.tv_sec == earliest.tv_sec && waiter->deadline.tv_nsec < earliest.tv_nsec)) {
+          earliest = waiter->deadline;
+        }
+
+        waiter_index++;
+        continue;
+      }
+
+      // the client sockets have a short send timeout, so this does not hold the lock for long.
+      send(waiter->socket_id_client, status, PACKET_SIZE_OUTPUT, FLAGS_SEND);
+      shutdown(waiter->socket_id_client, SHUT_RDWR);
+      close(waiter->socket_id_client);
+
+      tickets->waiters_total--;
+      tickets->waiters[waiter_index] = tickets->waiters[tickets->waiters_total];
+    } // while
+
+    if (tickets->waiters_total == 0) {
+      pthread_cond_wait(&tickets->changed, &tickets->lock);
+    }
+    else {
+      pthread_cond_timedwait(&tickets->changed, &tickets->lock, &earliest);
+    }
+  } // while
+
+  pthread_mutex_unlock(&tickets->lock);
+
+  return NULL;
+}
+
+/**
+ * Parses the weights of the clients from the weights list.
+ *
+ * The list is space separated pairs of an ipv4 address and a weight, such as "10.0.0.5=4 10.0.0.6=2".
+ *
+ * @param scheduler_data *scheduler
+ *   The scheduler with the weights list already populated.
+ *
+ * @return int
+ *   1 on success and -1 on error.
+ */
+int scheduler_weights_initialize(scheduler_data *scheduler) {
+  char *position = NULL;
+  char *pair = strtok_r(scheduler->weights_list, " ", &position);
+
+  scheduler->weights_total = 0;
+
+  for (; pair != NULL; pair = strtok_r(NULL, " ", &position)) {
+    char *separator = strchr(pair, '=');
+    char *end = NULL;
+    long weight = 0;
+
+    if (scheduler->weights_total == SCHEDULER_WEIGHTS_MAX) {
+      log_write(LOG_ERR, "ERROR: only %u weights are supported in '%s'.\n", SCHEDULER_WEIGHTS_MAX, ENVIRONMENT_FAIR_WEIGHTS);
+      return -1;
+    }
+
+    if (separator != NULL) {
+      *separator = 0;
+      weight = strtol(separator + 1, &end, 10);
+    }
+
+    if (separator == NULL || *end != 0 || weight < 1 || weight > SCHEDULER_WEIGHT_MAX || inet_pton(AF_INET, pair, &scheduler->weight_addresses[scheduler->weights_total]) != 1) {
+      if (separator != NULL) {
+        *separator = '=';
+      }
+
+      log_write(LOG_ERR, "ERROR: the weight '%s' in '%s' is not valid, it must be an ipv4 address followed by '=' and a weight from 1 to %u.\n", pair, ENVIRONMENT_FAIR_WEIGHTS, SCHEDULER_WEIGHT_MAX);
+      return -1;
+    }
+
+    scheduler->weight_values[scheduler->weights_total] = weight;
+    scheduler->weights_total++;
+  } // for
+
+  return 1;
+}
+
+/**
+ * Gets the weight of a client, which is the requests dispatched from its flow in each turn.
+ *
+ * @param const scheduler_data *scheduler
+ *   The scheduler with the weights.
+ * @param uint32_t address
+ *   The ipv4 address of the client in network byte order, 0 for a socket client.
+ *
+ * @return int
+ *   The weight, 1 when the client has no weight.
+ */
+int scheduler_weight(const scheduler_data *scheduler, uint32_t address) {
+  int index = 0;
+
+  for (; index < scheduler->weights_total; index++) {
+    if (scheduler->weight_addresses[index] == address) {
+      return scheduler->weight_values[index];
+    }
+  } // for
+
+  return 1;
+}
+
+/**
+ * Initializes the scheduler and allocates the worker data, the worker threads are created separately (see scheduler_resize()).
+ *
+ * @param scheduler_data *scheduler
+ *   The scheduler with the workers and bulk share parameters already populated.
+ * @param shared_data *shared
+ *   The data shared between the parent and all threads.
+ *
+ * @return int
+ *   1 on success and -1 on error.
+ */
+int scheduler_initialize(scheduler_data *scheduler, shared_data *shared) {
+  int index = 0;
+
+  scheduler->worker_list = calloc(SCHEDULER_WORKERS_MAX, sizeof(worker_data));
+  scheduler->threads = calloc(SCHEDULER_WORKERS_MAX, sizeof(pthread_t));
+
+  if (scheduler->worker_list == NULL || scheduler->threads == NULL) {
+    log_write(LOG_ERR, "ERROR: failed to allocate memory for %u workers.\n", SCHEDULER_WORKERS_MAX);
+    return -1;
+  }
+
+  for (; index < SCHEDULER_WORKERS_MAX; index++) {
+    scheduler->worker_list[index].shared = shared;
+  } // for
+
+  for (index = 0; index < SCHEDULER_REQUESTS; index++) {
+    scheduler->unused[index] = SCHEDULER_REQUESTS - 1 - index;
+  } // for
+
+  scheduler->unused_total = SCHEDULER_REQUESTS;
+
+  for (index = 0; index < PRIORITY_TOTAL; index++) {
+    memset(scheduler->flow_head[index], -1, sizeof(int) * SCHEDULER_FLOWS);
+    memset(scheduler->flow_tail[index], -1, sizeof(int) * SCHEDULER_FLOWS);
+  } // for
+
+  // with a share of 10 percent, 9 interactive requests may be dispatched in a row while a bulk request waits.
+  if (scheduler->bulk_share > 0) {
+    scheduler->bulk_streak_limit = (100 - scheduler->bulk_share) / scheduler->bulk_share;
+  }
+  else {
+    scheduler->bulk_streak_limit = INT_MAX;
+  }
+
+  pthread_mutex_init(&scheduler->lock, NULL);
+  pthread_cond_init(&scheduler->ready, NULL);
+
+  return 1;
+}
+
+/**
+ * Queues a request for a worker.
+ *
+ * @param scheduler_data *scheduler
+ *   The scheduler to queue to.
+ * @param int socket_id_client
+ *   The client connection, which the worker responds to and closes, or -1 when there is no client to respond to.
+ * @param int keep
+ *   Non-zero to keep the client connection open after the response instead (PACKET_FLAG_KEEP).
+ * @param uint32_t ticket
+ *   The ticket to record the result for, or 0 for none.
+ * @param int priority
+ *   One of PRIORITY_INTERACTIVE or PRIORITY_BULK.
+ * @param const char *user_name
+ *   The validated user name.
+ * @param int budget
+ *   The time budget in milliseconds after the request was accepted, 0 for no deadline.
+ * @param trace_data *trace
+ *   The trace of the request, which is copied.
+ * @param int reserve
+ *   The unused requests that must remain after this one, 0 to use the last one.
+ *
+ * @return int
+ *   1 on success and -1 when the queues are full.
+ */
+int scheduler_queue(scheduler_data *scheduler, int socket_id_client, int keep, uint32_t ticket, int priority, const char *user_name, int budget, trace_data *trace, int reserve) {
+  const int user_name_length = strnlen(user_name, PACKET_SIZE_INPUT);
+  request_data *request = NULL;
+  int index = 0;
+
+  trace->priority = priority;
+  memcpy(trace->name, user_name, user_name_length);
+  trace_stage(trace, TRACE_PARSE);
+
+  pthread_mutex_lock(&scheduler->lock);
+
+  if (scheduler->unused_total <= reserve) {
+    // the control socket waits and queues again instead, so only the rejected clients are counted.
+    if (reserve == 0) {
+      scheduler->total_rejected[priority]++;
+    }
+
+    pthread_mutex_unlock(&scheduler->lock);
+    return -1;
+  }
+
+  scheduler->unused_total--;
+  index = scheduler->unused[scheduler->unused_total];
+  request = &scheduler->requests[index];
+
+  request->socket_id_client = socket_id_client;
+  request->keep = keep;
+  request->ticket = ticket;
+  request->priority = priority;
+  clock_gettime(CLOCK_MONOTONIC, &request->queued);
+  memcpy(request->name, user_name, user_name_length);
+  request->name[user_name_length] = 0;
+  memcpy(&request->trace, trace, sizeof(trace_data));
+
+  // the budget is counted from the accept, so that time spent reading the packet is included.
+  deadline_set(&request->deadline, &trace->started, budget);
+
+  {
+    const int flow = scheduler->fair ? (name_set_hash((const char *) &trace->address, sizeof(uint32_t)) & (SCHEDULER_FLOWS - 1)) : 0;
+
+    request->next = -1;
+
+    if (scheduler->flow_head[priority][flow] < 0) {
+      scheduler->flow_head[priority][flow] = index;
+      scheduler->flows_waiting[priority][(scheduler->flows_head[priority] + scheduler->flows_total[priority]) % SCHEDULER_FLOWS] = flow;
+      scheduler->flows_total[priority]++;
+      scheduler->flow_credit[priority][flow] = scheduler_weight(scheduler, trace->address);
+    }
+    else {
+      scheduler->requests[scheduler->flow_tail[priority][flow]].next = index;
+    }
+
+    scheduler->flow_tail[priority][flow] = index;
+  }
+
+  scheduler->queue_total[priority]++;
+
+  pthread_cond_signal(&scheduler->ready);
+  pthread_mutex_unlock(&scheduler->lock);
+
+  return 1;
+}
+
+/**
+ * Queues a parsed request for a worker.
+ *
+ * On success, the worker now owns the client connection and responds to it, and then keeps or closes it (see keepalive_release()).
+ * An asynchronous request (PACKET_FLAG_ASYNC) is instead answered here with its ticket, and the worker records the result for the ticket.
+ *
+ * @param scheduler_data *scheduler
+ *   The scheduler to queue to.
+ * @param listener_data *listener
+ *   The listener that accepted the request.
+ * @param int socket_id_client
+ *   The client connection.
+ * @param const char *user_name
+ *   The validated user name.
+ * @param int flags
+ *   The PACKET_FLAG_* flags from the packet header.
+ * @param int budget
+ *   The time budget in milliseconds after the request was accepted, 0 for no deadline.
+ * @param trace_data *trace
+ *   The trace of the request, which is copied.
+ *
+ * @return int
+ *   1 on success and -1 when the queues or tickets are full (the caller still owns the client connection).
+ */
+int scheduler_submit(scheduler_data *scheduler, listener_data *listener, int socket_id_client, const char *user_name, int flags, int budget, trace_data *trace) {
+  const int priority = (flags & PACKET_FLAG_BULK) ? PRIORITY_BULK : listener->priority;
+  ticket_data *tickets = &listener->shared->tickets;
+  uint32_t ticket = 0;
+
+  if (flags & PACKET_FLAG_ASYNC) {
+    ticket = ticket_issue(tickets, user_name);
+
+    if (ticket == 0) {
+      return -1;
+    }
+  }
+
+  if (scheduler_queue(scheduler, ticket == 0 ? socket_id_client : -1, flags & PACKET_FLAG_KEEP, ticket, priority, user_name, budget, trace, 0) < 0) {
+    if (ticket != 0) {
+      ticket_finish(tickets, ticket, ERROR_CLOSE);
+    }
+
+    return -1;
+  }
+
+  if (ticket != 0) {
+    char response[PACKET_SIZE_OUTPUT + PACKET_TICKET_LENGTH];
+
+    response[0] = ERROR_NONE[0];
+    response[1] = (ticket >> 24) & 0xff;
+    response[2] = (ticket >> 16) & 0xff;
+    response[3] = (ticket >> 8) & 0xff;
+    response[4] = ticket & 0xff;
+
+    send(socket_id_client, response, PACKET_SIZE_OUTPUT + PACKET_TICKET_LENGTH, FLAGS_SEND);
+    keepalive_release(listener->shared, socket_id_client, trace, flags & PACKET_FLAG_KEEP);
+  }
+
+  return 1;
+}
+
+/**
+ * Waits for and takes the next request to process.
+ *
+ * An interactive request is always taken first, except that a waiting bulk request is taken after bulk_streak_limit interactive requests in a row.
+ * Bulk requests are not taken while bulk_limit of them are already being processed, which keeps SCHEDULER_BULK_RESERVED workers for interactive requests.
+ *
+ * @param scheduler_data *scheduler
+ *   The scheduler to take from.
+ * @param int worker_index
+ *   The index of the calling worker.
+ *
+ * @return int
+ *   The index of the request, which must be returned with scheduler_finish().
+ *   -1 when the workers were reduced below this worker, which must then exit.
+ */
+int scheduler_take(scheduler_data *scheduler, int worker_index) {
+  struct timespec now;
+  int priority = PRIORITY_INTERACTIVE;
+  int index = 0;
+  unsigned long waited = 0;
+
+  pthread_mutex_lock(&scheduler->lock);
+
+  while (1) {
+    if (worker_index >= scheduler->workers) {
+      scheduler->running[worker_index] = 0;
+      pthread_mutex_unlock(&scheduler->lock);
+      return -1;
+    }
+
+    const int interactive = scheduler->queue_total[PRIORITY_INTERACTIVE] > 0;
+    const int bulk = scheduler->queue_total[PRIORITY_BULK] > 0 && scheduler->active[PRIORITY_BULK] < scheduler->bulk_limit;
+
+    if (bulk && (!interactive || scheduler->bulk_streak >= scheduler->bulk_streak_limit)) {
+      priority = PRIORITY_BULK;
+      scheduler->bulk_streak = 0;
+      break;
+    }
+
+    if (interactive) {
+      priority = PRIORITY_INTERACTIVE;
+
+      if (scheduler->queue_total[PRIORITY_BULK] > 0) {
+        scheduler->bulk_streak++;
+      }
+
+      break;
+    }
+
+    pthread_cond_wait(&scheduler->ready, &scheduler->lock);
+  } // while
+
+  // the first flow in turn is dispatched from until its credit is spent, and then it goes to the end of the turns.
+  {
+    const int flow = scheduler->flows_waiting[priority][scheduler->flows_head[priority]];
+
+    index = scheduler->flow_head[priority][flow];
+    scheduler->flow_head[priority][flow] = scheduler->requests[index].next;
+    scheduler->flow_credit[priority][flow]--;
+
+    if (scheduler->flow_head[priority][flow] < 0) {
+      scheduler->flow_tail[priority][flow] = -1;
+      scheduler->flows_head[priority] = (scheduler->flows_head[priority] + 1) % SCHEDULER_FLOWS;
+      scheduler->flows_total[priority]--;
+    }
+    else if (scheduler->flow_credit[priority][flow] <= 0) {
+      scheduler->flows_head[priority] = (scheduler->flows_head[priority] + 1) % SCHEDULER_FLOWS;
+      scheduler->flows_waiting[priority][(scheduler->flows_head[priority] + scheduler->flows_total[priority] - 1) % SCHEDULER_FLOWS] = flow;
+      scheduler->flow_credit[priority][flow] = scheduler_weight(scheduler, scheduler->requests[scheduler->flow_head[priority][flow]].trace.address);
+    }
+  }
+
+  scheduler->queue_total[priority]--;
+  scheduler->active[priority]++;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  {
+    const long elapsed = (now.tv_sec - scheduler->requests[index].queued.tv_sec) * 1000000 + (now.tv_nsec - scheduler->requests[index].queued.tv_nsec) / 1000;
+
+    // a negative difference is counted as no wait, rather than as a huge unsigned wait.
+    waited = elapsed > 0 ? (unsigned long) elapsed : 0;
+  }
+
+  scheduler->total_dispatched[priority]++;
+  scheduler->total_wait[priority] += waited;
+
+  if (waited > scheduler->wait_longest[priority]) {
+    scheduler->wait_longest[priority] = waited;
+  }
+
+  pthread_mutex_unlock(&scheduler->lock);
+
+  return index;
+}
+
+/**
+ * Returns a processed request to the scheduler.
+ *
+ * @param scheduler_data *scheduler
+ *   The scheduler the request was taken from.
+ * @param int index
+ *   The index of the request.
+ */
+void scheduler_finish(scheduler_data *scheduler, int index) {
+  pthread_mutex_lock(&scheduler->lock);
+
+  scheduler->active[scheduler->requests[index].priority]--;
+  scheduler->unused[scheduler->unused_total] = index;
+  scheduler->unused_total++;
+
+  // a bulk request may have been waiting on bulk_limit.
+  if (scheduler->queue_total[PRIORITY_BULK] > 0) {
+    pthread_cond_signal(&scheduler->ready);
+  }
+
+  pthread_mutex_unlock(&scheduler->lock);
+}
+
+/**
+ * A worker thread, processing the queued requests and responding to the clients.
+ *
+ * A request whose deadline passed while it was queued is answered with ERROR_TIMEOUT without being processed.
+ * The result of an asynchronous request is recorded for its ticket instead, and a request queued by the control socket has no response at all.
+ *
+ * @param void *argument
+ *   The worker_data of this worker.
+ *
+ * @return void *
+ *   NULL, this thread only returns when the workers are reduced below it (see scheduler_resize()).
+ *
+ * @see: pthread_create()
+ */
+void *handler_worker(void *argument) {
+  worker_data *worker = (worker_data *) argument;
+  shared_data *shared = worker->shared;
+  scheduler_data *scheduler = &shared->scheduler;
+  const int worker_index = worker - scheduler->worker_list;
+
+  while (1) {
+    const int index = scheduler_take(scheduler, worker_index);
+    request_data *request = NULL;
+    char *status = NULL;
+
+    if (index < 0) {
+      break;
+    }
+
+    request = &scheduler->requests[index];
+
+    trace_stage(&request->trace, TRACE_DISPATCH);
+
+    if (deadline_expired(&request->deadline)) {
+      worker->total_expired[DEADLINE_DISPATCH]++;
+      status = ERROR_TIMEOUT;
+    }
+    else {
+      worker->trace = &request->trace;
+      worker->deadline = request->deadline;
+      status = request_process_name(shared, worker, request->name);
+      worker->trace = NULL;
+    }
+
+    if (request->ticket != 0) {
+      ticket_finish(&shared->tickets, request->ticket, status);
+    }
+    else if (request->socket_id_client >= 0) {
+      send(request->socket_id_client, status, PACKET_SIZE_OUTPUT, FLAGS_SEND);
+      MACRO_PROBE_3(request_send, request->trace.listener, request->socket_id_client, status[0]);
+      keepalive_release(shared, request->socket_id_client, &request->trace, request->keep);
+    }
+
+    trace_finish(worker, &request->trace, status);
+    scheduler_finish(scheduler, index);
+  } // while
+
+  return NULL;
+}
+
+/**
+ * Changes the number of worker threads, creating the missing threads and asking the threads beyond the new number to exit.
+ *
+ * A worker asked to exit first finishes the request it is processing, so no request is dropped.
+ * The threads that have exited are joined here, by the next resize.
+ * This is only called by one thread at a time, the parent on start and then the control thread.
+ *
+ * @param scheduler_data *scheduler
+ *   The initialized scheduler.
+ * @param long workers
+ *   The new number of workers, from 1 to SCHEDULER_WORKERS_MAX.
+ *
+ * @return int
+ *   1 on success and -1 when a thread could not be created (the workers that were created keep running).
+ */
+int scheduler_resize(scheduler_data *scheduler, long workers) {
+  pthread_attr_t thread_attributes;
+  int running[SCHEDULER_WORKERS_MAX];
+  int index = 0;
+  int result = 1;
+
+  pthread_mutex_lock(&scheduler->lock);
+
+  scheduler->workers = workers;
+
+  // at least one worker may always process bulk requests, even when there is only one worker.
+  scheduler->bulk_limit = workers > SCHEDULER_BULK_RESERVED ? workers - SCHEDULER_BULK_RESERVED : 1;
+
+  memcpy(running, scheduler->running, sizeof(int) * SCHEDULER_WORKERS_MAX);
+
+  // the waiting workers beyond the new number must wake up to exit.
+  pthread_cond_broadcast(&scheduler->ready);
+  pthread_mutex_unlock(&scheduler->lock);
+
+  for (; index < SCHEDULER_WORKERS_MAX; index++) {
+    if (scheduler->started[index] && !running[index]) {
+      pthread_join(scheduler->threads[index], NULL);
+      scheduler->started[index] = 0;
+    }
+  } // for
+
+  pthread_attr_init(&thread_attributes);
+  pthread_attr_setstacksize(&thread_attributes, STACK_SIZE);
+
+  for (index = 0; index < workers; index++) {
+    int created = 0;
+
+    if (scheduler->started[index]) {
+      continue;
+    }
+
+    pthread_mutex_lock(&scheduler->lock);
+    scheduler->running[index] = 1;
+    pthread_mutex_unlock(&scheduler->lock);
+
+    created = pthread_create(&scheduler->threads[index], &thread_attributes, handler_worker, &scheduler->worker_list[index]);
+
+    if (created != 0) {
+      log_write(LOG_ERR, "ERROR: failed to create the worker thread, error: %i.\n", created);
+
+      pthread_mutex_lock(&scheduler->lock);
+      scheduler->running[index] = 0;
+      pthread_mutex_unlock(&scheduler->lock);
+
+      result = -1;
+      break;
+    }
+
+    scheduler->started[index] = 1;
+
+    if (index >= scheduler->workers_created) {
+      __atomic_store_n(&scheduler->workers_created, index + 1, __ATOMIC_RELEASE);
+    }
+  } // for
+
+  pthread_attr_destroy(&thread_attributes);
+
+  return result;
+}
+
+/**
+ * Closes a kept connection from the keepalive thread, returning its partially received packet (if any).
+ *
+ * @param keepalive_data *keepalive
+ *   The keepalive data.
+ * @param int socket_id_client
+ *   The kept client connection.
+ */
+void keepalive_close(keepalive_data *keepalive, int socket_id_client) {
+  keepalive_connection *connection = &keepalive->connections[socket_id_client];
+
+  if (connection->partial >= 0) {
+    keepalive->partials_unused[keepalive->partials_unused_total] = connection->partial;
+    keepalive->partials_unused_total++;
+    connection->partial = -1;
+  }
+
+  keepalive_detach(keepalive, socket_id_client);
+  close(socket_id_client);
+}
+
+/**
+ * Closes the kept connections that have been idle for KEEPALIVE_IDLE, or that have not finished sending a packet within KEEPALIVE_PARTIAL_TIMEOUT.
+ *
+ * Only the keepalive thread calls this, and the connections being answered by another thread are skipped.
+ *
+ * @param keepalive_data *keepalive
+ *   The keepalive data.
+ * @param uint32_t now
+ *   (seconds) The CLOCK_MONOTONIC time.
+ *
+ * @return int
+ *   The number of connections closed.
+ */
+int keepalive_sweep(keepalive_data *keepalive, uint32_t now) {
+  const int highest = __atomic_load_n(&keepalive->highest, __ATOMIC_RELAXED);
+  int socket_id_client = 0;
+  int closed = 0;
+
+  for (; socket_id_client <= highest; socket_id_client++) {
+    keepalive_connection *connection = &keepalive->connections[socket_id_client];
+
+    if (__atomic_load_n(&connection->state, __ATOMIC_ACQUIRE) != KEEPALIVE_STATE_IDLE) {
+      continue;
+    }
+
+    if (connection->partial >= 0) {
+      if (now - connection->idle_since < KEEPALIVE_PARTIAL_TIMEOUT) {
+        continue;
+      }
+
+      send(socket_id_client, ERROR_TIMEOUT, PACKET_SIZE_OUTPUT, FLAGS_SEND | MSG_DONTWAIT);
+      trace_finish(&keepalive->worker, &keepalive->partials[connection->partial].trace, ERROR_TIMEOUT);
+      keepalive->total_timeout++;
+    }
+    else {
+      if (now - connection->idle_since < KEEPALIVE_IDLE) {
+        continue;
+      }
+
+      keepalive->total_idle++;
+    }
+
+    keepalive_close(keepalive, socket_id_client);
+    closed++;
+  } // for
+
+  return closed;
+}
+
+/**
+ * Receives a packet segment from a kept connection that is ready, and answers or queues the request once its packet is complete.
+ *
+ * A packet received in a single segment, as is usual, is parsed without taking a partial.
+ * A partial is only taken while more segments of the packet are expected.
+ *
+ * @param shared_data *shared
+ *   The data shared between the parent and all threads.
+ * @param int socket_id_client
+ *   The kept client connection, owned by the keepalive thread.
+ */
+void keepalive_receive(shared_data *shared, int socket_id_client) {
+  keepalive_data *keepalive = &shared->keepalive;
+  keepalive_connection *connection = &keepalive->connections[socket_id_client];
+  keepalive_partial received;
+  keepalive_partial *request = &received;
+  char buffer[PACKET_SIZE_INPUT];
+  ssize_t length = 0;
+  int parsed = 0;
+  char *status = NULL;
+
+  if (connection->partial >= 0) {
+    request = &keepalive->partials[connection->partial];
+  }
+  else {
+    memset(&received, 0, sizeof(keepalive_partial));
+  }
+
+  length = recv(socket_id_client, buffer, PACKET_SIZE_INPUT - request->processed, FLAGS_RECEIVE | MSG_DONTWAIT);
+
+  if (length < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+    if (keepalive_arm(keepalive, socket_id_client) < 0) {
+      keepalive_close(keepalive, socket_id_client);
+    }
+
+    return;
+  }
+
+  if (length <= 0) {
+    // this happens on proper client connection termination, which is only traced while a packet is being received.
+    if (connection->partial >= 0) {
+      trace_finish(&keepalive->worker, &request->trace, NULL);
+    }
+
+    keepalive_close(keepalive, socket_id_client);
+    return;
+  }
+
+  // the first segment of a packet starts the trace, as an accept does on a new connection.
+  if (request == &received) {
+    struct sockaddr_in peer;
+
+    memset(&peer, 0, sizeof(struct sockaddr_in));
+    peer.sin_family = AF_INET;
+    peer.sin_addr.s_addr = connection->address;
+    peer.sin_port = htons(connection->port);
+
+    trace_begin(&received.trace, &shared->listeners[connection->listener], socket_id_client, (struct sockaddr *) &peer);
+    MACRO_PROBE_2(request_accept, connection->listener, socket_id_client);
+  }
+
+  parsed = packet_parse(buffer, length, request->user_name, &request->processed, &request->user_name_length, &request->flags, &request->budget, &request->ticket);
+
+  if (parsed == PACKET_PARSE_MORE) {
+    if (request == &received) {
+      struct timespec now;
+
+      if (keepalive->partials_unused_total == 0) {
+        keepalive->total_partial_full++;
+        send(socket_id_client, ERROR_CLOSE, PACKET_SIZE_OUTPUT, FLAGS_SEND | MSG_DONTWAIT);
+        trace_finish(&keepalive->worker, &received.trace, ERROR_CLOSE);
+        keepalive_close(keepalive, socket_id_client);
+        return;
+      }
+
+      keepalive->partials_unused_total--;
+      connection->partial = keepalive->partials_unused[keepalive->partials_unused_total];
+      memcpy(&keepalive->partials[connection->partial], &received, sizeof(keepalive_partial));
+      keepalive->total_partial++;
+
+      // KEEPALIVE_PARTIAL_TIMEOUT is counted from the first segment.
+      clock_gettime(CLOCK_MONOTONIC, &now);
+      connection->idle_since = now.tv_sec;
+    }
+
+    if (keepalive_arm(keepalive, socket_id_client) < 0) {
+      keepalive_close(keepalive, socket_id_client);
+    }
+
+    return;
+  }
+
+  // the packet is complete, so its partial is no longer needed.
+  if (request != &received) {
+    memcpy(&received, request, sizeof(keepalive_partial));
+    keepalive->partials_unused[keepalive->partials_unused_total] = connection->partial;
+    keepalive->partials_unused_total++;
+    connection->partial = -1;
+  }
+
+  keepalive->total_requests++;
+
+  if (parsed == PACKET_PARSE_INVALID) {
+    memcpy(received.trace.name, received.user_name, received.user_name_length);
+    send(socket_id_client, ERROR_NAME, PACKET_SIZE_OUTPUT, FLAGS_SEND | MSG_DONTWAIT);
+    MACRO_PROBE_3(request_send, connection->listener, socket_id_client, ERROR_NAME[0]);
+    trace_finish(&keepalive->worker, &received.trace, ERROR_NAME);
+    keepalive_close(keepalive, socket_id_client);
+    return;
+  }
+
+  MACRO_PROBE_3(request_parse, connection->listener, socket_id_client, received.user_name);
+
+  // the thread that responds then keeps or closes the connection, see keepalive_release().
+  __atomic_store_n(&connection->state, KEEPALIVE_STATE_BUSY, __ATOMIC_RELEASE);
+
+  if (received.flags & PACKET_FLAG_PING) {
+    status = health_respond(shared, socket_id_client, &received.trace, received.flags & PACKET_FLAG_KEEP);
+    MACRO_PROBE_3(request_send, received.trace.listener, socket_id_client, status[0]);
+    trace_finish(&keepalive->worker, &received.trace, status);
+    return;
+  }
+
+  if (received.flags & PACKET_FLAG_TICKET) {
+    // a poll is not kept, because a poll that waits is answered and closed by the ticket thread.
+    keepalive_detach(keepalive, socket_id_client);
+
+    status = ticket_poll(&shared->tickets, socket_id_client, received.user_name, received.ticket, received.budget, &received.trace.started);
+
+    if (status == NULL) {
+      return;
+    }
+  }
+  else {
+    if (scheduler_submit(&shared->scheduler, &shared->listeners[received.trace.listener], socket_id_client, received.user_name, received.flags, received.budget, &received.trace) > 0) {
+      return;
+    }
+
+    keepalive_detach(keepalive, socket_id_client);
+    status = ERROR_CLOSE;
+  }
+
+  send(socket_id_client, status, PACKET_SIZE_OUTPUT, FLAGS_SEND | MSG_DONTWAIT);
+  MACRO_PROBE_3(request_send, received.trace.listener, socket_id_client, status[0]);
+  shutdown(socket_id_client, SHUT_RDWR);
+  close(socket_id_client);
+
+  trace_finish(&keepalive->worker, &received.trace, status);
+}
+
+/**
+ * The keepalive thread, receiving the requests of the kept connections as they become ready.
+ *
+ * A kept connection is only read again once the response to its previous request was sent, so that the responses of a client sending several requests at once stay in order.
+ *
+ * @param void *argument
+ *   The shared_data.
+ *
+ * @return void *
+ *   NULL, this thread only returns when epoll fails, which quits the service as a failed listener does.
+ *
+ * @see: pthread_create()
+ */
+void *handler_keepalive(void *argument) {
+  shared_data *shared = (shared_data *) argument;
+  keepalive_data *keepalive = &shared->keepalive;
+  struct epoll_event events[KEEPALIVE_EVENTS];
+  struct timespec now;
+  time_t next_sweep = 0;
+
+  while (1) {
+    int index = 0;
+    const int ready = epoll_wait(keepalive->epoll_id, events, KEEPALIVE_EVENTS, KEEPALIVE_SWEEP * 1000);
+
+    if (ready < 0 && errno != EINTR) {
+      log_write(LOG_ERR, "ERROR: failed to wait for the kept connections, error: %i.\n", errno);
+
+      // send SIGQUIT signal to parent process.
+      if (shared->pid_parent > 0) {
+        kill(shared->pid_parent, SIGQUIT);
+      }
+
+      return NULL;
+    }
+
+    for (; index < ready; index++) {
+      keepalive_receive(shared, events[index].data.fd);
+    } // for
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    if (now.tv_sec >= next_sweep) {
+      keepalive_sweep(keepalive, now.tv_sec);
+      next_sweep = now.tv_sec + KEEPALIVE_SWEEP;
+    }
+  } // while
+
+  return NULL;
+}
+
+/**
+ * Waits while the control socket has paused accepting new connections.
+ *
+ * @param control_data *control
+ *   The control socket data.
+ */
+void control_wait_resumed(control_data *control) {
+  if (!control->enabled) {
+    return;
+  }
+
+  pthread_mutex_lock(&control->lock);
+
+  while (control->paused) {
+    pthread_cond_wait(&control->resumed, &control->lock);
+  } // while
+
+  pthread_mutex_unlock(&control->lock);
+}
+
+/**
+ * Pauses or resumes accepting new connections on every listener.
+ *
+ * While paused, new connections wait in the listen backlog of the kernel, and the requests already accepted or queued are still processed.
+ * The blocking listeners check before each accept() and so may accept one more connection, the io_uring listeners cancel their accept (see handler_io_uring()).
+ *
+ * @param shared_data *shared
+ *   The data shared between the parent and all threads.
+ * @param int paused
+ *   1 to pause and 0 to resume.
+ */
+void control_pause(shared_data *shared, int paused) {
+  control_data *control = &shared->control;
+  int listener_index = 0;
+
+  pthread_mutex_lock(&control->lock);
+
+  __atomic_store_n(&control->paused, paused, __ATOMIC_RELEASE);
+
+  if (!paused) {
+    pthread_cond_broadcast(&control->resumed);
+  }
+
+  pthread_mutex_unlock(&control->lock);
+
+  for (; listener_index < LISTENER_TOTAL; listener_index++) {
+    if (shared->listeners[listener_index].wake_id > 0) {
+      const uint64_t wake = 1;
+
+      if (write(shared->listeners[listener_index].wake_id, &wake, sizeof(uint64_t)) < 0) {
+        log_write(LOG_ERR, "ERROR: failed to wake the listener, error: %i.\n", errno);
+      }
+    }
+  } // for
+}
+
+/**
+ * Queues a name as a bulk request with no client, so that it is provisioned and cached before its first login.
+ *
+ * The name is only queued while more than 1/CONTROL_PREWARM_SHARE of the requests are unused, otherwise this waits, so that the clients are never rejected because of a prewarm.
+ *
+ * @param shared_data *shared
+ *   The data shared between the parent and all threads.
+ * @param const char *user_name
+ *   The validated user name.
+ */
+void control_prewarm(shared_data *shared, const char *user_name) {
+  trace_data trace;
+
+  memset(&trace, 0, sizeof(trace_data));
+
+  clock_gettime(CLOCK_REALTIME, &trace.accepted);
+  clock_gettime(CLOCK_MONOTONIC, &trace.started);
+
+  trace.listener = LISTENER_CONTROL;
+  trace.reached = 1 << TRACE_ACCEPT;
+  trace.status = TRACE_STATUS_NONE;
+
+  while (scheduler_queue(&shared->scheduler, -1, 0, 0, PRIORITY_BULK, user_name, 0, &trace, SCHEDULER_REQUESTS / CONTROL_PREWARM_SHARE) < 0) {
+    usleep(CONTROL_PREWARM_WAIT);
+  } // while
+}
+
+/**
+ * Performs a single command received on the control socket.
+ *
+ * @param shared_data *shared
+ *   The data shared between the parent and all threads.
+ * @param char *command
+ *   The NULL terminated command line, which is modified.
+ * @param char *reply
+ *   The reply is written here, a single line starting with "ok" or "error:".
+ * @param size_t reply_size
+ *   The size of the reply buffer.
+ */
+void control_command(shared_data *shared, char *command, char *reply, size_t reply_size) {
+  scheduler_data *scheduler = &shared->scheduler;
+  cache_data *cache = &shared->cache;
+  char *position = NULL;
+  char *name = strtok_r(command, " \t\r", &position);
+  char *argument = NULL;
+  char *end = NULL;
+  long value = 0;
+
+  shared->control.total_commands++;
+
+  if (name == NULL) {
+    snprintf(reply, reply_size, "error: no command, see 'help'.\n");
+  }
+  else if (strcmp(name, "help") == 0) {
+    snprintf(reply, reply_size, "ok commands: status, workers <1-%u>, spares <0-%u>, flush, invalidate <name>..., prewarm <name>..., pause, resume.\n", SCHEDULER_WORKERS_MAX, LDAP_POOL_SPARES_MAX);
+  }
+  else if (strcmp(name, "status") == 0) {
+    int waiting[PRIORITY_TOTAL];
+    int active[PRIORITY_TOTAL];
+    int unused = 0;
+    long workers = 0;
+    long spares = 0;
+    unsigned spares_ready = 0;
+    int server_index = 0;
+    int database_limit = 0;
+    int database_in_flight = 0;
+    int database_waiting = 0;
+    int health_flags = 0;
+    char *health = health_check(shared, &health_flags);
+
+    pthread_mutex_lock(&scheduler->lock);
+
+    memcpy(waiting, scheduler->queue_total, sizeof(int) * PRIORITY_TOTAL);
+    memcpy(active, scheduler->active, sizeof(int) * PRIORITY_TOTAL);
+    unused = scheduler->unused_total;
+    workers = scheduler->workers;
+
+    pthread_mutex_unlock(&scheduler->lock);
+
+    pthread_mutex_lock(&shared->ldap_pool.lock);
+
+    spares = shared->ldap_pool.spares;
+
+    for (; server_index < shared->ldap_pool.total; server_index++) {
+      spares_ready += shared->ldap_pool.servers[server_index].spares_total;
+    } // for
+
+    pthread_mutex_unlock(&shared->ldap_pool.lock);
+
+    pthread_mutex_lock(&shared->limiter_database.lock);
+
+    database_limit = shared->limiter_database.limit;
+    database_in_flight = shared->limiter_database.in_flight;
+    database_waiting = shared->limiter_database.waiting;
+
+    pthread_mutex_unlock(&shared->limiter_database.lock);
+
+    snprintf(reply, reply_size, "ok paused=%s workers=%ld interactive_waiting=%d interactive_processing=%d bulk_waiting=%d bulk_processing=%d requests_unused=%d ldap_spares=%ld ldap_spares_ready=%u cache_names=%lu tickets_waiting=%d database_limit=%d database_in_flight=%d database_waiting=%d health=%s health_flags=0x%02x keepalive_kept=%ld\n", __atomic_load_n(&shared->control.paused, __ATOMIC_ACQUIRE) ? "yes" : "no", workers, waiting[PRIORITY_INTERACTIVE], active[PRIORITY_INTERACTIVE], waiting[PRIORITY_BULK], active[PRIORITY_BULK], unused, spares, spares_ready, (unsigned long) cache->used, shared->tickets.waiters_total, database_limit, database_in_flight, database_waiting, health[0] == ERROR_NONE[0] ? "ready" : (health[0] == ERROR_DEGRADED[0] ? "degraded" : "live"), health_flags, __atomic_load_n(&shared->keepalive.kept, __ATOMIC_RELAXED));
+  }
+  else if (strcmp(name, "workers") == 0 || strcmp(name, "spares") == 0) {
+    const long maximum = strcmp(name, "workers") == 0 ? SCHEDULER_WORKERS_MAX : LDAP_POOL_SPARES_MAX;
+    const long minimum = strcmp(name, "workers") == 0 ? 1 : 0;
+
+    argument = strtok_r(NULL, " \t\r", &position);
+
+    if (argument != NULL) {
+      errno = 0;
+      value = strtol(argument, &end, 10);
+    }
+
+    if (argument == NULL || errno != 0 || *end != 0 || value < minimum || value > maximum) {
+      snprintf(reply, reply_size, "error: %s requires a number from %ld to %ld.\n", name, minimum, maximum);
+    }
+    else if (strcmp(name, "workers") == 0) {
+      if (scheduler_resize(scheduler, value) < 0) {
+        snprintf(reply, reply_size, "error: failed to create the worker threads.\n");
+      }
+      else {
+        log_write(LOG_INFO, "INFO: the workers were changed to %ld by the control socket.\n", value);
+        snprintf(reply, reply_size, "ok workers=%ld\n", value);
+      }
+    }
+    else {
+      // the breaker thread opens or closes the spares on its next pass (see ldap_pool_prewarm()).
+      pthread_mutex_lock(&shared->ldap_pool.lock);
+      shared->ldap_pool.spares = value;
+      pthread_mutex_unlock(&shared->ldap_pool.lock);
+
+      log_write(LOG_INFO, "INFO: the ldap spares were changed to %ld by the control socket.\n", value);
+      snprintf(reply, reply_size, "ok spares=%ld\n", value);
+    }
+  }
+  else if (strcmp(name, "flush") == 0) {
+    if (cache->entries == NULL) {
+      snprintf(reply, reply_size, "error: the cache is disabled.\n");
+    }
+    else {
+      const unsigned long removed = cache_flush(cache);
+
+      log_write(LOG_INFO, "INFO: the cache was flushed by the control socket, %lu names removed.\n", removed);
+      snprintf(reply, reply_size, "ok flushed=%lu\n", removed);
+    }
+  }
+  else if (strcmp(name, "invalidate") == 0 || strcmp(name, "prewarm") == 0) {
+    char names[CONTROL_LINE_LENGTH];
+    char normalized[PACKET_SIZE_INPUT + 1];
+    char *names_position = NULL;
+    unsigned long total = 0;
+
+    if (strcmp(name, "invalidate") == 0 && cache->entries == NULL) {
+      snprintf(reply, reply_size, "error: the cache is disabled.\n");
+      return;
+    }
+
+    // every name is validated before any is acted on, the remainder of the command is kept for the second pass.
+    names[0] = 0;
+
+    if (position != NULL) {
+      strncpy(names, position, CONTROL_LINE_LENGTH - 1);
+      names[CONTROL_LINE_LENGTH - 1] = 0;
+    }
+
+    for (argument = strtok_r(NULL, " \t\r", &position); argument != NULL; argument = strtok_r(NULL, " \t\r", &position)) {
+      if (!name_normalize(argument, strnlen(argument, PACKET_SIZE_INPUT + 1), normalized)) {
+        snprintf(reply, reply_size, "error: the name '%.*s' is not valid.\n", PACKET_SIZE_INPUT, argument);
+        return;
+      }
+
+      total++;
+    } // for
+
+    if (total == 0) {
+      snprintf(reply, reply_size, "error: %s requires at least one name.\n", name);
+      return;
+    }
+
+    total = 0;
+
+    for (argument = strtok_r(names, " \t\r", &names_position); argument != NULL; argument = strtok_r(NULL, " \t\r", &names_position)) {
+      const int length = strnlen(argument, PACKET_SIZE_INPUT);
+
+      name_normalize(argument, length, normalized);
+
+      if (strcmp(name, "prewarm") == 0) {
+        control_prewarm(shared, normalized);
+        total++;
+      }
+      else {
+        total += cache_invalidate(cache, normalized, length);
+      }
+    } // for
+
+    if (strcmp(name, "prewarm") == 0) {
+      snprintf(reply, reply_size, "ok queued=%lu\n", total);
+    }
+    else {
+      snprintf(reply, reply_size, "ok invalidated=%lu\n", total);
+    }
+  }
+  else if (strcmp(name, "pause") == 0 || strcmp(name, "resume") == 0) {
+    const int paused = strcmp(name, "pause") == 0;
+
+    control_pause(shared, paused);
+
+    log_write(LOG_INFO, "INFO: accepting connections was %s by the control socket.\n", paused ? "paused" : "resumed");
+    snprintf(reply, reply_size, "ok %s\n", paused ? "paused" : "resumed");
+  }
+  else {
+    snprintf(reply, reply_size, "error: unknown command '%.32s', see 'help'.\n", name);
+  }
+}
+
+/**
+ * Binds and listens on the control socket, which only the owner may connect to.
+ *
+ * @param control_data *control
+ *   The control socket data, with the path already populated.
+ *
+ * @return int
+ *   1 on success and -1 on error.
+ */
+int control_initialize(control_data *control) {
+  struct sockaddr_un socket_address;
+  struct stat file_stat;
+  int socket_id = 0;
+
+  pthread_mutex_init(&control->lock, NULL);
+  pthread_cond_init(&control->resumed, NULL);
+
+  // as with the request socket, an existing file is not removed in case it belongs to another running service.
+  if (stat(control->path, &file_stat) >= 0) {
+    log_write(LOG_ERR, "ERROR: failed to initialize the control socket '%s' because a file already exists at that path.\n", control->path);
+    return -1;
+  }
+
+  if (strnlen(control->path, PATH_MAX) >= sizeof(socket_address.sun_path)) {
+    log_write(LOG_ERR, "ERROR: the control socket path '%s' is too long.\n", control->path);
+    return -1;
+  }
+
+  socket_id = socket(SOCKET_FAMILY_SOCKET, SOCKET_TYPE | SOCK_CLOEXEC, SOCKET_PROTOCOL_SOCKET);
+
+  if (socket_id < 0) {
+    log_write(LOG_ERR, "ERROR: failed to create the control socket '%s', error: %i.\n", control->path, errno);
+    return -1;
+  }
+
+  memset(&socket_address, 0, sizeof(struct sockaddr_un));
+  socket_address.sun_family = SOCKET_FAMILY_SOCKET;
+  strncpy(socket_address.sun_path, control->path, sizeof(socket_address.sun_path) - 1);
+
+  if (bind(socket_id, (struct sockaddr *) &socket_address, sizeof(struct sockaddr_un)) < 0) {
+    log_write(LOG_ERR, "ERROR: failed to bind the control socket '%s', error: %i.\n", control->path, errno);
+    close(socket_id);
+    return -1;
+  }
+
+  // from here on, the socket file is removed on exit.
+  control->socket_id_target = socket_id;
+
+  if (chmod(control->path, CONTROL_MODE) < 0 || listen(socket_id, SOCKET_BACKLOG) < 0) {
+    log_write(LOG_ERR, "ERROR: failed to listen on the control socket '%s', error: %i.\n", control->path, errno);
+    return -1;
+  }
+
+  return 1;
+}
+
+/**
+ * The control thread, accepting admin connections one at a time and performing their commands.
+ *
+ * Each command is a single line and is answered with a single line, starting with "ok" or "error:".
+ * Only root and the user the service runs as may connect, using the SO_PEERCRED credentials of the connection.
+ *
+ * @param void *argument
+ *   The shared_data.
+ *
+ * @return void *
+ *   NULL, this thread does not return until the process exits.
+ *
+ * @see: pthread_create()
+ */
+void *handler_control(void *argument) {
+  shared_data *shared = (shared_data *) argument;
+  control_data *control = &shared->control;
+  char buffer[CONTROL_LINE_LENGTH];
+  char reply[CONTROL_REPLY_LENGTH];
+  struct timeval timeout;
+
+  timeout.tv_sec = CONTROL_TIMEOUT;
+  timeout.tv_usec = 0;
+
+  while (1) {
+    struct ucred credentials;
+    socklen_t credentials_length = sizeof(struct ucred);
+    int socket_id_client = accept4(control->socket_id_target, NULL, NULL, SOCK_CLOEXEC);
+    int length = 0;
+
+    if (socket_id_client < 0) {
+      if (errno != EINTR && errno != ECONNABORTED) {
+        log_write(LOG_ERR, "ERROR: failed to accept connections on the control socket '%s', error: %i.\n", control->path, errno);
+        sleep(1);
+      }
+
+      continue;
+    }
+
+    memset(&credentials, 0, sizeof(struct ucred));
+
+    if (getsockopt(socket_id_client, PROTOCOL_SOCKET, SO_PEERCRED, &credentials, &credentials_length) < 0 || (credentials.uid != 0 && credentials.uid != geteuid())) {
+      log_write(LOG_WARNING, "WARNING: rejected control client pid = %u, uid = %u, gid = %u on the control socket '%s'.\n", credentials.pid, credentials.uid, credentials.gid, control->path);
+      control->total_rejected++;
+
+      snprintf(reply, CONTROL_REPLY_LENGTH, "error: not allowed.\n");
+      send(socket_id_client, reply, strlen(reply), FLAGS_SEND);
+      close(socket_id_client);
+      continue;
+    }
+
+    setsockopt(socket_id_client, PROTOCOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(struct timeval));
+
+    while (1) {
+      char *line_end = memchr(buffer, '\n', length);
+      ssize_t received = 0;
+
+      if (line_end != NULL) {
+        *line_end = 0;
+
+        control_command(shared, buffer, reply, CONTROL_REPLY_LENGTH);
+        send(socket_id_client, reply, strlen(reply), FLAGS_SEND);
+
+        length -= line_end + 1 - buffer;
+        memmove(buffer, line_end + 1, length);
+        continue;
+      }
+
+      if (length == CONTROL_LINE_LENGTH) {
+        snprintf(reply, CONTROL_REPLY_LENGTH, "error: the command is longer than %u characters.\n", CONTROL_LINE_LENGTH - 1);
+        send(socket_id_client, reply, strlen(reply), FLAGS_SEND);
+        break;
+      }
+
+      received = recv(socket_id_client, buffer + length, CONTROL_LINE_LENGTH - length, FLAGS_RECEIVE);
+
+      if (received <= 0) {
+        break;
+      }
+
+      length += received;
+    } // while
+
+    close(socket_id_client);
+  } // while
+
+  return NULL;
+}
+
+/**
+ * Accepts connections and reads the packets one at a time using blocking calls, queuing each request for a worker.
+ *
+ * This is the default handler and is the fallback when io_uring is not available.
+ *
+ * @param listener_data *listener
+ *   The bound and listening listener to handle.
+ *
+ * @return int
+ *   0 when the loop exits normally and -1 on error.
+ */
+int handler_blocking(listener_data *listener) {
+  shared_data *shared = listener->shared;
+
+  int socket_error = 0;
+  socklen_t socket_error_length = 0;
+
+  int message_length = 0;
+  int processed = 0;
+  int user_name_length = 0;
+  int parsed = 0;
+  int flags = 0;
+  int budget = 0;
+  uint32_t ticket = 0;
+
+  socklen_t length = 0;
+  ssize_t sent = 0;
+
+  char buffer[PACKET_SIZE_INPUT];
+  char user_name[PACKET_SIZE_INPUT + 1];
+  char *error_receive = ERROR_NONE;
+
+  struct sockaddr_un socket_client_address;
+
+  const unsigned structure_socket_length = sizeof(struct sockaddr_un);
+
+  struct timeval timeout;
+  timeout.tv_sec = 0;
+
+  if (listener->type == LISTENER_NETWORK) {
+    timeout.tv_usec = SOCKET_TIMEOUT_NETWORK;
+  }
+  else {
+    timeout.tv_usec = SOCKET_TIMEOUT_SOCKET;
+  }
+
+  while (1) {
+    length = structure_socket_length;
+    processed = 0;
+    user_name_length = 0;
+    flags = 0;
+    budget = 0;
+    ticket = 0;
+    error_receive = ERROR_NONE;
+
+    // make sure that socket_id_client is always closed before continuing.
+    if (listener->socket_id_client != 0) {
+      sent = send(listener->socket_id_client, ERROR_CLOSE, PACKET_SIZE_OUTPUT, FLAGS_SEND);
+      close(listener->socket_id_client);
+      listener->socket_id_client = 0;
+    }
+
+    memset(&socket_client_address, 0, structure_socket_length);
+
+    // while paused, new connections wait in the listen backlog.
+    control_wait_resumed(&shared->control);
+
+    listener->socket_id_client = accept(listener->socket_id_target, (struct sockaddr *) &socket_client_address, &length);
+
+    if (listener->socket_id_client < 0) {
+      if (listener->type == LISTENER_NETWORK) {
+        log_write(LOG_ERR, "ERROR: failed to accept connections on the port '%u' using protocol '%u': error %i (%u).\n", shared->parameter_port, SOCKET_PROTOCOL_NETWORK, listener->socket_id_client, errno);
+      }
+      else {
+        log_write(LOG_ERR, "ERROR: failed to accept connections on the socket '%s' using protocol '%u': error %i (%u).\n", shared->socket_path, SOCKET_PROTOCOL_SOCKET, listener->socket_id_client, errno);
+      }
+
+      listener->socket_id_client = 0;
+
+      return -1;
+    }
+
+    trace_begin(&listener->worker.trace_current, listener, listener->socket_id_client, (struct sockaddr *) &socket_client_address);
+    MACRO_PROBE_2(request_accept, listener->type, listener->socket_id_client);
+
+    {
+      int authorized = listener_authorize_client(listener, listener->socket_id_client);
+
+      if (authorized < 1) {
+        sent = send(listener->socket_id_client, ERROR_CLOSE, PACKET_SIZE_OUTPUT, FLAGS_SEND);
+        close(listener->socket_id_client);
+        listener->socket_id_client = 0;
+        trace_finish(&listener->worker, &listener->worker.trace_current, ERROR_CLOSE);
+        continue;
+      }
+    }
+
+    memset(&buffer, 0, sizeof(char) * PACKET_SIZE_INPUT);
+    memset(&user_name, 0, sizeof(char) * (PACKET_SIZE_INPUT + 1));
+
+    // define a very short timeout for fast responses (both send and receive).
+    // the socket is expected to be a local connection, so it should be very fast.
+    setsockopt(listener->socket_id_client, PROTOCOL_SOCKET, SO_RCVTIMEO, (char *)&timeout, sizeof(timeout));
+    setsockopt(listener->socket_id_client, PROTOCOL_SOCKET, SO_SNDTIMEO, (char *)&timeout, sizeof(timeout));
+
+    // receive the user name from the client.
+    do {
+      error_receive = ERROR_NONE;
+      message_length = recv(listener->socket_id_client, buffer, PACKET_SIZE_INPUT - processed, FLAGS_RECEIVE);
+
+      if (message_length == 0) {
+        // this happens on proper client connection termination.
+        close(listener->socket_id_client);
+        listener->socket_id_client = 0;
+        trace_finish(&listener->worker, &listener->worker.trace_current, NULL);
+        break;
+      }
+      else if (message_length < 0) {
+        // this is not working as expected, socket_error is 0 when something like EAGAIN is expected.
+        // the idea here is to detect a timeout and report ERROR_TIMEOUT instead of ERROR_READ.
+        // until this is figured out, assume that ERROR_READ is the same as ERROR_TIMEOUT.
+        // look into recvmsg().
+        //socket_error = 0;
+        //socket_error_length = sizeof(int);
+        //getsockopt(listener->socket_id_client, PROTOCOL_SOCKET, SO_ERROR, (void *) &socket_error, &socket_error_length);
+        error_receive = ERROR_READ;
+        break;
+      }
+
+      parsed = packet_parse(buffer, message_length, user_name, &processed, &user_name_length, &flags, &budget, &ticket);
+
+      if (parsed == PACKET_PARSE_INVALID) {
+        memcpy(listener->worker.trace_current.name, user_name, user_name_length);
+        error_receive = ERROR_NAME;
+        break;
+      }
+    } while (parsed == PACKET_PARSE_MORE);
+
+    if (listener->socket_id_client == 0) {
+      continue;
+    }
+
+    if (error_receive == ERROR_NONE) {
+      MACRO_PROBE_3(request_parse, listener->type, listener->socket_id_client, user_name);
+
+      // the ping is answered here, from the health kept by the breaker thread.
+      if (flags & PACKET_FLAG_PING) {
+        error_receive = health_respond(shared, listener->socket_id_client, &listener->worker.trace_current, flags & PACKET_FLAG_KEEP);
+        MACRO_PROBE_3(request_send, listener->type, listener->socket_id_client, error_receive[0]);
+        listener->socket_id_client = 0;
+
+        trace_finish(&listener->worker, &listener->worker.trace_current, error_receive);
+        continue;
+      }
+
+      if (flags & PACKET_FLAG_TICKET) {
+        error_receive = ticket_poll(&shared->tickets, listener->socket_id_client, user_name, ticket, budget, &listener->worker.trace_current.started);
+
+        // the ticket thread now responds to and closes the client connection.
+        if (error_receive == NULL) {
+          listener->socket_id_client = 0;
+          continue;
+        }
+      }
+      else {
+        // the worker now responds to and then keeps or closes the client connection.
+        if (scheduler_submit(&shared->scheduler, listener, listener->socket_id_client, user_name, flags, budget, &listener->worker.trace_current) > 0) {
+          listener->socket_id_client = 0;
+          continue;
+        }
+
+        error_receive = ERROR_CLOSE;
+      }
+    }
+
+    // respond to the client for failure and then close the connection
+    sent = send(listener->socket_id_client, error_receive, PACKET_SIZE_OUTPUT, FLAGS_SEND);
+    MACRO_PROBE_3(request_send, listener->type, listener->socket_id_client, error_receive[0]);
+    shutdown(listener->socket_id_client, SHUT_RDWR);
+    close(listener->socket_id_client);
+    listener->socket_id_client = 0;
+
+    trace_finish(&listener->worker, &listener->worker.trace_current, error_receive);
+  } // while
+
+  return 0;
+}
+
+#ifdef USE_IO_URING
+  /**
+   * Releases the io_uring instance.
+   *
+   * @param uring_data *ring
+   *   The io_uring data to release.
+   */
+  void uring_destroy(uring_data *ring) {
+    if (ring->sqes != NULL) {
+      munmap(ring->sqes, ring->sqes_length);
+      ring->sqes = NULL;
+    }
+
+    if (ring->ring != NULL) {
+      munmap(ring->ring, ring->ring_length);
+      ring->ring = NULL;
+    }
+
+    if (ring->ring_id > 0) {
+      close(ring->ring_id);
+      ring->ring_id = 0;
+    }
+  }
+
+  /**
+   * Initializes the io_uring instance and registers the packet buffers.
+   *
+   * @param uring_data *ring
+   *   The io_uring data to initialize.
+   *
+   * @return int
+   *   1 on success, 0 when io_uring is not supported by the running kernel, and -1 on error.
+   */
+  int uring_initialize(uring_data *ring) {
+    struct io_uring_params parameters;
+
+    memset(ring, 0, sizeof(uring_data));
+    memset(&parameters, 0, sizeof(struct io_uring_params));
+
+    ring->ring_id = syscall(__NR_io_uring_setup, IO_URING_ENTRIES, &parameters);
+
+    if (ring->ring_id < 0) {
+      ring->ring_id = 0;
+
+      if (errno == ENOSYS || errno == EPERM || errno == EINVAL) {
+        return 0;
+      }
+
+      log_write(LOG_ERR, "ERROR: failed to setup io_uring, error: %i.\n", errno);
+      return -1;
+    }
+
+    // IORING_FEAT_NODROP and IORING_FEAT_SINGLE_MMAP are required to keep this simple, they exist on all kernels that support IORING_OP_SEND.
+    if (!(parameters.features & IORING_FEAT_SINGLE_MMAP) || !(parameters.features & IORING_FEAT_NODROP)) {
+      close(ring->ring_id);
+      ring->ring_id = 0;
+      return 0;
+    }
+
+    ring->ring_length = parameters.sq_off.array + parameters.sq_entries * sizeof(unsigned);
+
+    if (ring->ring_length < parameters.cq_off.cqes + parameters.cq_entries * sizeof(struct io_uring_cqe)) {
+      ring->ring_length = parameters.cq_off.cqes + parameters.cq_entries * sizeof(struct io_uring_cqe);
+    }
+
+    ring->ring = mmap(NULL, ring->ring_length, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->ring_id, IORING_OFF_SQ_RING);
+    if (ring->ring == MAP_FAILED) {
+      log_write(LOG_ERR, "ERROR: failed to map the io_uring rings, error: %i.\n", errno);
+      ring->ring = NULL;
+      uring_destroy(ring);
+      return -1;
+    }
+
+    ring->sqes_length = parameters.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_length, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->ring_id, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+      log_write(LOG_ERR, "ERROR: failed to map the io_uring submission entries, error: %i.\n", errno);
+      ring->sqes = NULL;
+      uring_destroy(ring);
+      return -1;
+    }
+
+    ring->sq_head = (unsigned *) (ring->ring + parameters.sq_off.head);
+    ring->sq_tail = (unsigned *) (ring->ring + parameters.sq_off.tail);
+    ring->sq_mask = (unsigned *) (ring->ring + parameters.sq_off.ring_mask);
+    ring->sq_array = (unsigned *) (ring->ring + parameters.sq_off.array);
+    ring->sq_entries = parameters.sq_entries;
+    ring->cq_head = (unsigned *) (ring->ring + parameters.cq_off.head);
+    ring->cq_tail = (unsigned *) (ring->ring + parameters.cq_off.tail);
+    ring->cq_mask = (unsigned *) (ring->ring + parameters.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *) (ring->ring + parameters.cq_off.cqes);
+
+    // the name packets are fixed size, so each slot gets one registered buffer, allowing IORING_OP_READ_FIXED.
+    {
+      struct iovec vectors[IO_URING_SLOTS];
+      int i = 0;
+
+      for (; i < IO_URING_SLOTS; i++) {
+        vectors[i].iov_base = ring->buffers[i];
+        vectors[i].iov_len = PACKET_SIZE_INPUT;
+      }
+
+      if (syscall(__NR_io_uring_register, ring->ring_id, IORING_REGISTER_BUFFERS, vectors, IO_URING_SLOTS) < 0) {
+        log_write(LOG_ERR, "ERROR: failed to register the io_uring buffers, error: %i.\n", errno);
+        uring_destroy(ring);
+        return -1;
+      }
+    }
+
+    ring->multishot = 1;
+
+    return 1;
+  }
+
+  /**
+   * Submits all prepared entries, optionally waiting for completions.
+   *
+   * @param uring_data *ring
+   *   The io_uring data.
+   * @param unsigned wait
+   *   The minimum number of completions to wait for.
+   *
+   * @return int
+   *   1 on success and -1 on error.
+   */
+  int uring_submit(uring_data *ring, unsigned wait) {
+    int submitted = 0;
+
+    do {
+      submitted = syscall(__NR_io_uring_enter, ring->ring_id, ring->pending, wait, wait > 0 ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    } while (submitted < 0 && errno == EINTR);
+
+    if (submitted < 0) {
+      return -1;
+    }
+
+    ring->pending -= submitted;
+
+    return 1;
+  }
+
+  /**
+   * Gets the next free submission queue entry.
+   *
+   * When the submission queue is full, the pending entries are submitted to make room.
+   *
+   * @param uring_data *ring
+   *   The io_uring data.
+   *
+   * @return struct io_uring_sqe *
+   *   The cleared submission queue entry or NULL on error.
+   */
+  struct io_uring_sqe *uring_sqe_get(uring_data *ring) {
+    unsigned tail = *ring->sq_tail;
+    unsigned index = 0;
+
+    if (tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= ring->sq_entries) {
+      if (uring_submit(ring, 0) < 0) {
+        return NULL;
+      }
+
+      if (tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= ring->sq_entries) {
+        return NULL;
+      }
+    }
+
+    index = tail & *ring->sq_mask;
+    ring->sq_array[index] = index;
+    memset(&ring->sqes[index], 0, sizeof(struct io_uring_sqe));
+
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ring->pending++;
+
+    return &ring->sqes[index];
   }
 
+  /**
+   * Prepares an accept on the listener, using multishot accept when the kernel supports it.
+   *
+   * @param uring_data *ring
+   *   The io_uring data.
+   * @param listener_data *listener
+   *   The listener to accept on.
+   *
+   * @return int
+   *   1 on success and -1 on error.
+   */
+  int uring_prepare_accept(uring_data *ring, listener_data *listener) {
+    struct io_uring_sqe *entry = uring_sqe_get(ring);
+
+    if (entry == NULL) {
+      return -1;
+    }
 
-  // once bound, perform the search.
-  {
-    struct timeval ldap_timeout;
-    int ldap_sizelimit = 1;
-    int ldap_message_type = 0;
-    LDAPMessage *ldap_message = NULL;
-    int ldap_matched = 0;
+    entry->opcode = IORING_OP_ACCEPT;
+    entry->fd = listener->socket_id_target;
+    entry->user_data = IO_URING_USER_DATA(IO_URING_OPERATION_ACCEPT, 0, 0);
 
-    memset(&ldap_timeout, 0, sizeof(struct timeval));
-    ldap_timeout.tv_sec = 0;
-    ldap_timeout.tv_usec = LDAP_RETRY_SEARCH_TIMEOUT;
+    if (ring->multishot) {
+      entry->ioprio = IORING_ACCEPT_MULTISHOT;
+    }
 
-    {
-      int tries = 0;
-      for (; tries < LDAP_RETRY_SEARCH_RETRY; tries++) {
-        ldap_status = ldap_search_ext_s(ldap_settings, ldap_name, LDAP_SCOPE_BASE, NULL, NULL, 0, NULL, NULL, &ldap_timeout, ldap_sizelimit, &ldap_message);
+    ring->accepting = 1;
 
-        ldap_message_type = ldap_msgtype(ldap_message);
+    return 1;
+  }
 
-        if (ldap_status == LDAP_SUCCESS) {
-          ldap_matched = ldap_count_entries(ldap_settings, ldap_message);
+  /**
+   * Prepares cancelling the accept, so that new connections wait in the listen backlog while the control socket has paused accepting.
+   *
+   * @param uring_data *ring
+   *   The io_uring data.
+   *
+   * @return int
+   *   1 on success and -1 on error.
+   */
+  int uring_prepare_cancel(uring_data *ring) {
+    struct io_uring_sqe *entry = uring_sqe_get(ring);
+
+    if (entry == NULL) {
+      return -1;
+    }
 
-          // From manpage: "Note that res parameter of ldap_search_ext_s() and ldap_search_s() should be freed with ldap_msgfree() regardless of return value of these functions"
-          ldap_msgfree(ldap_message);
+    entry->opcode = IORING_OP_ASYNC_CANCEL;
+    entry->fd = -1;
+    entry->addr = IO_URING_USER_DATA(IO_URING_OPERATION_ACCEPT, 0, 0);
+    entry->user_data = IO_URING_USER_DATA(IO_URING_OPERATION_CANCEL, 0, 0);
 
-          break;
-        }
+    return 1;
+  }
 
-        // From manpage: "Note that res parameter of ldap_search_ext_s() and ldap_search_s() should be freed with ldap_msgfree() regardless of return value of these functions"
-        ldap_msgfree(ldap_message);
+  /**
+   * Prepares waiting for the control thread to pause or resume accepting, which writes to the eventfd of the listener.
+   *
+   * @param uring_data *ring
+   *   The io_uring data.
+   * @param listener_data *listener
+   *   The listener with the eventfd.
+   *
+   * @return int
+   *   1 on success and -1 on error.
+   */
+  int uring_prepare_wake(uring_data *ring, listener_data *listener) {
+    struct io_uring_sqe *entry = uring_sqe_get(ring);
+
+    if (entry == NULL) {
+      return -1;
+    }
 
-        if (ldap_status == LDAP_SERVER_DOWN) {
-          if (tries + 1 < LDAP_RETRY_SEARCH_RETRY) {
-            continue;
-          }
-        }
-        else if (ldap_status == LDAP_TIMEOUT) {
-          if (tries + 1 < LDAP_RETRY_SEARCH_RETRY) {
-            continue;
-          }
-        }
+    entry->opcode = IORING_OP_POLL_ADD;
+    entry->fd = listener->wake_id;
+    entry->poll_events = POLLIN;
+    entry->user_data = IO_URING_USER_DATA(IO_URING_OPERATION_WAKE, 0, 0);
 
-        log_write(LOG_ERR, "ERROR: failed to find '%s' on the ldap server '%s' with the ldap name '%s' with the ldap error (%d): %s\n", user_name, LDAP_SERVER, ldap_name, ldap_status, ldap_err2string(ldap_status));
+    return 1;
+  }
 
-        if (ldap_settings != NULL) {
-          ldap_unbind(ldap_settings);
-        }
+  /**
+   * Prepares a read of the next packet segment into the slot's registered buffer, linked to a timeout.
+   *
+   * The linked timeout is used for these reads, the SO_RCVTIMEO and SO_SNDTIMEO socket options are still set for the blocking calls made once the request is handed off.
+   *
+   * @param uring_data *ring
+   *   The io_uring data.
+   * @param int slot
+   *   The slot of the client connection.
+   *
+   * @return int
+   *   1 on success and -1 on error.
+   */
+  int uring_prepare_read(uring_data *ring, int slot) {
+    struct io_uring_sqe *entry = uring_sqe_get(ring);
+
+    if (entry == NULL) {
+      return -1;
+    }
 
-        if (ldap_name != NULL) {
-          free(ldap_name);
-        }
-        return -1;
-      }
+    entry->opcode = IORING_OP_READ_FIXED;
+    entry->fd = ring->slot_client[slot];
+    entry->addr = (unsigned long) ring->buffers[slot];
+    entry->len = PACKET_SIZE_INPUT - ring->slot_processed[slot];
+    entry->buf_index = slot;
+    entry->flags = IOSQE_IO_LINK;
+    entry->user_data = IO_URING_USER_DATA(IO_URING_OPERATION_READ, slot, ring->slot_client[slot]);
+
+    entry = uring_sqe_get(ring);
+
+    if (entry == NULL) {
+      return -1;
     }
 
-    // Ldap is no longer needed.
-    if (ldap_settings != NULL) {
-      ldap_unbind(ldap_settings);
+    entry->opcode = IORING_OP_LINK_TIMEOUT;
+    entry->fd = -1;
+    entry->addr = (unsigned long) &ring->slot_timeout[slot];
+    entry->len = 1;
+    entry->user_data = IO_URING_USER_DATA(IO_URING_OPERATION_TIMEOUT, slot, 0);
+
+    return 1;
+  }
+
+  /**
+   * Prepares sending the status to the client followed by closing the client connection.
+   *
+   * The close is hard-linked so that it happens even if the send fails.
+   * The entries are not submitted here so that all responses in a batch of completions are submitted together.
+   *
+   * @param uring_data *ring
+   *   The io_uring data.
+   * @param int socket_id_client
+   *   The client connection.
+   * @param char *status
+   *   The status to send, such as ERROR_NONE.
+   *   This must not be freed until the send is complete.
+   *
+   * @return int
+   *   1 on success and -1 on error.
+   */
+  int uring_prepare_respond(uring_data *ring, int socket_id_client, char *status) {
+    struct io_uring_sqe *entry = uring_sqe_get(ring);
+
+    if (entry == NULL) {
+      close(socket_id_client);
+      return -1;
     }
 
-    if (ldap_name != NULL) {
-      free(ldap_name);
+    entry->opcode = IORING_OP_SEND;
+    entry->fd = socket_id_client;
+    entry->addr = (unsigned long) status;
+    entry->len = PACKET_SIZE_OUTPUT;
+    entry->msg_flags = FLAGS_SEND;
+    entry->flags = IOSQE_IO_HARDLINK;
+    entry->user_data = IO_URING_USER_DATA(IO_URING_OPERATION_SEND, 0, socket_id_client);
+
+    entry = uring_sqe_get(ring);
+
+    if (entry == NULL) {
+      // the send is already queued and will be submitted, the close cannot be queued.
+      return -1;
     }
 
-    if (ldap_matched == 0) {
-      return 0;
+    entry->opcode = IORING_OP_CLOSE;
+    entry->fd = socket_id_client;
+    entry->user_data = IO_URING_USER_DATA(IO_URING_OPERATION_CLOSE, 0, socket_id_client);
+
+    return 1;
+  }
+
+  /**
+   * Finds a free slot for a new client connection.
+   *
+   * @param uring_data *ring
+   *   The io_uring data.
+   *
+   * @return int
+   *   The free slot or -1 when all slots are in use.
+   */
+  int uring_slot_get(uring_data *ring) {
+    int slot = 0;
+
+    for (; slot < IO_URING_SLOTS; slot++) {
+      if (ring->slot_client[slot] == 0) {
+        return slot;
+      }
     }
+
+    return -1;
   }
 
-  return 1;
-}
+  /**
+   * Accepts and processes connections using io_uring.
+   *
+   * The accept is multishot, the packets are read into registered buffers, and the status sends of rejected requests are batched.
+   * Each parsed request is queued for a worker, as with handler_blocking().
+   *
+   * @param listener_data *listener
+   *   The bound and listening listener to handle.
+   *
+   * @return int
+   *   0 when io_uring is not supported (so that the caller may fall back to handler_blocking()) and -1 on error.
+   */
+  int handler_io_uring(listener_data *listener) {
+    shared_data *shared = listener->shared;
+    uring_data *ring = NULL;
+    struct timeval timeout;
+    int initialized = 0;
+
+    // the linked timeouts only cover the reads made here, the workers, the health response, and keepalive use the socket options (see handler_blocking()).
+    timeout.tv_sec = 0;
+
+    if (listener->type == LISTENER_NETWORK) {
+      timeout.tv_usec = SOCKET_TIMEOUT_NETWORK;
+    }
+    else {
+      timeout.tv_usec = SOCKET_TIMEOUT_SOCKET;
+    }
 
-/**
- * Handles network connections.
- *
- * This is called by clone().
- *
- * @param void *argument
- *   The data shared between the parent and cloned child.
- *
- * @see: clone()
- */
-int handler_child(void *argument) {
-  // do no accept/allow signals in the child handler.
-  sigset_t signal_mask;
-  sigemptyset(&signal_mask);
-  sigprocmask(SIG_BLOCK, &signal_mask, NULL);
+    ring = malloc(sizeof(uring_data));
+    if (ring == NULL) {
+      log_write(LOG_ERR, "ERROR: failed to allocate memory for io_uring.\n");
+      return -1;
+    }
 
-  shared_data *shared;
-  shared = (shared_data *) argument;
+    initialized = uring_initialize(ring);
+    if (initialized < 1) {
+      free(ring);
+      return initialized;
+    }
 
-  //shared->pid_child = syscall(SYS_gettid);
-  shared->pid_child = getpid();
+    {
+      int slot = 0;
+      for (; slot < IO_URING_SLOTS; slot++) {
+        ring->slot_timeout[slot].tv_sec = 0;
 
-  log_write(LOG_DEBUG, "DEBUG: after clone (child) pid = %u, child pid = %u, target socket id = %u\n", shared->pid_parent, shared->pid_child, shared->socket_id_target);
+        if (listener->type == LISTENER_NETWORK) {
+          ring->slot_timeout[slot].tv_nsec = SOCKET_TIMEOUT_NETWORK * 1000;
+        }
+        else {
+          ring->slot_timeout[slot].tv_nsec = SOCKET_TIMEOUT_SOCKET * 1000;
+        }
+      }
+    }
 
-  const unsigned structure_socket_length = sizeof(struct sockaddr_un);
+    if (uring_prepare_accept(ring, listener) < 0) {
+      log_write(LOG_ERR, "ERROR: failed to prepare the io_uring accept.\n");
+      uring_destroy(ring);
+      free(ring);
+      return -1;
+    }
 
-  #ifdef USE_NETWORK
-    {
-      // bind the socket to port.
-      struct addrinfo *port_information = NULL;
-      struct addrinfo port_setup;
+    // the accept cannot be interrupted by the control thread otherwise, so the control thread writes to an eventfd that is polled here.
+    // the eventfd starts readable, in case accepting was paused before it existed.
+    if (shared->control.enabled) {
+      listener->wake_id = eventfd(1, EFD_CLOEXEC | EFD_NONBLOCK);
 
-      memset(&port_setup, 0, sizeof(struct addrinfo));
+      if (listener->wake_id < 0 || uring_prepare_wake(ring, listener) < 0) {
+        log_write(LOG_ERR, "ERROR: failed to prepare the io_uring control wake, error: %i.\n", errno);
 
-      port_setup.ai_family = INADDR_ANY;
-      port_setup.ai_socktype = SOCKET_TYPE;
-      port_setup.ai_flags = AI_PASSIVE;
+        if (listener->wake_id > 0) {
+          close(listener->wake_id);
+        }
 
-      {
-        char string_port[16];
-        memset(&string_port, 0, sizeof(char) * 16);
+        listener->wake_id = 0;
+        uring_destroy(ring);
+        free(ring);
+        return -1;
+      }
+    }
 
-        sprintf(string_port, "%u", shared->parameter_port);
+    log_write(LOG_DEBUG, "DEBUG: using io_uring for the listener, target socket id = %u\n", listener->socket_id_target);
+
+    while (1) {
+      if (uring_submit(ring, 1) < 0) {
+        log_write(LOG_ERR, "ERROR: failed to submit to io_uring, error: %i.\n", errno);
+        break;
+      }
 
-        int addressed = getaddrinfo(NULL, string_port, &port_setup, &port_information);
-        if (addressed != 0) {
-          log_write(LOG_ERR, "ERROR: failed to process the port '%u' using protocol '%u', 'socket id = '%i': error %i (%u).\n", shared->parameter_port, SOCKET_PROTOCOL, shared->pid_child, addressed, errno);
+      unsigned head = *ring->cq_head;
+      unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+
+      for (; head != tail; head++) {
+        struct io_uring_cqe *completion = &ring->cqes[head & *ring->cq_mask];
+        const int operation = IO_URING_USER_DATA_OPERATION(completion->user_data);
+        const int slot = IO_URING_USER_DATA_SLOT(completion->user_data);
+        const int result = completion->res;
+        const unsigned flags = completion->flags;
+
+        if (operation == IO_URING_OPERATION_ACCEPT) {
+          if (result < 0) {
+            if (result == -EINVAL && ring->multishot) {
+              // multishot accept is not supported by this kernel, so fall back to re-arming a single accept each time.
+              ring->multishot = 0;
+            }
+            else if (result != -EINTR && result != -ECONNABORTED && result != -EAGAIN && result != -ECANCELED) {
+              if (listener->type == LISTENER_NETWORK) {
+                log_write(LOG_ERR, "ERROR: failed to accept connections on the port '%u' using protocol '%u': error (%u).\n", shared->parameter_port, SOCKET_PROTOCOL_NETWORK, -result);
+              }
+              else {
+                log_write(LOG_ERR, "ERROR: failed to accept connections on the socket '%s' using protocol '%u': error (%u).\n", shared->socket_path, SOCKET_PROTOCOL_SOCKET, -result);
+              }
+            }
+          }
+          else {
+            int slot_new = uring_slot_get(ring);
+
+            setsockopt(result, PROTOCOL_SOCKET, SO_RCVTIMEO, (char *)&timeout, sizeof(timeout));
+            setsockopt(result, PROTOCOL_SOCKET, SO_SNDTIMEO, (char *)&timeout, sizeof(timeout));
+
+            if (slot_new < 0) {
+              uring_prepare_respond(ring, result, ERROR_CLOSE);
+            }
+            else if (listener_authorize_client(listener, result) < 1) {
+              uring_prepare_respond(ring, result, ERROR_CLOSE);
+            }
+            else {
+              ring->slot_client[slot_new] = result;
+              ring->slot_processed[slot_new] = 0;
+              ring->slot_name_length[slot_new] = 0;
+              ring->slot_flags[slot_new] = 0;
+              ring->slot_budget[slot_new] = 0;
+              ring->slot_ticket[slot_new] = 0;
+              memset(ring->slot_name[slot_new], 0, sizeof(char) * (PACKET_SIZE_INPUT + 1));
+              trace_begin(&ring->slot_trace[slot_new], listener, result, NULL);
+              MACRO_PROBE_2(request_accept, listener->type, result);
+
+              if (uring_prepare_read(ring, slot_new) < 0) {
+                uring_prepare_respond(ring, result, ERROR_CLOSE);
+                trace_finish(&listener->worker, &ring->slot_trace[slot_new], ERROR_CLOSE);
+                ring->slot_client[slot_new] = 0;
+              }
+            }
+          }
 
-          freeaddrinfo(port_information);
-          port_information = NULL;
+          if (!(flags & IORING_CQE_F_MORE)) {
+            ring->accepting = 0;
 
-          // send SIGCHLD signal to parent process.
-          if (shared->pid_parent > 0) {
-            kill(shared->pid_parent, SIGCHLD);
+            // while paused, the accept is armed again once resumed (see IO_URING_OPERATION_WAKE).
+            if (!__atomic_load_n(&shared->control.paused, __ATOMIC_ACQUIRE) && uring_prepare_accept(ring, listener) < 0) {
+              log_write(LOG_ERR, "ERROR: failed to prepare the io_uring accept.\n");
+            }
           }
-          return -1;
         }
-      }
+        else if (operation == IO_URING_OPERATION_WAKE) {
+          const int paused = __atomic_load_n(&shared->control.paused, __ATOMIC_ACQUIRE);
+          uint64_t wake = 0;
 
-      if (shared->socket_bound == 0) {
-        shared->socket_bound = bind(shared->socket_id_target, port_information->ai_addr, port_information->ai_addrlen);
-        if (shared->socket_bound < 0) {
-          log_write(LOG_ERR, "ERROR: failed to bind the port '%u' using protocol '%u', 'socket id = '%i': error %i (%u).\n", shared->parameter_port, SOCKET_PROTOCOL, shared->pid_child, shared->socket_bound, errno);
-          shared->socket_bound = 0;
+          // the eventfd is non-blocking, it is only read to clear it.
+          if (read(listener->wake_id, &wake, sizeof(uint64_t)) < 0 && errno != EAGAIN) {
+            log_write(LOG_ERR, "ERROR: failed to read the io_uring control wake, error: %i.\n", errno);
+          }
 
-          freeaddrinfo(port_information);
-          port_information = NULL;
+          if (paused && ring->accepting) {
+            if (uring_prepare_cancel(ring) < 0) {
+              log_write(LOG_ERR, "ERROR: failed to prepare the io_uring accept cancel.\n");
+            }
+          }
+          else if (!paused && !ring->accepting) {
+            if (uring_prepare_accept(ring, listener) < 0) {
+              log_write(LOG_ERR, "ERROR: failed to prepare the io_uring accept.\n");
+            }
+          }
 
-          // send SIGQUIT signal to parent process.
-          if (shared->pid_parent > 0) {
-            kill(shared->pid_parent, SIGQUIT);
+          if (uring_prepare_wake(ring, listener) < 0) {
+            log_write(LOG_ERR, "ERROR: failed to prepare the io_uring control wake.\n");
+          }
+        }
+        else if (operation == IO_URING_OPERATION_READ) {
+          const int socket_id_client = ring->slot_client[slot];
+
+          if (result == 0) {
+            // this happens on proper client connection termination.
+            close(socket_id_client);
+            trace_finish(&listener->worker, &ring->slot_trace[slot], NULL);
+            ring->slot_client[slot] = 0;
+          }
+          else if (result < 0) {
+            // a linked timeout results in -ECANCELED, which is treated as ERROR_READ as with handler_blocking().
+            uring_prepare_respond(ring, socket_id_client, ERROR_READ);
+            MACRO_PROBE_3(request_send, listener->type, socket_id_client, ERROR_READ[0]);
+            trace_finish(&listener->worker, &ring->slot_trace[slot], ERROR_READ);
+            ring->slot_client[slot] = 0;
+          }
+          else {
+            int parsed = packet_parse(ring->buffers[slot], result, ring->slot_name[slot], &ring->slot_processed[slot], &ring->slot_name_length[slot], &ring->slot_flags[slot], &ring->slot_budget[slot], &ring->slot_ticket[slot]);
+
+            if (parsed == PACKET_PARSE_INVALID) {
+              memcpy(ring->slot_trace[slot].name, ring->slot_name[slot], ring->slot_name_length[slot]);
+              uring_prepare_respond(ring, socket_id_client, ERROR_NAME);
+              MACRO_PROBE_3(request_send, listener->type, socket_id_client, ERROR_NAME[0]);
+              trace_finish(&listener->worker, &ring->slot_trace[slot], ERROR_NAME);
+              ring->slot_client[slot] = 0;
+            }
+            else if (parsed == PACKET_PARSE_MORE) {
+              if (uring_prepare_read(ring, slot) < 0) {
+                uring_prepare_respond(ring, socket_id_client, ERROR_CLOSE);
+                MACRO_PROBE_3(request_send, listener->type, socket_id_client, ERROR_CLOSE[0]);
+                trace_finish(&listener->worker, &ring->slot_trace[slot], ERROR_CLOSE);
+                ring->slot_client[slot] = 0;
+              }
+            }
+            else {
+              MACRO_PROBE_3(request_parse, listener->type, socket_id_client, ring->slot_name[slot]);
+
+              // the ping is answered here, from the health kept by the breaker thread.
+              if (ring->slot_flags[slot] & PACKET_FLAG_PING) {
+                char *status = health_respond(shared, socket_id_client, &ring->slot_trace[slot], ring->slot_flags[slot] & PACKET_FLAG_KEEP);
+
+                MACRO_PROBE_3(request_send, listener->type, socket_id_client, status[0]);
+                trace_finish(&listener->worker, &ring->slot_trace[slot], status);
+              }
+              else if (ring->slot_flags[slot] & PACKET_FLAG_TICKET) {
+                char *status = ticket_poll(&shared->tickets, socket_id_client, ring->slot_name[slot], ring->slot_ticket[slot], ring->slot_budget[slot], &ring->slot_trace[slot].started);
+
+                // otherwise, the ticket thread responds to and closes the client connection.
+                if (status != NULL) {
+                  uring_prepare_respond(ring, socket_id_client, status);
+                  MACRO_PROBE_3(request_send, listener->type, socket_id_client, status[0]);
+                  trace_finish(&listener->worker, &ring->slot_trace[slot], status);
+                }
+              }
+              // the worker responds to and then keeps or closes the client connection, unless the queues are full.
+              else if (scheduler_submit(&shared->scheduler, listener, socket_id_client, ring->slot_name[slot], ring->slot_flags[slot], ring->slot_budget[slot], &ring->slot_trace[slot]) < 0) {
+                uring_prepare_respond(ring, socket_id_client, ERROR_CLOSE);
+                MACRO_PROBE_3(request_send, listener->type, socket_id_client, ERROR_CLOSE[0]);
+                trace_finish(&listener->worker, &ring->slot_trace[slot], ERROR_CLOSE);
+              }
+
+              ring->slot_client[slot] = 0;
+            }
           }
-          return -1;
         }
 
-        shared->socket_bound = 1;
-      }
+        // IO_URING_OPERATION_TIMEOUT, IO_URING_OPERATION_SEND, IO_URING_OPERATION_CLOSE, and IO_URING_OPERATION_CANCEL completions require no further action.
+      } // for
+
+      __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+    } // while
 
-      freeaddrinfo(port_information);
-      port_information = NULL;
+    if (listener->wake_id > 0) {
+      close(listener->wake_id);
+      listener->wake_id = 0;
     }
-  #elif defined USE_SOCKET
-    {
-      // bind the socket to the shared.socket_path so that the
-      struct sockaddr_un socket_address;
 
-      memset(&socket_address, 0, structure_socket_length);
-      socket_address.sun_family = SOCKET_FAMILY;
-      strncpy(socket_address.sun_path, shared->socket_path, sizeof(socket_address.sun_path) - 1);
+    uring_destroy(ring);
+    free(ring);
 
-      {
-        int bound = bind(shared->socket_id_target, (struct sockaddr *) &socket_address, structure_socket_length);
-        if (bound < 0) {
-          log_write(LOG_ERR, "ERROR: failed to bind the socket '%s' using protocol '%u', 'socket id = '%i'\n", shared->socket_path, SOCKET_PROTOCOL, shared->socket_id_target);
+    return -1;
+  }
+#endif // USE_IO_URING
 
-          // send SIGQUIT signal to parent process.
-          if (shared->pid_parent > 0) {
-            kill(shared->pid_parent, SIGQUIT);
-          }
-          return -1;
-        }
-      }
-    }
-  #endif // USE_SOCKET
+/**
+ * Handles network and socket connections.
+ *
+ * This is called by pthread_create(), once for each enabled listener.
+ * The signals are blocked by the parent before the thread is created, so that only the parent receives them.
+ *
+ * @param void *argument
+ *   The listener_data for the listener to handle.
+ *   The listener_data contains a pointer to the data shared between the parent and all children.
+ *
+ * @return void *
+ *   NULL is always returned.
+ *
+ * @see: pthread_create()
+ */
+void *handler_child(void *argument) {
+  listener_data *listener;
+  listener = (listener_data *) argument;
+
+  shared_data *shared;
+  shared = listener->shared;
+
+  listener->pid_child = syscall(SYS_gettid);
+
+  log_write(LOG_DEBUG, "DEBUG: after thread (child) pid = %u, child pid = %u, target socket id = %u\n", shared->pid_parent, listener->pid_child, listener->socket_id_target);
+
+  if (listener_bind(listener) < 0) {
+    return NULL;
+  }
 
   {
-    int listening = listen(shared->socket_id_target, SOCKET_BACKLOG);
+    int handled = 0;
 
-    if (listening < 0) {
-      #ifdef USE_NETWORK
-        log_write(LOG_ERR, "ERROR: failed to listen to the port '%u' using protocol '%u', 'socket id = '%i', error %i (%u).\n", shared->parameter_port, SOCKET_PROTOCOL, shared->pid_child, listening, errno);
-      #elif defined USE_SOCKET
-        log_write(LOG_ERR, "ERROR: failed to listen to the socket '%s' using protocol '%u', 'socket id = '%i', error %i (%u).\n", shared->socket_path, SOCKET_PROTOCOL, shared->pid_child, listening, errno);
-      #endif // USE_SOCKET
+    #ifdef USE_IO_URING
+      handled = handler_io_uring(listener);
+
+      if (handled == 0) {
+        log_write(LOG_NOTICE, "NOTICE: io_uring is not supported by the running kernel, falling back to blocking calls.\n");
+        handled = handler_blocking(listener);
+      }
+    #else
+      handled = handler_blocking(listener);
+    #endif // USE_IO_URING
 
+    if (handled < 0) {
       // send SIGQUIT signal to parent process.
       if (shared->pid_parent > 0) {
         kill(shared->pid_parent, SIGQUIT);
       }
+
+      return NULL;
+    }
+  }
+
+  // send SIGQUIT signal to parent process.
+  if (shared->pid_parent > 0) {
+    kill(shared->pid_parent, SIGQUIT);
+  }
+
+  return NULL;
+}
+
+/**
+ * Load an optional numeric id, such as a uid or a gid, from the environment.
+ *
+ * @param const char *name
+ *   The name of the environment variable.
+ * @param long *id
+ *   The loaded id, this value will be updated.
+ *   This is set to -1 when the environment variable is not defined.
+ *
+ * @return int
+ *   1 is returned on success and -1 on error.
+ */
+int populate_parameter_id(const char *name, long *id) {
+  char *value = getenv(name);
+  char *value_end = NULL;
+
+  *id = -1;
+
+  if (value == NULL || value[0] == 0) {
+    return 1;
+  }
+
+  errno = 0;
+  *id = strtol(value, &value_end, 10);
+
+  if (errno != 0 || value_end == NULL || *value_end != 0 || *id < 0) {
+    printf("ERROR: the environment variable '%s' has an invalid value '%s', it must be a non-negative number.\n", name, value);
+    *id = -1;
+    return -1;
+  }
+
+  return 1;
+}
+
+/**
+ * Handle command line arguments
+ *
+ * @param int argc
+ *   Total of command line arguments.
+ * @param char *argv[]
+ *   Array of command line argument strings.
+ * @param char *parameter_system
+ *   Name of the system, this value will be updated.
+ * @param char *parameter_group
+ *   Name of the group, this value will be updated.
+ * @param char *parameter_database
+ *   Name of the database, this value will be updated.
+ * @param char *parameter_connect_name
+ *   Name of the user to connect to the database as.
+ * @param char *parameter_connect_password
+ *   Password of the user to connect to the database as.
+ * @param int *parameter_port
+ *   Number of the port, this value will be updated.
+ *   This is only loaded when the network listener is enabled.
+ * @param int *parameter_listen_network
+ *   Set to 1 when the network listener is enabled, 0 otherwise.
+ * @param int *parameter_listen_socket
+ *   Set to 1 when the socket listener is enabled, 0 otherwise.
+ * @param long *parameter_socket_allow_uid
+ *   The uid socket clients are required to have or -1 to allow any uid.
+ * @param long *parameter_socket_allow_gid
+ *   The gid socket clients are required to have or -1 to allow any gid.
+ * @param int *parameter_mirror
+ *   Set to 1 when the live local mirror of the ldap names is enabled, 0 otherwise.
+ * @param long *parameter_cache_ttl
+ *   The seconds a name is cached, 0 when the cache is disabled, this value will be updated.
+ * @param long *parameter_cache_coherence
+ *   The seconds between group membership snapshots, 0 when disabled, this value will be updated.
+ * @param long *parameter_cache_snapshot
+ *   The seconds between writing the cache snapshot file, 0 when disabled, this value will be updated.
+ * @param int *parameter_table
+ *   Set to 1 when the provisioned names are published to the table for the clients, 0 otherwise.
+ * @param int *parameter_control
+ *   Set to 1 when the admin control socket is enabled, 0 otherwise.
+ * @param int *parameter_capture
+ *   One of CAPTURE_NONE, CAPTURE_NAMES, or CAPTURE_HASHES.
+ * @param long *parameter_health_interval
+ *   The seconds between the background probes of the backends, 0 when disabled, this value will be updated.
+ * @param long *parameter_keepalive
+ *   The most connections kept open between requests, 0 when disabled, this value will be updated.
+ * @param char *parameter_ldap_servers
+ *   The space separated ldap server uris, this value will be updated (an empty string when not defined).
+ * @param int *parameter_ldap_hedge
+ *   Set to 1 when slow ldap searches are hedged to a second server, 0 otherwise.
+ * @param long *parameter_ldap_hedge_percentile
+ *   The latency percentile of a server after which a search is hedged, this value will be updated.
+ * @param long *parameter_ldap_spares
+ *   The spare connections kept bound ahead of time for each ldap server, 0 when disabled, this value will be updated.
+ * @param long *parameter_workers
+ *   The worker threads that process requests, this value will be updated.
+ * @param int *parameter_priority_network
+ *   The priority class of requests accepted on the network listener, this value will be updated.
+ * @param int *parameter_priority_socket
+ *   The priority class of requests accepted on the socket listener, this value will be updated.
+ * @param long *parameter_bulk_share
+ *   The minimum percent of the dispatches given to waiting bulk requests, this value will be updated.
+ * @param int *parameter_fair
+ *   Set to 1 when the network client addresses take turns within each class (the default), 0 otherwise.
+ * @param char *parameter_fair_weights
+ *   The space separated address=weight pairs, this value will be updated (an empty string when not defined).
+ * @param const int parameter_reconcile
+ *   When non-zero, the program is to reconcile instead of listen, so no listeners are enabled.
+ * @param long *parameter_reconcile_rate
+ *   The names provisioned per second when reconciling, this value will be updated.
+ * @param long *parameter_reconcile_batch
+ *   The names provisioned per transaction when reconciling, this value will be updated.
+ *
+ * @return int
+ *   1 is returned on success, 0 on success but exit, and -1 on error.
+ */
+int populate_parameters(int argc, char *argv[], char *parameter_system, char *parameter_group, char *parameter_database, char *parameter_connect_name, char *parameter_connect_password, int *parameter_port, int *parameter_listen_network, int *parameter_listen_socket, long *parameter_socket_allow_uid, long *parameter_socket_allow_gid, int *parameter_mirror, long *parameter_cache_ttl, long *parameter_cache_coherence, long *parameter_cache_snapshot, int *parameter_table, int *parameter_control, int *parameter_capture, long *parameter_health_interval, long *parameter_keepalive, char *parameter_ldap_servers, int *parameter_ldap_hedge, long *parameter_ldap_hedge_percentile, long *parameter_ldap_spares, long *parameter_workers, int *parameter_priority_network, int *parameter_priority_socket, long *parameter_bulk_share, int *parameter_fair, char *parameter_fair_weights, const int parameter_reconcile, long *parameter_reconcile_rate, long *parameter_reconcile_batch) {
+  // the listeners must be known before the arguments can be validated.
+  if (parameter_reconcile) {
+    *parameter_listen_network = 0;
+    *parameter_listen_socket = 0;
+
+    if (populate_parameter_id(ENVIRONMENT_RECONCILE_RATE, parameter_reconcile_rate) < 0) {
+      return -1;
+    }
+
+    if (populate_parameter_id(ENVIRONMENT_RECONCILE_BATCH, parameter_reconcile_batch) < 0) {
       return -1;
     }
+
+    if (*parameter_reconcile_rate < 0) {
+      *parameter_reconcile_rate = RECONCILE_RATE;
+    }
+
+    if (*parameter_reconcile_batch < 1) {
+      *parameter_reconcile_batch = RECONCILE_BATCH;
+    }
+    else if (*parameter_reconcile_batch > RECONCILE_BATCH_MAX) {
+      *parameter_reconcile_batch = RECONCILE_BATCH_MAX;
+    }
   }
+  else {
+    char *listen = getenv(ENVIRONMENT_LISTEN);
 
-  int socket_error = 0;
-  socklen_t socket_error_length = 0;
+    *parameter_listen_network = 1;
+    *parameter_listen_socket = 0;
 
-  int message_length = 0;
-  int i = 0;
-  int processed = 0;
+    if (listen != NULL && listen[0] != 0) {
+      if (strcmp(listen, LISTEN_NETWORK) == 0) {
+        *parameter_listen_network = 1;
+        *parameter_listen_socket = 0;
+      }
+      else if (strcmp(listen, LISTEN_SOCKET) == 0) {
+        *parameter_listen_network = 0;
+        *parameter_listen_socket = 1;
+      }
+      else if (strcmp(listen, LISTEN_BOTH) == 0) {
+        *parameter_listen_network = 1;
+        *parameter_listen_socket = 1;
+      }
+      else {
+        printf("ERROR: the environment variable '%s' has an invalid value '%s', it must be one of '%s', '%s', or '%s'.\n", ENVIRONMENT_LISTEN, listen, LISTEN_NETWORK, LISTEN_SOCKET, LISTEN_BOTH);
+        return -1;
+      }
+    }
 
-  socklen_t length = 0;
-  ssize_t sent = 0;
+    if (populate_parameter_id(ENVIRONMENT_SOCKET_ALLOW_UID, parameter_socket_allow_uid) < 0) {
+      return -1;
+    }
 
-  char buffer[PACKET_SIZE_INPUT];
-  char user_name[PACKET_SIZE_INPUT];
-  char *error_receive = ERROR_NONE;
+    if (populate_parameter_id(ENVIRONMENT_SOCKET_ALLOW_GID, parameter_socket_allow_gid) < 0) {
+      return -1;
+    }
 
-  struct sockaddr_un socket_client_address;
+    if (populate_parameter_id(ENVIRONMENT_WORKERS, parameter_workers) < 0) {
+      return -1;
+    }
 
-  struct timeval timeout;
-  timeout.tv_sec = 0;
-  timeout.tv_usec = SOCKET_TIMEOUT;
+    if (*parameter_workers < 0) {
+      *parameter_workers = SCHEDULER_WORKERS;
+    }
+    else if (*parameter_workers < 1 || *parameter_workers > SCHEDULER_WORKERS_MAX) {
+      printf("ERROR: the environment variable '%s' has an invalid value '%ld', it must be between 1 and %u.\n", ENVIRONMENT_WORKERS, *parameter_workers, SCHEDULER_WORKERS_MAX);
+      return -1;
+    }
 
-  while (1) {
-    length = structure_socket_length;
-    processed = 0;
-    error_receive = ERROR_NONE;
+    {
+      char *bulk_listener = getenv(ENVIRONMENT_BULK_LISTENER);
 
-    // make sure that socket_id_client is always closed before continuing.
-    if (shared->socket_id_client != 0) {
-      sent = send(shared->socket_id_client, ERROR_CLOSE, PACKET_SIZE_OUTPUT, FLAGS_SEND);
-      close(shared->socket_id_client);
-      shared->socket_id_client = 0;
+      *parameter_priority_network = PRIORITY_INTERACTIVE;
+      *parameter_priority_socket = PRIORITY_INTERACTIVE;
+
+      if (bulk_listener != NULL && bulk_listener[0] != 0) {
+        if (strcmp(bulk_listener, LISTEN_NETWORK) == 0) {
+          *parameter_priority_network = PRIORITY_BULK;
+        }
+        else if (strcmp(bulk_listener, LISTEN_SOCKET) == 0) {
+          *parameter_priority_socket = PRIORITY_BULK;
+        }
+        else {
+          printf("ERROR: the environment variable '%s' has an invalid value '%s', it must be one of '%s' or '%s'.\n", ENVIRONMENT_BULK_LISTENER, bulk_listener, LISTEN_NETWORK, LISTEN_SOCKET);
+          return -1;
+        }
+      }
     }
 
-    memset(&socket_client_address, 0, structure_socket_length);
+    if (populate_parameter_id(ENVIRONMENT_BULK_SHARE, parameter_bulk_share) < 0) {
+      return -1;
+    }
+
+    if (*parameter_bulk_share < 0) {
+      *parameter_bulk_share = SCHEDULER_BULK_SHARE;
+    }
+    else if (*parameter_bulk_share > 100) {
+      printf("ERROR: the environment variable '%s' has an invalid value '%ld', it must be between 0 and 100.\n", ENVIRONMENT_BULK_SHARE, *parameter_bulk_share);
+      return -1;
+    }
 
-    shared->socket_id_client = accept(shared->socket_id_target, (struct sockaddr *) &socket_client_address, &length);
+    {
+      char *fair = getenv(ENVIRONMENT_FAIR);
+      char *fair_weights = getenv(ENVIRONMENT_FAIR_WEIGHTS);
 
-    if (shared->socket_id_client < 0) {
-      #ifdef USE_NETWORK
-        log_write(LOG_ERR, "ERROR: failed to accept connections on the port '%u' using protocol '%u': error %i (%u).\n", shared->parameter_port, SOCKET_PROTOCOL, shared->socket_id_client, errno);
-      #elif defined USE_SOCKET
-        log_write(LOG_ERR, "ERROR: failed to accept connections on the socket '%s' using protocol '%u': error %i (%u).\n", shared->socket_path, SOCKET_PROTOCOL, shared->socket_id_client, errno);
-      #endif // USE_SOCKET
+      // enabled unless explicitly disabled.
+      *parameter_fair = fair == NULL || strcmp(fair, SCHEDULER_FAIR_DISABLED) != 0;
+      parameter_fair_weights[0] = 0;
 
-      shared->socket_id_client = 0;
+      if (fair_weights != NULL) {
+        if (strnlen(fair_weights, SCHEDULER_WEIGHTS_LENGTH) == SCHEDULER_WEIGHTS_LENGTH) {
+          printf("ERROR: the environment variable '%s' is too long, it must be less than %u characters.\n", ENVIRONMENT_FAIR_WEIGHTS, SCHEDULER_WEIGHTS_LENGTH);
+          return -1;
+        }
 
-      // send SIGQUIT signal to parent process.
-      if (shared->pid_parent > 0) {
-        kill(shared->pid_parent, SIGQUIT);
+        strcpy(parameter_fair_weights, fair_weights);
       }
+    }
+
+    {
+      char *mirror = getenv(ENVIRONMENT_MIRROR);
+
+      *parameter_mirror = mirror != NULL && strcmp(mirror, MIRROR_ENABLED) == 0;
+    }
 
+    if (populate_parameter_id(ENVIRONMENT_CACHE_TTL, parameter_cache_ttl) < 0) {
       return -1;
     }
 
-    memset(&buffer, 0, sizeof(char) * PACKET_SIZE_INPUT);
-    memset(&user_name, 0, sizeof(char) * PACKET_SIZE_INPUT);
+    if (populate_parameter_id(ENVIRONMENT_CACHE_COHERENCE, parameter_cache_coherence) < 0) {
+      return -1;
+    }
 
-    // define a very short timeout for fast responses (both send and receive).
-    // the socket is expected to be a local connection, so it should be very fast.
-    setsockopt(shared->socket_id_client, PROTOCOL_SOCKET, SO_RCVTIMEO, (char *)&timeout, sizeof(timeout));
-    setsockopt(shared->socket_id_client, PROTOCOL_SOCKET, SO_SNDTIMEO, (char *)&timeout, sizeof(timeout));
+    if (*parameter_cache_ttl < 0) {
+      *parameter_cache_ttl = CACHE_TTL;
+    }
+
+    if (*parameter_cache_coherence < 0) {
+      *parameter_cache_coherence = CACHE_COHERENCE;
+    }
+
+    if (populate_parameter_id(ENVIRONMENT_CACHE_SNAPSHOT, parameter_cache_snapshot) < 0) {
+      return -1;
+    }
 
-    // linger connection for at most 2 seconds to help properly close connections.
-    {
-      struct linger linger_value = {1, 2};
-      setsockopt(shared->socket_id_target, PROTOCOL_SOCKET, SO_LINGER, &linger_value, sizeof(struct linger));
+    if (*parameter_cache_snapshot < 0) {
+      *parameter_cache_snapshot = CACHE_SNAPSHOT;
     }
 
-    // receive the user name from the client.
-    do {
-      error_receive = ERROR_NONE;
-      message_length = recv(shared->socket_id_client, buffer, PACKET_SIZE_INPUT, FLAGS_RECEIVE);
+    {
+      char *table = getenv(ENVIRONMENT_TABLE);
+      char *control = getenv(ENVIRONMENT_CONTROL);
 
-      if (message_length == 0) {
-        // this happens on proper client connection termination.
-        close(shared->socket_id_client);
-        shared->socket_id_client = 0;
-        break;
-      }
-      else if (message_length < 0) {
-        // this is not working as expected, socket_error is 0 when something like EAGAIN is expected.
-        // the idea here is to detect a timeout and report ERROR_TIMEOUT instead of ERROR_READ.
-        // until this is figured out, assume that ERROR_READ is the same as ERROR_TIMEOUT.
-        // look into recvmsg().
-        //socket_error = 0;
-        //socket_error_length = sizeof(int);
-        //getsockopt(shared->socket_id_client, PROTOCOL_SOCKET, SO_ERROR, (void *) &socket_error, &socket_error_length);
-        send(shared->socket_id_client, ERROR_READ, PACKET_SIZE_OUTPUT, FLAGS_SEND);
-        break;
-      }
+      *parameter_table = table != NULL && strcmp(table, TABLE_ENABLED) == 0;
+      *parameter_control = control != NULL && strcmp(control, CONTROL_ENABLED) == 0;
+    }
 
-      // require a valid packet length.
-      if (message_length > PACKET_SIZE_INPUT) {
-        sent = send(shared->socket_id_client, ERROR_PACKET, PACKET_SIZE_OUTPUT, FLAGS_SEND);
-        break;
-      }
+    {
+      char *capture = getenv(ENVIRONMENT_CAPTURE);
 
-      // only allow the following ASCII characters in the user name (utf8 should be fine for all codes that match the ASCII table).
-      for (i = 0; i < message_length && processed < PACKET_SIZE_INPUT; i++) {
-        // if a NULL char is reached, then the packet is finished.
-        if (buffer[i] == 0) {
-          // force the loop to terminate without processing any more packet data.
-          processed = PACKET_SIZE_INPUT;
-          break;
-        }
+      *parameter_capture = CAPTURE_NONE;
 
-        if ((buffer[i] < 'a' || buffer[i] > 'z') && (buffer[i] < 'A' || buffer[i] > 'Z') && (buffer[i] < '0' || buffer[i] > '9')) {
-          if (buffer[i] != '-' && buffer[i] != '_') {
-            error_receive = ERROR_NAME;
-            break;
-          }
+      if (capture != NULL && capture[0] != 0 && strcmp(capture, "no") != 0) {
+        if (strcmp(capture, CAPTURE_NAMES_VALUE) == 0) {
+          *parameter_capture = CAPTURE_NAMES;
         }
-
-        if (processed + 1 > PACKET_SIZE_INPUT) {
-          sent = send(shared->socket_id_client, ERROR_PACKET, PACKET_SIZE_OUTPUT, FLAGS_SEND);
-          break;
+        else if (strcmp(capture, CAPTURE_HASHES_VALUE) == 0) {
+          *parameter_capture = CAPTURE_HASHES;
         }
+        else {
+          printf("ERROR: the environment variable '%s' has an invalid value '%s', it must be one of '%s', '%s', or 'no'.\n", ENVIRONMENT_CAPTURE, capture, CAPTURE_NAMES_VALUE, CAPTURE_HASHES_VALUE);
+          return -1;
+        }
+      }
+    }
 
-        user_name[processed] = buffer[i];
-        processed++;
-      } // for
+    if (populate_parameter_id(ENVIRONMENT_HEALTH_INTERVAL, parameter_health_interval) < 0) {
+      return -1;
+    }
 
-      if (error_receive != ERROR_NONE) {
-        sent = send(shared->socket_id_client, error_receive, PACKET_SIZE_OUTPUT, FLAGS_SEND);
-        break;
-      }
+    if (*parameter_health_interval < 0) {
+      *parameter_health_interval = HEALTH_INTERVAL;
+    }
 
-      // require processed to be populated in some manner at this point.
-      if (processed == 0) {
-        error_receive = ERROR_NAME;
-        break;
-      }
-    } while (processed < PACKET_SIZE_INPUT);
+    if (populate_parameter_id(ENVIRONMENT_KEEPALIVE, parameter_keepalive) < 0) {
+      return -1;
+    }
 
-    if (error_receive == ERROR_NONE) {
-      int ldap_name_exists = 0;
-      ldap_name_exists = does_name_exist_in_ldap(user_name);
+    if (*parameter_keepalive < 0) {
+      *parameter_keepalive = KEEPALIVE_CONNECTIONS;
+    }
+  }
 
-      if (ldap_name_exists < 0) {
-        sent = send(shared->socket_id_client, ERROR_LDAP, PACKET_SIZE_OUTPUT, FLAGS_SEND);
-        shutdown(shared->socket_id_client, SHUT_RDWR);
-        shared->socket_id_client = 0;
-        continue;
-      }
-      else if (ldap_name_exists == 0) {
-        sent = send(shared->socket_id_client, ERROR_NAME, PACKET_SIZE_OUTPUT, FLAGS_SEND);
-        shutdown(shared->socket_id_client, SHUT_RDWR);
-        shared->socket_id_client = 0;
-        continue;
-      }
+  // the ldap servers are used by both the service and the reconcile.
+  {
+    char *ldap_servers = getenv(ENVIRONMENT_LDAP_SERVERS);
+    char *ldap_hedge = getenv(ENVIRONMENT_LDAP_HEDGE);
 
-      {
-        int status = 0;
-        status = grant_role_in_database(user_name, shared->parameter_group, shared->parameter_database, shared->parameter_connect_name, shared->parameter_connect_password);
+    parameter_ldap_servers[0] = 0;
 
-        if (status < 0) {
-          sent = send(shared->socket_id_client, ERROR_SQL, PACKET_SIZE_OUTPUT, FLAGS_SEND);
-          shutdown(shared->socket_id_client, SHUT_RDWR);
-          shared->socket_id_client = 0;
-          continue;
-        }
+    if (ldap_servers != NULL) {
+      if (strnlen(ldap_servers, LDAP_POOL_LIST_LENGTH) == LDAP_POOL_LIST_LENGTH) {
+        printf("ERROR: the environment variable '%s' is too long, it must be less than %u characters.\n", ENVIRONMENT_LDAP_SERVERS, LDAP_POOL_LIST_LENGTH);
+        return -1;
       }
+
+      strcpy(parameter_ldap_servers, ldap_servers);
     }
 
-    if (shared->socket_id_client > 0) {
-      // respond to the client for success or failure and then close the connection
-      if (processed > 0) {
-        sent = send(shared->socket_id_client, error_receive, PACKET_SIZE_OUTPUT, FLAGS_SEND);
-      }
+    *parameter_ldap_hedge = ldap_hedge != NULL && strcmp(ldap_hedge, LDAP_POOL_HEDGE_ENABLED) == 0;
 
-      shutdown(shared->socket_id_client, SHUT_RDWR);
-      shared->socket_id_client = 0;
+    if (populate_parameter_id(ENVIRONMENT_LDAP_PERCENTILE, parameter_ldap_hedge_percentile) < 0) {
+      return -1;
     }
-  } // while
 
-  // send SIGQUIT signal to parent process.
-  if (shared->pid_parent > 0) {
-    kill(shared->pid_parent, SIGQUIT);
-  }
+    if (*parameter_ldap_hedge_percentile < 1 || *parameter_ldap_hedge_percentile > 99) {
+      *parameter_ldap_hedge_percentile = LDAP_POOL_HEDGE_PERCENTILE;
+    }
 
-  return 0;
-}
+    if (populate_parameter_id(ENVIRONMENT_LDAP_SPARES, parameter_ldap_spares) < 0) {
+      return -1;
+    }
+
+    if (*parameter_ldap_spares < 0) {
+      *parameter_ldap_spares = LDAP_POOL_SPARES;
+    }
+  }
 
-/**
- * Handle command line arguments
- *
- * @param int argc
- *   Total of command line arguments.
- * @param char *argv[]
- *   Array of command line argument strings.
- * @param char *parameter_system
- *   Name of the system, this value will be updated.
- * @param char *parameter_group
- *   Name of the group, this value will be updated.
- * @param char *parameter_database
- *   Name of the database, this value will be updated.
- * @param char *parameter_connect_name
- *   Name of the user to connect to the database as.
- * @param char *parameter_connect_password
- *   Password of the user to connect to the database as.
- * @param int *parameter_port
- *   Number of the port, this value will be updated.
- *   This only appears when USE_NETWORK is defined.
- *
- * @return int
- *   1 is returned on success, 0 on success but exit, and -1 on error.
- */
-#ifdef USE_NETWORK
-  int populate_parameters(int argc, char *argv[], char *parameter_system, char *parameter_group, char *parameter_database, char *parameter_connect_name, char *parameter_connect_password, int *parameter_port) {
-#elif defined USE_SOCKET
-  int populate_parameters(int argc, char *argv[], char *parameter_system, char *parameter_group, char *parameter_database, char *parameter_connect_name, char *parameter_connect_password) {
-#endif // USE_SOCKET
   {
     int do_help = 0;
     char *program_name = "(program_name)";
@@ -1010,40 +8555,62 @@ int handler_child(void *argument) {
       }
     }
 
-    #ifdef USE_NETWORK
-      if (do_help == 0 && !(argc == 4 || argc == 5)) {
-        printf("ERROR: This program requires four or five arguments (with max lengths of %u) 'system name', 'group name', 'database name', 'listen port', example: %s fcs fcs_users fcs_database 125.\n", PARAMETER_LENGTH_MAX, program_name);
+    if (*parameter_listen_network) {
+      if (do_help == 0 && argc != 5) {
+        printf("ERROR: This program requires four arguments (with max lengths of %u) 'system name', 'group name', 'database name', 'listen port', example: %s fcs fcs_users fcs_database 125.\n", PARAMETER_LENGTH_MAX, program_name);
         do_help = 2;
       }
-    #elif defined USE_SOCKET
-      if (do_help == 0 && !(argc == 3 || argc == 4)) {
+    }
+    else {
+      if (do_help == 0 && !(argc == 4 || argc == 5)) {
         printf("ERROR: This program requires three or four arguments (with max lengths of %u) 'system name', 'group name', 'database name', example: %s fcs fcs_users fcs_database.\n", PARAMETER_LENGTH_MAX, program_name);
         do_help = 2;
       }
-    #endif // USE_SOCKET
+    }
 
     if (do_help > 0) {
       printf("\n");
 
-      #ifdef USE_NETWORK
-        printf("%s [ system name ] [ group name ] [ database name ] [ listen port ]\n", program_name);
-      #elif defined USE_SOCKET
-        printf("%s [ system name ] [ group name ] [ database name ]\n", program_name);
-      #endif // USE_SOCKET
+      printf("%s [ system name ] [ group name ] [ database name ] [ listen port ]\n", program_name);
+      printf("%s %s [ system name ] [ group name ] [ database name ]\n", program_name, RECONCILE_PARAMETER);
 
       printf("  [ system name ]    This argument is used as the name of the socket file, which will end in '.socket'.\n");
       printf("  [ group name ]     This argument is used as the postgresql role to grant access for in the specified database.\n");
       printf("  [ database name ]  This argument is used as the postgresql database.\n");
-
-      #ifdef USE_NETWORK
-        printf("  [ listen port ]    This argument is the port to listen on to accept user names.\n");
-      #endif // USE_NETWORK
+      printf("  [ listen port ]    This argument is the port to listen on to accept user names (optional when only the socket is listened on).\n");
+      printf("\n");
+      printf("  %s        Instead of listening, pre-provision every ldap name missing from the group in the database, report progress, and exit.\n", RECONCILE_PARAMETER);
 
       printf("\n");
       printf("Environment Variables:\n");
       printf("  The following environment variables must be defined:\n");
       printf("    %s      This parameter is used as the user to connect to the database as to perform operations.\n", ENVIRONMENT_CONNECT_USER);
       printf("    %s  This parameter is used as the password for the user connecting to the database.\n", ENVIRONMENT_CONNECT_PASSWORD);
+      printf("\n");
+      printf("  The following environment variables are optional:\n");
+      printf("    %s            One of '%s', '%s', or '%s' (default: '%s').\n", ENVIRONMENT_LISTEN, LISTEN_NETWORK, LISTEN_SOCKET, LISTEN_BOTH, LISTEN_NETWORK);
+      printf("    %s  Only accept socket clients with this uid (via SO_PEERCRED).\n", ENVIRONMENT_SOCKET_ALLOW_UID);
+      printf("    %s  Only accept socket clients with this gid (via SO_PEERCRED).\n", ENVIRONMENT_SOCKET_ALLOW_GID);
+      printf("    %s           The worker threads that process requests (default: %u).\n", ENVIRONMENT_WORKERS, SCHEDULER_WORKERS);
+      printf("    %s     One of '%s' or '%s', requests accepted on that listener are bulk instead of interactive.\n", ENVIRONMENT_BULK_LISTENER, LISTEN_NETWORK, LISTEN_SOCKET);
+      printf("    %s        The minimum percent of requests dispatched from the waiting bulk requests, 0 for none (default: %u).\n", ENVIRONMENT_BULK_SHARE, SCHEDULER_BULK_SHARE);
+      printf("    %s              Set to '%s' to not take turns between the network client addresses, by default one busy client does not delay the others.\n", ENVIRONMENT_FAIR, SCHEDULER_FAIR_DISABLED);
+      printf("    %s      Space separated 'address=weight' pairs, the requests dispatched in each turn of that client (default: 1).\n", ENVIRONMENT_FAIR_WEIGHTS);
+      printf("    %s            Set to '%s' to answer ldap name checks from a live local mirror of the ldap names.\n", ENVIRONMENT_MIRROR, MIRROR_ENABLED);
+      printf("    %s         The seconds a name is cached, 0 to disable the cache (default: %u).\n", ENVIRONMENT_CACHE_TTL, CACHE_TTL);
+      printf("    %s   The seconds between group membership snapshots that correct the cache, 0 to disable (default: %u).\n", ENVIRONMENT_CACHE_COHERENCE, CACHE_COHERENCE);
+      printf("    %s    The seconds between writing the cache to '%s' for a warm start, 0 to disable (default: %u).\n", ENVIRONMENT_CACHE_SNAPSHOT, PATH_CACHE, CACHE_SNAPSHOT);
+      printf("    %s             Set to '%s' to publish the provisioned names to '%s' for the clients to look up without a request.\n", ENVIRONMENT_TABLE, TABLE_ENABLED, PATH_TABLE);
+      printf("    %s           Set to '%s' to accept admin commands, such as resizing the workers or flushing the cache, on '%s'.\n", ENVIRONMENT_CONTROL, CONTROL_ENABLED, PATH_CONTROL);
+      printf("    %s           Set to '%s' or '%s' to write the arrival, name (or a hash of it), and result of every request to '%s' for replay.\n", ENVIRONMENT_CAPTURE, CAPTURE_NAMES_VALUE, CAPTURE_HASHES_VALUE, PATH_CAPTURE);
+      printf("    %s   The seconds between the background probes of the ldap servers and the database, answered to pings, 0 to disable (default: %u).\n", ENVIRONMENT_HEALTH_INTERVAL, HEALTH_INTERVAL);
+      printf("    %s         The most connections kept open between requests by the clients that ask for it, 0 to disable (default: %u).\n", ENVIRONMENT_KEEPALIVE, KEEPALIVE_CONNECTIONS);
+      printf("    %s      Space separated ldap server uris, the fastest healthy server is searched (default: '%s').\n", ENVIRONMENT_LDAP_SERVERS, LDAP_SERVER);
+      printf("    %s        Set to '%s' to repeat a slow search on a second ldap server and use the first answer.\n", ENVIRONMENT_LDAP_HEDGE, LDAP_POOL_HEDGE_ENABLED);
+      printf("    %s  The latency percentile of a server after which a search is hedged (default: %u).\n", ENVIRONMENT_LDAP_PERCENTILE, LDAP_POOL_HEDGE_PERCENTILE);
+      printf("    %s        The spare connections kept bound ahead of time for each ldap server, 0 to disable (default: %u).\n", ENVIRONMENT_LDAP_SPARES, LDAP_POOL_SPARES);
+      printf("    %s    The names provisioned per second by %s, 0 for no limit (default: %u).\n", ENVIRONMENT_RECONCILE_RATE, RECONCILE_PARAMETER, RECONCILE_RATE);
+      printf("    %s   The names provisioned per transaction by %s (default: %u).\n", ENVIRONMENT_RECONCILE_BATCH, RECONCILE_PARAMETER, RECONCILE_BATCH);
 
       printf("\n");
       printf("Notes:\n");
@@ -1205,7 +8772,7 @@ int handler_child(void *argument) {
     }
 
 
-    #ifdef USE_NETWORK
+    if (*parameter_listen_network) {
       // first sanitize the parameter and ensure that only numbers are allowed.
       for (; i < PARAMETER_LENGTH_MAX; i++) {
         if (argv[4][i] >= '0' || argv[4][i] <= '9') {
@@ -1220,7 +8787,7 @@ int handler_child(void *argument) {
       }
 
       *parameter_port = atoi(argv[4]);
-    #endif // USE_NETWORK
+    }
 
     // process database connection user name.
     {
@@ -1291,6 +8858,126 @@ int handler_child(void *argument) {
   return 1;
 }
 
+/**
+ * Builds the database connection information and the group specific statements once, so that requests only fill in the user name.
+ *
+ * The group name is validated by populate_parameters() to contain no '%', so it is safe to use within the grant statement format.
+ *
+ * @param shared_data *shared
+ *   The populated parameters, the templates will be updated.
+ */
+void populate_templates(shared_data *shared) {
+  snprintf(shared->psql_connection, sizeof(shared->psql_connection), PSQL_CONNECTION, shared->parameter_database, shared->parameter_connect_name, shared->parameter_connect_password);
+  snprintf(shared->psql_grant, sizeof(shared->psql_grant), PSQL_GRANT, shared->parameter_group, "%s");
+}
+
+/**
+ * Writes the statistics counters to the system logger.
+ *
+ * The counters are read without locking, so the values are approximate while requests are being processed.
+ *
+ * @param shared_data *shared
+ *   The data shared between the parent and all threads.
+ */
+void statistics_report(shared_data *shared) {
+  scheduler_data *scheduler = &shared->scheduler;
+
+  if (scheduler->worker_list != NULL) {
+    unsigned long requests = 0;
+    unsigned long requests_allocating = 0;
+    unsigned long allocations = 0;
+    unsigned long expired[DEADLINE_TOTAL] = { 0, 0, 0 };
+    int worker_index = 0;
+    int priority = 0;
+    int reason = 0;
+
+    for (; worker_index < scheduler->workers_created; worker_index++) {
+      requests += scheduler->worker_list[worker_index].total_requests;
+      requests_allocating += scheduler->worker_list[worker_index].total_requests_allocating;
+      allocations += scheduler->worker_list[worker_index].total_allocations;
+
+      for (reason = 0; reason < DEADLINE_TOTAL; reason++) {
+        expired[reason] += scheduler->worker_list[worker_index].total_expired[reason];
+      } // for
+    } // for
+
+    #ifdef USE_ALLOCATION_COUNTERS
+      log_write(LOG_INFO, "INFO: statistics for the %ld workers: %lu requests, %lu requests without allocation, %lu allocations (%.2f per request).\n", scheduler->workers, requests, requests - requests_allocating, allocations, requests > 0 ? (double) allocations / requests : 0.0);
+    #else
+      log_write(LOG_INFO, "INFO: statistics for the %ld workers: %lu requests.\n", scheduler->workers, requests);
+    #endif // USE_ALLOCATION_COUNTERS
+    log_write(LOG_INFO, "INFO: statistics for the deadlines: %lu expired while waiting, %lu expired before or during ldap, %lu expired before the database.\n", expired[DEADLINE_DISPATCH], expired[DEADLINE_LDAP], expired[DEADLINE_DATABASE]);
+
+    pthread_mutex_lock(&scheduler->lock);
+
+    for (; priority < PRIORITY_TOTAL; priority++) {
+      log_write(LOG_INFO, "INFO: statistics for the %s requests: %lu dispatched, %d waiting, %d processing, %lu rejected when full, %lu microseconds average wait, %lu microseconds longest wait.\n", priority == PRIORITY_BULK ? "bulk" : "interactive", scheduler->total_dispatched[priority], scheduler->queue_total[priority], scheduler->active[priority], scheduler->total_rejected[priority], scheduler->total_dispatched[priority] > 0 ? scheduler->total_wait[priority] / scheduler->total_dispatched[priority] : 0, scheduler->wait_longest[priority]);
+    } // for
+
+    pthread_mutex_unlock(&scheduler->lock);
+  }
+
+  if (shared->tickets.total_issued > 0 || shared->tickets.total_polls > 0) {
+    log_write(LOG_INFO, "INFO: statistics for the tickets: %lu issued, %lu rejected when full, %lu polls, %lu polls waited, %lu answered pending, %lu unknown.\n", shared->tickets.total_issued, shared->tickets.total_full, shared->tickets.total_polls, shared->tickets.total_waited, shared->tickets.total_pending, shared->tickets.total_unknown);
+  }
+
+  if (shared->cache.entries != NULL) {
+    log_write(LOG_INFO, "INFO: statistics for the cache: %lu names, %lu hits, %lu misses, %lu refreshed, %lu evicted, %lu not cached when full, %lu group snapshots.\n", (unsigned long) shared->cache.used, shared->cache.total_hits, shared->cache.total_misses, shared->cache.total_refreshed, shared->cache.total_evicted, shared->cache.total_full, shared->cache.total_snapshots);
+  }
+
+  if (shared->mirror.enabled) {
+    log_write(LOG_INFO, "INFO: statistics for the mirror: %s, %lu names loaded, %lu added, %lu removed, %lu loads.\n", shared->mirror.synced ? "synced" : "not synced", shared->mirror.total_loaded, shared->mirror.total_added, shared->mirror.total_removed, shared->mirror.total_reloads);
+  }
+
+  {
+    int server_index = 0;
+
+    pthread_mutex_lock(&shared->ldap_pool.lock);
+
+    for (; server_index < shared->ldap_pool.total; server_index++) {
+      ldap_pool_server *server = &shared->ldap_pool.servers[server_index];
+
+      log_write(LOG_INFO, "INFO: statistics for the ldap server '%s': circuit %s, %u microseconds average, %u microseconds hedge delay, %lu searches, %lu failures, %lu hedged, %lu hedges won, %lu times opened, %lu rejected, %lu probes, %u spares, %lu spares used, %lu tls handshakes, %lu tls handshakes resumed.\n", server->uri, __atomic_load_n(&server->breaker.state, __ATOMIC_RELAXED) == BREAKER_OPEN ? "open" : "closed", server->latency_average, server->hedge_delay, server->total_searches, server->total_failures, server->total_hedged, server->total_hedge_wins, server->breaker.total_opened, server->breaker.total_rejected, server->breaker.total_probes, server->spares_total, server->total_spares_used, server->total_handshakes, server->total_resumed);
+    } // for
+
+    pthread_mutex_unlock(&shared->ldap_pool.lock);
+  }
+
+  log_write(LOG_INFO, "INFO: statistics for the database '%s': circuit %s, %lu times opened, %lu rejected, %lu probes.\n", shared->parameter_database, __atomic_load_n(&shared->breaker_database.state, __ATOMIC_RELAXED) == BREAKER_OPEN ? "open" : "closed", shared->breaker_database.total_opened, shared->breaker_database.total_rejected, shared->breaker_database.total_probes);
+
+  {
+    limiter_data *limiter = &shared->limiter_database;
+
+    pthread_mutex_lock(&limiter->lock);
+
+    log_write(LOG_INFO, "INFO: statistics for the database limiter: %d limit, %d changing the database, %d waiting, %u microseconds baseline, %lu acquired, %lu waited, %lu expired while waiting, %lu times increased, %lu times decreased.\n", limiter->limit, limiter->in_flight, limiter->waiting, limiter->baseline, limiter->total_acquired, limiter->total_waited, limiter->total_expired, limiter->total_increased, limiter->total_decreased);
+
+    pthread_mutex_unlock(&limiter->lock);
+  }
+
+  {
+    int flags = 0;
+    char *health = health_check(shared, &flags);
+
+    log_write(LOG_INFO, "INFO: statistics for the health: %s, 0x%02x flags, %lu probes, %lu pings.\n", health[0] == ERROR_NONE[0] ? "ready" : (health[0] == ERROR_DEGRADED[0] ? "degraded" : "live"), flags, shared->health.total_probes, shared->health.total_pings);
+  }
+
+  if (shared->keepalive.connections != NULL) {
+    keepalive_data *keepalive = &shared->keepalive;
+
+    log_write(LOG_INFO, "INFO: statistics for the kept connections: %ld kept, %lu kept in total, %lu not kept when full, %lu requests, %lu packets received in segments, %lu closed when the partial packets were full, %lu closed when idle, %lu timed out while sending a packet.\n", keepalive->kept, keepalive->total_kept, keepalive->total_full, keepalive->total_requests, keepalive->total_partial, keepalive->total_partial_full, keepalive->total_idle, keepalive->total_timeout);
+  }
+
+  if (shared->capture.mode != CAPTURE_NONE) {
+    pthread_mutex_lock(&shared->capture.lock);
+
+    log_write(LOG_INFO, "INFO: statistics for the capture: %s, %lu requests captured, %lu requests dropped, %lu bytes written.\n", shared->capture.file < 0 ? "stopped" : "capturing", shared->capture.total_captured, shared->capture.total_dropped, (unsigned long) shared->capture.written);
+
+    pthread_mutex_unlock(&shared->capture.lock);
+  }
+}
+
+#ifndef MAIN_DISABLED
 /**
  * Main Function
  *
@@ -1304,29 +8991,65 @@ int handler_child(void *argument) {
  */
 int main(int argc, char *argv[]) {
   shared_data shared;
-  char *stack = NULL;
 
   memset(&shared, 0, sizeof(shared_data));
 
+  {
+    int listener_index = 0;
+    for (; listener_index < LISTENER_TOTAL; listener_index++) {
+      shared.listeners[listener_index].type = listener_index;
+      shared.listeners[listener_index].shared = &shared;
+      shared.listeners[listener_index].worker.shared = &shared;
+    }
+
+    shared.keepalive.worker.shared = &shared;
+  }
+
   // this pid will change once daemonized, but until then record the current pid.
   shared.pid_parent = getpid();
 
   {
     int populated = 0;
 
-    #ifdef USE_NETWORK
-      populated = populate_parameters(argc, argv, shared.parameter_system, shared.parameter_group, shared.parameter_database, shared.parameter_connect_name, shared.parameter_connect_password, &shared.parameter_port);
-    #elif defined USE_SOCKET
-      populated = populate_parameters(argc, argv, shared.parameter_system, shared.parameter_group, shared.parameter_database, shared.parameter_connect_name, shared.parameter_connect_password);
-    #endif // USE_SOCKET
+    // the reconcile parameter must come first and is removed so that the remaining arguments are handled as normal.
+    if (argc > 1 && strcmp(argv[1], RECONCILE_PARAMETER) == 0) {
+      shared.parameter_reconcile = 1;
+      argv[1] = argv[0];
+      argv++;
+      argc--;
+    }
+
+    populated = populate_parameters(argc, argv, shared.parameter_system, shared.parameter_group, shared.parameter_database, shared.parameter_connect_name, shared.parameter_connect_password, &shared.parameter_port, &shared.listeners[LISTENER_NETWORK].enabled, &shared.listeners[LISTENER_SOCKET].enabled, &shared.parameter_socket_allow_uid, &shared.parameter_socket_allow_gid, &shared.mirror.enabled, &shared.cache.ttl, &shared.cache.coherence, &shared.cache.snapshot, &shared.cache.publish, &shared.control.enabled, &shared.capture.mode, &shared.health.interval, &shared.keepalive.limit, shared.ldap_pool.list, &shared.ldap_pool.hedge, &shared.ldap_pool.hedge_percentile, &shared.ldap_pool.spares, &shared.scheduler.workers, &shared.listeners[LISTENER_NETWORK].priority, &shared.listeners[LISTENER_SOCKET].priority, &shared.scheduler.bulk_share, &shared.scheduler.fair, shared.scheduler.weights_list, shared.parameter_reconcile, &shared.parameter_reconcile_rate, &shared.parameter_reconcile_batch);
 
 
     if (populated == 0) {
-      MACRO_EXIT_STANDARD_1(shared, stack, 0);
+      MACRO_EXIT_STANDARD_1(shared, 0);
     }
     else if (populated < 0) {
-      MACRO_EXIT_STANDARD_1(shared, stack, -1);
+      MACRO_EXIT_STANDARD_1(shared, -1);
+    }
+
+    populate_templates(&shared);
+
+    if (ldap_pool_initialize(&shared.ldap_pool) < 0) {
+      MACRO_EXIT_STANDARD_1(shared, -1);
+    }
+
+    if (scheduler_weights_initialize(&shared.scheduler) < 0) {
+      MACRO_EXIT_STANDARD_1(shared, -1);
+    }
+
+    breaker_initialize(&shared.breaker_database, shared.parameter_database);
+  }
+
+
+  // the reconcile runs in the foreground, without a pid file, and then exits.
+  if (shared.parameter_reconcile) {
+    if (reconcile_run(&shared) < 0) {
+      MACRO_EXIT_STANDARD_1(shared, -1);
     }
+
+    MACRO_EXIT_STANDARD_1(shared, 0);
   }
 
 
@@ -1334,7 +9057,7 @@ int main(int argc, char *argv[]) {
   shared.pid_path = malloc(sizeof(char) * PATH_MAX);
   if (shared.pid_path == NULL) {
     log_write(LOG_ERR, "ERROR: failed to allocate memory for the pid path.\n");
-    MACRO_EXIT_STANDARD_1(shared, stack, -1);
+    MACRO_EXIT_STANDARD_1(shared, -1);
   }
 
 
@@ -1360,19 +9083,22 @@ int main(int argc, char *argv[]) {
 
       memset(&pid_stat, 0, sizeof(struct stat));
       result_stat = 0;
-      MACRO_EXIT_STANDARD_1(shared, stack, -1);
+      MACRO_EXIT_STANDARD_1(shared, -1);
     }
   }
 
 
-  #ifdef USE_NETWORK
-    shared.socket_id_target = socket(SOCKET_FAMILY, SOCKET_TYPE, SOCKET_PROTOCOL);
+  if (shared.listeners[LISTENER_NETWORK].enabled) {
+    shared.listeners[LISTENER_NETWORK].socket_id_target = socket(SOCKET_FAMILY_NETWORK, SOCKET_TYPE, SOCKET_PROTOCOL_NETWORK);
 
-    if (shared.socket_id_target < 0) {
-      printf("ERROR: failed to initiailize the port '%u' using protocol '%u': error %i (%u).'\n", shared.parameter_port, SOCKET_PROTOCOL, shared.socket_id_target, errno);
-      MACRO_EXIT_STANDARD_1(shared, stack, -1);
+    if (shared.listeners[LISTENER_NETWORK].socket_id_target < 0) {
+      printf("ERROR: failed to initiailize the port '%u' using protocol '%u': error %i (%u).'\n", shared.parameter_port, SOCKET_PROTOCOL_NETWORK, shared.listeners[LISTENER_NETWORK].socket_id_target, errno);
+      shared.listeners[LISTENER_NETWORK].socket_id_target = 0;
+      MACRO_EXIT_STANDARD_1(shared, -1);
     }
-  #elif defined USE_SOCKET
+  }
+
+  if (shared.listeners[LISTENER_SOCKET].enabled) {
     {
       int socket_path_length = SOCKET_PATH_LENGTH + 1;
       socket_path_length += strnlen(shared.parameter_system, PARAMETER_LENGTH_MAX);
@@ -1382,7 +9108,7 @@ int main(int argc, char *argv[]) {
       shared.socket_path = malloc(socket_path_length);
       if (shared.socket_path == NULL) {
         printf("ERROR: failed to allocate enough memory for the socket path string.\n");
-        MACRO_EXIT_STANDARD_1(shared, stack, -1);
+        MACRO_EXIT_STANDARD_1(shared, -1);
       }
 
       memset(shared.socket_path, 0, socket_path_length);
@@ -1396,22 +9122,24 @@ int main(int argc, char *argv[]) {
       if (stat(shared.socket_path, &file_stat) >= 0) {
         printf("ERROR: failed to initiailize the socket '%s' because a file already exists at that path, exiting.\n", shared.socket_path);
 
+        // do not attempt to unlink the path, so manually free and reset before MACRO_EXIT_STANDARD_1() is called.
         if (shared.socket_path != NULL) {
           free(shared.socket_path);
           shared.socket_path = NULL;
         }
 
-        MACRO_EXIT_STANDARD_1(shared, stack, -1);
+        MACRO_EXIT_STANDARD_1(shared, -1);
       }
     }
 
-    shared.socket_id_target = socket(SOCKET_FAMILY, SOCKET_TYPE, SOCKET_PROTOCOL);
+    shared.listeners[LISTENER_SOCKET].socket_id_target = socket(SOCKET_FAMILY_SOCKET, SOCKET_TYPE, SOCKET_PROTOCOL_SOCKET);
 
-    if (shared.socket_id_target < 0) {
-      printf("ERROR: failed to initiailize the socket '%s' using protocol '%u', 'socket id = '%i, exiting.'\n", shared.socket_path, SOCKET_PROTOCOL, shared.socket_id_target);
-      MACRO_EXIT_STANDARD_1(shared, stack, -1);
+    if (shared.listeners[LISTENER_SOCKET].socket_id_target < 0) {
+      printf("ERROR: failed to initiailize the socket '%s' using protocol '%u', 'socket id = '%i, exiting.'\n", shared.socket_path, SOCKET_PROTOCOL_SOCKET, shared.listeners[LISTENER_SOCKET].socket_id_target);
+      shared.listeners[LISTENER_SOCKET].socket_id_target = 0;
+      MACRO_EXIT_STANDARD_1(shared, -1);
     }
-  #endif // USE_SOCKET
+  }
 
 
   // now run the process in the background before cloning and before blocking for signals.
@@ -1424,25 +9152,16 @@ int main(int argc, char *argv[]) {
 
     if (daemonized < 0) {
       printf("ERROR: failed to daemonize, error: %i.\n", errno);
-      MACRO_EXIT_STANDARD_1(shared, stack, -1);
+      MACRO_EXIT_STANDARD_1(shared, -1);
     }
   }
 
 
-  // The stack must be malloced after the process has daemonized because daemon() calls fork().
-  stack = malloc(STACK_SIZE);
-  if (stack == NULL) {
-    log_write(LOG_ERR, "ERROR: failed to allocate the stack for cloning, error: %i.\n", errno);
-    MACRO_EXIT_STANDARD_1(shared, stack, -1);
-  }
-  memset(stack, 0, sizeof(char) * STACK_SIZE);
-
-
   // create the pid file or fail if one already exists.
   shared.pid_parent = getpid();
   if (snprintf(shared.pid_path, sizeof(char) * PATH_MAX, PATH_PID, shared.parameter_system) < 0) {
     log_write(LOG_ERR, "ERROR: failed to setup the pid string '%s' using system name '%s', this pid: %u.'\n", PATH_PID, shared.parameter_system, shared.pid_parent);
-    MACRO_EXIT_STANDARD_1(shared, stack, -1);
+    MACRO_EXIT_STANDARD_1(shared, -1);
   }
 
   {
@@ -1452,14 +9171,14 @@ int main(int argc, char *argv[]) {
     if (pid_file <= 0) {
       log_write(LOG_ERR, "ERROR: failed to create pid file '%s', this pid: %u.'\n", shared.pid_path, shared.pid_parent);
       pid_file = NULL;
-      MACRO_EXIT_STANDARD_1(shared, stack, -1);
+      MACRO_EXIT_STANDARD_1(shared, -1);
     }
 
     if (fprintf(pid_file, "%u\n", shared.pid_parent) < 0) {
       log_write(LOG_ERR, "ERROR: failed to create pid file '%s', this pid: %u.'\n", shared.pid_path, shared.pid_parent);
       fclose(pid_file);
       pid_file = NULL;
-      MACRO_EXIT_STANDARD_1(shared, stack, -1);
+      MACRO_EXIT_STANDARD_1(shared, -1);
     }
 
     fclose(pid_file);
@@ -1467,13 +9186,6 @@ int main(int argc, char *argv[]) {
   }
 
 
-  pid_t pid_child = clone(handler_child, stack + STACK_SIZE, FLAGS_CLONE, &shared);
-
-  if (pid_child < 0) {
-    log_write(LOG_ERR, "ERROR: failed to clone the process, error: %i.\n", errno);
-    MACRO_EXIT_STANDARD_1(shared, stack, -1);
-  }
-
   // signal blocking is used to help the program safely quit on interrupt.
   sigset_t signal_mask;
   siginfo_t signal_information_parent;
@@ -1500,9 +9212,196 @@ int main(int argc, char *argv[]) {
   sigaddset(&signal_mask, SIGPWR);
   sigaddset(&signal_mask, SIGXCPU);
   sigaddset(&signal_mask, SIGCHLD);
+  sigaddset(&signal_mask, SIGNAL_STATISTICS);
+  sigaddset(&signal_mask, SIGNAL_TRACE);
 
   sigprocmask(SIG_BLOCK, &signal_mask, NULL);
 
+  // each enabled listener gets its own thread so that both can accept connections at the same time.
+  // the breaker, mirror, cache, and worker threads are started first so that they are ready before any request is accepted.
+  // the signals are blocked before this so that the threads inherit the blocked signal mask.
+  {
+    pthread_attr_t thread_attributes;
+    int listener_index = 0;
+
+    pthread_attr_init(&thread_attributes);
+    pthread_attr_setstacksize(&thread_attributes, STACK_SIZE);
+
+    // the capture is created before the breaker thread, which flushes it every CAPTURE_FLUSH.
+    shared.capture.file = -1;
+
+    if (shared.capture.mode != CAPTURE_NONE) {
+      char path[PATH_MAX];
+
+      if (snprintf(path, PATH_MAX, PATH_CAPTURE, shared.parameter_system) >= PATH_MAX || capture_initialize(&shared.capture, path) < 0) {
+        log_write(LOG_ERR, "ERROR: failed to create the capture '%s' using system name '%s'.\n", PATH_CAPTURE, shared.parameter_system);
+        pthread_attr_destroy(&thread_attributes);
+        MACRO_EXIT_STANDARD_2(shared, -1);
+      }
+    }
+
+    // the breaker thread probes the ldap servers and the database while their circuits are open, and checks their health every interval.
+    {
+      int created = pthread_create(&shared.breaker_thread, &thread_attributes, handler_breaker, &shared);
+
+      if (created != 0) {
+        log_write(LOG_ERR, "ERROR: failed to create the breaker thread, error: %i.\n", created);
+        pthread_attr_destroy(&thread_attributes);
+        MACRO_EXIT_STANDARD_2(shared, -1);
+      }
+    }
+
+    // the mirror is loaded in the background, ldap is queried directly until the mirror is synced.
+    if (shared.mirror.enabled) {
+      int created = 0;
+
+      pthread_mutex_init(&shared.mirror.lock, NULL);
+
+      created = pthread_create(&shared.mirror.thread, &thread_attributes, handler_mirror, &shared);
+
+      if (created != 0) {
+        log_write(LOG_ERR, "ERROR: failed to create the mirror thread, error: %i.\n", created);
+        pthread_attr_destroy(&thread_attributes);
+        MACRO_EXIT_STANDARD_2(shared, -1);
+      }
+    }
+
+    // the cache thread evicts cached members that have been revoked in the database and writes the cache snapshot.
+    // the table is published from the cache, so it requires the cache.
+    if (shared.cache.publish && shared.cache.ttl == 0) {
+      log_write(LOG_INFO, "INFO: the table is not published because the cache is disabled.\n");
+    }
+
+    if (shared.cache.ttl > 0) {
+      pthread_mutex_init(&shared.cache.lock, NULL);
+
+      if (shared.cache.snapshot > 0) {
+        shared.cache.snapshot_path = malloc(sizeof(char) * PATH_MAX);
+
+        if (shared.cache.snapshot_path == NULL || snprintf(shared.cache.snapshot_path, sizeof(char) * PATH_MAX, PATH_CACHE, shared.parameter_system) < 0) {
+          log_write(LOG_ERR, "ERROR: failed to setup the cache snapshot path '%s' using system name '%s'.\n", PATH_CACHE, shared.parameter_system);
+          pthread_attr_destroy(&thread_attributes);
+          MACRO_EXIT_STANDARD_2(shared, -1);
+        }
+      }
+
+      if (cache_initialize(&shared.cache, shared.parameter_group, shared.parameter_database) < 0) {
+        log_write(LOG_ERR, "ERROR: failed to allocate memory for the cache.\n");
+        pthread_attr_destroy(&thread_attributes);
+        MACRO_EXIT_STANDARD_2(shared, -1);
+      }
+
+      if (shared.cache.publish) {
+        char path[PATH_MAX];
+
+        if (snprintf(path, PATH_MAX, PATH_TABLE, shared.parameter_system) >= PATH_MAX || table_initialize(&shared.cache, path, shared.parameter_system, shared.parameter_group, shared.parameter_database) < 0) {
+          log_write(LOG_ERR, "ERROR: failed to publish the table '%s' using system name '%s'.\n", PATH_TABLE, shared.parameter_system);
+          pthread_attr_destroy(&thread_attributes);
+          MACRO_EXIT_STANDARD_2(shared, -1);
+        }
+      }
+
+      if (shared.cache.coherence > 0 || shared.cache.snapshot > 0) {
+        int created = pthread_create(&shared.cache.thread, &thread_attributes, handler_cache, &shared);
+
+        if (created != 0) {
+          log_write(LOG_ERR, "ERROR: failed to create the cache thread, error: %i.\n", created);
+          pthread_attr_destroy(&thread_attributes);
+          MACRO_EXIT_STANDARD_2(shared, -1);
+        }
+      }
+    }
+
+    // the ticket thread responds to the polls that wait for the result of an asynchronous request.
+    {
+      int created = 0;
+
+      if (ticket_initialize(&shared.tickets) < 0) {
+        pthread_attr_destroy(&thread_attributes);
+        MACRO_EXIT_STANDARD_2(shared, -1);
+      }
+
+      created = pthread_create(&shared.tickets.thread, &thread_attributes, handler_ticket, &shared);
+
+      if (created != 0) {
+        log_write(LOG_ERR, "ERROR: failed to create the ticket thread, error: %i.\n", created);
+        pthread_attr_destroy(&thread_attributes);
+        MACRO_EXIT_STANDARD_2(shared, -1);
+      }
+    }
+
+    // the workers process the requests queued by the listeners.
+    if (limiter_initialize(&shared.limiter_database) < 0) {
+      pthread_attr_destroy(&thread_attributes);
+      MACRO_EXIT_STANDARD_2(shared, -1);
+    }
+
+    if (scheduler_initialize(&shared.scheduler, &shared) < 0 || scheduler_resize(&shared.scheduler, shared.scheduler.workers) < 0) {
+      pthread_attr_destroy(&thread_attributes);
+      MACRO_EXIT_STANDARD_2(shared, -1);
+    }
+
+    // the keepalive thread receives the next requests on the connections kept open by the clients, and then queues them as the listeners do.
+    if (shared.keepalive.limit > 0) {
+      int created = 0;
+
+      if (keepalive_initialize(&shared.keepalive) < 0) {
+        pthread_attr_destroy(&thread_attributes);
+        MACRO_EXIT_STANDARD_2(shared, -1);
+      }
+
+      created = pthread_create(&shared.keepalive.thread, &thread_attributes, handler_keepalive, &shared);
+
+      if (created != 0) {
+        log_write(LOG_ERR, "ERROR: failed to create the keepalive thread, error: %i.\n", created);
+        pthread_attr_destroy(&thread_attributes);
+        MACRO_EXIT_STANDARD_2(shared, -1);
+      }
+    }
+
+    // the control thread performs the admin commands, such as resizing the workers, without a restart.
+    if (shared.control.enabled) {
+      int created = 0;
+
+      shared.control.path = malloc(sizeof(char) * PATH_MAX);
+
+      if (shared.control.path == NULL || snprintf(shared.control.path, sizeof(char) * PATH_MAX, PATH_CONTROL, shared.parameter_system) >= PATH_MAX) {
+        log_write(LOG_ERR, "ERROR: failed to setup the control socket path '%s' using system name '%s'.\n", PATH_CONTROL, shared.parameter_system);
+        pthread_attr_destroy(&thread_attributes);
+        MACRO_EXIT_STANDARD_2(shared, -1);
+      }
+
+      if (control_initialize(&shared.control) < 0) {
+        pthread_attr_destroy(&thread_attributes);
+        MACRO_EXIT_STANDARD_2(shared, -1);
+      }
+
+      created = pthread_create(&shared.control.thread, &thread_attributes, handler_control, &shared);
+
+      if (created != 0) {
+        log_write(LOG_ERR, "ERROR: failed to create the control thread, error: %i.\n", created);
+        pthread_attr_destroy(&thread_attributes);
+        MACRO_EXIT_STANDARD_2(shared, -1);
+      }
+    }
+
+    for (; listener_index < LISTENER_TOTAL; listener_index++) {
+      if (!shared.listeners[listener_index].enabled) {
+        continue;
+      }
+
+      int created = pthread_create(&shared.listeners[listener_index].thread, &thread_attributes, handler_child, &shared.listeners[listener_index]);
+
+      if (created != 0) {
+        log_write(LOG_ERR, "ERROR: failed to create the listener thread, error: %i.\n", created);
+        pthread_attr_destroy(&thread_attributes);
+        MACRO_EXIT_STANDARD_2(shared, -1);
+      }
+    }
+
+    pthread_attr_destroy(&thread_attributes);
+  }
+
   // sit and wait for signals.
   while(1) {
     signal_result = sigwaitinfo(&signal_mask, &signal_information_parent);
@@ -1518,7 +9417,7 @@ int main(int argc, char *argv[]) {
         signal_problem_count++;
         if (signal_problem_count > PROBLEM_COUNT_MAX_SIGNAL_SIZE) {
           log_write(LOG_ERR, "ERROR: max signal problem count has been reached, exiting.\n");
-          MACRO_EXIT_STANDARD_2(pid_child, shared, stack, -1);
+          MACRO_EXIT_STANDARD_2(shared, -1);
         }
 
         continue;
@@ -1531,22 +9430,29 @@ int main(int argc, char *argv[]) {
       // do nothing.
     }
     else if (signal_information_parent.si_signo == SIGINT || signal_information_parent.si_signo == SIGQUIT || signal_information_parent.si_signo == SIGTERM) {
-      MACRO_EXIT_STANDARD_2(pid_child, shared, stack, 0);
+      MACRO_EXIT_STANDARD_2(shared, 0);
     }
     else if (signal_information_parent.si_signo == SIGSEGV || signal_information_parent.si_signo == SIGBUS || signal_information_parent.si_signo == SIGILL || signal_information_parent.si_signo == SIGFPE) {
-      MACRO_EXIT_STANDARD_2(pid_child, shared, stack, 0);
+      MACRO_EXIT_STANDARD_2(shared, 0);
     }
     else if (signal_information_parent.si_signo == SIGABRT || signal_information_parent.si_signo == SIGIOT || signal_information_parent.si_signo == SIGPWR || signal_information_parent.si_signo == SIGXCPU) {
-      MACRO_EXIT_STANDARD_2(pid_child, shared, stack, 0);
+      MACRO_EXIT_STANDARD_2(shared, 0);
     }
     else if (signal_information_parent.si_signo == SIGCHLD) {
       // do nothing
     }
+    else if (signal_information_parent.si_signo == SIGNAL_STATISTICS) {
+      statistics_report(&shared);
+    }
+    else if (signal_information_parent.si_signo == SIGNAL_TRACE) {
+      trace_dump(&shared);
+    }
 
     memset(&signal_information_parent, 0, sizeof(siginfo_t));
     continue;
   }
 
   // failsafe, but should not get here.
-  MACRO_EXIT_STANDARD_2(pid_child, shared, stack, 0);
+  MACRO_EXIT_STANDARD_2(shared, 0);
 }
+#endif // MAIN_DISABLED
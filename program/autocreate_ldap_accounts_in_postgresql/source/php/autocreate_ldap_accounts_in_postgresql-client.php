@@ -1,5 +1,6 @@
 <?php
   // This is an example client script for talking to the service.
+  // Applications should instead use c_base_autocreate from common/base/classes/base_autocreate.php, which keeps the connection open between requests.
 
   error_reporting(E_ALL);
 
@@ -19,6 +20,172 @@
 
   $packet_size_target = 63;
   $packet_size_client = 1;
+  $packet_size_ticket = 4;
+
+  // set to TRUE for background provisioning (such as an import script) so that interactive logins are processed first.
+  $bulk = FALSE;
+
+  // set to the milliseconds this caller is willing to wait (at most 65535) so that the daemon drops the request once the caller has given up.
+  $deadline = 0;
+
+  // set to TRUE to only queue the request, the response is then followed by a ticket that is polled right before the role is first needed.
+  // the poll waits at most $async_wait milliseconds for the result.
+  $async = FALSE;
+  $async_wait = 2000;
+
+  // set to TRUE to only check the health of the service (such as for a load balancer), without sending a name.
+  $ping = FALSE;
+
+  // when the service publishes its table (alap_table), names found in it are already provisioned and need no request.
+  $table_path = "/dev/shm/autocreate_ldap_accounts_in_postgresql/example.table";
+
+
+  /**
+   * Looks up a name in the table published by the service.
+   *
+   * @param string $table_path
+   *   The path to the table file.
+   * @param string $name
+   *   The user name to look up.
+   *
+   * @return bool
+   *   TRUE when the name is provisioned, FALSE when it is not found or the table cannot be read (send the request instead).
+   */
+  function alap_table_find($table_path, $name) {
+    $table = @fopen($table_path, 'rb');
+    if ($table === FALSE) {
+      return FALSE;
+    }
+
+    // each read must come from the file and not from a stream buffer, or the sequence checks are meaningless.
+    stream_set_read_buffer($table, 0);
+
+    $header = fread($table, 24);
+    if (!is_string($header) || strlen($header) < 24 || substr($header, 0, 8) !== 'alaptabl') {
+      fclose($table);
+      return FALSE;
+    }
+
+    $header = unpack('Vversion/Ventry_size/Vslots/Vsequence', substr($header, 8));
+    if ($header['version'] != 1 || $header['entry_size'] != 80 || $header['slots'] == 0) {
+      fclose($table);
+      return FALSE;
+    }
+
+    $name = strtolower($name);
+    $name_length = strlen($name);
+
+    // the 32-bit FNV-1a hash, as used by the service.
+    $hash = 2166136261;
+    for ($i = 0; $i < $name_length; $i++) {
+      $hash = (($hash ^ ord($name[$i])) * 16777619) & 0xffffffff;
+    }
+
+    for ($tries = 0; $tries < 3; $tries++) {
+      fseek($table, 20);
+      $sequence = unpack('V', fread($table, 4))[1];
+
+      if ($sequence % 2 == 1) {
+        usleep(100);
+        continue;
+      }
+
+      $found = FALSE;
+      $slot = $hash & ($header['slots'] - 1);
+
+      for ($probes = 0; $probes < $header['slots']; $probes++) {
+        fseek($table, 320 + $slot * 80);
+        $entry = fread($table, 80);
+        if (!is_string($entry) || strlen($entry) < 80) {
+          break;
+        }
+
+        $entry_values = unpack('qexpires/Vlength', $entry);
+        if ($entry_values['length'] == 0) {
+          break;
+        }
+
+        if ($entry_values['length'] == $name_length && substr($entry, 16, $name_length) === $name) {
+          $found = $entry_values['expires'] > time();
+          break;
+        }
+
+        $slot = ($slot + 1) & ($header['slots'] - 1);
+      }
+
+      fseek($table, 20);
+      if (unpack('V', fread($table, 4))[1] == $sequence) {
+        fclose($table);
+        return $found;
+      }
+    }
+
+    fclose($table);
+    return FALSE;
+  }
+
+
+  /**
+   * Checks the health of the service with a ping, which no ldap search or database statement is made for.
+   *
+   * @param string $socket_path
+   *   The socket file or the host name.
+   * @param int $socket_family
+   *   AF_UNIX or AF_INET.
+   * @param int $socket_port
+   *   The port, 0 for a socket file.
+   * @param int $socket_protocol
+   *   The socket protocol.
+   *
+   * @return array|bool
+   *   The status (0 = ready, 14 = degraded, 15 = not ready) and the health flags, or FALSE when the service did not answer (not live).
+   *   The health flags are: 0x01 = some ldap servers are failing, 0x02 = every ldap server is failing, 0x04 = the database is failing, 0x08 = paused, 0x10 = every request is in use, 0x20 = not probed yet.
+   */
+  function alap_ping($socket_path, $socket_family, $socket_port, $socket_protocol) {
+    $socket = socket_create($socket_family, SOCK_STREAM, $socket_protocol);
+    if ($socket === FALSE) {
+      return FALSE;
+    }
+
+    if (socket_connect($socket, $socket_path, $socket_port) === FALSE) {
+      socket_close($socket);
+      return FALSE;
+    }
+
+    // the ping flag 0x10, no name follows.
+    socket_write($socket, pack('Cx62', 0x80 | 0x10), 63);
+
+    $response = socket_read($socket, 2);
+    socket_close($socket);
+
+    if (!is_string($response) || strlen($response) < 2) {
+      return FALSE;
+    }
+
+    return unpack('Cstatus/Cflags', $response);
+  }
+
+
+  if ($ping) {
+    $health = alap_ping($socket_path, $socket_family, $socket_port, $socket_protocol);
+
+    if ($health === FALSE) {
+      print("The service is not live.\n");
+    }
+    else {
+      print("The service replied to the ping with = " . $health['status'] . ", flags = " . sprintf('0x%02x', $health['flags']) . "\n");
+    }
+
+    return;
+  }
+
+
+  $test_name = 'example';
+
+  if (alap_table_find($table_path, $test_name)) {
+    print("The name '$test_name' is already provisioned according to the table, no request is needed.\n");
+    return;
+  }
 
 
   // open a client socket.
@@ -41,16 +208,40 @@
 
 
   // build packet for requesting that the user 'example' should be created.
-  $test_name = 'example';
   $test_name_length = strlen($test_name);
-  $test_name_difference = $packet_size_target - $test_name_length;
+
+  // the optional header byte (0x80 with the bulk flag 0x01, the deadline flag 0x02, and the async flag 0x04) is part of the $packet_size_target bytes.
+  // with the deadline flag, the header is followed by the budget in milliseconds as a 16-bit big endian integer.
+  $test_header = '';
+  $test_flags = 0;
+  if ($bulk) {
+    $test_flags |= 0x01;
+  }
+
+  if ($deadline > 0) {
+    $test_flags |= 0x02;
+  }
+
+  if ($async) {
+    $test_flags |= 0x04;
+  }
+
+  if ($test_flags > 0) {
+    $test_header = chr(0x80 | $test_flags);
+
+    if ($deadline > 0) {
+      $test_header .= pack('n', min($deadline, 65535));
+    }
+  }
+
+  $test_name_difference = $packet_size_target - strlen($test_header) - $test_name_length;
 
   if ($test_name_difference > 0) {
     // the packet expects a packet to be NULL terminated or at most $packet_size_target.
-    $test_packet = pack('a' . $test_name_length . 'x' . $test_name_difference, $test_name);
+    $test_packet = $test_header . pack('a' . $test_name_length . 'x' . $test_name_difference, $test_name);
   }
   else {
-    $test_packet = pack('a' . $test_name_length, $test_name);
+    $test_packet = $test_header . pack('a' . $test_name_length, $test_name);
   }
 
   print("Packet looks like: '$test_packet'\n");
@@ -69,7 +260,8 @@
 
 
   // read the return result from the target socket.
-  $response = socket_read($socket, $packet_size_client);
+  // an asynchronous request is answered with the status followed by the ticket.
+  $response = socket_read($socket, $async ? $packet_size_client + $packet_size_ticket : $packet_size_client);
 
   if (!is_string($response) || strlen($response) == 0) {
     print("Something went wrong with socket_read() and did not get a valid return from the socket.\n");
@@ -83,6 +275,35 @@
 
   print("Target Socket Replied with = " . print_r($response_value, TRUE) . "\n");
 
+  if ($async && $response_value == 0 && strlen($response) == $packet_size_client + $packet_size_ticket) {
+    $ticket = unpack('N', substr($response, $packet_size_client))[1];
+    print("The request is queued with the ticket $ticket.\n");
+    socket_close($socket);
+
+    // ... the page is generated here, until the role is first needed ...
+
+    // poll the ticket (flag 0x08), waiting (flag 0x02) for the result, the name must be the same as the name in the request.
+    $socket = socket_create($socket_family, $socket_type, $socket_protocol);
+    if ($socket === FALSE || socket_connect($socket, $socket_path, $socket_port) === FALSE) {
+      print("Something went wrong when connecting to poll the ticket.\n");
+      return;
+    }
+
+    $poll_header = chr(0x80 | 0x08 | 0x02) . pack('nN', min($async_wait, 65535), $ticket);
+    $poll_packet = $poll_header . pack('a' . ($packet_size_target - strlen($poll_header)), $test_name);
+    socket_write($socket, $poll_packet, $packet_size_target);
+
+    $response = socket_read($socket, $packet_size_client);
+    if (!is_string($response) || strlen($response) == 0) {
+      print("Something went wrong with socket_read() when polling the ticket.\n");
+      socket_close($socket);
+      return;
+    }
+
+    $response_value = (int) unpack('C', $response)[1];
+    print("The ticket $ticket Replied with = " . print_r($response_value, TRUE) . "\n");
+  }
+
   // response codes as defined in the c source file:
   //    0 = no problems detected.
   //    1 = invalid user name, bad characters, or name too long.
@@ -93,9 +314,13 @@
   //    6 = error occured while reading input from the user (such as via recv()).
   //    7 = error occured while writing input from the user (such as via send()).
   //    8 = the received packet is invalid, such as wrong length.
-  //   10 = connection timed out when reading or writing.
-  //   11 = the connection is being forced closed.
-  //   12 = the connection is closing because the service is quitting.
+  //    9 = connection timed out when reading or writing, or the deadline passed.
+  //   10 = the connection is being forced closed.
+  //   11 = the connection is closing because the service is quitting.
+  //   12 = the asynchronous request of the ticket is still being processed (poll again later).
+  //   13 = the ticket is unknown, such as when it is too old or was issued for another name.
+  //   14 = (ping) the service is ready, but ldap or the database is failing.
+  //   15 = (ping) the service is live, but not ready for requests.
 
 
   socket_close($socket);
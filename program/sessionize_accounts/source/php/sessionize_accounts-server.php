@@ -16,6 +16,15 @@
  *
  * This packet uses json to transmit data to and from the program.
  *
+ * A connection that starts with a json packet is closed after the response (limited to PACKET_MAX_LENGTH).
+ * A connection that starts with a frame is instead kept open and may send any number of frames, each answered by a frame in the same encoding.
+ * A frame is a 1 byte encoding, the length of the packet as a 4 byte big endian integer, and then the packet (at most FRAME_MAX_LENGTH).
+ *   The encodings are:
+ *   - FRAME_JSON (0x01): the packet is a json string.
+ *   - FRAME_BINARY (0x02): the packet is a binary encoded array (see binary_encode()), which avoids the json encoding and decoding.
+ *   A client can tell that a server does not support frames when the response starts with '{', the server then also closes the connection.
+ *   A kept connection is closed once idle for SOCKET_IDLE_TIMEOUT seconds or when SOCKET_CLIENTS_MAX connections are open, and the client then connects again.
+ *
  *   A response packet will contain a json string that stores an array with the following keys:
  *     error:  FALSE on no error, an array containing error details on error.
  *     result: An array is returned for valid save requests.
@@ -74,8 +83,27 @@ define('SESSION_RANDOM_BYTES', 512);
 define('SOCKET_BACKLOG', 1024);
 define('SOCKET_TIMEOUT_SECONDS', 0);
 define('SOCKET_TIMEOUT_MICROSECONDS', 40000); // 0.04 seconds.
+define('SOCKET_SEND_TIMEOUT_SECONDS', 0);
+define('SOCKET_SEND_TIMEOUT_MICROSECONDS', 200000); // 0.2 seconds, every other client waits while a write blocks.
 define('PACKET_MAX_LENGTH', 4096);
 
+define('SOCKET_IDLE_TIMEOUT', 300); // seconds a kept connection may be idle before it is closed.
+define('SOCKET_CLIENTS_MAX', 512); // the open connections, socket_select() cannot wait on more than 1024 sockets.
+
+define('FRAME_HEADER_LENGTH', 5);
+define('FRAME_MAX_LENGTH', 65536);
+define('FRAME_JSON', 0x01);
+define('FRAME_BINARY', 0x02);
+
+define('BINARY_NULL', 0x00);
+define('BINARY_FALSE', 0x01);
+define('BINARY_TRUE', 0x02);
+define('BINARY_INT', 0x03);
+define('BINARY_FLOAT', 0x04);
+define('BINARY_STRING', 0x05);
+define('BINARY_ARRAY', 0x06);
+define('BINARY_DEPTH_MAX', 32);
+
 define('INTERVAL_TIMEOUT_HARD_EXPIRE', 172800); // 48 hours.
 define('INTERVAL_TIMEOUT_HARD_MAX', 1382400); // 16 days.
 
@@ -184,455 +212,688 @@ function main($argc, $argv) {
 
 
   // listening for connections indefinetely.
-  do {
-    $client_socket = socket_accept($socket);
-    if ($client_socket === FALSE) {
-      print("socket_accept() failed: reason: " . socket_strerror(socket_last_error($socket)) . "\n");
+  // each client is an array of the socket, the bytes received but not yet processed, the frame encoding (NULL until the first packet), and when it was last active.
+  $clients = array();
 
-      unset($client_socket);
-      continue;
+  do {
+    $read = array($socket);
+    foreach ($clients as $client) {
+      $read[] = $client['socket'];
     }
+    unset($client);
 
-    socket_set_option($client_socket, SOL_SOCKET, SO_RCVTIMEO, array('sec' => SOCKET_TIMEOUT_SECONDS, 'usec' => SOCKET_TIMEOUT_MICROSECONDS));
-
-    $response = array(
-      'error' => FALSE,
-      'result' => FALSE,
-    );
-
-    $encoded_packet = socket_read($client_socket, PACKET_MAX_LENGTH);
+    $write = NULL;
+    $except = NULL;
 
-    if ($encoded_packet === FALSE) {
-      print("socket_read() failed: reason: " . socket_strerror(socket_last_error($client_socket)) . "\n");
+    $selected = socket_select($read, $write, $except, SOCKET_IDLE_TIMEOUT);
+    if ($selected === FALSE) {
+      print("socket_select() failed: reason: " . socket_strerror(socket_last_error()) . "\n");
 
-      socket_close($client_socket);
-      unset($client_socket);
-      unset($encoded_packet);
+      unset($selected);
+      unset($read);
       continue;
     }
+    unset($selected);
 
-    if (!is_string($encoded_packet)) {
-      $response['error'] = array(
-        'target' => 'encoded_packet',
-        'message' => "No valid encoded packet was specified. It must be a valid json string.",
-      );
+    $now = time();
 
-      socket_write($client_socket, json_encode($response));
-      unset($response);
-      unset($encoded_packet);
+    foreach ($read as $ready) {
+      if ($ready === $socket) {
+        $client_socket = socket_accept($socket);
+        if ($client_socket === FALSE) {
+          print("socket_accept() failed: reason: " . socket_strerror(socket_last_error($socket)) . "\n");
 
-      socket_close($client_socket);
-      unset($client_socket);
-      continue;
-    }
+          unset($client_socket);
+          continue;
+        }
 
-    $decoded_packet = json_decode($encoded_packet, TRUE);
+        // make room by closing the connection that has been idle the longest.
+        if (count($clients) >= SOCKET_CLIENTS_MAX) {
+          $oldest = NULL;
+          foreach ($clients as $key => $client) {
+            if (is_null($oldest) || $client['active'] < $clients[$oldest]['active']) {
+              $oldest = $key;
+            }
+          }
+          unset($key);
+          unset($client);
 
-    if (!is_array($decoded_packet) || empty($decoded_packet)) {
-      $response['error'] = array(
-        'target' => 'decoded_packet',
-        'message' => "No valid decoded packet was specified. It must be a valid, non-empty, array.",
-      );
+          socket_close($clients[$oldest]['socket']);
+          unset($clients[$oldest]);
+          unset($oldest);
+        }
 
-      socket_write($client_socket, json_encode($response));
-      unset($response);
-      unset($encoded_packet);
+        socket_set_option($client_socket, SOL_SOCKET, SO_RCVTIMEO, array('sec' => SOCKET_TIMEOUT_SECONDS, 'usec' => SOCKET_TIMEOUT_MICROSECONDS));
 
-      socket_close($client_socket);
-      unset($client_socket);
-      continue;
-    }
+        // a kept client that stops reading its responses would otherwise block the server once the send buffer is full.
+        socket_set_option($client_socket, SOL_SOCKET, SO_SNDTIMEO, array('sec' => SOCKET_SEND_TIMEOUT_SECONDS, 'usec' => SOCKET_SEND_TIMEOUT_MICROSECONDS));
 
-    // support manually sending custom packets to periodically flush expired sessions (usefull for cron jobs).
-    if (array_key_exists('flush', $decoded_packet)) {
-      if (isset($decoded_packet['flush']) !== TRUE) {
-        $not_found_error = array(
-          'target' => 'decoded_packet[flush]',
-          'message' => "Invalid flush value provided.",
+        $clients[] = array(
+          'socket' => $client_socket,
+          'buffer' => '',
+          'encoding' => NULL,
+          'active' => $now,
         );
 
-        socket_write($client_socket, json_encode($response));
-        unset($response);
-        unset($encoded_packet);
-
-        socket_close($client_socket);
         unset($client_socket);
         continue;
       }
 
-      if (count($decoded_packet) > 1) {
-        $not_found_error = array(
-          'target' => 'decoded_packet[*]',
-          'message' => "Too many values provided, only the flush parameter is allowed.",
-        );
-
-        socket_write($client_socket, json_encode($response));
-        unset($response);
-        unset($encoded_packet);
+      // the client may have been closed to make room for a new connection.
+      $key = NULL;
+      foreach ($clients as $client_key => $client) {
+        if ($client['socket'] === $ready) {
+          $key = $client_key;
+          break;
+        }
+      }
+      unset($client_key);
+      unset($client);
 
-        socket_close($client_socket);
-        unset($client_socket);
+      if (is_null($key)) {
         continue;
       }
 
-      $response['result'] = process_expired_sessions($database, $timeouts, $cleartext);
-      if ($response['result'] === FALSE) {
-        $response['error'] = array(
-          'target' => 'failure',
-          'message' => "Failed to flush the expired sessions.",
-        );
+      if (!process_client($clients[$key], $database, $timeouts, $cleartext, $now)) {
+        socket_close($clients[$key]['socket']);
+        unset($clients[$key]);
       }
+      unset($key);
+    }
+    unset($ready);
+    unset($read);
 
-      socket_write($client_socket, json_encode($response));
-      unset($response);
-      unset($encoded_packet);
-
-      socket_close($client_socket);
-      unset($client_socket);
-      continue;
+    foreach ($clients as $key => $client) {
+      if ($now - $client['active'] > SOCKET_IDLE_TIMEOUT) {
+        socket_close($client['socket']);
+        unset($clients[$key]);
+      }
     }
+    unset($key);
+    unset($client);
+    unset($now);
+  } while (TRUE);
 
-    if (!isset($decoded_packet['ip']) || !is_string($decoded_packet['ip']) || strlen($decoded_packet['ip']) == 0 || ip2long($decoded_packet['ip']) === FALSE) {
-      $response['error'] = array(
-        'target' => 'decoded_packet[ip]',
-        'message' => "No valid ip address was specified. A valid, non-empty, ip address string must be provided.",
-      );
+  socket_close($socket);
+  unlink($socket_path);
+  unlink($pid_path);
+  return TRUE;
+}
 
-      socket_write($client_socket, json_encode($response));
-      unset($response);
+/**
+ * Reads from a client connection that is ready and responds to each packet received.
+ *
+ * @param array $client
+ *   The client, as defined in main().
+ * @param array $database
+ *   An array of all usernames, ips, passwords, and sessions.
+ * @param array $timeouts
+ *   An array of all timeouts keyed in numeric order.
+ * @param string $cleartext
+ *  Used as an unproven attempt to clear passwords from memory before delete in hopes to avoid security issues inherit in a garbage collector.
+ * @param int $now
+ *   The current unix timestamp.
+ *
+ * @return bool
+ *   TRUE when the connection is kept open, FALSE when it must be closed.
+ */
+function process_client(&$client, &$database, &$timeouts, $cleartext, $now) {
+  $encoded_packet = socket_read($client['socket'], PACKET_MAX_LENGTH);
+
+  if ($encoded_packet === FALSE) {
+    print("socket_read() failed: reason: " . socket_strerror(socket_last_error($client['socket'])) . "\n");
+
+    unset($encoded_packet);
+    return FALSE;
+  }
+
+  // the client closed the connection.
+  if (strlen($encoded_packet) == 0) {
+    unset($encoded_packet);
+    return FALSE;
+  }
+
+  $client['active'] = $now;
+
+  // a connection that does not start with a frame sends a single json packet and is then closed.
+  if (is_null($client['encoding'])) {
+    $encoding = ord($encoded_packet[0]);
+
+    if ($encoding != FRAME_JSON && $encoding != FRAME_BINARY) {
+      unset($encoding);
+
+      $decoded_packet = json_decode($encoded_packet, TRUE);
       unset($encoded_packet);
 
-      socket_close($client_socket);
-      unset($client_socket);
-      continue;
+      socket_write($client['socket'], json_encode(process_request($database, $timeouts, $cleartext, $decoded_packet)));
+      unset($decoded_packet);
+
+      return FALSE;
     }
 
+    $client['encoding'] = $encoding;
+    unset($encoding);
+  }
 
-    // support closing sessions before they expire.
-    if (array_key_exists('close', $decoded_packet)) {
-      if (isset($decoded_packet['close']) !== TRUE) {
-        $not_found_error = array(
-          'target' => 'decoded_packet[close]',
-          'message' => "Invalid close value provided.",
-        );
+  $client['buffer'] .= $encoded_packet;
+  unset($encoded_packet);
 
-        socket_write($client_socket, json_encode($response));
-        unset($response);
-        unset($encoded_packet);
+  while (strlen($client['buffer']) >= FRAME_HEADER_LENGTH) {
+    $encoding = ord($client['buffer'][0]);
+    $length = unpack('N', substr($client['buffer'], 1, 4))[1];
 
-        socket_close($client_socket);
-        unset($client_socket);
-        continue;
-      }
+    if (($encoding != FRAME_JSON && $encoding != FRAME_BINARY) || $length > FRAME_MAX_LENGTH) {
+      print("ERROR: Received an invalid frame, closing the connection.\n");
 
-      if (isset($decoded_packet['session_id']) && strlen($decoded_packet['session_id']) > 0) {
-        $not_found_error = array(
-          'target' => 'decoded_packet[session_id]',
-          'message' => "No valid session was provided.",
-        );
+      unset($encoding);
+      unset($length);
+      return FALSE;
+    }
 
-        socket_write($client_socket, json_encode($response));
-        unset($response);
-        unset($encoded_packet);
+    // wait for the rest of the frame.
+    if (strlen($client['buffer']) < FRAME_HEADER_LENGTH + $length) {
+      unset($encoding);
+      unset($length);
+      break;
+    }
 
-        socket_close($client_socket);
-        unset($client_socket);
-        continue;
+    $encoded_packet = substr($client['buffer'], FRAME_HEADER_LENGTH, $length);
+    $client['buffer'] = (string) substr($client['buffer'], FRAME_HEADER_LENGTH + $length);
+    unset($length);
+
+    if ($encoding == FRAME_BINARY) {
+      $offset = 0;
+      $decoded_packet = NULL;
+      if (!binary_decode($encoded_packet, $offset, $decoded_packet) || $offset != strlen($encoded_packet)) {
+        $decoded_packet = NULL;
       }
+      unset($offset);
 
-      if (count($decoded_packet) > 3) {
-        $not_found_error = array(
-          'target' => 'decoded_packet[*]',
-          'message' => "Too many values provided, only the session_id, ip, and close parameters are allowed.",
-        );
+      $encoded_packet = binary_encode(process_request($database, $timeouts, $cleartext, $decoded_packet));
+    }
+    else {
+      $decoded_packet = json_decode($encoded_packet, TRUE);
+      $encoded_packet = json_encode(process_request($database, $timeouts, $cleartext, $decoded_packet));
+    }
+    unset($decoded_packet);
 
-        socket_write($client_socket, json_encode($response));
-        unset($response);
-        unset($encoded_packet);
+    $encoded_packet = chr($encoding) . pack('N', strlen($encoded_packet)) . $encoded_packet;
+    unset($encoding);
 
-        socket_close($client_socket);
-        unset($client_socket);
-        continue;
-      }
+    // a partial write would break the framing of the responses that follow, so write until the entire frame is sent.
+    // a write that times out (see SOCKET_SEND_TIMEOUT_SECONDS) closes the client, as the rest of the frame can no longer be sent in order.
+    while (strlen($encoded_packet) > 0) {
+      $written = socket_write($client['socket'], $encoded_packet);
 
-      // provide an error, but specifically do not give details about which field is invalid for security reasons.
-      if (!isset($database['sessions'][$decoded_packet['ip']][$decoded_packet['session_id']])) {
-        $response['error'] = array(
-          'target' => 'not_found',
-          'message' => "No valid session was found associated with the specified user name and ip address.",
-        );
+      if ($written === FALSE || $written == 0) {
+        print("socket_write() failed: reason: " . socket_strerror(socket_last_error($client['socket'])) . "\n");
 
-        socket_write($client_socket, json_encode($response));
-        unset($response);
+        unset($written);
         unset($encoded_packet);
-
-        socket_close($client_socket);
-        unset($client_socket);
-        continue;
+        return FALSE;
       }
 
-      $response['result'] = expire_session($database, $timeouts, $decoded_packet['session_id'], $decoded_packet['ip']);
-      if ($response['result'] === FALSE) {
-        $response['error'] = array(
-          'target' => 'failure',
-          'message' => "Failed to close the session by the given session id and ip address.",
-        );
-      }
+      $encoded_packet = (string) substr($encoded_packet, $written);
+    }
+    unset($written);
+    unset($encoded_packet);
+  }
 
-      socket_write($client_socket, json_encode($response));
-      unset($response);
-      unset($encoded_packet);
+  return TRUE;
+}
 
-      socket_close($client_socket);
-      unset($client_socket);
-      continue;
+/**
+ * Processes a single request packet.
+ *
+ * @param array $database
+ *   An array of all usernames, ips, passwords, and sessions.
+ * @param array $timeouts
+ *   An array of all timeouts keyed in numeric order.
+ * @param string $cleartext
+ *  Used as an unproven attempt to clear passwords from memory before delete in hopes to avoid security issues inherit in a garbage collector.
+ * @param array|null $decoded_packet
+ *   The decoded request packet.
+ *
+ * @return array
+ *   The response array, with the keys 'error' and 'result'.
+ */
+function process_request(&$database, &$timeouts, $cleartext, $decoded_packet) {
+  $response = array(
+    'error' => FALSE,
+    'result' => FALSE,
+  );
+
+  if (!is_array($decoded_packet) || empty($decoded_packet)) {
+    $response['error'] = array(
+      'target' => 'decoded_packet',
+      'message' => "No valid decoded packet was specified. It must be a valid, non-empty, array.",
+    );
+
+    return $response;
+  }
+
+  // support manually sending custom packets to periodically flush expired sessions (usefull for cron jobs).
+  if (array_key_exists('flush', $decoded_packet)) {
+    if (isset($decoded_packet['flush']) !== TRUE) {
+      $not_found_error = array(
+        'target' => 'decoded_packet[flush]',
+        'message' => "Invalid flush value provided.",
+      );
+
+      return $response;
     }
 
+    if (count($decoded_packet) > 1) {
+      $not_found_error = array(
+        'target' => 'decoded_packet[*]',
+        'message' => "Too many values provided, only the flush parameter is allowed.",
+      );
 
-    // expire sessions now so that expired session do not get included in the retrieval process.
-    process_expired_sessions($database, $timeouts, $cleartext);
+      return $response;
+    }
 
+    $response['result'] = process_expired_sessions($database, $timeouts, $cleartext);
+    if ($response['result'] === FALSE) {
+      $response['error'] = array(
+        'target' => 'failure',
+        'message' => "Failed to flush the expired sessions.",
+      );
+    }
 
-    // retrieve password.
-    if (isset($decoded_packet['session_id']) && strlen($decoded_packet['session_id']) > 0) {
-      if (!isset($database['sessions'][$decoded_packet['ip']][$decoded_packet['session_id']])) {
-        $response['error'] = array(
-          'target' => 'not_found',
-          'message' => "No valid session was found associated with the specified user name and ip address.",
-        );
-        socket_write($client_socket, json_encode($response));
-        unset($response);
-        unset($encoded_packet);
+    return $response;
+  }
 
-        socket_close($client_socket);
-        unset($client_socket);
-        continue;
-      }
+  if (!isset($decoded_packet['ip']) || !is_string($decoded_packet['ip']) || strlen($decoded_packet['ip']) == 0 || ip2long($decoded_packet['ip']) === FALSE) {
+    $response['error'] = array(
+      'target' => 'decoded_packet[ip]',
+      'message' => "No valid ip address was specified. A valid, non-empty, ip address string must be provided.",
+    );
 
+    return $response;
+  }
 
-      // a password request shows that this connection is still active, so extend the timestamp.
-      $db_session = &$database['sessions'][$decoded_packet['ip']][$decoded_packet['session_id']];
-      $unique_id = $db_session['timeouts']['id'];
 
-      if (isset($db_session['timeouts']['expire']) && isset($db_session['timeouts']['max']) && $db_session['timeouts']['expire'] < $db_session['timeouts']['max']) {
-        $stamp_old = $db_session['timeouts']['expire'];
-        $stamp_new = strtotime('+' . $db_session['timeouts']['interval'] . ' seconds');
-        if ($stamp_new > $db_session['timeouts']['max']) {
-          $stamp_new = $db_session['timeouts']['max'];
-        }
+  // support closing sessions before they expire.
+  if (array_key_exists('close', $decoded_packet)) {
+    if (isset($decoded_packet['close']) !== TRUE) {
+      $not_found_error = array(
+        'target' => 'decoded_packet[close]',
+        'message' => "Invalid close value provided.",
+      );
 
-        if (isset($timeouts[$stamp_old]) && $stamp_old != $stamp_new) {
-          $db_session['timeouts']['expire'] = $stamp_new;
-          $new_key = !array_key_exists($stamp_new, $timeouts);
+      return $response;
+    }
 
-          $timeouts[$stamp_new]['expire'][$unique_id] = $timeouts[$stamp_old]['expire'][$unique_id];
-          unset($timeouts[$stamp_old]['expire'][$unique_id]);
+    if (isset($decoded_packet['session_id']) && strlen($decoded_packet['session_id']) > 0) {
+      $not_found_error = array(
+        'target' => 'decoded_packet[session_id]',
+        'message' => "No valid session was provided.",
+      );
 
-          if (empty($timeouts[$stamp_old]['expire'])) {
-            unset($timeouts[$stamp_old]['expire']);
-          }
+      return $response;
+    }
 
-          if (empty($timeouts[$stamp_old])) {
-            unset($timeouts[$stamp_old]);
-          }
+    if (count($decoded_packet) > 3) {
+      $not_found_error = array(
+        'target' => 'decoded_packet[*]',
+        'message' => "Too many values provided, only the session_id, ip, and close parameters are allowed.",
+      );
 
-          // only perform expensive sort if its a new key, which might be out of order.
-          if ($new_key) {
-            ksort($timeouts);
-          }
+      return $response;
+    }
 
-          unset($new_key);
-        }
+    // provide an error, but specifically do not give details about which field is invalid for security reasons.
+    if (!isset($database['sessions'][$decoded_packet['ip']][$decoded_packet['session_id']])) {
+      $response['error'] = array(
+        'target' => 'not_found',
+        'message' => "No valid session was found associated with the specified user name and ip address.",
+      );
 
-        unset($stamp_new);
-        unset($stamp_old);
-      }
+      return $response;
+    }
 
-      $response['result'] = array(
-        'name' => $db_session['name'],
-        'password' => $db_session['password'],
-        'expire' => $db_session['timeouts']['expire'],
-        'max' => $db_session['timeouts']['max'],
-        'interval' => $db_session['timeouts']['interval'],
-        'settings' => $db_session['settings'],
+    $response['result'] = expire_session($database, $timeouts, $decoded_packet['session_id'], $decoded_packet['ip']);
+    if ($response['result'] === FALSE) {
+      $response['error'] = array(
+        'target' => 'failure',
+        'message' => "Failed to close the session by the given session id and ip address.",
       );
+    }
 
-      socket_write($client_socket, json_encode($response));
-      unset($db_timeout);
-      unset($unique_id);
-      unset($response);
-      unset($encoded_packet);
+    return $response;
+  }
 
-      socket_close($client_socket);
-      unset($client_socket);
-      continue;
+
+  // expire sessions now so that expired session do not get included in the retrieval process.
+  process_expired_sessions($database, $timeouts, $cleartext);
+
+
+  // retrieve password.
+  if (isset($decoded_packet['session_id']) && strlen($decoded_packet['session_id']) > 0) {
+    if (!isset($database['sessions'][$decoded_packet['ip']][$decoded_packet['session_id']])) {
+      $response['error'] = array(
+        'target' => 'not_found',
+        'message' => "No valid session was found associated with the specified user name and ip address.",
+      );
+      return $response;
     }
-    // store password.
-    else if (array_key_exists('password', $decoded_packet) && (is_null($decoded_packet['password']) || is_string($decoded_packet['password']))) {
-      if (!isset($decoded_packet['name']) || strlen($decoded_packet['name']) == 0 || preg_match('/^(\w|-)+$/i', $decoded_packet['name']) != 1) {
-        $response['error'] = array(
-          'target' => 'decoded_packet[name]',
-          'message' => "No valid user name was specified. A valid, non-empty, user name string must be provided.",
-        );
 
-        socket_write($client_socket, json_encode($response));
-        unset($response);
-        unset($encoded_packet);
 
-        socket_close($client_socket);
-        unset($client_socket);
-        continue;
+    // a password request shows that this connection is still active, so extend the timestamp.
+    $db_session = &$database['sessions'][$decoded_packet['ip']][$decoded_packet['session_id']];
+    $unique_id = $db_session['timeouts']['id'];
+
+    if (isset($db_session['timeouts']['expire']) && isset($db_session['timeouts']['max']) && $db_session['timeouts']['expire'] < $db_session['timeouts']['max']) {
+      $stamp_old = $db_session['timeouts']['expire'];
+      $stamp_new = strtotime('+' . $db_session['timeouts']['interval'] . ' seconds');
+      if ($stamp_new > $db_session['timeouts']['max']) {
+        $stamp_new = $db_session['timeouts']['max'];
       }
 
-      if (!isset($decoded_packet['name']) || !is_string($decoded_packet['name']) || empty($decoded_packet['name'])) {
-        $response['error'] = array(
-          'target' => 'decoded_packet[name]',
-          'message' => "No valid name was specified. A valid user name string, must be provided.",
-        );
+      if (isset($timeouts[$stamp_old]) && $stamp_old != $stamp_new) {
+        $db_session['timeouts']['expire'] = $stamp_new;
+        $new_key = !array_key_exists($stamp_new, $timeouts);
 
-        socket_write($client_socket, json_encode($response));
-        unset($response);
-        unset($encoded_packet);
+        $timeouts[$stamp_new]['expire'][$unique_id] = $timeouts[$stamp_old]['expire'][$unique_id];
+        unset($timeouts[$stamp_old]['expire'][$unique_id]);
 
-        socket_close($client_socket);
-        unset($client_socket);
-        continue;
-      }
+        if (empty($timeouts[$stamp_old]['expire'])) {
+          unset($timeouts[$stamp_old]['expire']);
+        }
 
-      if (isset($decoded_packet['settings']) && !is_array($decoded_packet['settings'])) {
-        $response['error'] = array(
-          'target' => 'decoded_packet[settings]',
-          'message' => "If specified, settings must be a valid array.",
-        );
+        if (empty($timeouts[$stamp_old])) {
+          unset($timeouts[$stamp_old]);
+        }
 
-        socket_write($client_socket, json_encode($response));
-        unset($response);
-        unset($encoded_packet);
+        // only perform expensive sort if its a new key, which might be out of order.
+        if ($new_key) {
+          ksort($timeouts);
+        }
 
-        socket_close($client_socket);
-        unset($client_socket);
-        continue;
+        unset($new_key);
       }
 
-      $session_id = build_session_id();
-      if (isset($database['sessions'][$decoded_packet['ip']]) && is_array($database['sessions'][$decoded_packet['ip']]) && array_key_exists($session_id, $database['sessions'][$decoded_packet['ip']])) {
-        $response['error'] = array(
-          'target' => 'conflict',
-          'message' => "Failed to generate a unique session id due to a conflict. Please try again.",
-        );
+      unset($stamp_new);
+      unset($stamp_old);
+    }
 
-        socket_write($client_socket, json_encode($response));
-        unset($response);
-        unset($encoded_packet);
-        unset($session_id);
+    $response['result'] = array(
+      'name' => $db_session['name'],
+      'password' => $db_session['password'],
+      'expire' => $db_session['timeouts']['expire'],
+      'max' => $db_session['timeouts']['max'],
+      'interval' => $db_session['timeouts']['interval'],
+      'settings' => $db_session['settings'],
+    );
 
-        socket_close($client_socket);
-        unset($client_socket);
-        continue;
-      }
+    unset($db_timeout);
+    unset($unique_id);
+
+    return $response;
+  }
+  // store password.
+  else if (array_key_exists('password', $decoded_packet) && (is_null($decoded_packet['password']) || is_string($decoded_packet['password']))) {
+    if (!isset($decoded_packet['name']) || strlen($decoded_packet['name']) == 0 || preg_match('/^(\w|-)+$/i', $decoded_packet['name']) != 1) {
+      $response['error'] = array(
+        'target' => 'decoded_packet[name]',
+        'message' => "No valid user name was specified. A valid, non-empty, user name string must be provided.",
+      );
+
+      return $response;
+    }
 
-      $unique_id = $decoded_packet['name'] . '-' . uniqid();
-      $database['sessions'][$decoded_packet['ip']][$session_id] = array(
-        'name' => $decoded_packet['name'],
-        'password' => $decoded_packet['password'],
-        'timeouts' => array(
-          'id' => $unique_id,
-          'expire' => NULL,
-          'max' => NULL,
-        ),
-        'settings' => isset($decoded_packet['settings']) ? $decoded_packet['settings'] : array(),
+    if (!isset($decoded_packet['name']) || !is_string($decoded_packet['name']) || empty($decoded_packet['name'])) {
+      $response['error'] = array(
+        'target' => 'decoded_packet[name]',
+        'message' => "No valid name was specified. A valid user name string, must be provided.",
       );
 
+      return $response;
+    }
 
-      // the timeout only needs to contain what is necessary to obtain the session data.
-      $timeout = array(
-        'ip' => $decoded_packet['ip'],
-        'session_id' => $session_id,
+    if (isset($decoded_packet['settings']) && !is_array($decoded_packet['settings'])) {
+      $response['error'] = array(
+        'target' => 'decoded_packet[settings]',
+        'message' => "If specified, settings must be a valid array.",
       );
 
+      return $response;
+    }
 
-      // grab optional soft timeouts and enforce hard timeouts.
-      $timeout_expire = INTERVAL_TIMEOUT_HARD_EXPIRE;
-      $timeout_max = INTERVAL_TIMEOUT_HARD_MAX;
+    $session_id = build_session_id();
+    if (isset($database['sessions'][$decoded_packet['ip']]) && is_array($database['sessions'][$decoded_packet['ip']]) && array_key_exists($session_id, $database['sessions'][$decoded_packet['ip']])) {
+      $response['error'] = array(
+        'target' => 'conflict',
+        'message' => "Failed to generate a unique session id due to a conflict. Please try again.",
+      );
 
-      if (isset($decoded_packet['max']) && is_int($decoded_packet['max']) && $decoded_packet['max'] > 0) {
-        if ($decoded_packet['max'] < INTERVAL_TIMEOUT_HARD_MAX) {
-          $timeout_max = $decoded_packet['max'];
+      unset($session_id);
 
-          if ($timeout_expire > $timeout_max) {
-            $timeout_expire = $decoded_packet['max'];
-          }
+      return $response;
+    }
+
+    $unique_id = $decoded_packet['name'] . '-' . uniqid();
+    $database['sessions'][$decoded_packet['ip']][$session_id] = array(
+      'name' => $decoded_packet['name'],
+      'password' => $decoded_packet['password'],
+      'timeouts' => array(
+        'id' => $unique_id,
+        'expire' => NULL,
+        'max' => NULL,
+      ),
+      'settings' => isset($decoded_packet['settings']) ? $decoded_packet['settings'] : array(),
+    );
+
+
+    // the timeout only needs to contain what is necessary to obtain the session data.
+    $timeout = array(
+      'ip' => $decoded_packet['ip'],
+      'session_id' => $session_id,
+    );
+
+
+    // grab optional soft timeouts and enforce hard timeouts.
+    $timeout_expire = INTERVAL_TIMEOUT_HARD_EXPIRE;
+    $timeout_max = INTERVAL_TIMEOUT_HARD_MAX;
+
+    if (isset($decoded_packet['max']) && is_int($decoded_packet['max']) && $decoded_packet['max'] > 0) {
+      if ($decoded_packet['max'] < INTERVAL_TIMEOUT_HARD_MAX) {
+        $timeout_max = $decoded_packet['max'];
+
+        if ($timeout_expire > $timeout_max) {
+          $timeout_expire = $decoded_packet['max'];
         }
       }
+    }
 
-      if (isset($decoded_packet['expire']) && is_int($decoded_packet['expire']) && $decoded_packet['expire'] > 0) {
-        if ($decoded_packet['expire'] < INTERVAL_TIMEOUT_HARD_EXPIRE && $decoded_packet['expire'] < $timeout_max) {
-          $timeout_expire = $decoded_packet['expire'];
-        }
+    if (isset($decoded_packet['expire']) && is_int($decoded_packet['expire']) && $decoded_packet['expire'] > 0) {
+      if ($decoded_packet['expire'] < INTERVAL_TIMEOUT_HARD_EXPIRE && $decoded_packet['expire'] < $timeout_max) {
+        $timeout_expire = $decoded_packet['expire'];
       }
+    }
 
 
-      // save basic timeout.
-      $stamp = strtotime('+' . $timeout_expire . ' seconds');
-      $database['sessions'][$decoded_packet['ip']][$session_id]['timeouts']['expire'] = $stamp;
-      $database['sessions'][$decoded_packet['ip']][$session_id]['timeouts']['interval'] = $timeout_expire;
-      $timeouts[$stamp]['expire'][$unique_id] = $timeout;
+    // save basic timeout.
+    $stamp = strtotime('+' . $timeout_expire . ' seconds');
+    $database['sessions'][$decoded_packet['ip']][$session_id]['timeouts']['expire'] = $stamp;
+    $database['sessions'][$decoded_packet['ip']][$session_id]['timeouts']['interval'] = $timeout_expire;
+    $timeouts[$stamp]['expire'][$unique_id] = $timeout;
 
 
-      // save maxiumum timeout.
-      $stamp = strtotime('+' . $timeout_max . ' seconds');
-      $database['sessions'][$decoded_packet['ip']][$session_id]['timeouts']['max'] = $stamp;
-      $timeouts[$stamp]['max'][$unique_id] = $timeout;
+    // save maxiumum timeout.
+    $stamp = strtotime('+' . $timeout_max . ' seconds');
+    $database['sessions'][$decoded_packet['ip']][$session_id]['timeouts']['max'] = $stamp;
+    $timeouts[$stamp]['max'][$unique_id] = $timeout;
 
 
-      // sort timeouts array for faster cleanups (this action is required).
-      ksort($timeouts);
+    // sort timeouts array for faster cleanups (this action is required).
+    ksort($timeouts);
 
 
-      // return the session key.
-      $response['result'] = array(
-        'session_id' => $session_id,
-        'expire' => $database['sessions'][$decoded_packet['ip']][$session_id]['timeouts']['expire'],
-        'max' => $database['sessions'][$decoded_packet['ip']][$session_id]['timeouts']['max'],
-        'interval' => $timeout_expire,
-      );
+    // return the session key.
+    $response['result'] = array(
+      'session_id' => $session_id,
+      'expire' => $database['sessions'][$decoded_packet['ip']][$session_id]['timeouts']['expire'],
+      'max' => $database['sessions'][$decoded_packet['ip']][$session_id]['timeouts']['max'],
+      'interval' => $timeout_expire,
+    );
 
-      socket_write($client_socket, json_encode($response));
-      unset($session_id);
-      unset($stamp);
-      unset($unique_id);
-      unset($response);
-      unset($encoded_packet);
+    unset($session_id);
+    unset($stamp);
+    unset($unique_id);
 
-      socket_close($client_socket);
-      unset($client_socket);
-      continue;
+    return $response;
+  }
+  else {
+    $response['error'] = array(
+      'target' => 'no_session',
+      'message' => "Either a new session_id must be requested by provided the password string or a password must be requested by providing the session id string.",
+    );
+
+    return $response;
+  }
+
+}
+
+/**
+ * Encodes a value for a FRAME_BINARY packet.
+ *
+ * Each value is a 1 byte type followed by:
+ * - BINARY_NULL, BINARY_FALSE, BINARY_TRUE: nothing.
+ * - BINARY_INT: a 64-bit big endian integer.
+ * - BINARY_FLOAT: a 64-bit big endian double.
+ * - BINARY_STRING: the length as a 4 byte big endian integer, followed by the bytes.
+ * - BINARY_ARRAY: the count as a 4 byte big endian integer, followed by each key and then its value.
+ *
+ * @param mixed $value
+ *   The value to encode, objects and resources are encoded as NULL.
+ *
+ * @return string
+ *   The encoded value.
+ */
+function binary_encode($value) {
+  if (is_null($value)) {
+    return chr(BINARY_NULL);
+  }
+
+  if (is_bool($value)) {
+    return chr($value ? BINARY_TRUE : BINARY_FALSE);
+  }
+
+  if (is_int($value)) {
+    return chr(BINARY_INT) . pack('J', $value);
+  }
+
+  if (is_float($value)) {
+    return chr(BINARY_FLOAT) . pack('E', $value);
+  }
+
+  if (is_string($value)) {
+    return chr(BINARY_STRING) . pack('N', strlen($value)) . $value;
+  }
+
+  if (is_array($value)) {
+    $encoded = chr(BINARY_ARRAY) . pack('N', count($value));
+    foreach ($value as $key => $item) {
+      $encoded .= binary_encode($key) . binary_encode($item);
     }
-    else {
-      $response['error'] = array(
-        'target' => 'no_session',
-        'message' => "Either a new session_id must be requested by provided the password string or a password must be requested by providing the session id string.",
-      );
+    unset($key);
+    unset($item);
 
-      socket_write($client_socket, json_encode($response));
-      unset($response);
-      unset($encoded_packet);
+    return $encoded;
+  }
 
-      socket_close($client_socket);
-      unset($client_socket);
-      continue;
+  return chr(BINARY_NULL);
+}
+
+/**
+ * Decodes a value of a FRAME_BINARY packet.
+ *
+ * @param string $packet
+ *   The packet.
+ * @param int $offset
+ *   The position in the packet to decode from, which is moved past the decoded value.
+ * @param mixed $value
+ *   The decoded value.
+ * @param int $depth
+ *   (optional) The depth of the arrays this value is in, limited by BINARY_DEPTH_MAX.
+ *
+ * @return bool
+ *   TRUE on success, FALSE when the packet is invalid.
+ */
+function binary_decode($packet, &$offset, &$value, $depth = 0) {
+  $length = strlen($packet);
+  if ($offset >= $length || $depth > BINARY_DEPTH_MAX) {
+    return FALSE;
+  }
+
+  $type = ord($packet[$offset]);
+  $offset++;
+
+  if ($type == BINARY_NULL) {
+    $value = NULL;
+    return TRUE;
+  }
+
+  if ($type == BINARY_FALSE || $type == BINARY_TRUE) {
+    $value = $type == BINARY_TRUE;
+    return TRUE;
+  }
+
+  if ($type == BINARY_INT || $type == BINARY_FLOAT) {
+    if ($offset + 8 > $length) {
+      return FALSE;
     }
 
-    unset($response);
-    unset($encoded_packet);
+    $value = unpack($type == BINARY_INT ? 'J' : 'E', substr($packet, $offset, 8))[1];
+    $offset += 8;
+    return TRUE;
+  }
 
-    socket_close($client_socket);
-    unset($client_socket);
-  } while (TRUE);
+  if ($type != BINARY_STRING && $type != BINARY_ARRAY) {
+    return FALSE;
+  }
+
+  if ($offset + 4 > $length) {
+    return FALSE;
+  }
+
+  $count = unpack('N', substr($packet, $offset, 4))[1];
+  $offset += 4;
+
+  if ($type == BINARY_STRING) {
+    if ($offset + $count > $length) {
+      return FALSE;
+    }
+
+    $value = (string) substr($packet, $offset, $count);
+    $offset += $count;
+    return TRUE;
+  }
+
+  // each key and value is at least 1 byte, which also prevents a large count from looping.
+  if ($count * 2 > $length - $offset) {
+    return FALSE;
+  }
+
+  $value = array();
+  for ($i = 0; $i < $count; $i++) {
+    $key = NULL;
+    $item = NULL;
+
+    if (!binary_decode($packet, $offset, $key, $depth + 1) || (!is_int($key) && !is_string($key))) {
+      return FALSE;
+    }
+
+    if (!binary_decode($packet, $offset, $item, $depth + 1)) {
+      return FALSE;
+    }
+
+    $value[$key] = $item;
+  }
+  unset($key);
+  unset($item);
 
-  socket_close($socket);
-  unlink($socket_path);
-  unlink($pid_path);
   return TRUE;
 }
 